@@ -0,0 +1,116 @@
+#include "arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+arena_t *arena_new(size_t size) {
+  arena_t *arena = calloc(1, sizeof(arena_t) + size + ARENA_ALIGN);
+
+  if (!arena) {
+    return NULL;
+  }
+  arena->base = (unsigned char *)(((uintptr_t)(arena + 1) + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1));
+  arena->size = size;
+  return arena;
+}
+
+void arena_free(arena_t *arena) { free(arena); }
+
+/* Returns zeroed memory, NULL once the arena is exhausted. Exhaustion is a sizing bug, CFG_ARENA_SIZE is fixed for the
+ * lifetime of the process. */
+void *arena_alloc(arena_t *arena, size_t size) {
+  size_t aligned = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  void *ptr;
+
+  if (aligned > arena->size - arena->used) {
+    arena->failures++;
+    fprintf(stderr, "Error: Configuration arena exhausted (%zu of %zu bytes used), raise CFG_ARENA_SIZE.\n",
+            arena->used, arena->size);
+    return NULL;
+  }
+  ptr = arena->base + arena->used;
+  arena->used += aligned;
+  arena->allocs++;
+  return ptr;
+}
+
+char *arena_strdup(arena_t *arena, const char *str) {
+  size_t len = strlen(str) + 1;
+  char *copy = arena_alloc(arena, len);
+
+  if (copy) {
+    memcpy(copy, str, len);
+  }
+  return copy;
+}
+
+bool arena_owns(const arena_t *arena, const void *ptr) {
+  return arena && (const unsigned char *)ptr >= arena->base && (const unsigned char *)ptr < arena->base + arena->size;
+}
+
+void arena_stats(const arena_t *arena, FILE *out) {
+  fprintf(out, "arena: %zu/%zu bytes in %lu allocations, %lu failed\n", arena->used, arena->size, arena->allocs,
+          arena->failures);
+}
+
+#ifdef MOSQ_LOW_FOOTPRINT
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long alloc_count;
+static unsigned long steady_mark;
+static int steady;
+
+// Interposed for the whole process, glibc routes its own internal allocations through these as well
+void *malloc(size_t size) {
+  __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+  return __libc_realloc(ptr, size);
+}
+
+void footprint_mark_steady(void) {
+  if (!steady) {
+    steady_mark = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
+    steady = 1;
+  }
+}
+
+static long status_kb(const char *key) {
+  char line[128];
+  long kb = -1;
+  FILE *status = fopen("/proc/self/status", "r");
+
+  if (!status) {
+    return -1;
+  }
+  while (fgets(line, sizeof(line), status)) {
+    if (!strncmp(line, key, strlen(key))) {
+      kb = atol(line + strlen(key));
+      break;
+    }
+  }
+  fclose(status);
+  return kb;
+}
+
+void footprint_report(FILE *out) {
+  unsigned long total = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
+
+  fprintf(out, "footprint: %lu allocations at startup, %lu after connect, RSS %ld kB, peak RSS %ld kB\n",
+          steady ? steady_mark : total, steady ? total - steady_mark : 0, status_kb("VmRSS:"), status_kb("VmHWM:"));
+}
+#else
+void footprint_mark_steady(void) {}
+
+void footprint_report(FILE *out) {}
+#endif
@@ -0,0 +1,36 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/* Bump allocator for the constrained-device build (-DMOSQ_LOW_FOOTPRINT). The whole block is allocated once at
+ * startup and released at exit, single allocations are never freed. */
+#ifndef CFG_ARENA_SIZE
+#define CFG_ARENA_SIZE (16 * 1024)
+#endif
+#define CFG_MAX_TOPICS 8  // the subscription table is allocated once instead of growing per topic
+#define ARENA_ALIGN 16
+
+typedef struct arena_s {
+  unsigned char *base;
+  size_t size;
+  size_t used;
+  unsigned long allocs;
+  unsigned long failures;
+} arena_t;
+
+arena_t *arena_new(size_t size);
+void arena_free(arena_t *arena);
+void *arena_alloc(arena_t *arena, size_t size);
+char *arena_strdup(arena_t *arena, const char *str);
+bool arena_owns(const arena_t *arena, const void *ptr);
+void arena_stats(const arena_t *arena, FILE *out);
+
+/* Counts every malloc in the process, libmosquitto included, so the low-footprint build can show that the steady-state
+ * loop does not allocate. Without MOSQ_LOW_FOOTPRINT these do nothing. */
+void footprint_mark_steady(void);
+void footprint_report(FILE *out);
+
+#endif
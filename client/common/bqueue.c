@@ -0,0 +1,122 @@
+#include "bqueue.h"
+#include <stdlib.h>
+
+int bqueue_init(bqueue_t *queue, int capacity) {
+  queue->items = calloc(capacity, sizeof(void *));
+  if (!queue->items) {
+    return -1;
+  }
+  queue->capacity = capacity;
+  queue->head = 0;
+  queue->count = 0;
+  queue->closed = false;
+  queue->pushed = 0;
+  queue->popped = 0;
+  queue->blocked = 0;
+  queue->high_watermark = 0;
+  pthread_mutex_init(&queue->lock, NULL);
+  pthread_cond_init(&queue->not_empty, NULL);
+  pthread_cond_init(&queue->not_full, NULL);
+  return 0;
+}
+
+void bqueue_destroy(bqueue_t *queue) {
+  pthread_mutex_destroy(&queue->lock);
+  pthread_cond_destroy(&queue->not_empty);
+  pthread_cond_destroy(&queue->not_full);
+  free(queue->items);
+  queue->items = NULL;
+}
+
+static void push_locked(bqueue_t *queue, void *item) {
+  queue->items[(queue->head + queue->count) % queue->capacity] = item;
+  queue->count++;
+  queue->pushed++;
+  if (queue->count > queue->high_watermark) {
+    queue->high_watermark = queue->count;
+  }
+  pthread_cond_signal(&queue->not_empty);
+}
+
+static void *pop_locked(bqueue_t *queue) {
+  void *item = queue->items[queue->head];
+
+  queue->head = (queue->head + 1) % queue->capacity;
+  queue->count--;
+  queue->popped++;
+  pthread_cond_signal(&queue->not_full);
+  return item;
+}
+
+/* Blocks while the queue is full. Returns false if the queue was closed, the item is then still owned by the caller. */
+bool bqueue_push(bqueue_t *queue, void *item) {
+  pthread_mutex_lock(&queue->lock);
+  if (queue->count == queue->capacity && !queue->closed) {
+    queue->blocked++;
+    while (queue->count == queue->capacity && !queue->closed) {
+      pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+  }
+  if (queue->closed) {
+    pthread_mutex_unlock(&queue->lock);
+    return false;
+  }
+  push_locked(queue, item);
+  pthread_mutex_unlock(&queue->lock);
+  return true;
+}
+
+bool bqueue_try_push(bqueue_t *queue, void *item) {
+  bool ret = false;
+
+  pthread_mutex_lock(&queue->lock);
+  if (!queue->closed && queue->count < queue->capacity) {
+    push_locked(queue, item);
+    ret = true;
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return ret;
+}
+
+/* Blocks while the queue is empty. Returns NULL once the queue is closed and drained. */
+void *bqueue_pop(bqueue_t *queue) {
+  void *item = NULL;
+
+  pthread_mutex_lock(&queue->lock);
+  while (queue->count == 0 && !queue->closed) {
+    pthread_cond_wait(&queue->not_empty, &queue->lock);
+  }
+  if (queue->count > 0) {
+    item = pop_locked(queue);
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return item;
+}
+
+void *bqueue_try_pop(bqueue_t *queue) {
+  void *item = NULL;
+
+  pthread_mutex_lock(&queue->lock);
+  if (queue->count > 0) {
+    item = pop_locked(queue);
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return item;
+}
+
+void bqueue_close(bqueue_t *queue) {
+  pthread_mutex_lock(&queue->lock);
+  queue->closed = true;
+  pthread_cond_broadcast(&queue->not_empty);
+  pthread_cond_broadcast(&queue->not_full);
+  pthread_mutex_unlock(&queue->lock);
+}
+
+int bqueue_depth(bqueue_t *queue) {
+  int depth;
+
+  pthread_mutex_lock(&queue->lock);
+  depth = queue->count;
+  pthread_mutex_unlock(&queue->lock);
+  return depth;
+}
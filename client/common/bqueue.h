@@ -0,0 +1,33 @@
+#ifndef BQUEUE_H
+#define BQUEUE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+/* Bounded blocking FIFO of pointers shared between pipeline stages. A full queue blocks the producer, which is how
+ * backpressure travels upstream. */
+typedef struct bqueue_s {
+  void **items;
+  int capacity;
+  int head;
+  int count;
+  bool closed;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  unsigned long pushed;
+  unsigned long popped;
+  unsigned long blocked;  // pushes that had to wait for room
+  int high_watermark;
+} bqueue_t;
+
+int bqueue_init(bqueue_t *queue, int capacity);
+void bqueue_destroy(bqueue_t *queue);
+bool bqueue_push(bqueue_t *queue, void *item);
+bool bqueue_try_push(bqueue_t *queue, void *item);
+void *bqueue_pop(bqueue_t *queue);
+void *bqueue_try_pop(bqueue_t *queue);
+void bqueue_close(bqueue_t *queue);
+int bqueue_depth(bqueue_t *queue);
+
+#endif
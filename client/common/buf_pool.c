@@ -0,0 +1,153 @@
+#include "buf_pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+static size_t slot_stride(size_t size) {
+  return (sizeof(buf_t) + size + BUF_POOL_ALIGN - 1) & ~(size_t)(BUF_POOL_ALIGN - 1);
+}
+
+/* `slots` buffers per size class, 0 makes every buffer come from malloc. */
+int buf_pool_init(buf_pool_t *pool, int slots) {
+  buf_class_t *cls;
+  buf_t *buf;
+  size_t stride;
+
+  memset(pool, 0, sizeof(buf_pool_t));
+  if (pthread_mutex_init(&pool->lock, NULL)) {
+    return -1;
+  }
+  for (int c = 0; c < BUF_POOL_CLASSES; c++) {
+    cls = &pool->classes[c];
+    cls->size = (size_t)BUF_POOL_MIN_SIZE << (2 * c);
+    if (slots <= 0) continue;
+    stride = slot_stride(cls->size);
+    cls->slab = aligned_alloc(BUF_POOL_ALIGN, stride * slots);
+    if (!cls->slab) {
+      buf_pool_destroy(pool);
+      return -1;
+    }
+    cls->slots = slots;
+    // Threaded back to front so the first buffers handed out are the ones at the start of the slab
+    for (int i = slots - 1; i >= 0; i--) {
+      buf = (buf_t *)(cls->slab + i * stride);
+      buf->pool = pool;
+      buf->cls = c;
+      buf->size = cls->size;
+      buf->next = cls->free;
+      cls->free = buf;
+    }
+  }
+  return 0;
+}
+
+/* Buffers still referenced at this point become dangling, release every slice first. */
+void buf_pool_destroy(buf_pool_t *pool) {
+  for (int c = 0; c < BUF_POOL_CLASSES; c++) {
+    free(pool->classes[c].slab);
+    pool->classes[c].slab = NULL;
+    pool->classes[c].free = NULL;
+  }
+  pthread_mutex_destroy(&pool->lock);
+}
+
+/* A buffer of at least `size` bytes with one reference, from the smallest class with a free slot. NULL when malloc
+ * fails as well. */
+buf_t *buf_get(buf_pool_t *pool, size_t size) {
+  buf_class_t *cls;
+  buf_t *buf = NULL;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->gets++;
+  for (int c = 0; c < BUF_POOL_CLASSES && !buf; c++) {
+    cls = &pool->classes[c];
+    if (cls->size < size || !cls->free) continue;
+    buf = cls->free;
+    cls->free = buf->next;
+    if (++cls->in_use > cls->high_watermark) cls->high_watermark = cls->in_use;
+  }
+  if (!buf) pool->fallbacks++;
+  pthread_mutex_unlock(&pool->lock);
+
+  if (!buf) {
+    buf = malloc(sizeof(buf_t) + size);
+    if (!buf) return NULL;
+    buf->pool = pool;
+    buf->cls = -1;
+    buf->size = size;
+  }
+  buf->next = NULL;
+  buf->refs = 1;
+  buf->len = 0;
+  return buf;
+}
+
+/* The one copy a payload gets on its way through the pipeline. */
+buf_t *buf_copy_in(buf_pool_t *pool, const void *data, size_t len) {
+  buf_t *buf = buf_get(pool, len);
+
+  if (!buf) return NULL;
+  if (len) memcpy(buf->data, data, len);
+  buf->len = len;
+  __atomic_fetch_add(&pool->copies, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&pool->copied_bytes, len, __ATOMIC_RELAXED);
+  return buf;
+}
+
+buf_t *buf_ref(buf_t *buf) {
+  __atomic_fetch_add(&buf->refs, 1, __ATOMIC_RELAXED);
+  return buf;
+}
+
+void buf_unref(buf_t *buf) {
+  buf_pool_t *pool = buf->pool;
+  buf_class_t *cls;
+
+  // Release so every write through a reference happens before the buffer is reused
+  if (__atomic_sub_fetch(&buf->refs, 1, __ATOMIC_ACQ_REL) > 0) return;
+  if (buf->cls < 0) {
+    free(buf);
+    return;
+  }
+  cls = &pool->classes[buf->cls];
+  pthread_mutex_lock(&pool->lock);
+  buf->next = cls->free;
+  cls->free = buf;
+  cls->in_use--;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/* Takes over the caller's reference to `buf`, `off` and `len` are clamped to its contents. */
+buf_slice_t buf_slice(buf_t *buf, size_t off, size_t len) {
+  buf_slice_t slice = {.buf = buf};
+
+  slice.off = off < buf->len ? off : buf->len;
+  slice.len = len < buf->len - slice.off ? len : buf->len - slice.off;
+  return slice;
+}
+
+buf_slice_t buf_slice_ref(const buf_slice_t *slice) {
+  buf_slice_t copy = *slice;
+
+  buf_ref(copy.buf);
+  return copy;
+}
+
+void buf_slice_release(buf_slice_t *slice) {
+  if (!slice->buf) return;
+  buf_unref(slice->buf);
+  slice->buf = NULL;
+  slice->len = 0;
+}
+
+void buf_pool_stats(buf_pool_t *pool, FILE *out) {
+  buf_class_t *cls;
+
+  pthread_mutex_lock(&pool->lock);
+  fprintf(out, "pool: %lu buffers, %lu from malloc, %lu copies of %lu bytes\n", pool->gets, pool->fallbacks,
+          pool->copies, pool->copied_bytes);
+  for (int c = 0; c < BUF_POOL_CLASSES; c++) {
+    cls = &pool->classes[c];
+    fprintf(out, "  %6zu B: %3d/%-3d in use, high %3d\n", cls->size, cls->in_use, cls->slots, cls->high_watermark);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
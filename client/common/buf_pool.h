@@ -0,0 +1,65 @@
+#ifndef BUF_POOL_H
+#define BUF_POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/* Refcounted payload buffers for handing a message from stage to stage without copying it. A payload is copied into
+ * the pool once, after that the stages pass slices of it around and the buffer goes back to its size class when the
+ * last slice is released. Each class is one slab allocated at startup, a request no free slot fits falls back to
+ * malloc and is counted. Slices may be taken and released from any thread. */
+#define BUF_POOL_CLASSES 5
+#define BUF_POOL_MIN_SIZE 64  // classes grow by 4x, 64 B to 16 KiB
+#define BUF_POOL_ALIGN 16
+
+typedef struct buf_s {
+  struct buf_pool_s *pool;
+  struct buf_s *next;  // free list
+  int refs;
+  int cls;  // -1 when allocated outside the slabs
+  size_t size;
+  size_t len;
+  unsigned char data[];
+} buf_t;
+
+/* A view into a buffer that owns one reference to it. */
+typedef struct buf_slice_s {
+  buf_t *buf;
+  size_t off;
+  size_t len;
+} buf_slice_t;
+
+typedef struct buf_class_s {
+  unsigned char *slab;
+  buf_t *free;
+  size_t size;
+  int slots;
+  int in_use;
+  int high_watermark;
+} buf_class_t;
+
+typedef struct buf_pool_s {
+  buf_class_t classes[BUF_POOL_CLASSES];
+  pthread_mutex_t lock;
+  unsigned long gets;
+  unsigned long fallbacks;  // served by malloc, the class was full or the size too large
+  unsigned long copies;
+  unsigned long copied_bytes;
+} buf_pool_t;
+
+int buf_pool_init(buf_pool_t *pool, int slots);
+void buf_pool_destroy(buf_pool_t *pool);
+buf_t *buf_get(buf_pool_t *pool, size_t size);
+buf_t *buf_copy_in(buf_pool_t *pool, const void *data, size_t len);
+buf_t *buf_ref(buf_t *buf);
+void buf_unref(buf_t *buf);
+buf_slice_t buf_slice(buf_t *buf, size_t off, size_t len);
+buf_slice_t buf_slice_ref(const buf_slice_t *slice);
+void buf_slice_release(buf_slice_t *slice);
+void buf_pool_stats(buf_pool_t *pool, FILE *out);
+
+static inline const unsigned char *buf_slice_data(const buf_slice_t *slice) { return slice->buf->data + slice->off; }
+
+#endif
@@ -0,0 +1,239 @@
+#include "capture.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static void put_u16(unsigned char *buf, uint16_t val) {
+  buf[0] = val >> 8;
+  buf[1] = val & 0xff;
+}
+
+static void put_u32(unsigned char *buf, uint32_t val) {
+  buf[0] = val >> 24;
+  buf[1] = (val >> 16) & 0xff;
+  buf[2] = (val >> 8) & 0xff;
+  buf[3] = val & 0xff;
+}
+
+static void put_u64(unsigned char *buf, uint64_t val) {
+  put_u32(buf, val >> 32);
+  put_u32(buf + 4, val & 0xffffffff);
+}
+
+static uint16_t get_u16(const unsigned char *buf) { return (uint16_t)(buf[0] << 8 | buf[1]); }
+
+static uint32_t get_u32(const unsigned char *buf) {
+  return (uint32_t)buf[0] << 24 | (uint32_t)buf[1] << 16 | (uint32_t)buf[2] << 8 | buf[3];
+}
+
+static uint64_t get_u64(const unsigned char *buf) { return (uint64_t)get_u32(buf) << 32 | get_u32(buf + 4); }
+
+static char *index_path(const char *path) {
+  char *idx = malloc(strlen(path) + sizeof(CAPTURE_INDEX_SUFFIX));
+
+  if (idx) {
+    sprintf(idx, "%s%s", path, CAPTURE_INDEX_SUFFIX);
+  }
+  return idx;
+}
+
+// Wall clock, so captures taken on different hosts can be lined up
+uint64_t capture_now_us(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Opens `path` for appending, a new file gets the magic first. An existing file has to be a capture already. */
+capture_writer_t *capture_open(const char *path) {
+  capture_writer_t *writer = calloc(1, sizeof(capture_writer_t));
+  char magic[CAPTURE_MAGIC_LEN], *idx = index_path(path);
+  long size;
+
+  if (!writer || !idx) {
+    goto error;
+  }
+  writer->data = fopen(path, "a+b");
+  writer->index = fopen(idx, "ab");
+  if (!writer->data || !writer->index) {
+    fprintf(stderr, "Error: Unable to open capture file %s.\n", path);
+    goto error;
+  }
+  fseek(writer->data, 0, SEEK_END);
+  size = ftell(writer->data);
+  if (size == 0) {
+    fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_LEN, writer->data);
+    size = CAPTURE_MAGIC_LEN;
+  } else {
+    rewind(writer->data);
+    if (fread(magic, 1, CAPTURE_MAGIC_LEN, writer->data) != CAPTURE_MAGIC_LEN ||
+        memcmp(magic, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN)) {
+      fprintf(stderr, "Error: %s is not a capture file.\n", path);
+      goto error;
+    }
+    fseek(writer->data, 0, SEEK_END);
+  }
+  writer->offset = size;
+  free(idx);
+  return writer;
+
+error:
+  free(idx);
+  capture_close(writer);
+  return NULL;
+}
+
+int capture_append(capture_writer_t *writer, const char *topic, const void *payload, int payload_len, int qos,
+                   bool retain, uint64_t ts_us) {
+  unsigned char header[CAPTURE_RECORD_HEADER_LEN], entry[CAPTURE_INDEX_ENTRY_LEN];
+  int topic_len = strlen(topic);
+
+  if (topic_len > UINT16_MAX || payload_len < 0) {
+    return -1;
+  }
+  // The first record after opening is indexed too, captures are often appended to by several short runs
+  if (writer->since_index == 0) {
+    put_u64(entry, ts_us);
+    put_u64(entry + 8, writer->offset);
+    fwrite(entry, 1, sizeof(entry), writer->index);
+    // Bounds what is lost when the subscriber is killed, without a write per message
+    fflush(writer->index);
+    fflush(writer->data);
+  }
+  writer->since_index = (writer->since_index + 1) % CAPTURE_INDEX_EVERY;
+
+  put_u64(header, ts_us);
+  put_u32(header + 8, payload_len);
+  put_u16(header + 12, topic_len);
+  header[14] = qos;
+  header[15] = retain ? CAPTURE_FLAG_RETAIN : 0;
+  if (fwrite(header, 1, sizeof(header), writer->data) != sizeof(header) ||
+      fwrite(topic, 1, topic_len, writer->data) != (size_t)topic_len ||
+      fwrite(payload, 1, payload_len, writer->data) != (size_t)payload_len) {
+    return -1;
+  }
+  writer->offset += sizeof(header) + topic_len + payload_len;
+  writer->records++;
+  writer->bytes += payload_len;
+  return 0;
+}
+
+void capture_close(capture_writer_t *writer) {
+  if (!writer) {
+    return;
+  }
+  if (writer->data) fclose(writer->data);
+  if (writer->index) fclose(writer->index);
+  free(writer);
+}
+
+capture_reader_t *capture_reader_open(const char *path) {
+  capture_reader_t *reader = calloc(1, sizeof(capture_reader_t));
+  char magic[CAPTURE_MAGIC_LEN];
+
+  if (!reader) {
+    return NULL;
+  }
+  reader->path = strdup(path);
+  reader->data = fopen(path, "rb");
+  if (!reader->path || !reader->data) {
+    fprintf(stderr, "Error: Unable to open capture file %s.\n", path);
+    capture_reader_close(reader);
+    return NULL;
+  }
+  if (fread(magic, 1, CAPTURE_MAGIC_LEN, reader->data) != CAPTURE_MAGIC_LEN ||
+      memcmp(magic, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN)) {
+    fprintf(stderr, "Error: %s is not a capture file.\n", path);
+    capture_reader_close(reader);
+    return NULL;
+  }
+  return reader;
+}
+
+/* Returns 1 and fills `record` with pointers into the reader's buffer, valid until the next call. Returns 0 at the
+ * end of the file, a record cut short by a crash counts as the end. */
+int capture_read(capture_reader_t *reader, capture_record_t *record) {
+  unsigned char header[CAPTURE_RECORD_HEADER_LEN];
+  uint32_t payload_len;
+  size_t len;
+
+  if (fread(header, 1, sizeof(header), reader->data) != sizeof(header)) {
+    return 0;
+  }
+  record->ts_us = get_u64(header);
+  payload_len = get_u32(header + 8);
+  record->topic_len = get_u16(header + 12);
+  record->qos = header[14];
+  record->retain = header[15] & CAPTURE_FLAG_RETAIN;
+  if (payload_len > CAPTURE_MAX_PAYLOAD || record->qos > 2) {
+    fprintf(stderr, "Error: Corrupt record %lu in %s.\n", reader->records, reader->path);
+    return -1;
+  }
+  record->payload_len = (int)payload_len;
+
+  // At most 64 KiB + 256 MiB, buf_size stays well within an int
+  len = (size_t)record->topic_len + 1 + payload_len;
+  if (len > (size_t)reader->buf_size) {
+    unsigned char *buf = realloc(reader->buf, len);
+    if (!buf) {
+      return -1;
+    }
+    reader->buf = buf;
+    reader->buf_size = len;
+  }
+  if (fread(reader->buf, 1, record->topic_len, reader->data) != (size_t)record->topic_len ||
+      fread(reader->buf + record->topic_len + 1, 1, record->payload_len, reader->data) != (size_t)record->payload_len) {
+    fprintf(stderr, "Warning: %s ends with a truncated record.\n", reader->path);
+    return 0;
+  }
+  reader->buf[record->topic_len] = '\0';
+  record->topic = (char *)reader->buf;
+  record->payload = reader->buf + record->topic_len + 1;
+  reader->records++;
+  return 1;
+}
+
+/* Positions the reader on the first record at or after `ts_us`. The index narrows the search down to at most
+ * CAPTURE_INDEX_EVERY records, without an index the whole file is scanned. */
+int capture_seek(capture_reader_t *reader, uint64_t ts_us) {
+  unsigned char entry[CAPTURE_INDEX_ENTRY_LEN];
+  uint64_t offset = CAPTURE_MAGIC_LEN;
+  capture_record_t record;
+  char *idx = index_path(reader->path);
+  FILE *index = idx ? fopen(idx, "rb") : NULL;
+  long pos;
+  int ret;
+
+  free(idx);
+  if (index) {
+    while (fread(entry, 1, sizeof(entry), index) == sizeof(entry) && get_u64(entry) <= ts_us) {
+      offset = get_u64(entry + 8);
+    }
+    fclose(index);
+  }
+  if (fseek(reader->data, offset, SEEK_SET)) {
+    return -1;
+  }
+  for (;;) {
+    pos = ftell(reader->data);
+    ret = capture_read(reader, &record);
+    if (ret <= 0) {
+      return ret;
+    }
+    if (record.ts_us >= ts_us) {
+      reader->records--;
+      return fseek(reader->data, pos, SEEK_SET) ? -1 : 1;
+    }
+  }
+}
+
+void capture_reader_close(capture_reader_t *reader) {
+  if (!reader) {
+    return;
+  }
+  if (reader->data) fclose(reader->data);
+  free(reader->path);
+  free(reader->buf);
+  free(reader);
+}
@@ -0,0 +1,60 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* A capture file starts with CAPTURE_MAGIC and is followed by records, all fields are big-endian:
+ * ts_us(8) payload_len(4) topic_len(2) qos(1) flags(1) topic payload
+ * The sidecar `<file>.idx` holds {ts_us(8), offset(8)} pairs for every CAPTURE_INDEX_EVERY-th record, so a replay can
+ * start in the middle of a long capture without scanning it.
+ */
+#define CAPTURE_MAGIC "MQCAP\0\0\1"
+#define CAPTURE_MAGIC_LEN 8
+#define CAPTURE_RECORD_HEADER_LEN 16
+#define CAPTURE_INDEX_ENTRY_LEN 16
+#define CAPTURE_INDEX_SUFFIX ".idx"
+#define CAPTURE_INDEX_EVERY 1024
+#define CAPTURE_FLAG_RETAIN 0x01
+#define CAPTURE_MAX_PAYLOAD 268435455  // the largest MQTT payload, anything above is a corrupt length
+
+typedef struct capture_record_s {
+  uint64_t ts_us;
+  int qos;
+  bool retain;
+  char *topic;
+  int topic_len;
+  unsigned char *payload;
+  int payload_len;
+} capture_record_t;
+
+typedef struct capture_writer_s {
+  FILE *data;
+  FILE *index;
+  uint64_t offset;
+  unsigned long since_index;
+  unsigned long records;
+  unsigned long bytes;
+} capture_writer_t;
+
+typedef struct capture_reader_s {
+  FILE *data;
+  char *path;
+  unsigned char *buf;
+  int buf_size;
+  unsigned long records;
+} capture_reader_t;
+
+uint64_t capture_now_us(void);
+capture_writer_t *capture_open(const char *path);
+int capture_append(capture_writer_t *writer, const char *topic, const void *payload, int payload_len, int qos,
+                   bool retain, uint64_t ts_us);
+void capture_close(capture_writer_t *writer);
+
+capture_reader_t *capture_reader_open(const char *path);
+int capture_read(capture_reader_t *reader, capture_record_t *record);
+int capture_seek(capture_reader_t *reader, uint64_t ts_us);
+void capture_reader_close(capture_reader_t *reader);
+
+#endif
@@ -3,34 +3,90 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include "arena.h"
+#include "capture.h"
+#include "cum_ack.h"
+#include "dedup_cache.h"
+#include "fragment.h"
+#include "json_index.h"
+#include "tls_session.h"
+#include "topic_set.h"
+#include "ts_store.h"
+#include "value_cache.h"
 
 #ifdef WITH_SOCKS
 static int mosquitto__parse_socks_url(mosq_config_t *cfg, char *url);
 #endif
 
+void *cfg_calloc(mosq_config_t *cfg, size_t size) {
+#ifdef MOSQ_LOW_FOOTPRINT
+  return arena_alloc(cfg->arena, size);
+#else
+  return calloc(1, size);
+#endif
+}
+
+char *cfg_strdup(mosq_config_t *cfg, const char *str) {
+#ifdef MOSQ_LOW_FOOTPRINT
+  return arena_strdup(cfg->arena, str);
+#else
+  return strdup(str);
+#endif
+}
+
+// Strings set with a plain strdup() by the tools are freed as usual, arena memory goes away with the arena
+void cfg_free(mosq_config_t *cfg, void *ptr) {
+#ifdef MOSQ_LOW_FOOTPRINT
+  if (arena_owns(cfg->arena, ptr)) return;
+#endif
+  free(ptr);
+}
+
 void init_mosq_config(mosq_config_t *cfg, client_type_t client_type) {
   memset(cfg, 0, sizeof(mosq_config_t));
-  cfg->general_config = (mosq_general_config_t *)malloc(sizeof(mosq_general_config_t));
-  cfg->property_config = (mosq_property_config_t *)malloc(sizeof(mosq_property_config_t));
+#ifdef MOSQ_LOW_FOOTPRINT
+  cfg->arena = arena_new(CFG_ARENA_SIZE);
+  if (!cfg->arena) {
+    fprintf(stderr, "Error: Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+#endif
+  cfg->general_config = (mosq_general_config_t *)cfg_calloc(cfg, sizeof(mosq_general_config_t));
+  cfg->property_config = (mosq_property_config_t *)cfg_calloc(cfg, sizeof(mosq_property_config_t));
 
 #ifdef WITH_TLS
-  cfg->tls_config = (mosq_tls_config_t *)malloc(sizeof(mosq_tls_config_t));
+  cfg->tls_config = (mosq_tls_config_t *)cfg_calloc(cfg, sizeof(mosq_tls_config_t));
 #endif
 
 #ifdef WITH_SOCKS
-  cfg->socks_config = (mosq_socks_config_t *)malloc(sizeof(mosq_socks_config_t));
+  cfg->socks_config = (mosq_socks_config_t *)cfg_calloc(cfg, sizeof(mosq_socks_config_t));
 #endif
 
   if (client_type == client_pub || client_type == client_duplex) {
-    cfg->pub_config = (mosq_pub_config_t *)malloc(sizeof(mosq_pub_config_t));
+    cfg->pub_config = (mosq_pub_config_t *)cfg_calloc(cfg, sizeof(mosq_pub_config_t));
     cfg->pub_config->repeat_delay.tv_sec = 0;
     cfg->pub_config->repeat_delay.tv_usec = 0;
     cfg->pub_config->first_publish = true;
     cfg->pub_config->disconnect_sent = false;
     cfg->pub_config->ready_for_repeat = false;
+    cfg->pub_config->mtu = FRAG_DEFAULT_MTU;
   }
-  if (client_type = client_sub || client_type == client_duplex) {
-    cfg->sub_config = (mosq_sub_config_t *)malloc(sizeof(mosq_sub_config_t));
+  if (client_type == client_sub || client_type == client_duplex) {
+    cfg->sub_config = (mosq_sub_config_t *)cfg_calloc(cfg, sizeof(mosq_sub_config_t));
+#ifdef MOSQ_LOW_FOOTPRINT
+    // The dedup cache would allocate after startup, the value cache is a small one allocated here instead of lazily,
+    // it stays off unless the client turns it on
+    cfg->sub_config->topics = topic_set_new(CFG_MAX_TOPICS);
+    cfg->sub_config->dedup_ttl = 0;
+    cfg->sub_config->vcache = vcache_new(VCACHE_SMALL_ENTRIES, VCACHE_SMALL_BUDGET, VCACHE_DEFAULT_TTL);
+    cfg->sub_config->vcache_ttl = 0;
+    cfg->sub_config->validate = false;
+#else
+    cfg->sub_config->topics = topic_set_new(0);
+    cfg->sub_config->dedup_ttl = 0;  // opt-in, a repeated seq may be a device that restarted its numbering
+    cfg->sub_config->vcache_ttl = 0;  // opt-in, answering GET requests publishes on the client's behalf
+    cfg->sub_config->validate = false;  // opt-in, binary payloads are normal
+#endif
   }
 
   cfg->general_config->port = -1;
@@ -42,61 +98,94 @@ void init_mosq_config(mosq_config_t *cfg, client_type_t client_type) {
 }
 
 void mosq_config_cleanup(mosq_config_t *cfg) {
-  if (cfg->general_config->client_type == client_pub || cfg->general_config->client_type == client_duplex) {
-    free(cfg->pub_config->message);
-    free(cfg->pub_config->topic);
-    free(cfg->pub_config->response_topic);
+  if (cfg->pub_config) {
+    cfg_free(cfg, cfg->pub_config->message);
+    cfg_free(cfg, cfg->pub_config->topic);
+    cfg_free(cfg, cfg->pub_config->response_topic);
+    if (cfg->pub_config->frag) {
+      frag_sender_cleanup(cfg->pub_config->frag);
+      cfg_free(cfg, cfg->pub_config->frag);
+    }
   }
-  if (cfg->general_config->client_type = client_sub || cfg->general_config->client_type == client_duplex) {
+  if (cfg->sub_config) {
+    frag_reasm_free(cfg->sub_config->reasm);
+    if (cfg->sub_config->dedup) {
+      dedup_cache_stats(cfg->sub_config->dedup, stdout);
+      dedup_cache_free(cfg->sub_config->dedup);
+    }
+    if (cfg->sub_config->vcache) {
+      vcache_stats(cfg->sub_config->vcache, stdout);
+      vcache_free(cfg->sub_config->vcache);
+    }
+    if (cfg->sub_config->capture) {
+      printf("capture: %lu messages, %lu payload bytes written to %s\n", cfg->sub_config->capture->records,
+             cfg->sub_config->capture->bytes, cfg->sub_config->capture_path);
+      capture_close(cfg->sub_config->capture);
+    }
+    cfg_free(cfg, cfg->sub_config->capture_path);
+    if (cfg->sub_config->store) {
+      ts_store_stats(cfg->sub_config->store, stdout);
+      ts_store_close(cfg->sub_config->store);
+    }
+    cfg_free(cfg, cfg->sub_config->store_path);
+    if (cfg->sub_config->json) {
+      json_index_free(cfg->sub_config->json);
+      free(cfg->sub_config->json);
+    }
+    if (cfg->sub_config->acks) {
+      cum_ack_stats(cfg->sub_config->acks, stdout);
+      cum_ack_tracker_free(cfg->sub_config->acks);
+    }
+    if (cfg->sub_config->invalid) printf("validation: %lu malformed payloads dropped\n", cfg->sub_config->invalid);
     if (cfg->sub_config->topics) {
-      for (int i = 0; i < cfg->sub_config->topic_count; i++) {
-        free(cfg->sub_config->topics[i]);
-      }
-      free(cfg->sub_config->topics);
+      if (cfg->sub_config->topics->packets) topic_set_stats(cfg->sub_config->topics, stdout);
+      topic_set_free(cfg->sub_config->topics);
     }
     if (cfg->sub_config->filter_outs) {
       for (int i = 0; i < cfg->sub_config->filter_out_count; i++) {
-        free(cfg->sub_config->filter_outs[i]);
+        cfg_free(cfg, cfg->sub_config->filter_outs[i]);
       }
-      free(cfg->sub_config->filter_outs);
+      cfg_free(cfg, cfg->sub_config->filter_outs);
     }
     if (cfg->sub_config->unsub_topics) {
       for (int i = 0; i < cfg->sub_config->unsub_topic_count; i++) {
-        free(cfg->sub_config->unsub_topics[i]);
+        cfg_free(cfg, cfg->sub_config->unsub_topics[i]);
       }
-      free(cfg->sub_config->unsub_topics);
+      cfg_free(cfg, cfg->sub_config->unsub_topics);
     }
   }
-  free(cfg->general_config->id);
-  free(cfg->general_config->id_prefix);
-  free(cfg->general_config->host);
-  free(cfg->general_config->bind_address);
-  free(cfg->general_config->username);
-  free(cfg->general_config->password);
-  free(cfg->general_config->will_topic);
-  free(cfg->general_config->will_payload);
+  cfg_free(cfg, cfg->general_config->id);
+  cfg_free(cfg, cfg->general_config->id_prefix);
+  cfg_free(cfg, cfg->general_config->host);
+  cfg_free(cfg, cfg->general_config->bind_address);
+  cfg_free(cfg, cfg->general_config->username);
+  cfg_free(cfg, cfg->general_config->password);
+  cfg_free(cfg, cfg->general_config->will_topic);
+  cfg_free(cfg, cfg->general_config->will_payload);
 
 #ifdef WITH_TLS
-  free(cfg->tls_config->cafile);
-  free(cfg->tls_config->capath);
-  free(cfg->tls_config->certfile);
-  free(cfg->tls_config->keyfile);
-  free(cfg->tls_config->ciphers);
-  free(cfg->tls_config->tls_alpn);
-  free(cfg->tls_config->tls_version);
-  free(cfg->tls_config->tls_engine);
-  free(cfg->tls_config->tls_engine_kpass_sha1);
-  free(cfg->tls_config->keyform);
+  cfg_free(cfg, cfg->tls_config->cafile);
+  cfg_free(cfg, cfg->tls_config->capath);
+  cfg_free(cfg, cfg->tls_config->certfile);
+  cfg_free(cfg, cfg->tls_config->keyfile);
+  cfg_free(cfg, cfg->tls_config->ciphers);
+  cfg_free(cfg, cfg->tls_config->tls_alpn);
+  cfg_free(cfg, cfg->tls_config->tls_version);
+  cfg_free(cfg, cfg->tls_config->tls_engine);
+  cfg_free(cfg, cfg->tls_config->tls_engine_kpass_sha1);
+  cfg_free(cfg, cfg->tls_config->keyform);
+  cfg_free(cfg, cfg->tls_config->session_file);
+  tls_session_free(cfg->tls_config->session);
 #ifdef FINAL_WITH_TLS_PSK
-  free(cfg->tls_config->psk);
-  free(cfg->tls_config->psk_identity);
+  cfg_free(cfg, cfg->tls_config->psk);
+  cfg_free(cfg, cfg->tls_config->psk_identity);
 #endif
 #endif
 
 #ifdef WITH_SOCKS
-  free(cfg->socks_config->socks5_host);
-  free(cfg->socks_config->socks5_username);
-  free(cfg->socks_config->socks5_password);
+  cfg_free(cfg, cfg->socks_config->socks5_host);
+  cfg_free(cfg, cfg->socks_config->socks5_username);
+  cfg_free(cfg, cfg->socks_config->socks5_password);
 #endif
   mosquitto_property_free_all(&cfg->property_config->connect_props);
   mosquitto_property_free_all(&cfg->property_config->publish_props);
@@ -104,6 +193,23 @@ void mosq_config_cleanup(mosq_config_t *cfg) {
   mosquitto_property_free_all(&cfg->property_config->unsubscribe_props);
   mosquitto_property_free_all(&cfg->property_config->disconnect_props);
   mosquitto_property_free_all(&cfg->property_config->will_props);
+
+#ifdef WITH_TLS
+  cfg_free(cfg, cfg->tls_config);
+#endif
+#ifdef WITH_SOCKS
+  cfg_free(cfg, cfg->socks_config);
+#endif
+  cfg_free(cfg, cfg->pub_config);
+  cfg_free(cfg, cfg->sub_config);
+  cfg_free(cfg, cfg->property_config);
+  cfg_free(cfg, cfg->general_config);
+#ifdef MOSQ_LOW_FOOTPRINT
+  arena_stats(cfg->arena, stdout);
+  footprint_report(stdout);
+  arena_free(cfg->arena);
+#endif
+  memset(cfg, 0, sizeof(mosq_config_t));
 }
 
 rc_mosq_retcode_t cfg_add_topic(mosq_config_t *cfg, client_type_t client_type, char *topic) {
@@ -116,25 +222,26 @@ rc_mosq_retcode_t cfg_add_topic(mosq_config_t *cfg, client_type_t client_type, c
       fprintf(stderr, "Error: Invalid publish topic '%s', does it contain '+' or '#'?\n", topic);
       return RC_MOS_ADD_TOPIC;
     }
-    cfg->pub_config->topic = strdup(topic);
+    cfg->pub_config->topic = cfg_strdup(cfg, topic);
   } else if (client_type == client_duplex) {
     if (mosquitto_pub_topic_check(topic) == MOSQ_ERR_INVAL) {
       fprintf(stderr, "Error: Invalid response topic '%s', does it contain '+' or '#'?\n", topic);
       return RC_MOS_ADD_TOPIC;
     }
-    cfg->pub_config->response_topic = strdup(topic);
+    cfg->pub_config->response_topic = cfg_strdup(cfg, topic);
   } else {
     if (mosquitto_sub_topic_check(topic) == MOSQ_ERR_INVAL) {
       fprintf(stderr, "Error: Invalid subscription topic '%s', are all '+' and '#' wildcards correct?\n", topic);
       return RC_MOS_ADD_TOPIC;
     }
-    cfg->sub_config->topic_count++;
-    cfg->sub_config->topics = realloc(cfg->sub_config->topics, cfg->sub_config->topic_count * sizeof(char *));
-    if (!cfg->sub_config->topics) {
+    if (!cfg->sub_config->topics || topic_set_add(cfg->sub_config->topics, topic) < 0) {
+#ifdef MOSQ_LOW_FOOTPRINT
+      fprintf(stderr, "Error: At most %d subscriptions in the low-footprint build.\n", CFG_MAX_TOPICS);
+#else
       fprintf(stderr, "Error: Out of memory.\n");
+#endif
       return RC_MOS_ADD_TOPIC;
     }
-    cfg->sub_config->topics[cfg->sub_config->topic_count - 1] = strdup(topic);
   }
   return RC_MOS_OK;
 }
@@ -215,6 +322,25 @@ rc_mosq_retcode_t mosq_opts_set(struct mosquitto *mosq, mosq_config_t *cfg) {
     mosquitto_lib_cleanup();
     return RC_MOS_OPT_SET;
   }
+  if (cfg->tls_config->cafile || cfg->tls_config->capath
+#ifdef FINAL_WITH_TLS_PSK
+      || cfg->tls_config->psk
+#endif
+  ) {
+    // Reconnects resume the last session instead of repeating the full handshake
+    if (!cfg->tls_config->session) {
+#ifdef FINAL_WITH_TLS_PSK
+      cfg->tls_config->session = tls_session_new(cfg->tls_config->session_file, cfg->tls_config->psk != NULL);
+#else
+      cfg->tls_config->session = tls_session_new(cfg->tls_config->session_file, false);
+#endif
+    }
+    if (!cfg->tls_config->session || tls_session_attach(cfg->tls_config->session, mosq)) {
+      fprintf(stderr, "Error: Problem setting up TLS session resumption.\n");
+      mosquitto_lib_cleanup();
+      return RC_MOS_OPT_SET;
+    }
+  }
 #endif
   mosquitto_max_inflight_messages_set(mosq, cfg->general_config->max_inflight);
 #ifdef WITH_SOCKS
@@ -232,7 +358,7 @@ rc_mosq_retcode_t mosq_opts_set(struct mosquitto *mosq, mosq_config_t *cfg) {
 
 rc_mosq_retcode_t generate_client_id(mosq_config_t *cfg) {
   if (cfg->general_config->id_prefix) {
-    cfg->general_config->id = malloc(strlen(cfg->general_config->id_prefix) + 10);
+    cfg->general_config->id = cfg_calloc(cfg, strlen(cfg->general_config->id_prefix) + 10);
     if (!cfg->general_config->id) {
       fprintf(stderr, "Error: Out of memory.\n");
       mosquitto_lib_cleanup();
@@ -244,11 +370,13 @@ rc_mosq_retcode_t generate_client_id(mosq_config_t *cfg) {
   return RC_MOS_OK;
 }
 
-rc_mosq_retcode_t mosq_client_connect(struct mosquitto *mosq, mosq_config_t *cfg) {
-  char *err;
-  rc_mosq_retcode_t ret = MOSQ_ERR_SUCCESS;
-  int port;
+/* Where the client connects to: the configured broker, or host and port of PROXY_ENV when that is set. `proxy` holds
+ * the host string of the override. */
+rc_mosq_retcode_t mosq_connect_target(mosq_config_t *cfg, char *proxy, size_t proxy_len, const char **host, int *port) {
+  const char *env = getenv(PROXY_ENV);
+  char *colon;
 
+  *host = cfg->general_config->host;
   if (cfg->general_config->port < 0) {
 #ifdef WITH_TLS
     if (cfg->tls_config->cafile || cfg->tls_config->capath
@@ -256,27 +384,56 @@ rc_mosq_retcode_t mosq_client_connect(struct mosquitto *mosq, mosq_config_t *cfg
         || cfg->tls_config->psk
 #endif
     ) {
-      port = 8883;
+      *port = 8883;
     } else
 #endif
     {
-      port = 1883;
+      *port = 1883;
     }
   } else {
-    port = cfg->general_config->port;
+    *port = cfg->general_config->port;
+  }
+  // Lets every client be tried through an impairment proxy without touching its options
+  if (env && *env) {
+    snprintf(proxy, proxy_len, "%s", env);
+    colon = strrchr(proxy, ':');
+    if (!colon || colon == proxy || atoi(colon + 1) <= 0) {
+      fprintf(stderr, "Error: %s must be host:port.\n", PROXY_ENV);
+      return RC_CLIENT_CONNTECT;
+    }
+    *colon = '\0';
+    *host = proxy;
+    *port = atoi(colon + 1);
+  }
+  return RC_MOS_OK;
+}
+
+rc_mosq_retcode_t mosq_client_connect(struct mosquitto *mosq, mosq_config_t *cfg) {
+  char *err, proxy[256];
+  rc_mosq_retcode_t ret = MOSQ_ERR_SUCCESS;
+  const char *host;
+  int port;
+
+  if (mosq_connect_target(cfg, proxy, sizeof(proxy), &host, &port)) {
+    mosquitto_lib_cleanup();
+    return RC_CLIENT_CONNTECT;
+  }
+  if (host == proxy) {
+    fprintf(stderr, "Warning: Connecting through %s:%d.\n", host, port);
   }
 
 #ifdef WITH_SRV
-  if (cfg->use_srv) {
+  // The proxy stands in for whatever broker the SRV record would have named
+  if (cfg->use_srv && host != proxy) {
     ret = mosquitto_connect_srv(mosq, cfg->general_config->host, cfg->general_config->keepalive,
                                 cfg->general_config->bind_address);
   } else {
-    ret = mosquitto_connect_bind_v5(mosq, cfg->general_config->host, port, cfg->general_config->keepalive,
+    ret = mosquitto_connect_bind_v5(mosq, host, port, cfg->general_config->keepalive,
                                     cfg->general_config->bind_address, cfg->property_config->connect_props);
   }
 #else
-  ret = mosquitto_connect_bind_v5(mosq, cfg->general_config->host, port, cfg->general_config->keepalive,
-                                  cfg->general_config->bind_address, cfg->property_config->connect_props);
+  ret = mosquitto_connect_bind_v5(mosq, host, port, cfg->general_config->keepalive, cfg->general_config->bind_address,
+                                  cfg->property_config->connect_props);
 #endif
   if (ret > 0) {
     {
@@ -289,6 +446,8 @@ rc_mosq_retcode_t mosq_client_connect(struct mosquitto *mosq, mosq_config_t *cfg
     }
     mosquitto_lib_cleanup();
     ret = RC_CLIENT_CONNTECT;
+  } else {
+    footprint_mark_steady();
   }
   return ret;
 }
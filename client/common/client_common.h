@@ -4,6 +4,7 @@
 #include <mosquitto.h>
 #include <stdio.h>
 #include <sys/time.h>
+#include <time.h>
 
 /* pub_client.c modes */
 #define MSGMODE_CMD 1
@@ -14,6 +15,7 @@
 #define TOPIC "NB/test/room1"
 #define TOPIC_RES "NB/test/room2"
 #define MESSAGE "this is the testing message, so say hi to me"
+#define PROXY_ENV "MQTT_PROXY"  // host:port every client connects through instead, e.g. an nbproxy
 
 typedef enum client_type_s { client_pub, client_sub, client_duplex } client_type_t;
 
@@ -29,6 +31,12 @@ typedef enum mosq_retcode_s {
   RC_MOS_OPT_SET,
   RC_MOS_GEN_ID,
   RC_CLIENT_CONNTECT,
+  RC_MQTTSN_SOCKET,
+  RC_MQTTSN_TIMEOUT,
+  RC_MQTTSN_REJECTED,
+  RC_ONESHOT_RESOLVE,
+  RC_ONESHOT_TIMEOUT,
+  RC_ONESHOT_REJECTED,
 } rc_mosq_retcode_t;
 
 typedef struct mosq_general_config_s {
@@ -71,11 +79,16 @@ typedef struct mosq_pub_config_s {
   bool ready_for_repeat;          /* pub, rr */
   bool have_topic_alias;          /* pub */
   char *response_topic;           /* rr */
+  int mtu;                        /* pub, payloads above it are fragmented */
+  struct frag_sender_s *frag;     /* pub, active fragmented transfer */
+  time_t frag_linger_until;       /* pub, keep the session for NACKs until then */
+  struct duplex_relay_s *relay;   /* duplex, received payloads to forward, owned by the caller */
+  struct mailbox_s *mailbox;      /* duplex, commands waiting for the devices' next uplink, owned by the caller */
+  struct shm_ring_s *ring;        /* duplex, local path to a TA on the same host, owned by the caller */
 } mosq_pub_config_t;
 
 typedef struct mosq_sub_config_s {
-  char **topics;         /* sub */
-  int topic_count;       /* sub */
+  struct topic_set_s *topics; /* sub, subscribed incrementally, see topic_set_flush */
   bool exit_after_sub;   /* sub */
   bool no_retain;        /* sub */
   bool retained_only;    /* sub */
@@ -86,6 +99,24 @@ typedef struct mosq_sub_config_s {
   int unsub_topic_count; /* sub */
   int timeout;           /* sub */
   int sub_opts;          /* sub */
+  struct frag_reasm_s *reasm; /* sub, created on the first received chunk */
+  struct dedup_cache_s *dedup; /* sub, created on the first QoS>0 message with a key */
+  int dedup_ttl;               /* sub, 0 disables deduplication */
+  bool dedup_payload;          /* sub, messages without a seq property are deduplicated by payload hash too */
+  struct value_cache_s *vcache; /* sub, latest payload per topic, created on the first message */
+  int vcache_ttl;               /* sub, 0 disables the cache and GET requests go to the device */
+  char *capture_path;           /* sub, every received message is appended here when set */
+  struct capture_writer_s *capture; /* sub */
+  char *store_path;                 /* sub, readings are decoded into the time-series store here when set */
+  struct ts_store_s *store;         /* sub */
+  bool validate;                    /* sub, drop payloads that are malformed JSON or UTF-8 */
+  struct json_index_s *json;        /* sub, structural index of the last JSON payload */
+  unsigned long invalid;            /* sub */
+  int hex;                          /* sub, print payloads as hex: 1 lowercase, 2 uppercase */
+  struct admit_queue_s *admit;      /* sub, owned by the caller, messages wait there for sub_poll when set */
+  bool cum_acks;                    /* sub, acknowledge numbered QoS 0 messages cumulatively, see cum_ack.h */
+  struct cum_ack_tracker_s *acks;   /* sub, created on the first numbered message */
+  struct shm_ring_s *ring;          /* sub, owned by the caller, messages from publishers on the same host */
 } mosq_sub_config_t;
 
 typedef struct mosq_property_config_s {
@@ -110,6 +141,8 @@ typedef struct mosq_tls_config_s {
   char *tls_engine;
   char *tls_engine_kpass_sha1;
   char *keyform;
+  char *session_file;             /* TLS session kept across restarts, NULL keeps it across reconnects only */
+  struct tls_session_s *session;  /* created in mosq_opts_set */
 #ifdef FINAL_WITH_TLS_PSK
   char *psk;
   char *psk_identity;
@@ -138,12 +171,21 @@ typedef struct mosq_config_s {
 #ifdef WITH_SOCKS
   mosq_socks_config_t *socks_config;
 #endif
+
+#ifdef MOSQ_LOW_FOOTPRINT
+  struct arena_s *arena;
+#endif
 } mosq_config_t;
 
+void *cfg_calloc(mosq_config_t *cfg, size_t size);
+char *cfg_strdup(mosq_config_t *cfg, const char *str);
+void cfg_free(mosq_config_t *cfg, void *ptr);
 void mosq_config_cleanup(mosq_config_t *cfg);
 void init_mosq_config(mosq_config_t *cfg, client_type_t client_type);
 rc_mosq_retcode_t mosq_opts_set(struct mosquitto *mosq, mosq_config_t *cfg);
 rc_mosq_retcode_t generate_client_id(mosq_config_t *cfg);
+rc_mosq_retcode_t mosq_connect_target(mosq_config_t *cfg, char *proxy, size_t proxy_len, const char **host,
+                                      int *port);
 rc_mosq_retcode_t mosq_client_connect(struct mosquitto *mosq, mosq_config_t *cfg);
 rc_mosq_retcode_t cfg_add_topic(mosq_config_t *cfg, client_type_t client_type, char *topic);
 
@@ -0,0 +1,334 @@
+#include "cum_ack.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FNV64_OFFSET 14695981039346656037ull
+#define FNV64_PRIME 1099511628211ull
+#define INDEX_EMPTY -1
+#define INDEX_DELETED -2
+
+static uint64_t hash_key(const char *key) {
+  uint64_t hash = FNV64_OFFSET;
+  for (; *key; key++) {
+    hash ^= (unsigned char)*key;
+    hash *= FNV64_PRIME;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+int cum_ack_format(const cum_ack_t *ack, char *buf, int size) {
+  int len = snprintf(buf, size, "%u", ack->top);
+
+  for (int i = 0; i < ack->range_count && len < size; i++) {
+    if (ack->ranges[i][0] == ack->ranges[i][1]) {
+      len += snprintf(buf + len, size - len, " %u", ack->ranges[i][0]);
+    } else {
+      len += snprintf(buf + len, size - len, " %u-%u", ack->ranges[i][0], ack->ranges[i][1]);
+    }
+  }
+  return len < size ? len : -1;
+}
+
+/* Reads a decimal number without a terminator to rely on. Returns the characters used, 0 when there is none. */
+static int parse_number(const char *s, int len, uint32_t *value) {
+  uint64_t v = 0;
+  int i = 0;
+
+  while (i < len && s[i] >= '0' && s[i] <= '9' && i < 10) v = v * 10 + (s[i++] - '0');
+  if (!i || v > UINT32_MAX || (i < len && s[i] >= '0' && s[i] <= '9')) return 0;
+  *value = (uint32_t)v;
+  return i;
+}
+
+int cum_ack_parse(cum_ack_t *ack, const char *payload, int len) {
+  uint32_t first, last, prev;
+  int pos, n;
+
+  memset(ack, 0, sizeof(cum_ack_t));
+  pos = parse_number(payload, len, &ack->top);
+  if (!pos) return -1;
+  prev = 0;
+  while (pos < len) {
+    if (payload[pos++] != ' ' || !(n = parse_number(payload + pos, len - pos, &first))) return -1;
+    pos += n;
+    last = first;
+    if (pos < len && payload[pos] == '-') {
+      pos++;
+      if (!(n = parse_number(payload + pos, len - pos, &last))) return -1;
+      pos += n;
+    }
+    // Ascending and below top, anything else is not an ack this side wrote
+    if (ack->range_count == CUMACK_MAX_RANGES || first > last || first <= prev || last > ack->top) return -1;
+    ack->ranges[ack->range_count][0] = first;
+    ack->ranges[ack->range_count++][1] = last;
+    prev = last;
+  }
+  return 0;
+}
+
+bool cum_ack_covers(const cum_ack_t *ack, uint32_t seq) {
+  if (seq > ack->top) return false;
+  for (int i = 0; i < ack->range_count; i++) {
+    if (seq >= ack->ranges[i][0] && seq <= ack->ranges[i][1]) return false;
+  }
+  return true;
+}
+
+int cum_seq_format(char *buf, int size, uint32_t seq, uint32_t base) {
+  if (base && base < seq) return snprintf(buf, size, "%u/%u", seq, base);
+  return snprintf(buf, size, "%u", seq);
+}
+
+/* Returns -1 unless `value` is "<seq>" or "<seq>/<base>", base is seq itself when left out. */
+int cum_seq_parse(const char *value, uint32_t *seq, uint32_t *base) {
+  int len = strlen(value), n = parse_number(value, len, seq);
+
+  if (!n || !*seq) return -1;
+  *base = *seq;
+  if (n == len) return 0;
+  if (value[n] != '/' || parse_number(value + n + 1, len - n - 1, base) != len - n - 1 || !*base || *base > *seq) {
+    return -1;
+  }
+  return 0;
+}
+
+cum_ack_tracker_t *cum_ack_tracker_new(int max_devices, int every, double delay_ms) {
+  cum_ack_tracker_t *tracker;
+  uint32_t index_size = 1;
+
+  if (max_devices <= 0 || every <= 0) {
+    return NULL;
+  }
+  // Keep the index at most half full so probe chains stay short
+  while (index_size < (uint32_t)max_devices * 2) index_size <<= 1;
+
+  tracker = calloc(1, sizeof(cum_ack_tracker_t));
+  if (!tracker) {
+    return NULL;
+  }
+  tracker->devices = calloc(max_devices, sizeof(cum_ack_device_t));
+  tracker->index = malloc(index_size * sizeof(int32_t));
+  if (!tracker->devices || !tracker->index) {
+    cum_ack_tracker_free(tracker);
+    return NULL;
+  }
+  memset(tracker->index, 0xff, index_size * sizeof(int32_t));
+  tracker->index_mask = index_size - 1;
+  tracker->capacity = max_devices;
+  tracker->every = every;
+  tracker->delay_ms = delay_ms;
+  return tracker;
+}
+
+void cum_ack_tracker_free(cum_ack_tracker_t *tracker) {
+  if (!tracker) {
+    return;
+  }
+  if (tracker->devices) {
+    for (int i = 0; i < tracker->count; i++) {
+      free(tracker->devices[i].topic);
+    }
+  }
+  free(tracker->devices);
+  free(tracker->index);
+  free(tracker);
+}
+
+/* Returns the index slot holding the device for `topic`, or -1. */
+static int32_t find_slot(const cum_ack_tracker_t *tracker, uint64_t hash, const char *topic) {
+  uint32_t pos = (uint32_t)hash & tracker->index_mask;
+  int32_t n;
+
+  for (uint32_t i = 0; i <= tracker->index_mask; i++, pos = (pos + 1) & tracker->index_mask) {
+    n = tracker->index[pos];
+    if (n == INDEX_EMPTY) {
+      return -1;
+    }
+    if (n >= 0 && tracker->devices[n].hash == hash && !strcmp(tracker->devices[n].topic, topic)) {
+      return pos;
+    }
+  }
+  return -1;
+}
+
+static void insert_slot(cum_ack_tracker_t *tracker, uint64_t hash, int32_t n) {
+  uint32_t pos = (uint32_t)hash & tracker->index_mask;
+
+  while (tracker->index[pos] >= 0) pos = (pos + 1) & tracker->index_mask;
+  if (tracker->index[pos] == INDEX_DELETED) tracker->tombstones--;
+  tracker->index[pos] = n;
+}
+
+/* The device heard from least recently makes room. It only loses its window, the base it sends along with its next
+ * message sets that up again. */
+static int32_t evict_idle(cum_ack_tracker_t *tracker) {
+  cum_ack_device_t *device;
+  int32_t n = 0, slot;
+
+  for (int32_t i = 1; i < tracker->count; i++) {
+    if (tracker->devices[i].last_seen < tracker->devices[n].last_seen) n = i;
+  }
+  device = &tracker->devices[n];
+  slot = find_slot(tracker, device->hash, device->topic);
+  if (slot >= 0) tracker->index[slot] = INDEX_DELETED;
+  if (++tracker->tombstones > tracker->count) {
+    // Tombstones lengthen every miss, once there are as many as live devices the index is rebuilt
+    memset(tracker->index, 0xff, (tracker->index_mask + 1) * sizeof(int32_t));
+    tracker->tombstones = 0;
+    for (int32_t i = 0; i < tracker->count; i++) {
+      if (i != n) insert_slot(tracker, tracker->devices[i].hash, i);
+    }
+  }
+  if (device->pending || device->urgent) tracker->pending--;
+  free(device->topic);
+  memset(device, 0, sizeof(cum_ack_device_t));
+  tracker->evictions++;
+  return n;
+}
+
+static bool seen(const cum_ack_device_t *device, uint32_t seq) {
+  uint32_t bit = seq % CUMACK_WINDOW;
+  return device->seen[bit / 64] >> (bit % 64) & 1;
+}
+
+static void set_seen(cum_ack_device_t *device, uint32_t seq, bool value) {
+  uint32_t bit = seq % CUMACK_WINDOW;
+
+  if (value) {
+    device->seen[bit / 64] |= 1ull << (bit % 64);
+  } else {
+    device->seen[bit / 64] &= ~(1ull << (bit % 64));
+  }
+}
+
+/* Moves the cumulative point to `to`, then on over whatever arrived right behind it. */
+static void advance(cum_ack_device_t *device, uint32_t to) {
+  if (to > device->cum) {
+    if (to - device->cum >= CUMACK_WINDOW) {
+      memset(device->seen, 0, sizeof(device->seen));
+    } else {
+      for (uint32_t seq = device->cum + 1; seq <= to; seq++) set_seen(device, seq, false);
+    }
+    device->cum = to;
+  }
+  while (seen(device, device->cum + 1)) set_seen(device, ++device->cum, false);
+  if (device->top < device->cum) device->top = device->cum;
+}
+
+static cum_ack_device_t *get_device(cum_ack_tracker_t *tracker, const char *topic, uint32_t base) {
+  uint64_t hash = hash_key(topic);
+  int32_t slot = find_slot(tracker, hash, topic), n;
+  cum_ack_device_t *device;
+  char *copy;
+
+  if (slot >= 0) {
+    return &tracker->devices[tracker->index[slot]];
+  }
+  // Copied before anyone is evicted, so a failure leaves the table as it was
+  copy = strdup(topic);
+  if (!copy) {
+    return NULL;
+  }
+  n = tracker->count < tracker->capacity ? tracker->count : evict_idle(tracker);
+  device = &tracker->devices[n];
+  device->topic = copy;
+  device->hash = hash;
+  // Whatever came before the first message seen is the device's business, it dropped it from its queue already
+  device->cum = device->top = base - 1;
+  insert_slot(tracker, hash, n);
+  if (n == tracker->count) tracker->count++;
+  return device;
+}
+
+/* Records that `seq` from the device publishing on `topic` arrived. Only CUMACK_NEW messages are to be processed, the
+ * caller drops the others. */
+cum_ack_retcode_t cum_ack_receive(cum_ack_tracker_t *tracker, const char *topic, uint32_t seq, uint32_t base,
+                                  double now) {
+  cum_ack_device_t *device = get_device(tracker, topic, base);
+  cum_ack_retcode_t ret = CUMACK_NEW;
+  bool owed;
+
+  if (!device) {
+    return CUMACK_UNTRACKED;
+  }
+  tracker->received++;
+  device->last_seen = now;
+  owed = device->pending || device->urgent;
+  // The device no longer holds anything below its base, an ack we sent before a restart may have covered it
+  if (base - 1 > device->cum) advance(device, base - 1);
+
+  if (seq <= device->cum || seen(device, seq)) {
+    tracker->duplicates++;
+    device->urgent = true;
+    ret = CUMACK_DUPLICATE;
+  } else if (seq - device->cum > CUMACK_WINDOW) {
+    tracker->beyond_window++;
+    device->urgent = true;
+    ret = CUMACK_BEYOND_WINDOW;
+  } else {
+    set_seen(device, seq, true);
+    if (seq > device->top) device->top = seq;
+    advance(device, device->cum);
+    if (!device->pending++) device->first_pending = now;
+  }
+  if (!owed) tracker->pending++;
+  return ret;
+}
+
+static void build_ack(const cum_ack_device_t *device, cum_ack_t *ack) {
+  uint32_t seq;
+
+  ack->top = device->top;
+  ack->range_count = 0;
+  for (seq = device->cum + 1; seq <= device->top; seq++) {
+    if (seen(device, seq)) continue;
+    if (ack->range_count && ack->ranges[ack->range_count - 1][1] == seq - 1) {
+      ack->ranges[ack->range_count - 1][1] = seq;
+    } else if (ack->range_count < CUMACK_MAX_RANGES) {
+      ack->ranges[ack->range_count][0] = ack->ranges[ack->range_count][1] = seq;
+      ack->range_count++;
+    } else {
+      // No room for this gap, so the ack must not claim anything from it on
+      ack->top = seq - 1;
+      break;
+    }
+  }
+}
+
+/* Sends the acks that are due: after `every` messages, `delay_ms` after the first unacknowledged one, or at once for a
+ * duplicate. Returns the number sent. */
+int cum_ack_flush(cum_ack_tracker_t *tracker, double now, cum_ack_send_t send, void *userdata) {
+  char buf[CUMACK_MAX_LEN];
+  cum_ack_device_t *device;
+  cum_ack_t ack;
+  int sent = 0, len;
+
+  for (int i = 0; i < tracker->count && tracker->pending; i++) {
+    device = &tracker->devices[i];
+    if (!device->urgent &&
+        (!device->pending || (device->pending < tracker->every && now - device->first_pending < tracker->delay_ms))) {
+      continue;
+    }
+    build_ack(device, &ack);
+    len = cum_ack_format(&ack, buf, sizeof(buf));
+    send(userdata, device->topic, buf, len);
+    device->pending = 0;
+    device->urgent = false;
+    tracker->pending--;
+    tracker->acks++;
+    tracker->ack_bytes += len;
+    sent++;
+  }
+  return sent;
+}
+
+void cum_ack_stats(const cum_ack_tracker_t *tracker, FILE *out) {
+  fprintf(out,
+          "cumulative acks: %lu messages from %d devices, %lu duplicates, %lu beyond the window, %lu acks of %lu "
+          "bytes, %.1f downlinks per 1000 messages instead of 1000, %lu devices evicted\n",
+          tracker->received, tracker->count, tracker->duplicates, tracker->beyond_window, tracker->acks,
+          tracker->ack_bytes, tracker->received ? tracker->acks * 1000.0 / tracker->received : 0, tracker->evictions);
+}
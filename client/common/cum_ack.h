@@ -0,0 +1,84 @@
+#ifndef CUM_ACK_H
+#define CUM_ACK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "dedup_cache.h"
+
+/* Application-level cumulative acknowledgements. With QoS 1 every uplink costs a PUBACK downlink, and on NB-IoT a
+ * downlink keeps the radio awake for its whole inactivity timer. Devices instead publish at QoS 0 with a sequence
+ * number in the DEDUP_SEQ_PROPERTY user property, "<seq>" or "<seq>/<base>" where base is the oldest sequence number
+ * still in the device's queue. The TA answers on `<topic>/ack` once per CUMACK_DEFAULT_EVERY messages or after
+ * CUMACK_DEFAULT_DELAY_MS, whichever comes first, with "<top>[ <first>[-<last>]]...": every sequence number up to top
+ * arrived except the ranges listed, which the device sends again. A duplicate means an ack got lost and is answered
+ * right away. */
+#define CUMACK_SUFFIX "/ack"
+#define CUMACK_SEQ_PROPERTY DEDUP_SEQ_PROPERTY
+#define CUMACK_DEFAULT_EVERY 32
+#define CUMACK_DEFAULT_DELAY_MS 30000
+#define CUMACK_DEFAULT_DEVICES 4096
+#define CUMACK_WINDOW 512     // sequence numbers beyond the cumulative point that are remembered, a multiple of 64
+#define CUMACK_MAX_RANGES 16  // missing ranges in one ack, later gaps wait for the next one
+#define CUMACK_MAX_LEN (11 + CUMACK_MAX_RANGES * 22)
+
+typedef enum cum_ack_retcode_s {
+  CUMACK_NEW,
+  CUMACK_DUPLICATE,
+  CUMACK_BEYOND_WINDOW,  // too far ahead, dropped unacknowledged so the device sends it again
+  CUMACK_UNTRACKED,      // out of memory, processed without acknowledgement
+} cum_ack_retcode_t;
+
+typedef struct cum_ack_s {
+  uint32_t top;
+  int range_count;
+  uint32_t ranges[CUMACK_MAX_RANGES][2];  // missing, first and last
+} cum_ack_t;
+
+typedef struct cum_ack_device_s {
+  uint64_t hash;
+  char *topic;  // NULL for a free entry
+  uint32_t cum;  // every sequence number up to here arrived
+  uint32_t top;
+  uint64_t seen[CUMACK_WINDOW / 64];  // bit seq % CUMACK_WINDOW for cum < seq <= cum + CUMACK_WINDOW
+  int pending;                        // messages since the last ack
+  double first_pending;
+  bool urgent;
+  double last_seen;
+} cum_ack_device_t;
+
+typedef struct cum_ack_tracker_s {
+  cum_ack_device_t *devices;
+  int capacity;
+  int count;
+  int32_t *index;  // open addressing over device numbers
+  uint32_t index_mask;
+  int tombstones;
+  int every;
+  double delay_ms;
+  int pending;  // devices owing an ack
+  unsigned long received;
+  unsigned long duplicates;
+  unsigned long beyond_window;
+  unsigned long acks;
+  unsigned long ack_bytes;
+  unsigned long evictions;
+} cum_ack_tracker_t;
+
+/* Called for every ack that is due, with the device's topic. */
+typedef void (*cum_ack_send_t)(void *userdata, const char *topic, const char *ack, int ack_len);
+
+int cum_ack_format(const cum_ack_t *ack, char *buf, int size);
+int cum_ack_parse(cum_ack_t *ack, const char *payload, int len);
+bool cum_ack_covers(const cum_ack_t *ack, uint32_t seq);
+int cum_seq_format(char *buf, int size, uint32_t seq, uint32_t base);
+int cum_seq_parse(const char *value, uint32_t *seq, uint32_t *base);
+
+cum_ack_tracker_t *cum_ack_tracker_new(int max_devices, int every, double delay_ms);
+void cum_ack_tracker_free(cum_ack_tracker_t *tracker);
+cum_ack_retcode_t cum_ack_receive(cum_ack_tracker_t *tracker, const char *topic, uint32_t seq, uint32_t base,
+                                  double now);
+int cum_ack_flush(cum_ack_tracker_t *tracker, double now, cum_ack_send_t send, void *userdata);
+void cum_ack_stats(const cum_ack_tracker_t *tracker, FILE *out);
+
+#endif
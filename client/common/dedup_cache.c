@@ -0,0 +1,102 @@
+#include "dedup_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FNV64_OFFSET 14695981039346656037ull
+#define FNV64_PRIME 1099511628211ull
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t len) {
+  const unsigned char *buf = data;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= buf[i];
+    hash *= FNV64_PRIME;
+  }
+  return hash;
+}
+
+// FNV-1a alone clusters badly in the low bits which are used as the table index
+static uint64_t finalize(uint64_t hash) {
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  return hash ? hash : 1;
+}
+
+dedup_cache_t *dedup_cache_new(uint32_t capacity, uint32_t ttl) {
+  dedup_cache_t *cache;
+
+  if (capacity == 0 || (capacity & (capacity - 1))) {
+    fprintf(stderr, "Error: Dedup cache capacity %u is not a power of two.\n", capacity);
+    return NULL;
+  }
+  cache = calloc(1, sizeof(dedup_cache_t));
+  if (!cache) {
+    return NULL;
+  }
+  cache->entries = calloc(capacity, sizeof(dedup_entry_t));
+  if (!cache->entries) {
+    free(cache);
+    return NULL;
+  }
+  cache->mask = capacity - 1;
+  cache->ttl = ttl;
+  return cache;
+}
+
+void dedup_cache_free(dedup_cache_t *cache) {
+  if (cache) {
+    free(cache->entries);
+    free(cache);
+  }
+}
+
+uint64_t dedup_key_seq(const char *topic, const char *seq) {
+  uint64_t hash = fnv1a(FNV64_OFFSET, topic, strlen(topic) + 1);
+  return finalize(fnv1a(hash, seq, strlen(seq)));
+}
+
+uint64_t dedup_key_message(const char *topic, const void *payload, int payloadlen) {
+  uint64_t hash = fnv1a(FNV64_OFFSET, topic, strlen(topic) + 1);
+  return finalize(fnv1a(hash, payload, payloadlen));
+}
+
+/* Returns true if `key` was already seen within the TTL, otherwise remembers it. Expired entries are never cleared,
+ * they are overwritten in place, so probe chains stay intact without tombstones. */
+bool dedup_cache_check(dedup_cache_t *cache, uint64_t key, uint32_t now) {
+  dedup_entry_t *entry, *victim = NULL;
+  uint32_t idx = (uint32_t)key & cache->mask;
+
+  for (int i = 0; i < DEDUP_MAX_PROBE; i++) {
+    entry = &cache->entries[(idx + i) & cache->mask];
+    if (entry->key == key) {
+      if (entry->expire > now) {
+        cache->hits++;
+        return true;
+      }
+      victim = entry;
+      break;
+    }
+    if (entry->key == 0) {
+      if (!victim || victim->expire > now) victim = entry;
+      break;
+    }
+    if (!victim || entry->expire < victim->expire) {
+      victim = entry;
+    }
+  }
+
+  if (victim->key && victim->key != key && victim->expire > now) {
+    cache->evictions++;
+  }
+  victim->key = key;
+  victim->expire = now + cache->ttl;
+  cache->misses++;
+  return false;
+}
+
+void dedup_cache_stats(const dedup_cache_t *cache, FILE *out) {
+  unsigned long total = cache->hits + cache->misses;
+
+  fprintf(out, "dedup: %lu checked, %lu duplicates (%.2f%%), %lu evicted\n", total, cache->hits,
+          total ? 100.0 * cache->hits / total : 0.0, cache->evictions);
+}
@@ -0,0 +1,36 @@
+#ifndef DEDUP_CACHE_H
+#define DEDUP_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define DEDUP_DEFAULT_CAPACITY 4096  // must be a power of two
+#define DEDUP_DEFAULT_TTL 30
+#define DEDUP_MAX_PROBE 16
+#define DEDUP_SEQ_PROPERTY "seq"  // MQTT v5 user property carrying the device sequence number
+
+/* 16 bytes per entry so four entries share a cache line. A key of 0 marks an empty slot. */
+typedef struct dedup_entry_s {
+  uint64_t key;
+  uint32_t expire;
+  uint32_t pad;
+} dedup_entry_t;
+
+typedef struct dedup_cache_s {
+  dedup_entry_t *entries;
+  uint32_t mask;
+  uint32_t ttl;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+} dedup_cache_t;
+
+dedup_cache_t *dedup_cache_new(uint32_t capacity, uint32_t ttl);
+void dedup_cache_free(dedup_cache_t *cache);
+uint64_t dedup_key_seq(const char *topic, const char *seq);
+uint64_t dedup_key_message(const char *topic, const void *payload, int payloadlen);
+bool dedup_cache_check(dedup_cache_t *cache, uint64_t key, uint32_t now);
+void dedup_cache_stats(const dedup_cache_t *cache, FILE *out);
+
+#endif
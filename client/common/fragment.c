@@ -0,0 +1,369 @@
+#include "fragment.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static uint16_t next_transfer_id;
+
+static void put_u16(unsigned char *buf, uint16_t val) {
+  buf[0] = val >> 8;
+  buf[1] = val & 0xff;
+}
+
+static void put_u32(unsigned char *buf, uint32_t val) {
+  buf[0] = val >> 24;
+  buf[1] = (val >> 16) & 0xff;
+  buf[2] = (val >> 8) & 0xff;
+  buf[3] = val & 0xff;
+}
+
+static uint16_t get_u16(const unsigned char *buf) { return (uint16_t)(buf[0] << 8 | buf[1]); }
+
+static uint32_t get_u32(const unsigned char *buf) {
+  return (uint32_t)buf[0] << 24 | (uint32_t)buf[1] << 16 | (uint32_t)buf[2] << 8 | buf[3];
+}
+
+// FNV-1a
+static uint32_t hash_str(const char *str) {
+  uint32_t hash = 2166136261u;
+
+  for (const char *c = str; *c; c++) {
+    hash ^= (unsigned char)*c;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+uint32_t frag_device_id(const char *client_id) {
+  // The pid is used for clients without an explicit id
+  char pid_buf[16];
+
+  if (!client_id) {
+    snprintf(pid_buf, sizeof(pid_buf), "%d", getpid());
+    client_id = pid_buf;
+  }
+  return hash_str(client_id);
+}
+
+int frag_header_encode(const frag_header_t *header, unsigned char *buf) {
+  buf[0] = FRAG_MAGIC;
+  buf[1] = header->flags;
+  put_u16(buf + 2, header->transfer_id);
+  put_u32(buf + 4, header->device_id);
+  put_u16(buf + 8, header->seq);
+  put_u16(buf + 10, header->count);
+  put_u32(buf + 12, header->total_len);
+  return FRAG_HEADER_LEN;
+}
+
+frag_retcode_t frag_header_decode(const unsigned char *buf, int len, frag_header_t *header) {
+  if (len < FRAG_HEADER_LEN || buf[0] != FRAG_MAGIC) {
+    return FRAG_NOT_FRAGMENT;
+  }
+  header->magic = buf[0];
+  header->flags = buf[1];
+  header->transfer_id = get_u16(buf + 2);
+  header->device_id = get_u32(buf + 4);
+  header->seq = get_u16(buf + 8);
+  header->count = get_u16(buf + 10);
+  header->total_len = get_u32(buf + 12);
+  if (header->count == 0 || header->count > FRAG_MAX_CHUNKS || header->seq >= header->count ||
+      header->total_len > FRAG_SLAB_SLOT_SIZE) {
+    return FRAG_MALFORMED;
+  }
+  return FRAG_INCOMPLETE;
+}
+
+rc_mosq_retcode_t frag_sender_init(frag_sender_t *sender, const char *topic, const void *payload, uint32_t len, int mtu,
+                                   int window, int qos, uint32_t device_id) {
+  memset(sender, 0, sizeof(frag_sender_t));
+  if (mtu <= FRAG_HEADER_LEN) {
+    fprintf(stderr, "Error: MTU %d is too small for fragmentation.\n", mtu);
+    return RC_MOS_MESSAGE_SETTING;
+  }
+  sender->chunk_len = mtu - FRAG_HEADER_LEN;
+  if (len == 0 || len > FRAG_SLAB_SLOT_SIZE || (len + sender->chunk_len - 1) / sender->chunk_len > FRAG_MAX_CHUNKS) {
+    fprintf(stderr, "Error: Message payload of %u bytes cannot be fragmented.\n", len);
+    return RC_MOS_MESSAGE_SETTING;
+  }
+
+  if (next_transfer_id == 0) {
+    next_transfer_id = (uint16_t)(getpid() ^ time(NULL));
+  }
+  sender->topic = strdup(topic);
+  sender->chunk_buf = malloc(mtu);
+  if (!sender->topic || !sender->chunk_buf) {
+    fprintf(stderr, "Error: Out of memory.\n");
+    frag_sender_cleanup(sender);
+    return RC_MOS_MESSAGE_SETTING;
+  }
+  sender->payload = payload;
+  sender->len = len;
+  sender->count = (len + sender->chunk_len - 1) / sender->chunk_len;
+  sender->transfer_id = next_transfer_id++;
+  sender->device_id = device_id;
+  sender->qos = qos;
+  sender->window = (window > 0 && window <= FRAG_MAX_WINDOW) ? window : FRAG_DEFAULT_WINDOW;
+  return RC_MOS_OK;
+}
+
+void frag_sender_cleanup(frag_sender_t *sender) {
+  free(sender->topic);
+  free(sender->chunk_buf);
+  sender->topic = NULL;
+  sender->chunk_buf = NULL;
+}
+
+static int find_pending(frag_sender_t *sender) {
+  for (int i = 0; i < sender->count; i++) {
+    int seq = (sender->next_seq + i) % sender->count;
+    if (sender->state[seq] == FRAG_CHUNK_PENDING) {
+      return seq;
+    }
+  }
+  return -1;
+}
+
+mosq_retcode_t frag_sender_pump(frag_sender_t *sender, struct mosquitto *mosq, mosq_config_t *cfg) {
+  mosq_retcode_t ret = MOSQ_ERR_SUCCESS;
+  frag_header_t header = {.device_id = sender->device_id, .transfer_id = sender->transfer_id, .count = sender->count};
+  int seq, mid, chunk_len;
+
+  header.total_len = sender->len;
+  while (sender->inflight < sender->window && (seq = find_pending(sender)) >= 0) {
+    header.seq = seq;
+    chunk_len = (seq == sender->count - 1) ? sender->len - seq * sender->chunk_len : sender->chunk_len;
+    frag_header_encode(&header, sender->chunk_buf);
+    memcpy(sender->chunk_buf + FRAG_HEADER_LEN, sender->payload + seq * sender->chunk_len, chunk_len);
+
+    ret = mosquitto_publish_v5(mosq, &mid, sender->topic, FRAG_HEADER_LEN + chunk_len, sender->chunk_buf, sender->qos,
+                               false, cfg->property_config->publish_props);
+    if (ret) {
+      return ret;
+    }
+    sender->state[seq] = FRAG_CHUNK_INFLIGHT;
+    sender->inflight_mid[sender->inflight] = mid;
+    sender->inflight_seq[sender->inflight] = seq;
+    sender->inflight++;
+    sender->next_seq = (seq + 1) % sender->count;
+  }
+  return ret;
+}
+
+bool frag_sender_on_publish(frag_sender_t *sender, int mid) {
+  for (int i = 0; i < sender->inflight; i++) {
+    if (sender->inflight_mid[i] == mid) {
+      sender->state[sender->inflight_seq[i]] = FRAG_CHUNK_DONE;
+      sender->done++;
+      sender->inflight--;
+      sender->inflight_mid[i] = sender->inflight_mid[sender->inflight];
+      sender->inflight_seq[i] = sender->inflight_seq[sender->inflight];
+      return true;
+    }
+  }
+  return false;
+}
+
+int frag_sender_on_nack(frag_sender_t *sender, const void *nack, int nack_len) {
+  const unsigned char *buf = nack;
+  int missing, marked = 0;
+  uint16_t seq;
+
+  if (nack_len < FRAG_NACK_HEADER_LEN || buf[0] != FRAG_NACK_MAGIC || get_u16(buf + 2) != sender->transfer_id ||
+      get_u32(buf + 4) != sender->device_id) {
+    return 0;
+  }
+  missing = get_u16(buf + 8);
+  if (nack_len < FRAG_NACK_HEADER_LEN + missing * 2) {
+    return 0;
+  }
+  for (int i = 0; i < missing; i++) {
+    seq = get_u16(buf + FRAG_NACK_HEADER_LEN + i * 2);
+    if (seq < sender->count && sender->state[seq] == FRAG_CHUNK_DONE) {
+      sender->state[seq] = FRAG_CHUNK_PENDING;
+      sender->done--;
+      marked++;
+    }
+  }
+  sender->retransmits += marked;
+  return marked;
+}
+
+bool frag_sender_done(const frag_sender_t *sender) { return sender->done == sender->count; }
+
+frag_reasm_t *frag_reasm_new(int timeout) {
+  frag_reasm_t *reasm = calloc(1, sizeof(frag_reasm_t));
+  if (!reasm) {
+    return NULL;
+  }
+  reasm->slab = malloc((size_t)FRAG_SLAB_SLOTS * FRAG_SLAB_SLOT_SIZE);
+  if (!reasm->slab) {
+    free(reasm);
+    return NULL;
+  }
+  for (int i = 0; i < FRAG_SLAB_SLOTS; i++) {
+    reasm->slots[i].data = reasm->slab + (size_t)i * FRAG_SLAB_SLOT_SIZE;
+  }
+  reasm->timeout = timeout > 0 ? timeout : FRAG_TIMEOUT_SEC;
+  return reasm;
+}
+
+void frag_reasm_free(frag_reasm_t *reasm) {
+  if (reasm) {
+    free(reasm->slab);
+    free(reasm);
+  }
+}
+
+static int find_slot(frag_reasm_t *reasm, const frag_header_t *header) {
+  for (int i = 0; i < FRAG_SLAB_SLOTS; i++) {
+    frag_slot_t *slot = &reasm->slots[i];
+    if (slot->used && slot->device_id == header->device_id && slot->transfer_id == header->transfer_id) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* A late retransmission of a released transfer would otherwise open a slot that never completes, get NACKed as a
+ * whole and be delivered a second time. */
+static bool recently_done(const frag_reasm_t *reasm, const char *topic, const frag_header_t *header, time_t now) {
+  uint32_t topic_hash = hash_str(topic);
+
+  for (int i = 0; i < FRAG_DONE_SLOTS; i++) {
+    const frag_done_t *done = &reasm->done[i];
+    if (done->done_at && now - done->done_at < 2 * reasm->timeout && done->device_id == header->device_id &&
+        done->transfer_id == header->transfer_id && done->topic_hash == topic_hash) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static int open_slot(frag_reasm_t *reasm, const char *topic, const frag_header_t *header, time_t now) {
+  int free_slot = -1;
+
+  for (int i = 0; i < FRAG_SLAB_SLOTS && free_slot < 0; i++) {
+    if (!reasm->slots[i].used) free_slot = i;
+  }
+  if (free_slot >= 0) {
+    frag_slot_t *slot = &reasm->slots[free_slot];
+    slot->used = true;
+    slot->device_id = header->device_id;
+    slot->transfer_id = header->transfer_id;
+    slot->count = header->count;
+    slot->total_len = header->total_len;
+    slot->received = 0;
+    slot->nack_sent = false;
+    slot->last_seen = now;
+    snprintf(slot->topic, sizeof(slot->topic), "%s", topic);
+    memset(slot->bitmap, 0, sizeof(slot->bitmap));
+  }
+  return free_slot;
+}
+
+frag_retcode_t frag_reasm_feed(frag_reasm_t *reasm, const char *topic, const void *payload, int len, time_t now,
+                               int *slot_id) {
+  const unsigned char *buf = payload;
+  frag_header_t header;
+  frag_retcode_t ret;
+  frag_slot_t *slot;
+  uint32_t offset, chunk_len;
+  int id;
+
+  ret = frag_header_decode(buf, len, &header);
+  if (ret != FRAG_INCOMPLETE) {
+    return ret;
+  }
+  id = find_slot(reasm, &header);
+  if (id < 0) {
+    if (recently_done(reasm, topic, &header, now)) {
+      reasm->late++;
+      return FRAG_DUPLICATE;
+    }
+    id = open_slot(reasm, topic, &header, now);
+  }
+  if (id < 0) {
+    reasm->dropped++;
+    return FRAG_NO_SLOT;
+  }
+  slot = &reasm->slots[id];
+  if (slot->count != header.count || slot->total_len != header.total_len) {
+    return FRAG_MALFORMED;
+  }
+  slot->last_seen = now;
+  if (slot->bitmap[header.seq / 8] & (1 << (header.seq % 8))) {
+    return FRAG_DUPLICATE;
+  }
+
+  // All chunks except the last one carry the same amount of data, the last one is aligned to the end of the payload
+  chunk_len = len - FRAG_HEADER_LEN;
+  offset = (header.seq == header.count - 1) ? header.total_len - chunk_len : header.seq * chunk_len;
+  if (chunk_len > header.total_len || offset + chunk_len > header.total_len) {
+    return FRAG_MALFORMED;
+  }
+  memcpy(slot->data + offset, buf + FRAG_HEADER_LEN, chunk_len);
+  slot->bitmap[header.seq / 8] |= 1 << (header.seq % 8);
+  slot->received++;
+  slot->nack_sent = false;
+  *slot_id = id;
+
+  if (slot->received == slot->count) {
+    reasm->completed++;
+    return FRAG_COMPLETE;
+  }
+  return FRAG_INCOMPLETE;
+}
+
+void frag_reasm_release(frag_reasm_t *reasm, int slot_id) {
+  frag_slot_t *slot;
+  frag_done_t *done;
+
+  if (slot_id >= 0 && slot_id < FRAG_SLAB_SLOTS && reasm->slots[slot_id].used) {
+    slot = &reasm->slots[slot_id];
+    done = &reasm->done[reasm->done_next];
+    reasm->done_next = (reasm->done_next + 1) % FRAG_DONE_SLOTS;
+    done->topic_hash = hash_str(slot->topic);
+    done->device_id = slot->device_id;
+    done->transfer_id = slot->transfer_id;
+    done->done_at = slot->last_seen;
+    slot->used = false;
+  }
+}
+
+static int encode_nack(const frag_slot_t *slot, unsigned char *buf, int max_missing) {
+  int missing = 0;
+
+  buf[0] = FRAG_NACK_MAGIC;
+  buf[1] = 0;
+  put_u16(buf + 2, slot->transfer_id);
+  put_u32(buf + 4, slot->device_id);
+  for (int seq = 0; seq < slot->count && missing < max_missing; seq++) {
+    if (!(slot->bitmap[seq / 8] & (1 << (seq % 8)))) {
+      put_u16(buf + FRAG_NACK_HEADER_LEN + missing * 2, seq);
+      missing++;
+    }
+  }
+  put_u16(buf + 8, missing);
+  return FRAG_NACK_HEADER_LEN + missing * 2;
+}
+
+void frag_reasm_gc(frag_reasm_t *reasm, time_t now, frag_nack_func_t nack_func, void *userdata) {
+  unsigned char nack[FRAG_NACK_HEADER_LEN + FRAG_MAX_CHUNKS * 2];
+  int nack_len;
+
+  for (int i = 0; i < FRAG_SLAB_SLOTS; i++) {
+    frag_slot_t *slot = &reasm->slots[i];
+    if (!slot->used || slot->received == slot->count) continue;
+
+    if (now - slot->last_seen >= reasm->timeout) {
+      slot->used = false;
+      reasm->expired++;
+    } else if (!slot->nack_sent && now - slot->last_seen >= reasm->timeout / 2 && nack_func) {
+      // Ask the sender once for the missing chunks before giving up the transfer
+      nack_len = encode_nack(slot, nack, FRAG_MAX_CHUNKS);
+      nack_func(userdata, slot->topic, nack, nack_len);
+      slot->nack_sent = true;
+    }
+  }
+}
@@ -0,0 +1,126 @@
+#ifndef FRAGMENT_H
+#define FRAGMENT_H
+
+#include <mosquitto.h>
+#include <stdint.h>
+#include <time.h>
+#include "client_common.h"
+
+/* Every chunk starts with a fixed header, all fields are big-endian:
+ * magic(1) flags(1) transfer_id(2) device_id(4) seq(2) count(2) total_len(4)
+ */
+#define FRAG_MAGIC 0xF7
+#define FRAG_NACK_MAGIC 0xF8
+#define FRAG_HEADER_LEN 16
+#define FRAG_NACK_HEADER_LEN 10
+
+#define FRAG_DEFAULT_MTU 256  // AT-command payload limit of the modem we are using
+#define FRAG_MAX_CHUNKS 1024
+#define FRAG_MAX_WINDOW 32
+#define FRAG_DEFAULT_WINDOW 8
+#define FRAG_SLAB_SLOTS 32
+#define FRAG_SLAB_SLOT_SIZE (64 * 1024)
+#define FRAG_TIMEOUT_SEC 30
+#define FRAG_NACK_SUFFIX "/nack"
+#define FRAG_MAX_TOPIC_LEN 128
+#define FRAG_DONE_SLOTS 64  // completed transfers remembered so late chunks of them are not taken for a new one
+
+typedef enum frag_retcode_s {
+  FRAG_NOT_FRAGMENT,
+  FRAG_INCOMPLETE,
+  FRAG_COMPLETE,
+  FRAG_DUPLICATE,
+  FRAG_NO_SLOT,
+  FRAG_MALFORMED,
+} frag_retcode_t;
+
+typedef enum frag_chunk_state_s { FRAG_CHUNK_PENDING, FRAG_CHUNK_INFLIGHT, FRAG_CHUNK_DONE } frag_chunk_state_t;
+
+typedef struct frag_header_s {
+  uint8_t magic;
+  uint8_t flags;
+  uint16_t transfer_id;
+  uint32_t device_id;
+  uint16_t seq;
+  uint16_t count;
+  uint32_t total_len;
+} frag_header_t;
+
+/* Sender side. The payload is borrowed, it must stay valid until the transfer is done. */
+typedef struct frag_sender_s {
+  char *topic;
+  const unsigned char *payload;
+  uint32_t len;
+  int chunk_len;
+  uint16_t count;
+  uint16_t transfer_id;
+  uint32_t device_id;
+  int qos;
+  int window;
+  int inflight;
+  int done;
+  int retransmits;
+  uint16_t next_seq;
+  int inflight_mid[FRAG_MAX_WINDOW];
+  uint16_t inflight_seq[FRAG_MAX_WINDOW];
+  uint8_t state[FRAG_MAX_CHUNKS];
+  unsigned char *chunk_buf;
+} frag_sender_t;
+
+/* Receiver side. All transfers share one slab which is allocated once when the reassembler is created. */
+typedef struct frag_slot_s {
+  bool used;
+  uint32_t device_id;
+  uint16_t transfer_id;
+  uint16_t count;
+  uint16_t received;
+  uint32_t total_len;
+  time_t last_seen;
+  bool nack_sent;
+  char topic[FRAG_MAX_TOPIC_LEN];
+  uint8_t bitmap[FRAG_MAX_CHUNKS / 8];
+  unsigned char *data;
+} frag_slot_t;
+
+/* A transfer that was reassembled and released, kept for twice the timeout or until FRAG_DONE_SLOTS newer ones. */
+typedef struct frag_done_s {
+  uint32_t topic_hash;
+  uint32_t device_id;
+  uint16_t transfer_id;
+  time_t done_at;
+} frag_done_t;
+
+typedef struct frag_reasm_s {
+  frag_slot_t slots[FRAG_SLAB_SLOTS];
+  unsigned char *slab;
+  int timeout;
+  frag_done_t done[FRAG_DONE_SLOTS];
+  int done_next;
+  unsigned long completed;
+  unsigned long expired;
+  unsigned long dropped;
+  unsigned long late;  // chunks of transfers already completed
+} frag_reasm_t;
+
+typedef void (*frag_nack_func_t)(void *userdata, const char *topic, const unsigned char *nack, int nack_len);
+
+uint32_t frag_device_id(const char *client_id);
+int frag_header_encode(const frag_header_t *header, unsigned char *buf);
+frag_retcode_t frag_header_decode(const unsigned char *buf, int len, frag_header_t *header);
+
+rc_mosq_retcode_t frag_sender_init(frag_sender_t *sender, const char *topic, const void *payload, uint32_t len, int mtu,
+                                   int window, int qos, uint32_t device_id);
+void frag_sender_cleanup(frag_sender_t *sender);
+mosq_retcode_t frag_sender_pump(frag_sender_t *sender, struct mosquitto *mosq, mosq_config_t *cfg);
+bool frag_sender_on_publish(frag_sender_t *sender, int mid);
+int frag_sender_on_nack(frag_sender_t *sender, const void *nack, int nack_len);
+bool frag_sender_done(const frag_sender_t *sender);
+
+frag_reasm_t *frag_reasm_new(int timeout);
+void frag_reasm_free(frag_reasm_t *reasm);
+frag_retcode_t frag_reasm_feed(frag_reasm_t *reasm, const char *topic, const void *payload, int len, time_t now,
+                               int *slot_id);
+void frag_reasm_release(frag_reasm_t *reasm, int slot_id);
+void frag_reasm_gc(frag_reasm_t *reasm, time_t now, frag_nack_func_t nack_func, void *userdata);
+
+#endif
@@ -0,0 +1,180 @@
+#include "hex.h"
+#include <stdint.h>
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+static int active_isa = -1;
+
+// -1 for anything that is not a hex digit
+static const int8_t hex_values[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0,  1,  2,  3,  4,  5,  6,  7,  8,  9,
+    -1, -1, -1, -1, -1, -1, -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
+
+static const char hex_lower[] = "0123456789abcdef";
+static const char hex_upper[] = "0123456789ABCDEF";
+
+/* Selects the kernels, for benchmarks and tests. */
+simd_isa_t hex_set_isa(simd_isa_t isa) {
+  active_isa = simd_clamp_isa(isa);
+  return active_isa;
+}
+
+static simd_isa_t current_isa(void) {
+  if (active_isa < 0) active_isa = simd_best_isa();
+  return active_isa;
+}
+
+static void encode_scalar(char *out, const unsigned char *in, size_t len, bool upper) {
+  const char *digits = upper ? hex_upper : hex_lower;
+
+  for (size_t i = 0; i < len; i++) {
+    out[2 * i] = digits[in[i] >> 4];
+    out[2 * i + 1] = digits[in[i] & 0x0f];
+  }
+}
+
+static long decode_scalar(unsigned char *out, const char *in, size_t len) {
+  int hi, lo;
+
+  for (size_t i = 0; i < len; i += 2) {
+    hi = hex_values[(unsigned char)in[i]];
+    lo = hex_values[(unsigned char)in[i + 1]];
+    if ((hi | lo) < 0) return -1;
+    out[i / 2] = hi << 4 | lo;
+  }
+  return len / 2;
+}
+
+#ifdef SIMD_X86
+/* Nibble n becomes '0' + n, plus the distance from '9' + 1 to 'a' (or 'A') when n > 9. */
+static void encode_sse2(char *out, const unsigned char *in, size_t len, bool upper) {
+  const __m128i low_nibble = _mm_set1_epi8(0x0f), nine = _mm_set1_epi8(9), zero = _mm_set1_epi8('0');
+  const __m128i letter_gap = _mm_set1_epi8(upper ? 'A' - '9' - 1 : 'a' - '9' - 1);
+  size_t i = 0;
+
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), low_nibble), lo = _mm_and_si128(v, low_nibble);
+    __m128i first = _mm_unpacklo_epi8(hi, lo), second = _mm_unpackhi_epi8(hi, lo);
+    first = _mm_add_epi8(_mm_add_epi8(first, zero), _mm_and_si128(_mm_cmpgt_epi8(first, nine), letter_gap));
+    second = _mm_add_epi8(_mm_add_epi8(second, zero), _mm_and_si128(_mm_cmpgt_epi8(second, nine), letter_gap));
+    _mm_storeu_si128((__m128i *)(out + 2 * i), first);
+    _mm_storeu_si128((__m128i *)(out + 2 * i + 16), second);
+  }
+  encode_scalar(out + 2 * i, in + i, len - i, upper);
+}
+
+/* Digits become 0-9 and letters of either case 10-15, any other byte leaves a lane out of the valid mask. Adjacent
+ * nibbles are joined in 16-bit lanes and packed down to bytes. */
+static long decode_sse2(unsigned char *out, const char *in, size_t len) {
+  const __m128i zero = _mm_set1_epi8('0'), nine = _mm_set1_epi8(9), case_bit = _mm_set1_epi8(0x20);
+  const __m128i a = _mm_set1_epi8('a'), five = _mm_set1_epi8(5), ten = _mm_set1_epi8(10);
+  const __m128i low_byte = _mm_set1_epi16(0x00ff);
+  __m128i packed[2];
+  size_t i = 0;
+
+  for (; i + 32 <= len; i += 32) {
+    for (int k = 0; k < 2; k++) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(in + i + 16 * k));
+      __m128i digit = _mm_sub_epi8(v, zero), letter = _mm_sub_epi8(_mm_or_si128(v, case_bit), a);
+      __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, nine), digit);
+      __m128i is_letter = _mm_cmpeq_epi8(_mm_min_epu8(letter, five), letter);
+      __m128i value;
+      if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)) != 0xffff) return -1;
+      value = _mm_or_si128(_mm_and_si128(is_digit, digit), _mm_and_si128(is_letter, _mm_add_epi8(letter, ten)));
+      // Little endian: the first digit of each pair is the low byte of the lane
+      packed[k] = _mm_and_si128(_mm_or_si128(_mm_slli_epi16(value, 4), _mm_srli_epi16(value, 8)), low_byte);
+    }
+    // Both loads are done before the store, so decoding in place works
+    _mm_storeu_si128((__m128i *)(out + i / 2), _mm_packus_epi16(packed[0], packed[1]));
+  }
+  return decode_scalar(out + i / 2, in + i, len - i) < 0 ? -1 : (long)(len / 2);
+}
+
+__attribute__((target("avx2"))) static void encode_avx2(char *out, const unsigned char *in, size_t len, bool upper) {
+  const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+  const __m256i digits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(upper ? hex_upper : hex_lower)));
+  size_t i = 0;
+
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+    __m256i hi = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibble));
+    __m256i lo = _mm256_shuffle_epi8(digits, _mm256_and_si256(v, low_nibble));
+    // The unpacks work per 128-bit lane, the permutes put the four quarters back in order
+    __m256i first = _mm256_unpacklo_epi8(hi, lo), second = _mm256_unpackhi_epi8(hi, lo);
+    _mm256_storeu_si256((__m256i *)(out + 2 * i), _mm256_permute2x128_si256(first, second, 0x20));
+    _mm256_storeu_si256((__m256i *)(out + 2 * i + 32), _mm256_permute2x128_si256(first, second, 0x31));
+  }
+  // GCC leaves out the vzeroupper on this tail call, legacy SSE code after it would pay the state transition
+  _mm256_zeroupper();
+  encode_sse2(out + 2 * i, in + i, len - i, upper);
+}
+
+__attribute__((target("avx2"))) static long decode_avx2(unsigned char *out, const char *in, size_t len) {
+  const __m256i zero = _mm256_set1_epi8('0'), nine = _mm256_set1_epi8(9), case_bit = _mm256_set1_epi8(0x20);
+  const __m256i a = _mm256_set1_epi8('a'), five = _mm256_set1_epi8(5), ten = _mm256_set1_epi8(10);
+  const __m256i weights = _mm256_set1_epi16(0x0110);  // 16 for the first digit of a pair, 1 for the second
+  __m256i packed[2];
+  size_t i = 0;
+
+  for (; i + 64 <= len; i += 64) {
+    for (int k = 0; k < 2; k++) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(in + i + 32 * k));
+      __m256i digit = _mm256_sub_epi8(v, zero), letter = _mm256_sub_epi8(_mm256_or_si256(v, case_bit), a);
+      __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, nine), digit);
+      __m256i is_letter = _mm256_cmpeq_epi8(_mm256_min_epu8(letter, five), letter);
+      __m256i value;
+      if (_mm256_movemask_epi8(_mm256_or_si256(is_digit, is_letter)) != -1) return -1;
+      value = _mm256_or_si256(_mm256_and_si256(is_digit, digit),
+                              _mm256_and_si256(is_letter, _mm256_add_epi8(letter, ten)));
+      packed[k] = _mm256_maddubs_epi16(value, weights);
+    }
+    _mm256_storeu_si256((__m256i *)(out + i / 2),
+                        _mm256_permute4x64_epi64(_mm256_packus_epi16(packed[0], packed[1]), 0xd8));
+  }
+  _mm256_zeroupper();
+  return decode_sse2(out + i / 2, in + i, len - i) < 0 ? -1 : (long)(len / 2);
+}
+#endif
+
+/* Writes 2 * len characters, without a terminator. */
+void hex_encode(char *out, const unsigned char *in, size_t len, bool upper) {
+  switch (current_isa()) {
+#ifdef SIMD_X86
+    case SIMD_AVX2:
+      encode_avx2(out, in, len, upper);
+      break;
+    case SIMD_SSE2:
+      encode_sse2(out, in, len, upper);
+      break;
+#endif
+    default:
+      encode_scalar(out, in, len, upper);
+  }
+}
+
+/* Returns the number of bytes written, len / 2, or -1 when the input is not hex. `out` may be `in`, decoding in place
+ * never overwrites input that has not been read. */
+long hex_decode(unsigned char *out, const char *in, size_t len) {
+  if (len % 2) {
+    return -1;
+  }
+  switch (current_isa()) {
+#ifdef SIMD_X86
+    case SIMD_AVX2:
+      return decode_avx2(out, in, len);
+    case SIMD_SSE2:
+      return decode_sse2(out, in, len);
+#endif
+    default:
+      return decode_scalar(out, in, len);
+  }
+}
@@ -0,0 +1,16 @@
+#ifndef HEX_H
+#define HEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "simd.h"
+
+/* Hex as NB-IoT modems use it for binary data in URCs and socket reads. Decoding accepts both cases, since vendors
+ * differ, and rejects odd lengths and anything that is not a hex digit. */
+#define HEX_ENCODED_LEN(len) ((len)*2)
+
+simd_isa_t hex_set_isa(simd_isa_t isa);
+void hex_encode(char *out, const unsigned char *in, size_t len, bool upper);
+long hex_decode(unsigned char *out, const char *in, size_t len);
+
+#endif
@@ -0,0 +1,614 @@
+#include "json_index.h"
+#include <stdlib.h>
+#include <string.h>
+#include "simd.h"
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+typedef struct json_masks_s {
+  uint64_t quote;
+  uint64_t backslash;
+  uint64_t op;     // { } [ ] : ,
+  uint64_t space;  // the four JSON whitespace characters
+  uint64_t ctrl;   // below 0x20, never allowed inside strings
+} json_masks_t;
+
+static int active_isa = -1;
+
+/* Selects the kernels, for benchmarks and tests. */
+simd_isa_t json_set_isa(simd_isa_t isa) {
+  active_isa = simd_clamp_isa(isa);
+  return active_isa;
+}
+
+static simd_isa_t current_isa(void) {
+  if (active_isa < 0) active_isa = simd_best_isa();
+  return active_isa;
+}
+
+const char *json_strerror(json_retcode_t ret) {
+  static const char *messages[] = {"ok",          "malformed UTF-8",   "unterminated string", "malformed string",
+                                   "bad literal", "malformed structure", "nested too deep",   "out of memory"};
+  return messages[ret];
+}
+
+/* UTF-8 */
+
+/* Validates the sequence starting at buf[i], returns its length or 0. */
+static int utf8_sequence(const unsigned char *buf, size_t len, size_t i) {
+  unsigned char c = buf[i];
+  int n;
+
+  if (c < 0x80) return 1;
+  if (c >= 0xc2 && c <= 0xdf) {
+    n = 2;
+  } else if (c >= 0xe0 && c <= 0xef) {
+    n = 3;
+  } else if (c >= 0xf0 && c <= 0xf4) {
+    n = 4;
+  } else {
+    return 0;
+  }
+  if (i + n > len) return 0;
+  for (int k = 1; k < n; k++) {
+    if ((buf[i + k] & 0xc0) != 0x80) return 0;
+  }
+  // Overlong forms, UTF-16 surrogates and code points above U+10FFFF
+  if ((c == 0xe0 && buf[i + 1] < 0xa0) || (c == 0xed && buf[i + 1] >= 0xa0) || (c == 0xf0 && buf[i + 1] < 0x90) ||
+      (c == 0xf4 && buf[i + 1] >= 0x90)) {
+    return 0;
+  }
+  return n;
+}
+
+static bool utf8_valid_scalar(const unsigned char *buf, size_t len) {
+  size_t i = 0;
+  uint64_t word;
+  int n;
+
+  while (i < len) {
+    // Telemetry is mostly ASCII, skip it a word at a time
+    if (i + 8 <= len) {
+      memcpy(&word, buf + i, 8);
+      if (!(word & 0x8080808080808080ull)) {
+        i += 8;
+        continue;
+      }
+    }
+    n = utf8_sequence(buf, len, i);
+    if (!n) return false;
+    i += n;
+  }
+  return true;
+}
+
+#ifdef SIMD_X86
+static bool utf8_valid_sse2(const unsigned char *buf, size_t len) {
+  size_t i = 0, end;
+  int n;
+
+  while (i < len) {
+    if (i + 16 <= len && !_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(buf + i)))) {
+      i += 16;
+      continue;
+    }
+    // SSE2 has no byte shuffle for the lookup tables below, blocks with multi-byte sequences go through the scalar
+    // decoder, which stops on a sequence boundary
+    for (end = i + 16 < len ? i + 16 : len; i < end; i += n) {
+      n = utf8_sequence(buf, len, i);
+      if (!n) return false;
+    }
+  }
+  return true;
+}
+
+/* Keiser and Lemire, "Validating UTF-8 in less than one instruction per byte". Three table lookups on the high and low
+ * nibble of each byte and the one before it flag every invalid two byte combination, the third and fourth bytes of
+ * longer sequences are checked with saturating subtractions on the bytes two and three positions back. */
+#define TOO_SHORT 0x01
+#define TOO_LONG 0x02
+#define OVERLONG_3 0x04
+#define TOO_LARGE 0x08
+#define SURROGATE 0x10
+#define OVERLONG_2 0x20
+#define TOO_LARGE_1000 0x40
+#define OVERLONG_4 0x40
+#define TWO_CONTS 0x80
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define TABLE16(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+__attribute__((target("avx2"))) static inline __m256i prev_bytes(__m256i input, __m256i prev, int n) {
+  __m256i shifted = _mm256_permute2x128_si256(prev, input, 0x21);
+
+  switch (n) {
+    case 1:
+      return _mm256_alignr_epi8(input, shifted, 15);
+    case 2:
+      return _mm256_alignr_epi8(input, shifted, 14);
+    default:
+      return _mm256_alignr_epi8(input, shifted, 13);
+  }
+}
+
+__attribute__((target("avx2"))) static __m256i utf8_block_errors(__m256i input, __m256i prev_input) {
+  const __m256i byte_1_high_table =
+      TABLE16(TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, (char)TWO_CONTS,
+              (char)TWO_CONTS, (char)TWO_CONTS, (char)TWO_CONTS, TOO_SHORT | OVERLONG_2, TOO_SHORT,
+              TOO_SHORT | OVERLONG_3 | SURROGATE, TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+  const __m256i byte_1_low_table =
+      TABLE16((char)(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4), (char)(CARRY | OVERLONG_2), (char)CARRY,
+              (char)CARRY, (char)(CARRY | TOO_LARGE), (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+              (char)(CARRY | TOO_LARGE | TOO_LARGE_1000), (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+              (char)(CARRY | TOO_LARGE | TOO_LARGE_1000), (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+              (char)(CARRY | TOO_LARGE | TOO_LARGE_1000), (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+              (char)(CARRY | TOO_LARGE | TOO_LARGE_1000), (char)(CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE),
+              (char)(CARRY | TOO_LARGE | TOO_LARGE_1000), (char)(CARRY | TOO_LARGE | TOO_LARGE_1000));
+  const __m256i byte_2_high_table =
+      TABLE16(TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+              (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4),
+              (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE),
+              (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+              (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE), TOO_SHORT, TOO_SHORT, TOO_SHORT,
+              TOO_SHORT);
+  const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+  __m256i prev1 = prev_bytes(input, prev_input, 1);
+  __m256i byte_1_high =
+      _mm256_shuffle_epi8(byte_1_high_table, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low_nibble));
+  __m256i byte_1_low = _mm256_shuffle_epi8(byte_1_low_table, _mm256_and_si256(prev1, low_nibble));
+  __m256i byte_2_high =
+      _mm256_shuffle_epi8(byte_2_high_table, _mm256_and_si256(_mm256_srli_epi16(input, 4), low_nibble));
+  __m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+  // Only a lead byte 111_____ two back or 1111____ three back leaves the high bit set
+  __m256i third = _mm256_subs_epu8(prev_bytes(input, prev_input, 2), _mm256_set1_epi8((char)(0xe0 - 0x80)));
+  __m256i fourth = _mm256_subs_epu8(prev_bytes(input, prev_input, 3), _mm256_set1_epi8((char)(0xf0 - 0x80)));
+  __m256i must_continue = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+
+  return _mm256_xor_si256(must_continue, special);
+}
+
+__attribute__((target("avx2"))) static bool utf8_valid_avx2(const unsigned char *buf, size_t len) {
+  // A sequence cut off by the end of a block is flagged when the next block starts without its continuation bytes
+  const __m256i incomplete_max =
+      _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                       -1, -1, -1, -1, -1, (char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1));
+  __m256i error = _mm256_setzero_si256(), prev_input = _mm256_setzero_si256(), prev_incomplete = error, input;
+  unsigned char tail[32];
+  size_t i = 0;
+
+  // The last block is padded with zeros, so it always exists and ends every sequence
+  for (;;) {
+    if (i + 32 <= len) {
+      input = _mm256_loadu_si256((const __m256i *)(buf + i));
+    } else {
+      memset(tail, 0, sizeof(tail));
+      memcpy(tail, buf + i, len - i);
+      input = _mm256_loadu_si256((const __m256i *)tail);
+    }
+    if (!_mm256_movemask_epi8(input)) {
+      error = _mm256_or_si256(error, prev_incomplete);
+    } else {
+      error = _mm256_or_si256(error, utf8_block_errors(input, prev_input));
+      prev_incomplete = _mm256_subs_epu8(input, incomplete_max);
+    }
+    prev_input = input;
+    if (i + 32 > len) break;
+    i += 32;
+  }
+  return _mm256_testz_si256(error, error);
+}
+#endif
+
+bool utf8_valid(const unsigned char *buf, size_t len) {
+  switch (current_isa()) {
+#ifdef SIMD_X86
+    case SIMD_AVX2:
+      return utf8_valid_avx2(buf, len);
+    case SIMD_SSE2:
+      return utf8_valid_sse2(buf, len);
+#endif
+    default:
+      return utf8_valid_scalar(buf, len);
+  }
+}
+
+/* Stage 1: classification */
+
+static void classify_scalar(const unsigned char *block, json_masks_t *masks) {
+  memset(masks, 0, sizeof(json_masks_t));
+  for (int i = 0; i < 64; i++) {
+    uint64_t bit = 1ull << i;
+    switch (block[i]) {
+      case '"':
+        masks->quote |= bit;
+        break;
+      case '\\':
+        masks->backslash |= bit;
+        break;
+      case '{':
+      case '}':
+      case '[':
+      case ']':
+      case ':':
+      case ',':
+        masks->op |= bit;
+        break;
+      case ' ':
+      case '\t':
+      case '\n':
+      case '\r':
+        masks->space |= bit;
+        if (block[i] != ' ') masks->ctrl |= bit;
+        break;
+      default:
+        if (block[i] < 0x20) masks->ctrl |= bit;
+    }
+  }
+}
+
+#ifdef SIMD_X86
+static void classify_sse2(const unsigned char *block, json_masks_t *masks) {
+  const __m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\'), colon = _mm_set1_epi8(':');
+  const __m128i comma = _mm_set1_epi8(','), case_bit = _mm_set1_epi8(0x20), ctrl_max = _mm_set1_epi8(0x1f);
+  const __m128i open = _mm_set1_epi8('{'), close = _mm_set1_epi8('}'), space = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t'), newline = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+
+  memset(masks, 0, sizeof(json_masks_t));
+  for (int i = 0; i < 4; i++) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(block + i * 16));
+    // '[' and ']' differ from '{' and '}' only in bit 5
+    __m128i folded = _mm_or_si128(v, case_bit);
+    __m128i op = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(folded, open), _mm_cmpeq_epi8(folded, close)),
+                              _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+    __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+                              _mm_or_si128(_mm_cmpeq_epi8(v, newline), _mm_cmpeq_epi8(v, cr)));
+    masks->quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) << (i * 16);
+    masks->backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash)) << (i * 16);
+    masks->op |= (uint64_t)(uint16_t)_mm_movemask_epi8(op) << (i * 16);
+    masks->space |= (uint64_t)(uint16_t)_mm_movemask_epi8(ws) << (i * 16);
+    masks->ctrl |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, ctrl_max), ctrl_max))
+                   << (i * 16);
+  }
+}
+
+__attribute__((target("avx2"))) static void classify_avx2(const unsigned char *block, json_masks_t *masks) {
+  const __m256i quote = _mm256_set1_epi8('"'), backslash = _mm256_set1_epi8('\\'), colon = _mm256_set1_epi8(':');
+  const __m256i comma = _mm256_set1_epi8(','), case_bit = _mm256_set1_epi8(0x20), ctrl_max = _mm256_set1_epi8(0x1f);
+  const __m256i open = _mm256_set1_epi8('{'), close = _mm256_set1_epi8('}'), space = _mm256_set1_epi8(' ');
+  const __m256i tab = _mm256_set1_epi8('\t'), newline = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8('\r');
+
+  memset(masks, 0, sizeof(json_masks_t));
+  for (int i = 0; i < 2; i++) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(block + i * 32));
+    __m256i folded = _mm256_or_si256(v, case_bit);
+    __m256i op = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(folded, open), _mm256_cmpeq_epi8(folded, close)),
+                                 _mm256_or_si256(_mm256_cmpeq_epi8(v, colon), _mm256_cmpeq_epi8(v, comma)));
+    __m256i ws = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, tab)),
+                                 _mm256_or_si256(_mm256_cmpeq_epi8(v, newline), _mm256_cmpeq_epi8(v, cr)));
+    masks->quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)) << (i * 32);
+    masks->backslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, backslash)) << (i * 32);
+    masks->op |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << (i * 32);
+    masks->space |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ws) << (i * 32);
+    masks->ctrl |=
+        (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(v, ctrl_max), ctrl_max))
+        << (i * 32);
+  }
+}
+#endif
+
+/* Characters preceded by an odd number of backslashes. Escapes are rare in telemetry, so the backslashes are walked
+ * one by one instead of with the carry-add trick. */
+static uint64_t find_escaped(uint64_t backslash, uint64_t *prev_escaped) {
+  uint64_t escaped = *prev_escaped;
+  int p;
+
+  *prev_escaped = 0;
+  backslash &= ~escaped;
+  while (backslash) {
+    p = __builtin_ctzll(backslash);
+    backslash &= backslash - 1;
+    if (escaped >> p & 1) continue;
+    if (p == 63) {
+      *prev_escaped = 1;
+    } else {
+      escaped |= 1ull << (p + 1);
+    }
+  }
+  return escaped;
+}
+
+// Bit i is set when an odd number of quotes is at or below i, i.e. inside a string or on its opening quote
+static uint64_t prefix_xor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+/* Writes four positions per iteration whatever the bit count, the slots past the last bit are garbage that the next
+ * block overwrites. Fewer branches to mispredict than one iteration per bit. */
+static inline __attribute__((always_inline)) void push_positions(json_index_t *idx, uint64_t bits, uint32_t base) {
+  uint32_t *out = idx->pos + idx->count;
+
+  idx->count += __builtin_popcountll(bits);
+  while (bits) {
+    for (int k = 0; k < 4; k++) {
+      // Bit 63 keeps the count defined once the bits run out
+      out[k] = base + __builtin_ctzll(bits | 1ull << 63);
+      bits &= bits - 1;
+    }
+    out += 4;
+  }
+}
+
+static bool is_hex(unsigned char c) { return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f'); }
+
+// The character after a backslash at `p - 1`
+static bool valid_escape(const unsigned char *buf, size_t len, size_t p) {
+  if (p >= len) return false;
+  if (buf[p] == 'u') {
+    return p + 4 < len && is_hex(buf[p + 1]) && is_hex(buf[p + 2]) && is_hex(buf[p + 3]) && is_hex(buf[p + 4]);
+  }
+  return buf[p] && strchr("\"\\/bfnrt", buf[p]);
+}
+
+/* Shared by every kernel and inlined into each, so the AVX2 build also gets BMI and POPCNT for the bit loops. */
+static inline __attribute__((always_inline)) json_retcode_t find_structurals(
+    json_index_t *idx, const unsigned char *buf, size_t len, void (*classify)(const unsigned char *, json_masks_t *)) {
+  uint64_t prev_escaped = 0, prev_in_string = 0, prev_scalar = 0, escaped, quote, in_string, scalar, bits;
+  unsigned char tail[64];
+  const unsigned char *block;
+  json_masks_t masks;
+
+  for (size_t off = 0; off < len; off += 64) {
+    block = buf + off;
+    if (len - off < 64) {
+      // Spaces classify as nothing
+      memset(tail, ' ', sizeof(tail));
+      memcpy(tail, buf + off, len - off);
+      block = tail;
+    }
+    classify(block, &masks);
+    escaped = find_escaped(masks.backslash, &prev_escaped);
+    quote = masks.quote & ~escaped;
+    in_string = prefix_xor(quote) ^ prev_in_string;
+    prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+    if (masks.ctrl & in_string) {
+      return JSON_BAD_STRING;
+    }
+    for (bits = escaped; bits; bits &= bits - 1) {
+      if (!valid_escape(buf, len, off + __builtin_ctzll(bits))) return JSON_BAD_STRING;
+    }
+    // Numbers and literals get the position of their first byte, so the gaps between positions are whitespace only
+    scalar = ~(masks.op | masks.space | masks.quote | in_string);
+    bits = (masks.op & ~in_string) | quote | (scalar & ~(scalar << 1 | prev_scalar));
+    prev_scalar = scalar >> 63;
+    push_positions(idx, bits, off);
+  }
+  return prev_in_string ? JSON_UNCLOSED_STRING : JSON_OK;
+}
+
+static json_retcode_t find_structurals_scalar(json_index_t *idx, const unsigned char *buf, size_t len) {
+  return find_structurals(idx, buf, len, classify_scalar);
+}
+
+#ifdef SIMD_X86
+static json_retcode_t find_structurals_sse2(json_index_t *idx, const unsigned char *buf, size_t len) {
+  return find_structurals(idx, buf, len, classify_sse2);
+}
+
+__attribute__((target("avx2,bmi,bmi2,popcnt"))) static json_retcode_t find_structurals_avx2(json_index_t *idx,
+                                                                                          const unsigned char *buf,
+                                                                                          size_t len) {
+  return find_structurals(idx, buf, len, classify_avx2);
+}
+#endif
+
+/* Stage 2: grammar over the structural positions */
+
+static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+// true, false, null or a number, followed by whitespace only
+static bool valid_literal(const char *buf, size_t from, size_t to) {
+  const char *p = buf + from, *end = buf + to;
+
+  while (end > p && is_space(end[-1])) end--;
+  switch (*p) {
+    case 't':
+      return end - p == 4 && !memcmp(p, "true", 4);
+    case 'f':
+      return end - p == 5 && !memcmp(p, "false", 5);
+    case 'n':
+      return end - p == 4 && !memcmp(p, "null", 4);
+  }
+  if (*p == '-') p++;
+  if (p == end || !is_digit(*p)) return false;
+  if (*p++ != '0') {
+    while (p < end && is_digit(*p)) p++;
+  }
+  if (p < end && *p == '.') {
+    if (++p == end || !is_digit(*p)) return false;
+    while (p < end && is_digit(*p)) p++;
+  }
+  if (p < end && (*p | 0x20) == 'e') {
+    if (++p < end && (*p == '+' || *p == '-')) p++;
+    if (p == end || !is_digit(*p)) return false;
+    while (p < end && is_digit(*p)) p++;
+  }
+  return p == end;
+}
+
+/* One label per grammar state, so each has its own branches for the predictor to learn. */
+static json_retcode_t check_grammar(const json_index_t *idx) {
+  const char *buf = idx->buf;
+  const uint32_t *pos = idx->pos;
+  int count = idx->count, i = 0, depth = 0;
+  char stack[JSON_MAX_DEPTH], c;
+  size_t end;
+
+value:
+  if (i >= count) return JSON_BAD_STRUCTURE;
+  c = buf[pos[i]];
+  switch (c) {
+    case '{':
+    case '[':
+      if (depth == JSON_MAX_DEPTH) return JSON_TOO_DEEP;
+      stack[depth++] = c + 2;  // the matching '}' or ']'
+      if (++i < count && buf[pos[i]] == c + 2) {
+        i++;
+        depth--;
+        goto after_value;
+      }
+      if (c == '[') goto value;
+      goto key;
+    case '"':
+      // The next position is the closing quote, stage 1 already checked what is between them
+      i += 2;
+      goto after_value;
+    case '}':
+    case ']':
+    case ':':
+    case ',':
+      return JSON_BAD_STRUCTURE;
+    default:
+      // A number or literal runs up to the next position
+      end = i + 1 < count ? pos[i + 1] : idx->len;
+      if (!valid_literal(buf, pos[i], end)) return JSON_BAD_LITERAL;
+      i++;
+      goto after_value;
+  }
+
+key:
+  if (i + 2 >= count || buf[pos[i]] != '"' || buf[pos[i + 2]] != ':') return JSON_BAD_STRUCTURE;
+  i += 3;
+  goto value;
+
+after_value:
+  if (!depth) return i == count ? JSON_OK : JSON_BAD_STRUCTURE;
+  if (i >= count) return JSON_BAD_STRUCTURE;
+  c = buf[pos[i++]];
+  if (c == ',') {
+    if (stack[depth - 1] == '}') goto key;
+    goto value;
+  }
+  if (c != stack[depth - 1]) return JSON_BAD_STRUCTURE;
+  depth--;
+  goto after_value;
+}
+
+void json_index_free(json_index_t *idx) {
+  free(idx->pos);
+  memset(idx, 0, sizeof(json_index_t));
+}
+
+/* Validates `buf` as UTF-8 encoded JSON and fills `idx`, whose position array is reused between calls. */
+json_retcode_t json_index_build(json_index_t *idx, const char *buf, size_t len) {
+  json_retcode_t ret;
+
+  idx->buf = buf;
+  idx->len = len;
+  idx->count = 0;
+  if (len >= INT32_MAX / 2) {
+    return JSON_NOMEM;
+  }
+  if (!utf8_valid((const unsigned char *)buf, len)) {
+    return JSON_BAD_UTF8;
+  }
+  // At most one position per byte, plus what push_positions writes past the last one
+  if ((size_t)idx->capacity < len + 64) {
+    size_t capacity = idx->capacity ? idx->capacity : JSON_INITIAL_STRUCTURALS;
+    uint32_t *pos;
+    while (capacity < len + 64) capacity *= 2;
+    pos = realloc(idx->pos, capacity * sizeof(uint32_t));
+    if (!pos) return JSON_NOMEM;
+    idx->pos = pos;
+    idx->capacity = capacity;
+  }
+  switch (current_isa()) {
+#ifdef SIMD_X86
+    case SIMD_AVX2:
+      ret = find_structurals_avx2(idx, (const unsigned char *)buf, len);
+      break;
+    case SIMD_SSE2:
+      ret = find_structurals_sse2(idx, (const unsigned char *)buf, len);
+      break;
+#endif
+    default:
+      ret = find_structurals_scalar(idx, (const unsigned char *)buf, len);
+  }
+  return ret ? ret : check_grammar(idx);
+}
+
+/* Returns the position after the value that starts at position `i`. */
+static int skip_value(const json_index_t *idx, int i) {
+  int depth = 0;
+
+  do {
+    switch (idx->buf[idx->pos[i]]) {
+      case '"':
+        i++;
+        break;
+      case '{':
+      case '[':
+        depth++;
+        break;
+      case '}':
+      case ']':
+        depth--;
+        break;
+    }
+    i++;
+  } while (depth > 0);
+  return i;
+}
+
+/* Iterates the members of the top-level object of a validated index, `*cursor` starts at 0. Values come back as from
+ * json_field(), keys without their quotes. */
+bool json_next_field(const json_index_t *idx, int *cursor, const char **key, int *key_len, const char **value,
+                     int *value_len) {
+  const char *buf = idx->buf;
+  int i = *cursor ? *cursor : 1, next;
+  size_t from, to;
+
+  if (*cursor < 0 || idx->count < 2 || buf[idx->pos[0]] != '{') {
+    return false;
+  }
+  // Each member is: quote, quote, colon, value, then ',' or the closing brace
+  if (i + 2 >= idx->count || buf[idx->pos[i]] != '"') {
+    return false;
+  }
+  from = idx->pos[i + 3];
+  next = skip_value(idx, i + 3);
+  if (buf[from] == '"') {
+    to = idx->pos[i + 4];
+    from++;
+  } else if (buf[from] == '{' || buf[from] == '[') {
+    to = idx->pos[next - 1] + 1;
+  } else {
+    for (to = idx->pos[next]; is_space(buf[to - 1]);) to--;
+  }
+  *key = buf + idx->pos[i] + 1;
+  *key_len = idx->pos[i + 1] - idx->pos[i] - 1;
+  *value = buf + from;
+  *value_len = to - from;
+  *cursor = buf[idx->pos[next]] == ',' ? next + 1 : -1;
+  return true;
+}
+
+/* Looks up `key` in the top-level object of a validated index. Strings come back without their quotes and with
+ * escapes left as they are, objects and arrays including their brackets. */
+bool json_field(const json_index_t *idx, const char *key, const char **value, int *value_len) {
+  int cursor = 0, found_len, key_len = strlen(key);
+  const char *found;
+
+  while (json_next_field(idx, &cursor, &found, &found_len, value, value_len)) {
+    if (found_len == key_len && !memcmp(found, key, key_len)) return true;
+  }
+  return false;
+}
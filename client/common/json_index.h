@@ -0,0 +1,46 @@
+#ifndef JSON_INDEX_H
+#define JSON_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "simd.h"
+
+/* Two passes in the style of simdjson. The first classifies 64 bytes at a time into bitmasks (quotes, backslashes,
+ * brackets, ':' and ',', whitespace, control characters) and keeps the positions of the structural characters outside
+ * strings and of the first byte of every number and literal. The second walks only those positions to check the
+ * grammar, and field lookups later walk them again instead of the payload. Kernels are picked as in simd.h. */
+#define JSON_MAX_DEPTH 32
+#define JSON_INITIAL_STRUCTURALS 64
+
+typedef enum json_retcode_s {
+  JSON_OK,
+  JSON_BAD_UTF8,
+  JSON_UNCLOSED_STRING,
+  JSON_BAD_STRING,  // control character or unknown escape inside a string
+  JSON_BAD_LITERAL,
+  JSON_BAD_STRUCTURE,
+  JSON_TOO_DEEP,
+  JSON_NOMEM,
+} json_retcode_t;
+
+/* Offsets of every { } [ ] : , outside strings, of both quotes of every string and of the start of every number and
+ * literal, in payload order. The payload is borrowed and has to outlive the lookups. */
+typedef struct json_index_s {
+  const char *buf;
+  size_t len;
+  uint32_t *pos;
+  int count;
+  int capacity;
+} json_index_t;
+
+simd_isa_t json_set_isa(simd_isa_t isa);
+const char *json_strerror(json_retcode_t ret);
+bool utf8_valid(const unsigned char *buf, size_t len);
+void json_index_free(json_index_t *idx);
+json_retcode_t json_index_build(json_index_t *idx, const char *buf, size_t len);
+bool json_field(const json_index_t *idx, const char *key, const char **value, int *value_len);
+bool json_next_field(const json_index_t *idx, int *cursor, const char **key, int *key_len, const char **value,
+                     int *value_len);
+
+#endif
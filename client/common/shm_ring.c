@@ -0,0 +1,352 @@
+#include "shm_ring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SHM_RING_MAGIC 0x4d51524cu
+#define SHM_RING_HEADER_SIZE ((sizeof(shm_ring_header_t) + 63) & ~(size_t)63)
+
+static double now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static shm_slot_t *slot_at(const shm_ring_t *ring, uint64_t pos) {
+  return (shm_slot_t *)((char *)ring->hdr + SHM_RING_HEADER_SIZE +
+                        (pos & (ring->hdr->slots - 1)) * (size_t)ring->hdr->slot_size);
+}
+
+static void ring_path(char *buf, size_t size, const char *name) { snprintf(buf, size, "%s/%s", SHM_RING_DIR, name); }
+
+// Abstract namespace, so a crashed consumer leaves nothing behind
+static socklen_t socket_addr(struct sockaddr_un *addr, const char *name) {
+  memset(addr, 0, sizeof(struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+  snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "%s", name);
+  return offsetof(struct sockaddr_un, sun_path) + 1 + strlen(addr->sun_path + 1);
+}
+
+static bool consumer_alive(const shm_ring_header_t *hdr) {
+  pid_t pid = __atomic_load_n(&hdr->consumer, __ATOMIC_ACQUIRE);
+  return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+static void unmap(shm_ring_t *ring) {
+  if (ring->hdr) munmap(ring->hdr, ring->map_len);
+  if (ring->efd >= 0) close(ring->efd);
+  ring->hdr = NULL;
+  ring->efd = -1;
+}
+
+int shm_ring_create(shm_ring_t *ring, const char *name) {
+  struct sockaddr_un addr;
+  socklen_t addr_len;
+  char path[256];
+  int fd;
+
+  memset(ring, 0, sizeof(shm_ring_t));
+  ring->efd = ring->listen_fd = -1;
+  ring->consumer = true;
+  ring->name = strdup(name);
+  ring->map_len = SHM_RING_HEADER_SIZE + (size_t)SHM_RING_SLOTS * SHM_RING_SLOT_SIZE;
+  ring_path(path, sizeof(path), name);
+  if (!ring->name) {
+    goto error;
+  }
+  // The bound socket is the single-consumer lock, the kernel releases it when the consumer dies
+  ring->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  addr_len = socket_addr(&addr, name);
+  if (ring->listen_fd < 0 || bind(ring->listen_fd, (struct sockaddr *)&addr, addr_len)) {
+    if (errno == EADDRINUSE) {
+      fprintf(stderr, "Error: The local ring %s already has a consumer.\n", path);
+      shm_ring_close(ring);
+      return -1;
+    }
+    goto error;
+  }
+  // Only now is the file ours, producers still on the ring of a crashed consumer find out it is dead and attach here
+  unlink(path);
+  fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    goto error;
+  }
+  if (ftruncate(fd, ring->map_len)) {
+    close(fd);
+    unlink(path);
+    goto error;
+  }
+  ring->hdr = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (ring->hdr == MAP_FAILED) {
+    ring->hdr = NULL;
+    unlink(path);
+    goto error;
+  }
+  ring->hdr->slots = SHM_RING_SLOTS;
+  ring->hdr->slot_size = SHM_RING_SLOT_SIZE;
+  ring->hdr->consumer = getpid();
+  ring->hdr->sleeping = 1;
+  for (uint64_t i = 0; i < SHM_RING_SLOTS; i++) slot_at(ring, i)->seq = i;
+
+  ring->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (ring->efd < 0 || listen(ring->listen_fd, 16)) {
+    goto error;
+  }
+  // Set last, a producer mapping the file before sees no magic and tries again later
+  __atomic_store_n(&ring->hdr->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+  return 0;
+
+error:
+  fprintf(stderr, "Error: Unable to create the local ring %s: %s\n", path, strerror(errno));
+  shm_ring_close(ring);
+  return -1;
+}
+
+static int recv_fd(int sock) {
+  char byte, control[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = {&byte, 1};
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  int fd = -1;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1) return -1;
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+  }
+  return fd;
+}
+
+static void send_fd(int sock, int fd) {
+  char byte = 0, control[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = {&byte, 1};
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  (void)sendmsg(sock, &msg, MSG_NOSIGNAL);
+}
+
+/* Maps the consumer's ring and fetches its eventfd. */
+static int map_ring(shm_ring_t *ring) {
+  struct timeval timeout = {1, 0};
+  struct sockaddr_un addr;
+  socklen_t addr_len;
+  struct stat st;
+  char path[256];
+  int fd, sock;
+
+  ring_path(path, sizeof(path), ring->name);
+  fd = open(path, O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  if (fstat(fd, &st) || (size_t)st.st_size < SHM_RING_HEADER_SIZE) {
+    close(fd);
+    return -1;
+  }
+  ring->map_len = st.st_size;
+  ring->hdr = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (ring->hdr == MAP_FAILED) {
+    ring->hdr = NULL;
+    return -1;
+  }
+  if (__atomic_load_n(&ring->hdr->magic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC || !ring->hdr->slots ||
+      (ring->hdr->slots & (ring->hdr->slots - 1)) ||
+      SHM_RING_HEADER_SIZE + (size_t)ring->hdr->slots * ring->hdr->slot_size > ring->map_len ||
+      !consumer_alive(ring->hdr)) {
+    unmap(ring);
+    return -1;
+  }
+
+  sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  addr_len = socket_addr(&addr, ring->name);
+  // A consumer that is alive but stuck must not stall the producer
+  if (sock >= 0 && !setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) &&
+      !connect(sock, (struct sockaddr *)&addr, addr_len)) {
+    ring->efd = recv_fd(sock);
+  }
+  if (sock >= 0) close(sock);
+  if (ring->efd < 0) {
+    unmap(ring);
+    return -1;
+  }
+  ring->checked_ms = now_ms();
+  printf("Attached to the local ring %s of process %d.\n", path, (int)ring->hdr->consumer);
+  return 0;
+}
+
+/* Producer side. Returns -1 when there is no consumer yet, shm_ring_push() keeps trying to attach. */
+int shm_ring_attach(shm_ring_t *ring, const char *name) {
+  memset(ring, 0, sizeof(shm_ring_t));
+  ring->efd = ring->listen_fd = -1;
+  ring->name = strdup(name);
+  ring->attempt_ms = now_ms();
+  if (!ring->name) {
+    return -1;
+  }
+  return map_ring(ring);
+}
+
+void shm_ring_close(shm_ring_t *ring) {
+  char path[256];
+
+  if (ring->consumer && ring->hdr) {
+    __atomic_store_n(&ring->hdr->consumer, 0, __ATOMIC_RELEASE);
+    ring_path(path, sizeof(path), ring->name);
+    unlink(path);
+  }
+  unmap(ring);
+  if (ring->listen_fd >= 0) close(ring->listen_fd);
+  ring->listen_fd = -1;
+  free(ring->name);
+  ring->name = NULL;
+}
+
+/* Returns -1 when the message has to go through the broker. */
+int shm_ring_push(shm_ring_t *ring, const char *topic, const void *payload, int len) {
+  int topic_len = strlen(topic);
+  uint64_t pos, one = 1;
+  shm_slot_t *slot;
+  int64_t diff;
+  double now;
+
+  if (!ring->hdr) {
+    now = now_ms();
+    if (ring->consumer || now - ring->attempt_ms < SHM_RING_RETRY_MS) goto fallback;
+    ring->attempt_ms = now;
+    if (map_ring(ring)) goto fallback;
+  }
+  if (sizeof(shm_slot_t) + topic_len + 1 + len > ring->hdr->slot_size) {
+    goto fallback;
+  }
+  if (!ring->consumer) {
+    now = now_ms();
+    if (now - ring->checked_ms >= SHM_RING_CHECK_MS) {
+      ring->checked_ms = now;
+      if (!consumer_alive(ring->hdr)) {
+        fprintf(stderr, "Warning: The consumer of the local ring %s is gone.\n", ring->name);
+        unmap(ring);
+        ring->attempt_ms = now;
+        goto fallback;
+      }
+    }
+  }
+
+  pos = __atomic_load_n(&ring->hdr->head, __ATOMIC_RELAXED);
+  for (;;) {
+    slot = slot_at(ring, pos);
+    diff = (int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+    if (diff == 0) {
+      // On failure pos is reloaded with the head another producer moved on
+      if (__atomic_compare_exchange_n(&ring->hdr->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (diff < 0) {
+      goto fallback;  // full, the consumer has not freed the slot of the previous round
+    } else {
+      pos = __atomic_load_n(&ring->hdr->head, __ATOMIC_RELAXED);
+    }
+  }
+  slot->topic_len = topic_len;
+  slot->payload_len = len;
+  memcpy(slot->data, topic, topic_len + 1);
+  memcpy(slot->data + topic_len + 1, payload, len);
+  __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+  // Pairs with the fence in shm_ring_pop(): either the consumer sees the slot filled or we see it asleep
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&ring->hdr->sleeping, __ATOMIC_RELAXED)) {
+    (void)write(ring->efd, &one, sizeof(one));
+    ring->wakeups++;
+  }
+  ring->pushed++;
+  return 0;
+
+fallback:
+  ring->fallbacks++;
+  return -1;
+}
+
+/* Consumer side, after its eventfd polled readable or when the previous call returned SHM_RING_BATCH. Returns the
+ * number of messages passed to `recv`. */
+int shm_ring_pop(shm_ring_t *ring, shm_ring_recv_t recv, void *userdata) {
+  uint64_t tail = ring->hdr->tail, value;
+  uint32_t topic_len, payload_len;
+  shm_slot_t *slot;
+  int count = 0;
+
+  (void)read(ring->efd, &value, sizeof(value));
+  __atomic_store_n(&ring->hdr->sleeping, 0, __ATOMIC_RELAXED);
+  while (count < SHM_RING_BATCH) {
+    slot = slot_at(ring, tail);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != tail + 1) {
+      // Asks for a wakeup, then looks once more for a producer that filled the slot before it saw the flag
+      __atomic_store_n(&ring->hdr->sleeping, 1, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != tail + 1) break;
+      __atomic_store_n(&ring->hdr->sleeping, 0, __ATOMIC_RELAXED);
+    }
+    // Producers are other processes, lengths that would run past the slot skip the message
+    topic_len = slot->topic_len;
+    payload_len = slot->payload_len;
+    if (sizeof(shm_slot_t) + (uint64_t)topic_len + 1 + payload_len <= ring->hdr->slot_size &&
+        slot->data[topic_len] == '\0') {
+      recv(userdata, slot->data, slot->data + topic_len + 1, payload_len);
+    } else {
+      ring->errors++;
+    }
+    __atomic_store_n(&slot->seq, tail + ring->hdr->slots, __ATOMIC_RELEASE);
+    tail++;
+    count++;
+  }
+  __atomic_store_n(&ring->hdr->tail, tail, __ATOMIC_RELAXED);
+  ring->popped += count;
+  return count;
+}
+
+/* Hands the eventfd to every producer waiting on the socket, called when the listening socket polls readable. */
+void shm_ring_serve(shm_ring_t *ring) {
+  int sock;
+
+  while ((sock = accept(ring->listen_fd, NULL, NULL)) >= 0) {
+    send_fd(sock, ring->efd);
+    close(sock);
+  }
+}
+
+void shm_ring_stats(const shm_ring_t *ring, FILE *out) {
+  if (ring->consumer) {
+    fprintf(out, "local ring %s: %lu messages taken, %lu corrupt\n", ring->name, ring->popped, ring->errors);
+  } else {
+    fprintf(out, "local ring %s: %lu messages pushed, %lu through the broker instead, %lu wakeups\n", ring->name,
+            ring->pushed, ring->fallbacks, ring->wakeups);
+  }
+}
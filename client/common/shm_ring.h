@@ -0,0 +1,71 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/* Local transport between publishers and a TA consumer on the same host, so their messages skip the two TCP hops and
+ * the broker's copy. The consumer creates a ring of fixed slots in SHM_RING_DIR, which is what shm_open() would use,
+ * and producers in any process claim slots lock-free: a slot's sequence number says whether it is free for position
+ * p (p), filled (p + 1) or waiting for the consumer to come round again. The consumer sleeps on an eventfd, which
+ * producers only write while it says so. They get the eventfd from the consumer over a unix socket in the abstract
+ * namespace named after the ring, which also keeps a second consumer off the ring while the first is alive.
+ * A push fails, and the message goes through the broker instead, when the ring is full, the message does not fit a
+ * slot, or the consumer went away; producers attach again on their own once a consumer is back. Like QoS 0, what
+ * was in the ring when the consumer died is lost, and a producer dying between claiming and filling a slot stalls
+ * the ring until the consumer restarts. */
+#define SHM_RING_DIR "/dev/shm"
+#define SHM_RING_DEFAULT_NAME "mqtt_local"
+#define SHM_RING_SLOTS 1024      // a power of two
+#define SHM_RING_SLOT_SIZE 2048  // slot header, topic and payload
+#define SHM_RING_BATCH 64        // messages taken per shm_ring_pop
+#define SHM_RING_CHECK_MS 1000   // how often producers check that the consumer is alive
+#define SHM_RING_RETRY_MS 5000   // and try to attach again when it is not
+
+typedef struct shm_ring_header_s {
+  uint32_t magic;
+  uint32_t slots;
+  uint32_t slot_size;
+  pid_t consumer;
+  uint64_t head __attribute__((aligned(64)));  // next position producers claim
+  uint64_t tail __attribute__((aligned(64)));  // next position the consumer takes
+  uint32_t sleeping;                           // the consumer wants an eventfd write
+} shm_ring_header_t;
+
+typedef struct shm_slot_s {
+  uint64_t seq;
+  uint32_t topic_len;
+  uint32_t payload_len;
+  char data[];  // topic, NUL, payload
+} shm_slot_t;
+
+/* Called for every message taken off the ring. The topic is NUL-terminated and both stay valid until it returns. */
+typedef void (*shm_ring_recv_t)(void *userdata, const char *topic, const void *payload, int len);
+
+typedef struct shm_ring_s {
+  char *name;
+  bool consumer;
+  shm_ring_header_t *hdr;  // NULL while a producer is not attached
+  size_t map_len;
+  int efd;
+  int listen_fd;  // consumer, hands the eventfd to producers
+  double checked_ms;
+  double attempt_ms;
+  unsigned long pushed;
+  unsigned long fallbacks;  // pushes that failed, the caller used the broker
+  unsigned long popped;
+  unsigned long errors;  // slots skipped for lengths that do not fit
+  unsigned long wakeups;
+} shm_ring_t;
+
+int shm_ring_create(shm_ring_t *ring, const char *name);
+int shm_ring_attach(shm_ring_t *ring, const char *name);
+void shm_ring_close(shm_ring_t *ring);
+int shm_ring_push(shm_ring_t *ring, const char *topic, const void *payload, int len);
+int shm_ring_pop(shm_ring_t *ring, shm_ring_recv_t recv, void *userdata);
+void shm_ring_serve(shm_ring_t *ring);
+void shm_ring_stats(const shm_ring_t *ring, FILE *out);
+
+#endif
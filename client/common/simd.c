@@ -0,0 +1,23 @@
+#include "simd.h"
+
+simd_isa_t simd_best_isa(void) {
+  static int best = -1;
+
+  if (best < 0) {
+    best = SIMD_SCALAR;
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) best = SIMD_SSE2;
+    if (__builtin_cpu_supports("avx2")) best = SIMD_AVX2;
+#endif
+  }
+  return best;
+}
+
+/* For benchmarks and tests that force a kernel: an ISA the CPU lacks falls back to the best one it has. */
+simd_isa_t simd_clamp_isa(simd_isa_t isa) { return isa < simd_best_isa() ? isa : simd_best_isa(); }
+
+const char *simd_isa_name(simd_isa_t isa) {
+  static const char *names[] = {"scalar", "sse2", "avx2"};
+  return names[isa];
+}
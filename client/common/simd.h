@@ -0,0 +1,16 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+/* Kernels for x86 are compiled with target attributes and picked at runtime, so one binary runs on any gateway. Other
+ * CPUs, the Pi included, get the portable C versions. */
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#endif
+
+typedef enum simd_isa_s { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2 } simd_isa_t;
+
+simd_isa_t simd_best_isa(void);
+simd_isa_t simd_clamp_isa(simd_isa_t isa);
+const char *simd_isa_name(simd_isa_t isa);
+
+#endif
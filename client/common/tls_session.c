@@ -0,0 +1,155 @@
+#include "tls_session.h"
+#ifdef WITH_TLS
+#include <fcntl.h>
+#include <openssl/pem.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *hs_names[TLS_HS_KINDS] = {"full", "resumed", "psk"};
+
+static double now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void load(tls_session_t *ts) {
+  FILE *fp = fopen(ts->path, "r");
+
+  if (!fp) return;
+  ts->session = PEM_read_SSL_SESSION(fp, NULL, NULL, NULL);
+  fclose(fp);
+  if (ts->session && !SSL_SESSION_is_resumable(ts->session)) {
+    SSL_SESSION_free(ts->session);
+    ts->session = NULL;
+  }
+}
+
+/* Written to a temporary file and renamed, so a restart never reads half a session. The file holds the session's
+ * master secret and is created readable by the owner only. */
+static void save(tls_session_t *ts) {
+  char tmp[4096];
+  FILE *fp;
+  int fd;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", ts->path);
+  fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0 || !(fp = fdopen(fd, "w"))) {
+    if (fd >= 0) close(fd);
+    fprintf(stderr, "Warning: Could not save the TLS session to %s.\n", ts->path);
+    return;
+  }
+  if (!PEM_write_SSL_SESSION(fp, ts->session) || fclose(fp) || rename(tmp, ts->path)) {
+    unlink(tmp);
+    fprintf(stderr, "Warning: Could not save the TLS session to %s.\n", ts->path);
+  }
+}
+
+static bool same_server(const SSL *ssl, const SSL_SESSION *session) {
+  const char *sni = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name), *cached = SSL_SESSION_get0_hostname(session);
+
+  return sni && cached ? !strcmp(sni, cached) : sni == cached;
+}
+
+static void info_callback(const SSL *ssl, int where, int ret) {
+  tls_session_t *ts = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+  tls_handshake_t kind;
+  tls_hs_stats_t *stats;
+
+  if (where & SSL_CB_HANDSHAKE_START) {
+    // A start without a done before it is a handshake that died without an alert
+    if (ts->start) ts->failed++;
+    ts->start = now_ms();
+    // The ClientHello is not built yet, the session set here is the one it offers
+    if (ts->session && SSL_SESSION_is_resumable(ts->session) && same_server(ssl, ts->session)) {
+      SSL_set_session((SSL *)ssl, ts->session);
+      ts->offered++;
+    }
+  } else if (where & SSL_CB_HANDSHAKE_DONE && ts->start) {
+    kind = ts->psk ? TLS_HS_PSK : SSL_session_reused((SSL *)ssl) ? TLS_HS_RESUMED : TLS_HS_FULL;
+    stats = &ts->stats[kind];
+    stats->count++;
+    stats->bytes += BIO_number_read(SSL_get_rbio(ssl)) + BIO_number_written(SSL_get_wbio(ssl));
+    stats->ms += now_ms() - ts->start;
+    ts->start = 0;
+  } else if (where & SSL_CB_ALERT && ts->start && !strcmp(SSL_alert_type_string(ret), "F")) {
+    ts->failed++;
+    ts->start = 0;
+  }
+}
+
+/* Called for every session the server hands out, with TLS 1.3 after the handshake when a ticket arrives. The newest
+ * one is kept. */
+static int new_session_callback(SSL *ssl, SSL_SESSION *session) {
+  tls_session_t *ts = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+  const char *sni = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+
+  // TLS 1.3 tickets do not record the server name on the client side, it is stored with them for same_server()
+  if (sni && !SSL_SESSION_get0_hostname(session)) SSL_SESSION_set1_hostname(session, sni);
+  if (ts->session) SSL_SESSION_free(ts->session);
+  ts->session = session;
+  if (ts->path) save(ts);
+  // Keeps the reference OpenSSL passed in
+  return 1;
+}
+
+/* `path` keeps the session across restarts, NULL only across reconnects. `psk` only decides how handshakes are
+ * counted, the key itself is set through mosquitto_tls_psk_set() as before. */
+tls_session_t *tls_session_new(const char *path, bool psk) {
+  tls_session_t *ts = calloc(1, sizeof(tls_session_t));
+
+  if (!ts) return NULL;
+  ts->psk = psk;
+  ts->ctx = SSL_CTX_new(TLS_client_method());
+  if (!ts->ctx || (path && !(ts->path = strdup(path)))) {
+    tls_session_free(ts);
+    return NULL;
+  }
+  SSL_CTX_set_app_data(ts->ctx, ts);
+  // Clients have no internal session store, the session only ever reaches the callback
+  SSL_CTX_set_session_cache_mode(ts->ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(ts->ctx, new_session_callback);
+  SSL_CTX_set_info_callback(ts->ctx, info_callback);
+  if (ts->path) load(ts);
+  return ts;
+}
+
+void tls_session_free(tls_session_t *ts) {
+  if (!ts) return;
+  if (ts->session) SSL_SESSION_free(ts->session);
+  SSL_CTX_free(ts->ctx);
+  free(ts->path);
+  free(ts);
+}
+
+/* libmosquitto applies its own settings (CA, verification, versions, ciphers, PSK) to the attached context on every
+ * connect, but only when a CA file, CA path or PSK was set as well. */
+int tls_session_attach(tls_session_t *ts, struct mosquitto *mosq) {
+  int ret = mosquitto_void_option(mosq, MOSQ_OPT_SSL_CTX, ts->ctx);
+
+  if (ret) return ret;
+  return mosquitto_int_option(mosq, MOSQ_OPT_SSL_CTX_WITH_DEFAULTS, 1);
+}
+
+/* The next handshake is a full one. */
+void tls_session_forget(tls_session_t *ts) {
+  if (ts->session) SSL_SESSION_free(ts->session);
+  ts->session = NULL;
+  if (ts->path) unlink(ts->path);
+}
+
+void tls_session_stats(const tls_session_t *ts, FILE *out) {
+  const tls_hs_stats_t *stats;
+
+  fprintf(out, "tls: %lu sessions offered, %lu handshakes failed\n", ts->offered, ts->failed);
+  for (int i = 0; i < TLS_HS_KINDS; i++) {
+    stats = &ts->stats[i];
+    if (!stats->count) continue;
+    fprintf(out, "  %-8s %5lu handshakes %7.0f B %8.2f ms on average\n", hs_names[i], stats->count,
+            (double)stats->bytes / stats->count, stats->ms / stats->count);
+  }
+}
+#endif
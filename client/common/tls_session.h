@@ -0,0 +1,46 @@
+#ifndef TLS_SESSION_H
+#define TLS_SESSION_H
+
+#ifdef WITH_TLS
+#include <mosquitto.h>
+#include <openssl/ssl.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Keeps the TLS session of a client across reconnects, and across restarts when given a file, so a reconnect over
+ * NB-IoT costs an abbreviated handshake instead of a certificate exchange. libmosquitto creates a fresh SSL object
+ * for every connection, so the client brings its own SSL_CTX (MOSQ_OPT_SSL_CTX, with libmosquitto's defaults still
+ * applied on top) and offers the cached session from the context's info callback, before the ClientHello is built.
+ * The same callback measures every handshake. */
+typedef enum tls_handshake_s {
+  TLS_HS_FULL,
+  TLS_HS_RESUMED,
+  TLS_HS_PSK,
+  TLS_HS_KINDS,
+} tls_handshake_t;
+
+typedef struct tls_hs_stats_s {
+  unsigned long count;
+  unsigned long bytes;  // both directions, ClientHello to the client's Finished
+  double ms;
+} tls_hs_stats_t;
+
+typedef struct tls_session_s {
+  SSL_CTX *ctx;
+  SSL_SESSION *session;  // only offered to the server name it came from
+  char *path;            // NULL keeps the session in memory only
+  bool psk;
+  double start;  // of the handshake in progress, 0 when none is
+  tls_hs_stats_t stats[TLS_HS_KINDS];
+  unsigned long offered;  // sessions offered, resumed ones are counted in stats
+  unsigned long failed;
+} tls_session_t;
+
+tls_session_t *tls_session_new(const char *path, bool psk);
+void tls_session_free(tls_session_t *ts);
+int tls_session_attach(tls_session_t *ts, struct mosquitto *mosq);
+void tls_session_forget(tls_session_t *ts);
+void tls_session_stats(const tls_session_t *ts, FILE *out);
+#endif
+
+#endif
@@ -0,0 +1,448 @@
+#include "topic_set.h"
+#include <stdlib.h>
+#include <string.h>
+#include "client_common.h"
+
+#define FNV64_OFFSET 14695981039346656037ull
+#define FNV64_PRIME 1099511628211ull
+#define INDEX_EMPTY -1
+#define INDEX_DELETED -2
+#define SUBSCRIBE_FILTER_OVERHEAD 3  // length prefix and subscription options
+#define UNSUBSCRIBE_FILTER_OVERHEAD 2
+
+static uint32_t hash_topic(const char *topic, int len) {
+  uint64_t hash = FNV64_OFFSET;
+  for (int i = 0; i < len; i++) {
+    hash ^= (unsigned char)topic[i];
+    hash *= FNV64_PRIME;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  return (uint32_t)hash;
+}
+
+static double elapsed_ms(const struct timespec *start) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void insert_slot(topic_set_t *set, uint32_t hash, int32_t n) {
+  uint32_t pos = (uint32_t)hash & set->index_mask;
+
+  while (set->index[pos] >= 0) pos = (pos + 1) & set->index_mask;
+  if (set->index[pos] == INDEX_DELETED) set->tombstones--;
+  set->index[pos] = n;
+}
+
+/* Returns the index slot holding `topic`, or -1. */
+static int32_t find_slot(const topic_set_t *set, const char *topic, int len, uint32_t hash) {
+  uint32_t pos = (uint32_t)hash & set->index_mask;
+  const topic_entry_t *entry;
+  int32_t n;
+
+  for (uint32_t i = 0; i <= set->index_mask; i++, pos = (pos + 1) & set->index_mask) {
+    n = set->index[pos];
+    if (n == INDEX_EMPTY) {
+      return -1;
+    }
+    if (n == INDEX_DELETED) {
+      continue;
+    }
+    entry = &set->entries[n];
+    if (entry->hash == hash && entry->len == len && !memcmp(set->pool + entry->offset, topic, len)) {
+      return pos;
+    }
+  }
+  return -1;
+}
+
+// Sized for at most half full, so growing the table always comes with a new index
+static int rebuild_index(topic_set_t *set) {
+  uint32_t index_size = 1;
+
+  while (index_size < (uint32_t)set->capacity * 2) index_size <<= 1;
+  if (index_size != set->index_mask + 1) {
+    int32_t *index = malloc(index_size * sizeof(int32_t));
+    if (!index) {
+      return -1;
+    }
+    free(set->index);
+    set->index = index;
+    set->index_mask = index_size - 1;
+  }
+  memset(set->index, 0xff, index_size * sizeof(int32_t));
+  set->tombstones = 0;
+  for (int n = 0; n < set->used; n++) {
+    if (set->entries[n].state != TOPIC_REMOVED) insert_slot(set, set->entries[n].hash, n);
+  }
+  return 0;
+}
+
+topic_set_t *topic_set_new(int max_topics) {
+  topic_set_t *set = calloc(1, sizeof(topic_set_t));
+
+  if (!set) {
+    return NULL;
+  }
+  set->max_topics = max_topics;
+  set->capacity = max_topics > 0 ? max_topics : TOPIC_SET_INITIAL_TOPICS;
+  set->pool_cap = TOPIC_SET_INITIAL_POOL;
+  set->chunk_topics = TOPIC_SET_CHUNK_TOPICS;
+  set->chunk_bytes = TOPIC_SET_CHUNK_BYTES;
+  set->entries = malloc(set->capacity * sizeof(topic_entry_t));
+  set->pool = malloc(set->pool_cap);
+  if (!set->entries || !set->pool || rebuild_index(set)) {
+    topic_set_free(set);
+    return NULL;
+  }
+  return set;
+}
+
+void topic_set_free(topic_set_t *set) {
+  if (!set) {
+    return;
+  }
+  free(set->entries);
+  free(set->index);
+  free(set->pool);
+  free(set);
+}
+
+/* Drops removed entries and their pool bytes. Entry numbers change, so only while no packet refers to them. */
+static void compact(topic_set_t *set) {
+  int live = 0;
+  size_t pool_len = 0;
+
+  for (int n = 0; n < set->used; n++) {
+    topic_entry_t entry = set->entries[n];
+    if (entry.state == TOPIC_REMOVED) continue;
+    memmove(set->pool + pool_len, set->pool + entry.offset, entry.len + 1);
+    entry.offset = pool_len;
+    pool_len += entry.len + 1;
+    set->entries[live++] = entry;
+  }
+  set->used = live;
+  set->pool_len = pool_len;
+  set->pool_garbage = 0;
+  set->next_sub = set->next_unsub = 0;
+  set->compactions++;
+  rebuild_index(set);
+}
+
+static int reserve(topic_set_t *set, size_t len) {
+  if (set->used == set->capacity && set->used > set->count && set->chunks_inflight == 0) {
+    compact(set);
+  }
+  if (set->used == set->capacity) {
+    topic_entry_t *entries;
+    if (set->max_topics > 0) {
+      return -1;
+    }
+    entries = realloc(set->entries, set->capacity * 2 * sizeof(topic_entry_t));
+    if (!entries) {
+      return -1;
+    }
+    set->entries = entries;
+    set->capacity *= 2;
+    if (rebuild_index(set)) {
+      return -1;
+    }
+  }
+  if (set->pool_len + len + 1 > set->pool_cap) {
+    size_t cap = set->pool_cap;
+    char *pool;
+    while (set->pool_len + len + 1 > cap) cap *= 2;
+    pool = realloc(set->pool, cap);
+    if (!pool) {
+      return -1;
+    }
+    set->pool = pool;
+    set->pool_cap = cap;
+  }
+  return 0;
+}
+
+static void delete_entry(topic_set_t *set, int32_t slot) {
+  topic_entry_t *entry = &set->entries[set->index[slot]];
+
+  entry->state = TOPIC_REMOVED;
+  set->pool_garbage += entry->len + 1;
+  set->index[slot] = INDEX_DELETED;
+  set->tombstones++;
+  if (set->tombstones > set->count) rebuild_index(set);
+}
+
+/* Returns 1 when the topic was added, 0 when it already is in the set and -1 when it does not fit. The SUBSCRIBE goes
+ * out with the next topic_set_flush. */
+int topic_set_add(topic_set_t *set, const char *topic) {
+  size_t len = strlen(topic);
+  uint32_t hash = hash_topic(topic, len);
+  topic_entry_t *entry;
+  int32_t slot;
+
+  if (len > UINT16_MAX) {
+    return -1;
+  }
+  slot = find_slot(set, topic, len, hash);
+  if (slot >= 0) {
+    entry = &set->entries[set->index[slot]];
+    if (entry->state == TOPIC_UNSUB_PENDING) {
+      entry->state = entry->mid ? TOPIC_SUBSCRIBING : TOPIC_ACTIVE;
+    } else if (entry->state == TOPIC_UNSUBSCRIBING) {
+      // Subscribed again after the broker has processed the UNSUBSCRIBE
+      entry->state = TOPIC_PENDING;
+      if (set->index[slot] < set->next_sub) set->next_sub = set->index[slot];
+    } else {
+      return 0;
+    }
+    set->count++;
+    return 1;
+  }
+
+  if (set->max_topics > 0 && set->count == set->max_topics) {
+    return -1;
+  }
+  if (reserve(set, len)) {
+    return -1;
+  }
+  entry = &set->entries[set->used];
+  entry->hash = hash;
+  entry->offset = set->pool_len;
+  entry->len = len;
+  entry->state = TOPIC_PENDING;
+  entry->mid = 0;
+  memcpy(set->pool + set->pool_len, topic, len + 1);
+  set->pool_len += len + 1;
+  insert_slot(set, hash, set->used++);
+  set->count++;
+  return 1;
+}
+
+static int remove_entry(topic_set_t *set, int32_t slot) {
+  int32_t n = set->index[slot];
+  topic_entry_t *entry = &set->entries[n];
+
+  switch (entry->state) {
+    case TOPIC_PENDING:
+    case TOPIC_REJECTED:
+      delete_entry(set, slot);
+      break;
+    case TOPIC_SUBSCRIBING:
+    case TOPIC_ACTIVE:
+      entry->state = TOPIC_UNSUB_PENDING;
+      if (n < set->next_unsub) set->next_unsub = n;
+      break;
+    default:
+      return 0;
+  }
+  set->count--;
+  return 1;
+}
+
+/* Returns 1 when the topic was in the set. An UNSUBSCRIBE is only sent if a SUBSCRIBE went out before. */
+int topic_set_remove(topic_set_t *set, const char *topic) {
+  size_t len = strlen(topic);
+  int32_t slot = len > UINT16_MAX ? -1 : find_slot(set, topic, len, hash_topic(topic, len));
+
+  return slot >= 0 ? remove_entry(set, slot) : 0;
+}
+
+void topic_set_remove_all(topic_set_t *set) {
+  for (int n = 0; n < set->used; n++) {
+    topic_entry_t *entry = &set->entries[n];
+    if (entry->state != TOPIC_REMOVED) {
+      remove_entry(set, find_slot(set, set->pool + entry->offset, entry->len, entry->hash));
+    }
+  }
+}
+
+bool topic_set_contains(const topic_set_t *set, const char *topic) {
+  size_t len = strlen(topic);
+  int32_t slot = len > UINT16_MAX ? -1 : find_slot(set, topic, len, hash_topic(topic, len));
+  int state = slot >= 0 ? set->entries[set->index[slot]].state : TOPIC_REMOVED;
+
+  return state != TOPIC_REMOVED && state != TOPIC_UNSUB_PENDING && state != TOPIC_UNSUBSCRIBING;
+}
+
+int topic_set_count(const topic_set_t *set) { return set->count; }
+
+/* Packets sent before the connection dropped are lost with it. Without a session the broker also forgot every
+ * subscription, all of them go out again in as few packets as the limits allow. */
+void topic_set_on_connect(topic_set_t *set, bool session_present) {
+  int resubscribe = 0;
+
+  memset(set->chunks, 0, sizeof(set->chunks));
+  set->chunks_inflight = 0;
+  for (int n = 0; n < set->used; n++) {
+    topic_entry_t *entry = &set->entries[n];
+    entry->mid = 0;
+    switch (entry->state) {
+      case TOPIC_SUBSCRIBING:
+        entry->state = TOPIC_PENDING;
+        break;
+      case TOPIC_UNSUBSCRIBING:
+        entry->state = TOPIC_UNSUB_PENDING;
+        break;
+      case TOPIC_ACTIVE:
+        if (!session_present) entry->state = TOPIC_PENDING;
+        break;
+      case TOPIC_REJECTED:
+        entry->state = TOPIC_PENDING;
+        break;
+    }
+    if (entry->state == TOPIC_UNSUB_PENDING && !session_present) {
+      delete_entry(set, find_slot(set, set->pool + entry->offset, entry->len, entry->hash));
+    }
+    if (entry->state == TOPIC_PENDING) resubscribe++;
+  }
+  set->next_sub = set->next_unsub = 0;
+  set->resub_pending = resubscribe;
+  if (resubscribe) {
+    set->resubscribes++;
+    clock_gettime(CLOCK_MONOTONIC, &set->resub_started);
+  }
+}
+
+static int send_chunks(topic_set_t *set, struct mosquitto *mosq, mosq_config_t *cfg, bool unsub) {
+  int *cursor = unsub ? &set->next_unsub : &set->next_sub;
+  uint8_t want = unsub ? TOPIC_UNSUB_PENDING : TOPIC_PENDING;
+  int overhead = unsub ? UNSUBSCRIBE_FILTER_OVERHEAD : SUBSCRIBE_FILTER_OVERHEAD;
+  char *filters[TOPIC_SET_CHUNK_TOPICS];
+  int limit = set->chunk_topics < TOPIC_SET_CHUNK_TOPICS ? set->chunk_topics : TOPIC_SET_CHUNK_TOPICS;
+  int n, bytes, first, last, i, mid, ret, sent = 0;
+  topic_chunk_t *chunk;
+
+  while (set->chunks_inflight < TOPIC_SET_MAX_CHUNKS) {
+    n = bytes = 0;
+    first = last = -1;
+    for (i = *cursor; i < set->used && n < limit; i++) {
+      topic_entry_t *entry = &set->entries[i];
+      // A topic removed or re-added while its previous packet is unacknowledged waits for that ack
+      if (entry->state != want || entry->mid) continue;
+      if (n > 0 && bytes + entry->len + overhead > set->chunk_bytes) break;
+      if (first < 0) first = i;
+      last = i;
+      filters[n++] = set->pool + entry->offset;
+      bytes += entry->len + overhead;
+    }
+    if (n == 0) {
+      *cursor = set->used;
+      break;
+    }
+    if (unsub) {
+      ret = mosquitto_unsubscribe_multiple(mosq, &mid, n, filters, cfg->property_config->unsubscribe_props);
+    } else {
+      ret = mosquitto_subscribe_multiple(mosq, &mid, n, filters, cfg->general_config->qos, cfg->sub_config->sub_opts,
+                                         cfg->property_config->subscribe_props);
+    }
+    if (ret) {
+      *cursor = first;
+      return sent ? sent : -ret;
+    }
+    *cursor = i;
+
+    for (int k = first; k <= last; k++) {
+      if (set->entries[k].state != want || set->entries[k].mid) continue;
+      set->entries[k].state = unsub ? TOPIC_UNSUBSCRIBING : TOPIC_SUBSCRIBING;
+      set->entries[k].mid = mid;
+    }
+    for (chunk = set->chunks; chunk->mid; chunk++) {
+    }
+    chunk->mid = mid;
+    chunk->first = first;
+    chunk->last = last;
+    chunk->count = n;
+    set->chunks_inflight++;
+    set->packets++;
+    sent++;
+  }
+  return sent;
+}
+
+/* Sends what was added or removed since the last call, unsubscribes first so removing a topic and adding an
+ * overlapping one ends subscribed. At most TOPIC_SET_MAX_CHUNKS packets wait for their ack, the rest goes out from
+ * topic_set_on_ack. Returns the number of packets sent or a negated mosquitto error. */
+int topic_set_flush(topic_set_t *set, struct mosquitto *mosq, mosq_config_t *cfg) {
+  int unsub = send_chunks(set, mosq, cfg, true);
+  int sub;
+
+  if (unsub < 0) {
+    return unsub;
+  }
+  sub = send_chunks(set, mosq, cfg, false);
+  return sub < 0 ? sub : unsub + sub;
+}
+
+bool topic_set_idle(const topic_set_t *set) {
+  if (set->chunks_inflight > 0) {
+    return false;
+  }
+  for (int n = set->next_sub < set->next_unsub ? set->next_sub : set->next_unsub; n < set->used; n++) {
+    if (set->entries[n].state == TOPIC_PENDING || set->entries[n].state == TOPIC_UNSUB_PENDING) return false;
+  }
+  return true;
+}
+
+/* Matches a SUBACK (`granted_qos` set) or UNSUBACK (`granted_qos` NULL) to its packet. Returns false for packets the
+ * set did not send. */
+bool topic_set_on_ack(topic_set_t *set, int mid, int qos_count, const int *granted_qos) {
+  topic_chunk_t *chunk = NULL;
+  int k = 0;
+
+  for (int i = 0; i < TOPIC_SET_MAX_CHUNKS && !chunk; i++) {
+    if (set->chunks[i].mid == mid) chunk = &set->chunks[i];
+  }
+  if (!chunk || !mid) {
+    return false;
+  }
+  for (int n = chunk->first; n <= chunk->last; n++) {
+    topic_entry_t *entry = &set->entries[n];
+    if (entry->mid != mid) continue;
+    entry->mid = 0;
+    if (granted_qos && entry->state == TOPIC_SUBSCRIBING) {
+      // 0x80 and above are failure reason codes, a short SUBACK counts as rejected
+      if (k >= qos_count || granted_qos[k] >= 0x80) {
+        entry->state = TOPIC_REJECTED;
+        set->rejected++;
+      } else {
+        entry->state = TOPIC_ACTIVE;
+        set->subscribed++;
+      }
+    } else if (!granted_qos && entry->state == TOPIC_UNSUBSCRIBING) {
+      delete_entry(set, find_slot(set, set->pool + entry->offset, entry->len, entry->hash));
+      set->unsubscribed++;
+    } else if (entry->state == TOPIC_PENDING && n < set->next_sub) {
+      set->next_sub = n;
+    } else if (entry->state == TOPIC_UNSUB_PENDING && n < set->next_unsub) {
+      set->next_unsub = n;
+    }
+    k++;
+  }
+  chunk->mid = 0;
+  set->chunks_inflight--;
+
+  if (set->chunks_inflight == 0) {
+    if (set->pool_garbage > set->pool_len / 2) compact(set);
+    if (set->resub_pending && topic_set_idle(set)) {
+      set->resub_ms = elapsed_ms(&set->resub_started);
+      set->resub_pending = 0;
+    }
+  }
+  return true;
+}
+
+size_t topic_set_memory(const topic_set_t *set) {
+  return sizeof(topic_set_t) + set->capacity * sizeof(topic_entry_t) + (set->index_mask + 1) * sizeof(int32_t) +
+         set->pool_cap;
+}
+
+void topic_set_stats(const topic_set_t *set, FILE *out) {
+  fprintf(out,
+          "topic set: %d topics in %zu bytes, %lu packets, %lu subscribed, %lu rejected, %lu unsubscribed, %lu "
+          "resubscribes (last %.1f ms), %lu compactions\n",
+          set->count, topic_set_memory(set), set->packets, set->subscribed, set->rejected, set->unsubscribed,
+          set->resubscribes, set->resub_ms, set->compactions);
+}
@@ -0,0 +1,92 @@
+#ifndef TOPIC_SET_H
+#define TOPIC_SET_H
+
+#include <mosquitto.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/* Broker limits on SUBSCRIBE differ (AWS IoT takes 8 filters per packet, others cap the packet size), both bounds are
+ * fields of the set so they can be lowered per deployment. */
+#define TOPIC_SET_CHUNK_TOPICS 128
+#define TOPIC_SET_CHUNK_BYTES 16384  // encoded filters per SUBSCRIBE/UNSUBSCRIBE, well below any max packet size
+#define TOPIC_SET_MAX_CHUNKS 16      // packets waiting for their SUBACK/UNSUBACK
+#define TOPIC_SET_INITIAL_TOPICS 16
+#define TOPIC_SET_INITIAL_POOL 1024
+
+typedef enum topic_state_s {
+  TOPIC_REMOVED,
+  TOPIC_PENDING,      // added, SUBSCRIBE not sent yet
+  TOPIC_SUBSCRIBING,  // waiting for the SUBACK
+  TOPIC_ACTIVE,
+  TOPIC_UNSUB_PENDING,
+  TOPIC_UNSUBSCRIBING,
+  TOPIC_REJECTED,  // the broker answered with a failure reason code, not retried until the next reconnect
+} topic_state_t;
+
+/* Topics live back to back in one string pool, an entry only holds the offset. Entries stay in insertion order so the
+ * filters of one packet are a contiguous range of the table. */
+typedef struct topic_entry_s {
+  uint32_t hash;
+  uint32_t offset;
+  uint16_t len;
+  uint8_t state;
+  int mid;
+} topic_entry_t;
+
+typedef struct topic_chunk_s {
+  int mid;  // 0 marks a free slot
+  int first;
+  int last;
+  int count;
+} topic_chunk_t;
+
+typedef struct topic_set_s {
+  topic_entry_t *entries;
+  int capacity;
+  int used;   // entries including removed ones
+  int count;  // live topics
+  int max_topics;
+  int32_t *index;  // open addressing over entry numbers
+  uint32_t index_mask;
+  int tombstones;
+  char *pool;
+  size_t pool_len;
+  size_t pool_cap;
+  size_t pool_garbage;
+  int next_sub;  // no entry below these is waiting to be sent
+  int next_unsub;
+  topic_chunk_t chunks[TOPIC_SET_MAX_CHUNKS];
+  int chunks_inflight;
+  int chunk_topics;
+  int chunk_bytes;
+  struct timespec resub_started;
+  double resub_ms;  // time from CONNACK until every topic was acknowledged
+  int resub_pending;
+  unsigned long packets;
+  unsigned long subscribed;
+  unsigned long unsubscribed;
+  unsigned long rejected;
+  unsigned long resubscribes;
+  unsigned long compactions;
+} topic_set_t;
+
+struct mosq_config_s;
+
+topic_set_t *topic_set_new(int max_topics);
+void topic_set_free(topic_set_t *set);
+int topic_set_add(topic_set_t *set, const char *topic);
+int topic_set_remove(topic_set_t *set, const char *topic);
+void topic_set_remove_all(topic_set_t *set);
+bool topic_set_contains(const topic_set_t *set, const char *topic);
+int topic_set_count(const topic_set_t *set);
+const char *topic_set_next(const topic_set_t *set, int *iter);
+void topic_set_on_connect(topic_set_t *set, bool session_present);
+int topic_set_flush(topic_set_t *set, struct mosquitto *mosq, struct mosq_config_s *cfg);
+bool topic_set_on_ack(topic_set_t *set, int mid, int qos_count, const int *granted_qos);
+bool topic_set_idle(const topic_set_t *set);
+size_t topic_set_memory(const topic_set_t *set);
+void topic_set_stats(const topic_set_t *set, FILE *out);
+
+#endif
@@ -0,0 +1,619 @@
+#include "ts_store.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FNV64_OFFSET 14695981039346656037ull
+#define FNV64_PRIME 1099511628211ull
+#define TS_DIR_NAME_LEN 48  // of the readable part of a device directory, the topic hash follows it
+#define TS_VARINT_MAX 10
+#define TS_NUMBER_LEN 64
+
+_Static_assert(sizeof(ts_segment_header_t) <= TS_HEADER_LEN, "segment header does not fit TS_HEADER_LEN");
+
+static uint64_t hash_key(const char *key, int key_len) {
+  uint64_t hash = FNV64_OFFSET;
+  for (int i = 0; i < key_len; i++) {
+    hash ^= (unsigned char)key[i];
+    hash *= FNV64_PRIME;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+int64_t ts_store_now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int put_varint(unsigned char *buf, int64_t val) {
+  uint64_t zigzag = ((uint64_t)val << 1) ^ (uint64_t)(val >> 63);
+  int n = 0;
+
+  while (zigzag >= 0x80) {
+    buf[n++] = (zigzag & 0x7f) | 0x80;
+    zigzag >>= 7;
+  }
+  buf[n++] = zigzag;
+  return n;
+}
+
+static int64_t get_varint(const unsigned char *buf, uint32_t *offset) {
+  uint64_t zigzag = 0;
+  int shift = 0;
+  unsigned char byte;
+
+  do {
+    byte = buf[(*offset)++];
+    zigzag |= (uint64_t)(byte & 0x7f) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  return (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+}
+
+static void segment_unmap(ts_segment_t *seg) {
+  if (seg->map) munmap(seg->map, TS_SEGMENT_LEN);
+  memset(seg, 0, sizeof(ts_segment_t));
+}
+
+static int segment_map(ts_segment_t *seg, int fd, bool writable) {
+  seg->map = mmap(NULL, TS_SEGMENT_LEN, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  if (seg->map == MAP_FAILED) {
+    seg->map = NULL;
+    return -1;
+  }
+  seg->header = (ts_segment_header_t *)seg->map;
+  seg->ts = seg->map + TS_HEADER_LEN;
+  seg->metrics = (uint16_t *)(seg->ts + TS_TS_BYTES);
+  seg->values = (double *)(seg->metrics + TS_SEGMENT_ROWS);
+  return 0;
+}
+
+/* Maps an existing segment, fails unless it is one of ours and complete. */
+static int segment_open(ts_segment_t *seg, const char *path, bool writable) {
+  int fd = open(path, writable ? O_RDWR : O_RDONLY);
+  struct stat st;
+  int ret = -1;
+
+  if (fd < 0) return -1;
+  if (!fstat(fd, &st) && st.st_size == TS_SEGMENT_LEN && !segment_map(seg, fd, writable)) {
+    if (!memcmp(seg->header->magic, TS_SEGMENT_MAGIC, sizeof(seg->header->magic))) {
+      ret = 0;
+    } else {
+      segment_unmap(seg);
+    }
+  }
+  close(fd);
+  return ret;
+}
+
+static bool segment_full(const ts_segment_header_t *header) {
+  return header->rows >= TS_SEGMENT_ROWS || header->ts_bytes + TS_VARINT_MAX > TS_TS_BYTES;
+}
+
+/* The file is allocated whole up front, so running out of disk fails here instead of as SIGBUS on a store into the
+ * mapping. */
+static int segment_create(ts_store_t *store, ts_device_t *dev, int64_t first_ts) {
+  char path[4096];
+  int fd, ret;
+
+  segment_unmap(&dev->tail);
+  snprintf(path, sizeof(path), "%s/%013" PRId64 "-%06u" TS_SEGMENT_SUFFIX, dev->dir, first_ts, dev->next_seq);
+  fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Error: Unable to create segment %s: %s.\n", path, strerror(errno));
+    return -1;
+  }
+  ret = posix_fallocate(fd, 0, TS_SEGMENT_LEN);
+  if (ret || segment_map(&dev->tail, fd, true)) {
+    fprintf(stderr, "Error: Unable to allocate segment %s: %s.\n", path, strerror(ret ? ret : errno));
+    close(fd);
+    unlink(path);
+    return -1;
+  }
+  close(fd);
+  memcpy(dev->tail.header->magic, TS_SEGMENT_MAGIC, sizeof(dev->tail.header->magic));
+  snprintf(dev->tail.header->device, TS_DEVICE_LEN, "%s", dev->topic);
+  dev->next_seq++;
+  store->segments++;
+  return 0;
+}
+
+static int compare_names(const void *a, const void *b) { return strcmp(*(char *const *)a, *(char *const *)b); }
+
+static void free_names(char **names, int count) {
+  for (int i = 0; i < count; i++) free(names[i]);
+  free(names);
+}
+
+/* Segment file names of `dir` in time order. Returns their number, or -1 when `dir` cannot be read. */
+static int list_segments(const char *dir, char ***names) {
+  size_t suffix_len = strlen(TS_SEGMENT_SUFFIX), len;
+  int count = 0, capacity = 0;
+  struct dirent *entry;
+  char **grown;
+  DIR *dp;
+
+  *names = NULL;
+  dp = opendir(dir);
+  if (!dp) return -1;
+  while ((entry = readdir(dp))) {
+    len = strlen(entry->d_name);
+    if (len <= suffix_len || strcmp(entry->d_name + len - suffix_len, TS_SEGMENT_SUFFIX)) continue;
+    if (count == capacity) {
+      capacity = capacity ? capacity * 2 : 16;
+      grown = realloc(*names, capacity * sizeof(char *));
+      if (!grown) break;
+      *names = grown;
+    }
+    if (!((*names)[count] = strdup(entry->d_name))) break;
+    count++;
+  }
+  closedir(dp);
+  if (entry) {
+    free_names(*names, count);
+    *names = NULL;
+    return -1;
+  }
+  if (count) qsort(*names, count, sizeof(char *), compare_names);
+  return count;
+}
+
+/* `<store>/<topic with everything but [A-Za-z0-9._-] replaced>-<topic hash>`, readable and unique. */
+static char *device_dir(const ts_store_t *store, const char *topic, uint64_t hash) {
+  size_t len = strlen(store->path) + TS_DIR_NAME_LEN + 19;
+  char *dir = malloc(len), *p;
+  int i;
+
+  if (!dir) return NULL;
+  p = dir + sprintf(dir, "%s/", store->path);
+  for (i = 0; topic[i] && i < TS_DIR_NAME_LEN; i++) {
+    p[i] = isalnum((unsigned char)topic[i]) || strchr("._-", topic[i]) ? topic[i] : '_';
+  }
+  // A leading '.' would hide the directory or make it `..`
+  if (p[0] == '.') p[0] = '_';
+  sprintf(p + i, "-%016" PRIx64, hash);
+  return dir;
+}
+
+/* Picks up appending where an earlier run left off: the newest segment stays the tail unless it is full. */
+static int device_load(ts_device_t *dev) {
+  char **names, path[4096];
+  unsigned long seq;
+  const char *dash;
+  int count;
+
+  if (mkdir(dev->dir, 0755) && errno != EEXIST) {
+    fprintf(stderr, "Error: Unable to create %s: %s.\n", dev->dir, strerror(errno));
+    return -1;
+  }
+  count = list_segments(dev->dir, &names);
+  if (count < 0) {
+    fprintf(stderr, "Error: Unable to read %s.\n", dev->dir);
+    return -1;
+  }
+  if (count > 0) {
+    dash = strchr(names[count - 1], '-');
+    seq = dash ? strtoul(dash + 1, NULL, 10) : 0;
+    dev->next_seq = seq + 1;
+    snprintf(path, sizeof(path), "%s/%s", dev->dir, names[count - 1]);
+    if (segment_open(&dev->tail, path, true)) {
+      fprintf(stderr, "Warning: %s is not a usable segment, starting a new one.\n", path);
+    }
+  }
+  free_names(names, count);
+  return 0;
+}
+
+static void device_free(ts_device_t *dev) {
+  if (!dev) return;
+  segment_unmap(&dev->tail);
+  free(dev->topic);
+  free(dev->dir);
+  free(dev);
+}
+
+static int grow_devices(ts_store_t *store) {
+  int capacity = store->device_capacity ? store->device_capacity * 2 : 64, pos;
+  ts_device_t **devices = calloc(capacity, sizeof(ts_device_t *));
+
+  if (!devices) return -1;
+  for (int i = 0; i < store->device_capacity; i++) {
+    if (!store->devices[i]) continue;
+    pos = store->devices[i]->hash & (capacity - 1);
+    while (devices[pos]) pos = (pos + 1) & (capacity - 1);
+    devices[pos] = store->devices[i];
+  }
+  free(store->devices);
+  store->devices = devices;
+  store->device_capacity = capacity;
+  return 0;
+}
+
+static ts_device_t *find_device(ts_store_t *store, const char *topic) {
+  int topic_len = strlen(topic), pos;
+  uint64_t hash = hash_key(topic, topic_len);
+  ts_device_t *dev;
+
+  if (store->device_count * 2 >= store->device_capacity && grow_devices(store)) return NULL;
+  for (pos = hash & (store->device_capacity - 1); (dev = store->devices[pos]);
+       pos = (pos + 1) & (store->device_capacity - 1)) {
+    if (dev->hash == hash && !strcmp(dev->topic, topic)) return dev;
+  }
+  dev = calloc(1, sizeof(ts_device_t));
+  if (!dev || !(dev->topic = strdup(topic)) || !(dev->dir = device_dir(store, topic, hash)) || device_load(dev)) {
+    device_free(dev);
+    return NULL;
+  }
+  dev->hash = hash;
+  store->devices[pos] = dev;
+  store->device_count++;
+  return dev;
+}
+
+static int grow_metrics(ts_store_t *store) {
+  int capacity = store->metric_capacity ? store->metric_capacity * 2 : 64, pos;
+  int32_t *index = malloc(capacity * sizeof(int32_t));
+  char **metrics = realloc(store->metrics, capacity / 2 * sizeof(char *));
+
+  if (!index || !metrics) {
+    free(index);
+    if (metrics) store->metrics = metrics;
+    return -1;
+  }
+  store->metrics = metrics;
+  memset(index, 0xff, capacity * sizeof(int32_t));
+  for (int id = 0; id < store->metric_count; id++) {
+    pos = hash_key(metrics[id], strlen(metrics[id])) & (capacity - 1);
+    while (index[pos] >= 0) pos = (pos + 1) & (capacity - 1);
+    index[pos] = id;
+  }
+  free(store->metric_index);
+  store->metric_index = index;
+  store->metric_capacity = capacity;
+  return 0;
+}
+
+static int add_metric(ts_store_t *store, const char *name, int name_len, int pos) {
+  char *copy;
+
+  if (store->metric_count == TS_MAX_METRICS) return -1;
+  copy = strndup(name, name_len);
+  if (!copy) return -1;
+  store->metrics[store->metric_count] = copy;
+  store->metric_index[pos] = store->metric_count;
+  return store->metric_count++;
+}
+
+/* Id of the metric `name`, which is added to the metrics file with `create`. Returns -1 when it is unknown or cannot
+ * be added. Names longer than TS_METRIC_LEN or with a line break in them are never stored. */
+int ts_store_metric(ts_store_t *store, const char *name, int name_len, bool create) {
+  uint64_t hash = hash_key(name, name_len);
+  const char *metric;
+  int pos, id;
+
+  if (name_len == 0 || name_len > TS_METRIC_LEN || memchr(name, '\n', name_len)) return -1;
+  if (store->metric_count * 2 >= store->metric_capacity && grow_metrics(store)) return -1;
+  for (pos = hash & (store->metric_capacity - 1); store->metric_index[pos] >= 0;
+       pos = (pos + 1) & (store->metric_capacity - 1)) {
+    metric = store->metrics[store->metric_index[pos]];
+    if (!strncmp(metric, name, name_len) && metric[name_len] == '\0') return store->metric_index[pos];
+  }
+  if (!create || (id = add_metric(store, name, name_len, pos)) < 0) return -1;
+  // Flushed right away, a segment must never refer to an id the file does not have
+  if (store->metric_file &&
+      (fprintf(store->metric_file, "%s\n", store->metrics[id]) < 0 || fflush(store->metric_file))) {
+    fprintf(stderr, "Warning: Failed to record metric %s.\n", store->metrics[id]);
+    free(store->metrics[id]);
+    store->metric_index[pos] = -1;
+    store->metric_count--;
+    return -1;
+  }
+  return id;
+}
+
+const char *ts_store_metric_name(const ts_store_t *store, int metric) {
+  return metric >= 0 && metric < store->metric_count ? store->metrics[metric] : NULL;
+}
+
+/* Names are added with the file detached, so the ones read back are not written again. */
+static int load_metrics(ts_store_t *store, const char *path) {
+  char line[TS_METRIC_LEN + 2];
+  FILE *file = fopen(path, "a+");
+  int len;
+
+  if (!file) {
+    fprintf(stderr, "Error: Unable to open %s: %s.\n", path, strerror(errno));
+    return -1;
+  }
+  rewind(file);
+  while (fgets(line, sizeof(line), file)) {
+    len = strcspn(line, "\n");
+    if (ts_store_metric(store, line, len, true) != store->metric_count - 1) {
+      fprintf(stderr, "Error: %s is damaged.\n", path);
+      fclose(file);
+      return -1;
+    }
+  }
+  store->metric_file = file;
+  return 0;
+}
+
+/* Opens the store in the directory `path`, which is created when missing. */
+ts_store_t *ts_store_open(const char *path) {
+  ts_store_t *store = calloc(1, sizeof(ts_store_t));
+  char metrics[4096];
+
+  if (!store || !(store->path = strdup(path))) goto error;
+  if (mkdir(path, 0755) && errno != EEXIST) {
+    fprintf(stderr, "Error: Unable to create store %s: %s.\n", path, strerror(errno));
+    goto error;
+  }
+  snprintf(metrics, sizeof(metrics), "%s/%s", path, TS_METRICS_FILE);
+  if (load_metrics(store, metrics)) goto error;
+  return store;
+
+error:
+  ts_store_close(store);
+  return NULL;
+}
+
+void ts_store_close(ts_store_t *store) {
+  if (!store) return;
+  for (int i = 0; i < store->device_capacity; i++) device_free(store->devices[i]);
+  free(store->devices);
+  for (int i = 0; i < store->metric_count; i++) free(store->metrics[i]);
+  free(store->metrics);
+  free(store->metric_index);
+  if (store->metric_file) fclose(store->metric_file);
+  json_index_free(&store->json);
+  json_index_free(&store->nested);
+  free(store->path);
+  free(store);
+}
+
+static int append_row(ts_store_t *store, ts_device_t *dev, int metric, double value, int64_t ts) {
+  ts_segment_header_t *header = dev->tail.header;
+  int64_t delta = 0;
+  uint32_t row;
+
+  // Scans rely on the rows of a device being in time order, a clock stepping back is held at the last timestamp
+  if (header && header->rows && ts < header->last_ts) ts = header->last_ts;
+  if (!header || segment_full(header)) {
+    if (segment_create(store, dev, ts)) return -1;
+    header = dev->tail.header;
+  }
+  row = header->rows;
+  if (row == 0) {
+    header->first_ts = ts;
+  } else {
+    delta = ts - header->last_ts;
+    header->ts_bytes += put_varint(dev->tail.ts + header->ts_bytes, delta - header->last_delta);
+  }
+  dev->tail.metrics[row] = metric;
+  dev->tail.values[row] = value;
+  if (row % TS_CHECKPOINT_EVERY == 0) {
+    header->checkpoints[row / TS_CHECKPOINT_EVERY] = (ts_checkpoint_t){ts, delta, header->ts_bytes};
+  }
+  header->last_ts = ts;
+  header->last_delta = delta;
+  // A scan from another process sees the row only once its columns are in place
+  __atomic_store_n(&header->rows, row + 1, __ATOMIC_RELEASE);
+  store->readings++;
+  return 0;
+}
+
+/* Appends one reading of `metric` for the device on `topic`, `ts` in ms since the epoch. */
+int ts_store_append(ts_store_t *store, const char *topic, int metric, double value, int64_t ts) {
+  ts_device_t *dev = find_device(store, topic);
+
+  if (!dev) return -1;
+  return append_row(store, dev, metric, value, ts);
+}
+
+/* Numbers, numbers in quotes, true and false. */
+static bool parse_value(const char *text, int len, double *value) {
+  char number[TS_NUMBER_LEN], *end;
+
+  if (len == 4 && !memcmp(text, "true", 4)) {
+    *value = 1;
+    return true;
+  }
+  if (len == 5 && !memcmp(text, "false", 5)) {
+    *value = 0;
+    return true;
+  }
+  if (len == 0 || len >= TS_NUMBER_LEN || !(isdigit((unsigned char)text[0]) || strchr("+-.", text[0]))) return false;
+  memcpy(number, text, len);
+  number[len] = '\0';
+  *value = strtod(number, &end);
+  return end == number + len;
+}
+
+/* `prefix` names the member a nested object came from, its members are stored as `prefix.key`. */
+static int ingest_member(ts_store_t *store, ts_device_t *dev, const char *prefix, int prefix_len, const char *key,
+                         int key_len, const char *text, int len, int64_t ts) {
+  char name[TS_METRIC_LEN + 1];
+  int metric;
+  double value;
+
+  if (!parse_value(text, len, &value)) return 0;
+  if (prefix_len) {
+    if (prefix_len + 1 + key_len > TS_METRIC_LEN) return 0;
+    memcpy(name, prefix, prefix_len);
+    name[prefix_len] = '.';
+    memcpy(name + prefix_len + 1, key, key_len);
+    key = name;
+    key_len += prefix_len + 1;
+  }
+  metric = ts_store_metric(store, key, key_len, true);
+  if (metric < 0) return 0;
+  return append_row(store, dev, metric, value, ts) ? -1 : 1;
+}
+
+/* Every number of the top-level object, and of objects one level down. */
+static int ingest_json(ts_store_t *store, ts_device_t *dev, const json_index_t *json, int64_t ts) {
+  const char *key, *text, *nested_key, *nested_text;
+  int cursor = 0, nested_cursor, key_len, len, nested_key_len, nested_len, ret, count = 0;
+
+  while (json_next_field(json, &cursor, &key, &key_len, &text, &len)) {
+    if (text[0] == '{' && text[-1] != '"') {
+      if (json_index_build(&store->nested, text, len) != JSON_OK) continue;
+      nested_cursor = 0;
+      while (json_next_field(&store->nested, &nested_cursor, &nested_key, &nested_key_len, &nested_text, &nested_len)) {
+        ret = ingest_member(store, dev, key, key_len, nested_key, nested_key_len, nested_text, nested_len, ts);
+        if (ret < 0) return -1;
+        count += ret;
+      }
+      continue;
+    }
+    ret = ingest_member(store, dev, NULL, 0, key, key_len, text, len, ts);
+    if (ret < 0) return -1;
+    count += ret;
+  }
+  return count;
+}
+
+/* `key=value` pairs separated by blanks, commas or semicolons, other words are ignored. A payload that is a single
+ * number is stored as TS_PLAIN_METRIC. */
+static int ingest_text(ts_store_t *store, ts_device_t *dev, const char *text, int len, int64_t ts) {
+  const char *word = text, *eq;
+  int i = 0, word_len = 0, ret, count = 0, words = 0;
+  double value;
+
+  while (i < len) {
+    while (i < len && (isspace((unsigned char)text[i]) || text[i] == ',' || text[i] == ';')) i++;
+    if (i == len) break;
+    word = text + i;
+    while (i < len && !isspace((unsigned char)text[i]) && text[i] != ',' && text[i] != ';') i++;
+    word_len = text + i - word;
+    words++;
+    eq = memchr(word, '=', word_len);
+    if (!eq) continue;
+    ret = ingest_member(store, dev, NULL, 0, word, eq - word, eq + 1, word + word_len - eq - 1, ts);
+    if (ret < 0) return -1;
+    count += ret;
+  }
+  if (words == 1 && !count && parse_value(word, word_len, &value)) {
+    return ingest_member(store, dev, NULL, 0, TS_PLAIN_METRIC, strlen(TS_PLAIN_METRIC), word, word_len, ts);
+  }
+  return count;
+}
+
+/* Decodes the readings in a payload and appends them for the device on `topic`. JSON objects give one reading per
+ * numeric member, other payloads are read as text. `json` is the caller's complete index of this same payload, or NULL
+ * to have it built here. Returns the number of readings stored, or -1 when the store could not be written. */
+int ts_store_ingest(ts_store_t *store, const char *topic, const void *payload, int payload_len,
+                    const json_index_t *json, int64_t ts) {
+  const char *text = payload;
+  ts_device_t *dev;
+  int i = 0, ret;
+
+  store->payloads++;
+  while (i < payload_len && isspace((unsigned char)text[i])) i++;
+  if (i == payload_len) {
+    store->skipped++;
+    return 0;
+  }
+  dev = find_device(store, topic);
+  if (!dev) return -1;
+  if (text[i] == '{') {
+    if (!json) {
+      ret = json_index_build(&store->json, text, payload_len);
+      json = ret == JSON_OK ? &store->json : NULL;
+    }
+    ret = json ? ingest_json(store, dev, json, ts) : 0;
+  } else {
+    ret = ingest_text(store, dev, text + i, payload_len - i, ts);
+  }
+  if (ret == 0) store->skipped++;
+  return ret;
+}
+
+/* Rows of one segment with `from <= ts <= to`, starting at the last checkpoint before `from`. */
+static long scan_segment(const ts_segment_t *seg, int metric, int64_t from, int64_t to, ts_scan_callback_t callback,
+                         void *arg, bool *stop) {
+  const ts_segment_header_t *header = seg->header;
+  uint32_t rows = __atomic_load_n(&header->rows, __ATOMIC_ACQUIRE), row, offset;
+  int checkpoint = 0;
+  int64_t ts, delta;
+  long count = 0;
+
+  if (rows == 0 || header->first_ts > to) return 0;
+  while (checkpoint + 1 < (int)((rows + TS_CHECKPOINT_EVERY - 1) / TS_CHECKPOINT_EVERY) &&
+         header->checkpoints[checkpoint + 1].ts < from) {
+    checkpoint++;
+  }
+  row = checkpoint * TS_CHECKPOINT_EVERY;
+  ts = header->checkpoints[checkpoint].ts;
+  delta = header->checkpoints[checkpoint].delta;
+  offset = header->checkpoints[checkpoint].offset;
+  for (;;) {
+    if (ts > to) break;
+    if (ts >= from && (metric < 0 || seg->metrics[row] == metric)) {
+      count++;
+      if (!callback(arg, ts, seg->metrics[row], seg->values[row])) {
+        *stop = true;
+        break;
+      }
+    }
+    if (++row == rows) break;
+    delta += get_varint(seg->ts, &offset);
+    ts += delta;
+  }
+  return count;
+}
+
+/* Calls `callback` for the rows of the device on `topic` with `from <= ts <= to` in time order, only for `metric`
+ * unless it is negative. Segments are named by their first timestamp, so only those that can hold the window are
+ * opened. Returns the number of rows passed to the callback, or -1 when the device's directory cannot be read. */
+long ts_store_scan(ts_store_t *store, const char *topic, int metric, int64_t from, int64_t to,
+                   ts_scan_callback_t callback, void *arg) {
+  char *dir = device_dir(store, topic, hash_key(topic, strlen(topic))), **names = NULL, path[4096];
+  ts_segment_t seg = {0};
+  int count, first = 0;
+  bool stop = false;
+  long rows = 0;
+
+  if (!dir) return -1;
+  count = list_segments(dir, &names);
+  if (count < 0) {
+    free(dir);
+    return errno == ENOENT ? 0 : -1;
+  }
+  // The last segment starting at or before `from` is the first that can hold rows of the window
+  for (int i = count - 1; i >= 0; i--) {
+    if (strtoll(names[i], NULL, 10) <= from) {
+      first = i;
+      break;
+    }
+  }
+  for (int i = first; i < count && !stop; i++) {
+    if (strtoll(names[i], NULL, 10) > to) break;
+    snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+    if (segment_open(&seg, path, false)) continue;
+    rows += scan_segment(&seg, metric, from, to, callback, arg, &stop);
+    segment_unmap(&seg);
+  }
+  free_names(names, count);
+  free(dir);
+  return rows;
+}
+
+void ts_store_stats(const ts_store_t *store, FILE *out) {
+  fprintf(out, "store: %lu readings from %lu payloads, %lu payloads without readings, %d devices, %d metrics, %lu "
+          "segments started in %s\n", store->readings, store->payloads, store->skipped, store->device_count,
+          store->metric_count, store->segments, store->path);
+}
@@ -0,0 +1,98 @@
+#ifndef TS_STORE_H
+#define TS_STORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "json_index.h"
+
+/* Columnar store for the readings the TA side receives, so analytics can query them instead of re-parsing the log.
+ * Every device (topic) gets a directory of segment files under the store, named `<first ms>-<sequence>.seg` so they
+ * sort by time. A segment is created at its full size and mapped whole, and holds three columns for the same rows:
+ *   timestamps  ms since the epoch as delta-of-delta zigzag varints, the first row's is in the header
+ *   metric ids  uint16, the line number of the metric's name in `<store>/metrics`
+ *   values      double
+ * A segment is full at TS_SEGMENT_ROWS rows or when another varint might not fit, and the next reading starts a new
+ * one. The header keeps the decoder state every TS_CHECKPOINT_EVERY rows, so a scan starts near the first row it wants.
+ * Segments are in host byte order. */
+#define TS_SEGMENT_MAGIC "MQTSSEG\1"
+#define TS_SEGMENT_SUFFIX ".seg"
+#define TS_METRICS_FILE "metrics"
+#define TS_SEGMENT_ROWS 16384
+#define TS_TS_BYTES (TS_SEGMENT_ROWS * 2)  // regular intervals take one byte per row, this allows two
+#define TS_CHECKPOINT_EVERY 1024
+#define TS_HEADER_LEN 4096
+#define TS_SEGMENT_LEN (TS_HEADER_LEN + TS_TS_BYTES + TS_SEGMENT_ROWS * (sizeof(uint16_t) + sizeof(double)))
+#define TS_DEVICE_LEN 256  // of the topic kept in the header, longer ones are cut
+#define TS_MAX_METRICS 65535
+#define TS_METRIC_LEN 64
+#define TS_PLAIN_METRIC "value"  // name of a payload that is a bare number
+
+/* Decoder state at row `n * TS_CHECKPOINT_EVERY` of a segment. */
+typedef struct ts_checkpoint_s {
+  int64_t ts;
+  int64_t delta;    // from the row before
+  uint32_t offset;  // in the timestamp column, of the row after
+} ts_checkpoint_t;
+
+typedef struct ts_segment_header_s {
+  char magic[8];
+  int64_t first_ts;
+  int64_t last_ts;
+  int64_t last_delta;
+  uint32_t rows;  // written after the columns, a row is only there once this counts it
+  uint32_t ts_bytes;
+  char device[TS_DEVICE_LEN];
+  ts_checkpoint_t checkpoints[TS_SEGMENT_ROWS / TS_CHECKPOINT_EVERY];
+} ts_segment_header_t;
+
+typedef struct ts_segment_s {
+  unsigned char *map;
+  ts_segment_header_t *header;
+  unsigned char *ts;
+  uint16_t *metrics;
+  double *values;
+} ts_segment_t;
+
+typedef struct ts_device_s {
+  uint64_t hash;
+  char *topic;
+  char *dir;
+  ts_segment_t tail;  // the segment readings are appended to, unmapped until the first one
+  unsigned int next_seq;
+} ts_device_t;
+
+typedef struct ts_store_s {
+  char *path;
+  ts_device_t **devices;  // open addressing by topic hash
+  int device_capacity;
+  int device_count;
+  char **metrics;
+  int metric_count;
+  int32_t *metric_index;  // open addressing over metric ids
+  int metric_capacity;
+  FILE *metric_file;
+  json_index_t json;
+  json_index_t nested;
+  unsigned long payloads;
+  unsigned long readings;
+  unsigned long skipped;  // payloads without a single reading
+  unsigned long segments;
+} ts_store_t;
+
+/* Called for every row of a scan in time order, returning false ends the scan. */
+typedef bool (*ts_scan_callback_t)(void *arg, int64_t ts, int metric, double value);
+
+int64_t ts_store_now_ms(void);
+ts_store_t *ts_store_open(const char *path);
+void ts_store_close(ts_store_t *store);
+int ts_store_ingest(ts_store_t *store, const char *topic, const void *payload, int payload_len,
+                    const json_index_t *json, int64_t ts);
+int ts_store_append(ts_store_t *store, const char *topic, int metric, double value, int64_t ts);
+int ts_store_metric(ts_store_t *store, const char *name, int name_len, bool create);
+const char *ts_store_metric_name(const ts_store_t *store, int metric);
+long ts_store_scan(ts_store_t *store, const char *topic, int metric, int64_t from, int64_t to,
+                   ts_scan_callback_t callback, void *arg);
+void ts_store_stats(const ts_store_t *store, FILE *out);
+
+#endif
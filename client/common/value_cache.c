@@ -0,0 +1,250 @@
+#include "value_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FNV64_OFFSET 14695981039346656037ull
+#define FNV64_PRIME 1099511628211ull
+#define INDEX_EMPTY -1
+#define INDEX_DELETED -2
+
+static uint64_t hash_key(const char *key, int key_len) {
+  uint64_t hash = FNV64_OFFSET;
+  for (int i = 0; i < key_len; i++) {
+    hash ^= (unsigned char)key[i];
+    hash *= FNV64_PRIME;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+static size_t entry_size(const vcache_entry_t *entry) {
+  return (entry->value - (unsigned char *)entry->key) + entry->value_len;
+}
+
+value_cache_t *vcache_new(int max_entries, size_t budget, int ttl) {
+  value_cache_t *cache;
+  uint32_t index_size = 1;
+
+  if (max_entries <= 0) {
+    return NULL;
+  }
+  // Keep the index at most half full so probe chains stay short
+  while (index_size < (uint32_t)max_entries * 2) index_size <<= 1;
+
+  cache = calloc(1, sizeof(value_cache_t));
+  if (!cache) {
+    return NULL;
+  }
+  cache->entries = calloc(max_entries, sizeof(vcache_entry_t));
+  cache->index = malloc(index_size * sizeof(int32_t));
+  cache->ring = malloc(budget);
+  if (!cache->entries || !cache->index || !cache->ring) {
+    vcache_free(cache);
+    return NULL;
+  }
+  memset(cache->index, 0xff, index_size * sizeof(int32_t));
+  cache->index_mask = index_size - 1;
+  cache->capacity = max_entries;
+  cache->budget = budget;
+  cache->ttl = ttl;
+  cache->newest = cache->oldest = -1;
+  for (int i = 0; i < max_entries; i++) {
+    cache->entries[i].age_next = i + 1 < max_entries ? i + 1 : -1;
+  }
+  cache->free_head = 0;
+  return cache;
+}
+
+void vcache_free(value_cache_t *cache) {
+  if (!cache) {
+    return;
+  }
+  free(cache->ring);
+  free(cache->entries);
+  free(cache->index);
+  free(cache);
+}
+
+/* Returns the index slot holding the entry for `key`, or -1. */
+static int32_t find_slot(const value_cache_t *cache, uint64_t hash, const char *key, int key_len) {
+  uint32_t pos = (uint32_t)hash & cache->index_mask;
+  const vcache_entry_t *entry;
+  int32_t n;
+
+  for (uint32_t i = 0; i <= cache->index_mask; i++, pos = (pos + 1) & cache->index_mask) {
+    n = cache->index[pos];
+    if (n == INDEX_EMPTY) {
+      return -1;
+    }
+    if (n == INDEX_DELETED) {
+      continue;
+    }
+    entry = &cache->entries[n];
+    if (entry->hash == hash && !strncmp(entry->key, key, key_len) && entry->key[key_len] == '\0') {
+      return pos;
+    }
+  }
+  return -1;
+}
+
+static void insert_slot(value_cache_t *cache, uint64_t hash, int32_t n) {
+  uint32_t pos = (uint32_t)hash & cache->index_mask;
+
+  while (cache->index[pos] >= 0) pos = (pos + 1) & cache->index_mask;
+  if (cache->index[pos] == INDEX_DELETED) cache->tombstones--;
+  cache->index[pos] = n;
+}
+
+// Tombstones lengthen every miss, once there are as many as live entries the index is rebuilt from the entry table
+static void rebuild_index(value_cache_t *cache) {
+  memset(cache->index, 0xff, (cache->index_mask + 1) * sizeof(int32_t));
+  cache->tombstones = 0;
+  for (int32_t n = cache->newest; n >= 0; n = cache->entries[n].age_next) {
+    insert_slot(cache, cache->entries[n].hash, n);
+  }
+}
+
+static void age_unlink(value_cache_t *cache, int32_t n) {
+  vcache_entry_t *entry = &cache->entries[n];
+
+  if (entry->age_prev >= 0) {
+    cache->entries[entry->age_prev].age_next = entry->age_next;
+  } else {
+    cache->newest = entry->age_next;
+  }
+  if (entry->age_next >= 0) {
+    cache->entries[entry->age_next].age_prev = entry->age_prev;
+  } else {
+    cache->oldest = entry->age_prev;
+  }
+}
+
+static void age_push_front(value_cache_t *cache, int32_t n) {
+  vcache_entry_t *entry = &cache->entries[n];
+
+  entry->age_prev = -1;
+  entry->age_next = cache->newest;
+  if (cache->newest >= 0) {
+    cache->entries[cache->newest].age_prev = n;
+  } else {
+    cache->oldest = n;
+  }
+  cache->newest = n;
+}
+
+static void remove_entry(value_cache_t *cache, int32_t slot) {
+  int32_t n = cache->index[slot];
+  vcache_entry_t *entry = &cache->entries[n];
+
+  cache->index[slot] = INDEX_DELETED;
+  cache->tombstones++;
+  age_unlink(cache, n);
+  cache->used_bytes -= entry_size(entry);
+  cache->count--;
+  memset(entry, 0, sizeof(vcache_entry_t));
+  entry->age_next = cache->free_head;
+  cache->free_head = n;
+}
+
+static void evict_oldest(value_cache_t *cache) {
+  vcache_entry_t *entry = &cache->entries[cache->oldest];
+
+  remove_entry(cache, find_slot(cache, entry->hash, entry->key, strlen(entry->key)));
+  cache->evictions++;
+}
+
+/* Whether `size` bytes at `off` are clear of every live entry. Entries are written one after the other around the ring
+ * and the oldest one marks where live data starts. */
+static bool ring_fits(const value_cache_t *cache, size_t off, size_t size) {
+  size_t tail;
+
+  if (!cache->count) return true;
+  tail = (unsigned char *)cache->entries[cache->oldest].key - cache->ring;
+  if (tail < cache->ring_head) {
+    return off >= cache->ring_head || off + size <= tail;
+  }
+  return off >= cache->ring_head && off + size <= tail;
+}
+
+/* Stores the latest `value` for `key`, evicting the oldest entries until both the entry table and the ring have room.
+ * The ring is the byte budget, nothing is allocated per message. Entries expire in the order they were written, so
+ * evicting by age rather than by use drops the one that would have expired first. Returns -1 when the value alone is
+ * larger than the budget. */
+int vcache_put(value_cache_t *cache, const char *key, const void *value, int value_len, time_t now) {
+  int key_len = strlen(key);
+  size_t size = key_len + 1 + value_len;
+  uint64_t hash = hash_key(key, key_len);
+  vcache_entry_t *entry;
+  int32_t slot, n;
+  size_t off;
+  char *buf;
+
+  if (size > cache->budget) {
+    return -1;
+  }
+  slot = find_slot(cache, hash, key, key_len);
+  if (slot >= 0) {
+    remove_entry(cache, slot);
+  }
+  while (cache->count == cache->capacity) {
+    evict_oldest(cache);
+  }
+  // An entry never wraps, when it does not fit before the end of the ring it goes to the start
+  for (;;) {
+    if (!cache->count) cache->ring_head = 0;
+    off = cache->ring_head + size <= cache->budget ? cache->ring_head : 0;
+    if (ring_fits(cache, off, size)) break;
+    evict_oldest(cache);
+  }
+  if (cache->tombstones > cache->count) {
+    rebuild_index(cache);
+  }
+
+  buf = (char *)cache->ring + off;
+  cache->ring_head = off + size;
+  n = cache->free_head;
+  entry = &cache->entries[n];
+  cache->free_head = entry->age_next;
+  memcpy(buf, key, key_len + 1);
+  memcpy(buf + key_len + 1, value, value_len);
+  entry->hash = hash;
+  entry->key = buf;
+  entry->value = (unsigned char *)buf + key_len + 1;
+  entry->value_len = value_len;
+  entry->expires = now + cache->ttl;
+  insert_slot(cache, hash, n);
+  age_push_front(cache, n);
+  cache->used_bytes += size;
+  cache->count++;
+  return 0;
+}
+
+/* `key` does not need to be terminated, so a request topic can be looked up without copying its prefix. */
+const vcache_entry_t *vcache_get(value_cache_t *cache, const char *key, int key_len, time_t now) {
+  int32_t slot = find_slot(cache, hash_key(key, key_len), key, key_len);
+  int32_t n;
+
+  if (slot < 0) {
+    cache->misses++;
+    return NULL;
+  }
+  n = cache->index[slot];
+  if (cache->entries[n].expires <= now) {
+    remove_entry(cache, slot);
+    cache->expired++;
+    cache->misses++;
+    return NULL;
+  }
+  cache->hits++;
+  return &cache->entries[n];
+}
+
+void vcache_stats(const value_cache_t *cache, FILE *out) {
+  unsigned long total = cache->hits + cache->misses;
+
+  fprintf(out, "value cache: %d/%d entries, %zu/%zu bytes, %lu lookups, %lu hits (%.2f%%), %lu expired, %lu evicted\n",
+          cache->count, cache->capacity, cache->used_bytes, cache->budget, total, cache->hits,
+          total ? 100.0 * cache->hits / total : 0.0, cache->expired, cache->evictions);
+}
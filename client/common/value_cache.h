@@ -0,0 +1,56 @@
+#ifndef VALUE_CACHE_H
+#define VALUE_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define VCACHE_DEFAULT_ENTRIES 4096
+#define VCACHE_DEFAULT_BUDGET (1024 * 1024)  // bytes of keys and payloads
+#define VCACHE_SMALL_ENTRIES 32              // the low-footprint build
+#define VCACHE_SMALL_BUDGET 4096
+#define VCACHE_DEFAULT_TTL 300
+#define VCACHE_GET_SUFFIX "/get"
+#define VCACHE_VALUE_SUFFIX "/value"  // replies go here unless the request carries a response topic
+
+/* Key and value are stored back to back in the ring: the key string, its terminator, then the payload. */
+typedef struct vcache_entry_s {
+  uint64_t hash;
+  char *key;
+  unsigned char *value;
+  int value_len;
+  time_t expires;
+  int32_t age_prev;
+  int32_t age_next;
+} vcache_entry_t;
+
+typedef struct value_cache_s {
+  vcache_entry_t *entries;
+  int capacity;
+  int count;
+  int32_t *index;  // open addressing over entry numbers
+  uint32_t index_mask;
+  int tombstones;
+  int32_t newest;  // entries in the order they were written, which is also their order in the ring
+  int32_t oldest;
+  int32_t free_head;
+  unsigned char *ring;  // `budget` bytes allocated with the cache, the next entry is written at `ring_head`
+  size_t ring_head;
+  size_t budget;
+  size_t used_bytes;
+  int ttl;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long expired;
+  unsigned long evictions;
+} value_cache_t;
+
+value_cache_t *vcache_new(int max_entries, size_t budget, int ttl);
+void vcache_free(value_cache_t *cache);
+int vcache_put(value_cache_t *cache, const char *key, const void *value, int value_len, time_t now);
+const vcache_entry_t *vcache_get(value_cache_t *cache, const char *key, int key_len, time_t now);
+void vcache_stats(const value_cache_t *cache, FILE *out);
+
+#endif
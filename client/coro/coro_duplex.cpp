@@ -0,0 +1,87 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "mqtt_coro.h"
+
+#define CORO_DEFAULT_FLOWS 16
+#define CORO_HEARTBEAT_MS 5000
+#define CORO_RETRY_MS 1000
+
+static volatile sig_atomic_t running = 1;
+
+static void stop_handler(int) { running = 0; }
+
+static unsigned long replies, failed;
+
+/* Keeps the connection up and the subscription in place, and says it is alive while it is. */
+static mqtt_coro::task<> session(mqtt_coro::executor &exec, mqtt_coro::client &c) {
+  int rc;
+
+  while (running) {
+    if (!c.connected()) {
+      rc = co_await c.connect();
+      if (rc == 0) rc = co_await c.subscribe(TOPIC) >= 128 ? MOSQ_ERR_NOT_SUPPORTED : MOSQ_ERR_SUCCESS;
+      if (rc) {
+        fprintf(stderr, "Warning: Connecting failed (%d), retrying.\n", rc);
+        co_await exec.sleep_for(CORO_RETRY_MS);
+        continue;
+      }
+    } else {
+      co_await c.publish(TOPIC_RES "/alive", "1", 0);
+    }
+    co_await exec.sleep_for(CORO_HEARTBEAT_MS);
+  }
+}
+
+/* On its own, so a signal is noticed while the other flows wait on the broker. */
+static mqtt_coro::task<> until_signal(mqtt_coro::executor &exec, mqtt_coro::client &c) {
+  while (running) co_await exec.sleep_for(CORO_RETRY_MS);
+  c.disconnect();
+  exec.stop();
+}
+
+/* One request at a time, written as if it were blocking. Every flow waits on the same subscription and the next
+ * request goes to whichever has waited longest, so a slow PUBACK holds up only its own flow. */
+static mqtt_coro::task<> responder(mqtt_coro::executor &exec, mqtt_coro::client &c) {
+  while (running) {
+    std::optional<mqtt_coro::message> request = co_await c.next_message(TOPIC);
+    if (!request) {
+      co_await exec.sleep_for(CORO_RETRY_MS);
+      continue;
+    }
+    if (co_await c.publish(TOPIC_RES, request->payload, 1)) {
+      failed++;
+    } else {
+      replies++;
+    }
+  }
+}
+
+/* Usage: coro_duplex [host] [flows]
+ * The duplex client's request/response loop as coroutines on one connection and one thread: `flows` responders,
+ * CORO_DEFAULT_FLOWS by default, each answer requests on TOPIC with the payload on TOPIC_RES and wait for the PUBACK,
+ * next to a session flow that reconnects and heartbeats on TOPIC_RES/alive. */
+int main(int argc, char *argv[]) {
+  mqtt_coro::executor exec;
+  int flows = argc > 2 ? atoi(argv[2]) : CORO_DEFAULT_FLOWS;
+
+  if (flows <= 0) {
+    fprintf(stderr, "Error: Invalid flow count %s.\n", argv[2]);
+    return EXIT_FAILURE;
+  }
+  mqtt_coro::client c(exec, client_duplex, argc > 1 ? argv[1] : HOST);
+  if (c.status()) {
+    fprintf(stderr, "Error: Unable to set up the client (%d).\n", c.status());
+    return EXIT_FAILURE;
+  }
+
+  signal(SIGINT, stop_handler);
+  signal(SIGTERM, stop_handler);
+  exec.spawn(until_signal(exec, c));
+  exec.spawn(session(exec, c));
+  for (int i = 0; i < flows; i++) exec.spawn(responder(exec, c));
+  exec.run();
+
+  printf("%lu replies, %lu failed, %lu requests dropped\n", replies, failed, c.dropped());
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,292 @@
+#include "mqtt_coro.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+
+namespace mqtt_coro {
+
+static double now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+void pending::complete(int rc) {
+  result = rc;
+  done = true;
+  if (waiter) {
+    exec->schedule(waiter);
+    waiter = nullptr;
+  }
+}
+
+void executor::spawn(task<> flow) {
+  schedule(flow.handle());
+  flows_.push_back(std::move(flow));
+}
+
+executor::sleep_awaiter executor::sleep_for(int ms) { return {this, now_ms() + ms}; }
+
+/* Only what was ready when the round started, flows that keep each other busy still let the sockets be served. */
+void executor::resume_ready() {
+  for (size_t n = ready_.size(); n > 0 && !ready_.empty(); n--) {
+    std::coroutine_handle<> handle = ready_.front();
+    ready_.pop_front();
+    handle.resume();
+  }
+}
+
+void executor::reap() {
+  auto finished = [](task<> &flow) {
+    if (!flow.done()) return false;
+    if (flow.handle().promise().error) {
+      try {
+        std::rethrow_exception(flow.handle().promise().error);
+      } catch (const std::exception &e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+      } catch (...) {
+        fprintf(stderr, "Error: Unknown exception in a flow.\n");
+      }
+    }
+    return true;
+  };
+  flows_.erase(std::remove_if(flows_.begin(), flows_.end(), finished), flows_.end());
+}
+
+/* One wait on the sockets of every client with a connection, then libmosquitto does the reading, writing and
+ * keepalive, and its callbacks schedule the flows they complete. */
+void executor::poll_clients(int timeout_ms) {
+  std::vector<struct pollfd> fds;
+  std::vector<client *> polled;
+  int rc;
+
+  for (client *c : clients_) {
+    int fd = c->mosq_ && (c->connecting_ || c->connected_) ? mosquitto_socket(c->mosq_) : -1;
+    if (fd < 0) continue;
+    fds.push_back({fd, (short)(POLLIN | (mosquitto_want_write(c->mosq_) ? POLLOUT : 0)), 0});
+    polled.push_back(c);
+  }
+  if (poll(fds.data(), fds.size(), timeout_ms) < 0 && errno != EINTR) {
+    perror("poll");
+    return;
+  }
+
+  for (size_t i = 0; i < polled.size(); i++) {
+    client *c = polled[i];
+    rc = MOSQ_ERR_SUCCESS;
+    if (fds[i].revents & (POLLIN | POLLERR | POLLHUP)) rc = mosquitto_loop_read(c->mosq_, 1);
+    if (rc == MOSQ_ERR_SUCCESS && (fds[i].revents & POLLOUT)) rc = mosquitto_loop_write(c->mosq_, 1);
+    if (rc == MOSQ_ERR_SUCCESS) rc = mosquitto_loop_misc(c->mosq_);
+    if (rc != MOSQ_ERR_SUCCESS) c->lost(rc);
+  }
+}
+
+void executor::run() {
+  int timeout;
+
+  running_ = true;
+  while (running_) {
+    resume_ready();
+    reap();
+    if (flows_.empty()) break;
+
+    timeout = CORO_POLL_TIMEOUT_MS;
+    if (!ready_.empty()) {
+      timeout = 0;
+    } else if (!timers_.empty()) {
+      timeout = std::clamp((int)(timers_.top().due - now_ms()) + 1, 0, CORO_POLL_TIMEOUT_MS);
+    }
+    poll_clients(timeout);
+    for (double now = now_ms(); !timers_.empty() && timers_.top().due <= now; timers_.pop()) {
+      schedule(timers_.top().handle);
+    }
+  }
+  running_ = false;
+}
+
+client::client(executor &exec, client_type_t type, const char *host) : exec_(exec) {
+  init_mosq_config(&cfg_, type);
+  mosquitto_lib_init();
+  connack_.exec = &exec_;
+  exec_.clients_.push_back(this);
+
+  cfg_.general_config->host = cfg_strdup(&cfg_, host);
+  status_ = generate_client_id(&cfg_);
+  if (status_) return;
+  mosq_ = mosquitto_new(cfg_.general_config->id, cfg_.general_config->clean_session, this);
+  if (!mosq_) {
+    status_ = RC_MOS_INIT_ERROR;
+    return;
+  }
+  status_ = mosq_opts_set(mosq_, &cfg_);
+  if (status_) return;
+
+  mosquitto_connect_v5_callback_set(mosq_, on_connect);
+  mosquitto_disconnect_v5_callback_set(mosq_, on_disconnect);
+  mosquitto_publish_v5_callback_set(mosq_, on_publish);
+  mosquitto_subscribe_callback_set(mosq_, on_subscribe);
+  mosquitto_message_v5_callback_set(mosq_, on_message);
+}
+
+client::~client() {
+  if (mosq_) {
+    if (connecting_ || connected_) mosquitto_disconnect(mosq_);
+    mosquitto_destroy(mosq_);
+  }
+  mosq_config_cleanup(&cfg_);
+  mosquitto_lib_cleanup();
+  exec_.clients_.erase(std::find(exec_.clients_.begin(), exec_.clients_.end(), this));
+}
+
+task<int> client::connect() {
+  if (status_) co_return MOSQ_ERR_INVAL;
+  connack_ = pending(&exec_);
+  if (mosq_client_connect(mosq_, &cfg_)) {
+    // It gives up the library reference on failure, this client still holds one
+    mosquitto_lib_init();
+    co_return MOSQ_ERR_NO_CONN;
+  }
+  connecting_ = true;
+  co_return co_await connack_;
+}
+
+void client::disconnect() {
+  if (!mosq_ || (!connecting_ && !connected_)) return;
+  mosquitto_disconnect(mosq_);
+  lost(MOSQ_ERR_SUCCESS);
+}
+
+task<int> client::publish(std::string topic, std::string payload, int qos, bool retain) {
+  int mid = 0, rc;
+
+  if (status_) co_return MOSQ_ERR_INVAL;
+  publishing_ = true;
+  rc = mosquitto_publish_v5(mosq_, &mid, topic.c_str(), (int)payload.size(), payload.data(), qos, retain, NULL);
+  publishing_ = false;
+  if (rc) {
+    acks_.erase(mid);
+    co_return rc;
+  }
+
+  auto wait = acks_.try_emplace(mid).first;
+  wait->second.ack.exec = &exec_;
+  wait->second.qos = qos;
+  rc = co_await wait->second.ack;
+  acks_.erase(wait);
+  co_return rc;
+}
+
+task<int> client::subscribe(std::string filter, int qos) {
+  int mid, rc;
+
+  if (status_) co_return MOSQ_ERR_INVAL;
+  rc = mosquitto_subscribe(mosq_, &mid, filter.c_str(), qos);
+  if (rc) co_return rc;
+
+  auto wait = subacks_.try_emplace(mid, &exec_).first;
+  rc = co_await wait->second;
+  subacks_.erase(wait);
+  co_return rc;
+}
+
+task<std::optional<message>> client::next_message(std::string filter) {
+  bool match;
+
+  for (auto it = inbox_.begin(); it != inbox_.end(); ++it) {
+    match = false;
+    mosquitto_topic_matches_sub(filter.c_str(), it->topic.c_str(), &match);
+    if (match) {
+      message msg = std::move(*it);
+      inbox_.erase(it);
+      co_return msg;
+    }
+  }
+  if (!connecting_ && !connected_) co_return std::nullopt;
+
+  message_waiter waiter{filter, std::nullopt, pending(&exec_)};
+  waiters_.push_back(&waiter);
+  co_await waiter.ready;
+  co_return std::move(waiter.msg);
+}
+
+/* Everything waiting on this connection learns of the loss, except QoS 1 and 2 publishes that libmosquitto sends
+ * again once connect() succeeds. A deliberate disconnect, rc 0, fails those as well. */
+void client::lost(int rc) {
+  int code = rc ? rc : MOSQ_ERR_NO_CONN;
+
+  connecting_ = connected_ = false;
+  if (!connack_.done) connack_.complete(code);
+  for (auto &[mid, wait] : acks_) {
+    if (!wait.ack.done && (wait.qos == 0 || rc == MOSQ_ERR_SUCCESS)) wait.ack.complete(MOSQ_ERR_CONN_LOST);
+  }
+  for (auto &[mid, wait] : subacks_) {
+    if (!wait.done) wait.complete(MOSQ_ERR_CONN_LOST);
+  }
+  while (!waiters_.empty()) {
+    message_waiter *waiter = waiters_.front();
+    waiters_.pop_front();
+    waiter->ready.complete(code);
+  }
+}
+
+void client::on_connect(struct mosquitto *, void *obj, int rc, int, const mosquitto_property *) {
+  client *c = (client *)obj;
+
+  c->connecting_ = false;
+  c->connected_ = rc == 0;
+  c->connack_.complete(rc);
+}
+
+void client::on_disconnect(struct mosquitto *, void *obj, int rc, const mosquitto_property *) {
+  ((client *)obj)->lost(rc);
+}
+
+void client::on_publish(struct mosquitto *, void *obj, int mid, int rc, const mosquitto_property *) {
+  client *c = (client *)obj;
+  auto wait = c->acks_.find(mid);
+
+  if (wait == c->acks_.end()) {
+    // Acks of publishes failed by a disconnect have nobody waiting any more
+    if (!c->publishing_) return;
+    wait = c->acks_.try_emplace(mid).first;
+    wait->second.ack.exec = &c->exec_;
+  }
+  wait->second.ack.complete(rc);
+}
+
+void client::on_subscribe(struct mosquitto *, void *obj, int mid, int qos_count, const int *granted_qos) {
+  client *c = (client *)obj;
+  auto wait = c->subacks_.find(mid);
+
+  if (wait != c->subacks_.end()) wait->second.complete(qos_count > 0 ? granted_qos[0] : 128);
+}
+
+/* The flow that has waited longest on a matching filter gets the message, otherwise it waits in the inbox. */
+void client::on_message(struct mosquitto *, void *obj, const struct mosquitto_message *msg,
+                        const mosquitto_property *) {
+  client *c = (client *)obj;
+  message copy{msg->topic, std::string((const char *)msg->payload, msg->payloadlen), msg->qos, msg->retain};
+  bool match;
+
+  for (auto it = c->waiters_.begin(); it != c->waiters_.end(); ++it) {
+    match = false;
+    mosquitto_topic_matches_sub((*it)->filter.c_str(), msg->topic, &match);
+    if (match) {
+      message_waiter *waiter = *it;
+      c->waiters_.erase(it);
+      waiter->msg = std::move(copy);
+      waiter->ready.complete(MOSQ_ERR_SUCCESS);
+      return;
+    }
+  }
+  c->inbox_.push_back(std::move(copy));
+  if (c->inbox_.size() > CORO_INBOX_MAX) {
+    c->inbox_.pop_front();
+    c->dropped_++;
+  }
+}
+
+}  // namespace mqtt_coro
@@ -0,0 +1,270 @@
+#ifndef MQTT_CORO_H
+#define MQTT_CORO_H
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <map>
+#include <optional>
+#include <queue>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+extern "C" {
+#include "client_common.h"
+}
+
+#define CORO_INBOX_MAX 256         // messages kept per client while no flow waits for them, the oldest are dropped
+#define CORO_POLL_TIMEOUT_MS 1000  // loop_misc() runs at least this often for the keepalive
+
+/* C++20 coroutines over the C clients. A flow is a coroutine returning mqtt_coro::task<>, and it awaits the broker
+ * instead of being split across callbacks:
+ *
+ *   mqtt_coro::task<> relay(mqtt_coro::client &c) {
+ *     co_await c.connect();
+ *     co_await c.subscribe(TOPIC);
+ *     while (auto msg = co_await c.next_message(TOPIC)) co_await c.publish(TOPIC_RES, msg->payload);
+ *   }
+ *
+ * Everything runs on the thread calling executor::run(), which polls the sockets of its clients and resumes the flows
+ * whose PUBACK, SUBACK, CONNACK, message or timer arrived. Flows on one connection need no locks. Results are the
+ * codes of the C API: MOSQ_ERR_* from libmosquitto, the CONNACK result or the PUBACK reason code. */
+namespace mqtt_coro {
+
+template <typename T = void>
+class task;
+
+namespace detail {
+
+struct promise_base {
+  std::coroutine_handle<> continuation;
+  std::exception_ptr error;
+
+  struct final_awaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept {
+      // Back to whoever awaited the task, a spawned flow just stops and the executor reaps it
+      if (handle.promise().continuation) return handle.promise().continuation;
+      return std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+  };
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  final_awaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <typename T>
+struct promise : promise_base {
+  std::optional<T> value;
+
+  task<T> get_return_object();
+  template <typename U>
+  void return_value(U &&result) {
+    value.emplace(std::forward<U>(result));
+  }
+};
+
+template <>
+struct promise<void> : promise_base {
+  task<void> get_return_object();
+  void return_void() {}
+};
+
+}  // namespace detail
+
+/* Lazy, it starts when awaited or spawned, and owns its coroutine frame. */
+template <typename T>
+class task {
+ public:
+  using promise_type = detail::promise<T>;
+
+  task(task &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+  task &operator=(task &&other) noexcept {
+    if (this != &other) {
+      if (handle_) handle_.destroy();
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+  task(const task &) = delete;
+  task &operator=(const task &) = delete;
+  ~task() {
+    if (handle_) handle_.destroy();
+  }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+    handle_.promise().continuation = caller;
+    return handle_;
+  }
+  T await_resume() {
+    if (handle_.promise().error) std::rethrow_exception(handle_.promise().error);
+    if constexpr (!std::is_void_v<T>) return std::move(*handle_.promise().value);
+  }
+
+  bool done() const { return !handle_ || handle_.done(); }
+  std::coroutine_handle<promise_type> handle() const { return handle_; }
+
+ private:
+  friend promise_type;
+  explicit task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail {
+
+template <typename T>
+task<T> promise<T>::get_return_object() {
+  return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+
+inline task<void> promise<void>::get_return_object() {
+  return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+}
+
+}  // namespace detail
+
+class executor;
+
+/* One outstanding answer from the broker. The callback completes it and hands the waiting flow to the executor, flows
+ * are never resumed from inside libmosquitto. */
+struct pending {
+  executor *exec;
+  std::coroutine_handle<> waiter;
+  int result = 0;
+  bool done = false;
+
+  explicit pending(executor *owner = nullptr) : exec(owner) {}
+  void complete(int rc);
+  bool await_ready() const noexcept { return done; }
+  void await_suspend(std::coroutine_handle<> caller) noexcept { waiter = caller; }
+  int await_resume() const noexcept { return result; }
+};
+
+struct message {
+  std::string topic;
+  std::string payload;
+  int qos;
+  bool retain;
+};
+
+class client;
+
+class executor {
+ public:
+  executor() = default;
+  executor(const executor &) = delete;
+  executor &operator=(const executor &) = delete;
+
+  /* Starts `flow` on the next round of run(), the executor keeps it until it finished. */
+  void spawn(task<> flow);
+  /* Runs until every spawned flow finished or stop() was called. */
+  void run();
+  void stop() { running_ = false; }
+
+  struct sleep_awaiter {
+    executor *exec;
+    double due;
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> caller) { exec->timers_.push({due, caller}); }
+    void await_resume() const noexcept {}
+  };
+  sleep_awaiter sleep_for(int ms);
+
+  void schedule(std::coroutine_handle<> handle) { ready_.push_back(handle); }
+
+ private:
+  friend class client;
+
+  struct timer {
+    double due;
+    std::coroutine_handle<> handle;
+    bool operator>(const timer &other) const { return due > other.due; }
+  };
+
+  void resume_ready();
+  void reap();
+  void poll_clients(int timeout_ms);
+
+  std::vector<task<>> flows_;
+  std::deque<std::coroutine_handle<>> ready_;
+  std::priority_queue<timer, std::vector<timer>, std::greater<timer>> timers_;
+  std::vector<client *> clients_;
+  bool running_ = false;
+};
+
+/* Owns a libmosquitto client and its mosq_config_t, set up by init_mosq_config(), generate_client_id() and
+ * mosq_opts_set() like the C clients. status() is RC_MOS_OK when that worked. Has to outlive the flows using it, and
+ * its executor has to outlive the client. */
+class client {
+ public:
+  client(executor &exec, client_type_t type = client_duplex, const char *host = HOST);
+  ~client();
+  client(const client &) = delete;
+  client &operator=(const client &) = delete;
+
+  rc_mosq_retcode_t status() const { return status_; }
+  mosq_config_t &config() { return cfg_; }
+  struct mosquitto *handle() { return mosq_; }
+  bool connected() const { return connected_; }
+
+  /* Connects through mosq_client_connect(), so MQTT_PROXY applies, and also reconnects. The TCP connect itself blocks
+   * as in the C clients. Returns the CONNACK result, MOSQ_ERR_NO_CONN when the broker could not be reached. */
+  task<int> connect();
+  /* Completes on the PUBACK at QoS 1, PUBCOMP at QoS 2 and once written at QoS 0. A QoS 0 publish fails with
+   * MOSQ_ERR_CONN_LOST when the connection drops first, QoS 1 and 2 wait, libmosquitto sends them again after the
+   * reconnect. */
+  task<int> publish(std::string topic, std::string payload, int qos = 1, bool retain = false);
+  /* Returns the granted QoS, 128 when the broker refused the filter. */
+  task<int> subscribe(std::string filter, int qos = 1);
+  /* The next message matching `filter`, one flow per message, in the order the flows started waiting. Empty once the
+   * connection is lost. */
+  task<std::optional<message>> next_message(std::string filter);
+  /* Fails every wait on the connection, QoS 1 and 2 publishes included. */
+  void disconnect();
+
+  unsigned long dropped() const { return dropped_; }
+
+ private:
+  friend class executor;
+
+  struct publish_wait {
+    pending ack;
+    int qos;
+  };
+  struct message_waiter {
+    std::string filter;
+    std::optional<message> msg;
+    pending ready;
+  };
+
+  static void on_connect(struct mosquitto *mosq, void *obj, int rc, int flags, const mosquitto_property *props);
+  static void on_disconnect(struct mosquitto *mosq, void *obj, int rc, const mosquitto_property *props);
+  static void on_publish(struct mosquitto *mosq, void *obj, int mid, int rc, const mosquitto_property *props);
+  static void on_subscribe(struct mosquitto *mosq, void *obj, int mid, int qos_count, const int *granted_qos);
+  static void on_message(struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg,
+                         const mosquitto_property *props);
+  void lost(int rc);
+
+  executor &exec_;
+  mosq_config_t cfg_;
+  struct mosquitto *mosq_ = nullptr;
+  rc_mosq_retcode_t status_ = RC_MOS_OK;
+  bool connecting_ = false, connected_ = false;
+  bool publishing_ = false;  // inside mosquitto_publish_v5(), where a QoS 0 publish may already call back
+  pending connack_;
+  std::map<int, publish_wait> acks_;  // by mid, map nodes stay put while a flow waits on one
+  std::map<int, pending> subacks_;
+  std::deque<message_waiter *> waiters_;
+  std::deque<message> inbox_;
+  unsigned long dropped_ = 0;
+};
+
+}  // namespace mqtt_coro
+
+#endif
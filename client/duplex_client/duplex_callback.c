@@ -1,8 +1,52 @@
 #include "duplex_callback.h"
+#include <mqtt_protocol.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "duplex_relay.h"
 #include "duplex_utils.h"
+#include "mailbox.h"
 #include "pub_utils.h"
 #include "sub_utils.h"
 
+static double now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static bool has_suffix(const char *topic, const char *suffix) {
+  int topic_len = strlen(topic), suffix_len = strlen(suffix);
+  return topic_len > suffix_len && !strcmp(topic + topic_len - suffix_len, suffix);
+}
+
+static int publish_batch(void *userdata, const char *topic, const void *batch, int len) {
+  struct mosquitto *mosq = (struct mosquitto *)userdata;
+  char *cmd_topic = malloc(strlen(topic) + sizeof(MAILBOX_SUFFIX));
+  int ret;
+
+  if (!cmd_topic) return MOSQ_ERR_NOMEM;
+  sprintf(cmd_topic, "%s%s", topic, MAILBOX_SUFFIX);
+  ret = mosquitto_publish(mosq, NULL, cmd_topic, len, batch, 1, false);
+  free(cmd_topic);
+  return ret;
+}
+
+/* A command on `<device topic>/cmd/queue` waits in the device's mailbox, the broker's Message Expiry Interval is what
+ * is left of its lifetime. */
+static void queue_command(mailbox_t *mailbox, const struct mosquitto_message *message,
+                          const mosquitto_property *properties) {
+  uint32_t ttl_sec = 0;
+
+  mosquitto_property_read_int32(properties, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, &ttl_sec, false);
+  if (mailbox_put(mailbox, message->topic, strlen(message->topic) - strlen(MAILBOX_QUEUE_SUFFIX), message->payload,
+                  message->payloadlen, ttl_sec, now_ms())) {
+    fprintf(stderr, "Warning: Mailbox of %.*s is full, dropped a command.\n",
+            (int)(strlen(message->topic) - strlen(MAILBOX_QUEUE_SUFFIX)), message->topic);
+  }
+}
+
 static void publish_callback_duplex_func(struct mosquitto *mosq, void *obj, int mid, int reason_code,
                                          const mosquitto_property *properties) {
   publish_callback_pub_func(mosq, obj, mid, reason_code, properties);
@@ -11,14 +55,46 @@ static void publish_callback_duplex_func(struct mosquitto *mosq, void *obj, int
 
 static void message_callback_duplex_func(struct mosquitto *mosq, void *obj, const struct mosquitto_message *message,
                                          const mosquitto_property *properties) {
-  message_callback_sub_func(mosq, obj, message, properties);
-  mosquitto_disconnect_v5(mosq, 0, ((mosq_config_t *)obj)->property_config->disconnect_props);
+  mailbox_t *mailbox = ((mosq_config_t *)obj)->pub_config->mailbox;
+  bool kept;
+
+  if (mailbox && has_suffix(message->topic, MAILBOX_QUEUE_SUFFIX)) {
+    queue_command(mailbox, message, properties);
+    return;
+  }
+  if (mailbox && has_suffix(message->topic, MAILBOX_SUFFIX)) return;
+  // Duplicates, filtered, invalid and out of order messages and GETs answered from the cache are not relayed
+  kept = sub_receive(mosq, obj, message, properties);
+  if (kept && ((mosq_config_t *)obj)->pub_config->relay) {
+    duplex_relay_receive(((mosq_config_t *)obj)->pub_config->relay, message);
+    // A TA on the same host gets it right away instead of after the publishing session connected
+    if (((mosq_config_t *)obj)->pub_config->ring) {
+      duplex_relay_flush_local(((mosq_config_t *)obj)->pub_config->relay, ((mosq_config_t *)obj)->pub_config->ring,
+                               ((mosq_config_t *)obj)->pub_config->topic);
+    }
+  }
+  if (mailbox) {
+    // The device listens for a moment after it transmitted, everything waiting for it goes out now
+    if (mailbox_deliver(mailbox, message->topic, now_ms(), publish_batch, mosq) < 0) {
+      fprintf(stderr, "Warning: Failed to deliver the mailbox of %s.\n", message->topic);
+    }
+    // The session stays up for the next device, so the relay is flushed through it as well
+    if (((mosq_config_t *)obj)->pub_config->relay) {
+      duplex_relay_flush(((mosq_config_t *)obj)->pub_config->relay, mosq, obj);
+    }
+  } else {
+    mosquitto_disconnect_v5(mosq, 0, ((mosq_config_t *)obj)->property_config->disconnect_props);
+  }
   printf("message_callback_duplex_func \n");
 }
 
 static void connect_callback_duplex_func(struct mosquitto *mosq, void *obj, int result, int flags,
                                          const mosquitto_property *properties) {
   if (((mosq_config_t *)obj)->general_config->client_type == client_pub) {
+    // Relayed first, the PUBACK of the configured message is what ends the session
+    if (!result && ((mosq_config_t *)obj)->pub_config->relay) {
+      duplex_relay_flush(((mosq_config_t *)obj)->pub_config->relay, mosq, obj);
+    }
     connect_callback_pub_func(mosq, obj, result, flags, properties);
   } else if (((mosq_config_t *)obj)->general_config->client_type == client_sub) {
     connect_callback_sub_func(mosq, obj, result, flags, properties);
@@ -40,7 +116,7 @@ static void disconnect_callback_duplex_func(struct mosquitto *mosq, void *obj, m
 static void subscribe_callback_duplex_func(struct mosquitto *mosq, void *obj, int mid, int qos_count,
                                            const int *granted_qos) {
   subscribe_callback_sub_func(mosq, obj, mid, qos_count, granted_qos);
-  printf("subscribe_callback_duplex_func \n");
+  if (((mosq_config_t *)obj)->general_config->debug) printf("subscribe_callback_duplex_func \n");
 }
 
 static void log_callback_duplex_func(struct mosquitto *mosq, void *obj, int level, const char *str) {
@@ -50,8 +126,9 @@ static void log_callback_duplex_func(struct mosquitto *mosq, void *obj, int leve
 rc_mosq_retcode_t duplex_callback_func_set(struct mosquitto *mosq, mosq_config_t *cfg) {
   if (cfg->general_config->debug) {
     mosquitto_log_callback_set(mosq, log_callback_duplex_func);
-    mosquitto_subscribe_callback_set(mosq, subscribe_callback_duplex_func);
   }
+  mosquitto_subscribe_callback_set(mosq, subscribe_callback_duplex_func);
+  mosquitto_unsubscribe_callback_set(mosq, unsubscribe_callback_sub_func);
   mosquitto_connect_v5_callback_set(mosq, connect_callback_duplex_func);
   mosquitto_disconnect_v5_callback_set(mosq, disconnect_callback_duplex_func);
   mosquitto_publish_v5_callback_set(mosq, publish_callback_duplex_func);
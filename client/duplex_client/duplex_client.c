@@ -1,11 +1,59 @@
+#include <string.h>
+#include <time.h>
 #include "client_common.h"
 #include "duplex_callback.h"
+#include "duplex_relay.h"
 #include "duplex_utils.h"
+#include "mailbox.h"
+#include "shm_ring.h"
 
+static double now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* Subscribes the uplinks of the devices matching `filter` and the command queues next to them. A filter ending in '#'
+ * already covers both. */
+static rc_mosq_retcode_t subscribe_devices(mosq_config_t *cfg, const char *filter) {
+  char queue_filter[256];
+  bool loops;
+
+  if (mosquitto_sub_topic_check(filter) || strlen(filter) + sizeof(MAILBOX_QUEUE_SUFFIX) > sizeof(queue_filter)) {
+    fprintf(stderr, "Error: Invalid device filter %s.\n", filter);
+    return RC_MOS_ADD_TOPIC;
+  }
+  // Relayed uplinks would come back as uplinks
+  if (mosquitto_topic_matches_sub(filter, TOPIC_RES, &loops) || loops) {
+    fprintf(stderr, "Error: The device filter %s matches the relay topic %s.\n", filter, TOPIC_RES);
+    return RC_MOS_ADD_TOPIC;
+  }
+  if (strcmp(filter, TOPIC) && cfg_add_topic(cfg, client_sub, (char *)filter)) {
+    return RC_MOS_ADD_TOPIC;
+  }
+  if (filter[strlen(filter) - 1] == '#') {
+    return RC_MOS_OK;
+  }
+  snprintf(queue_filter, sizeof(queue_filter), "%s%s", filter, MAILBOX_QUEUE_SUFFIX);
+  return cfg_add_topic(cfg, client_sub, queue_filter);
+}
+
+/* Usage: duplex [--mailbox [device filter]] [--local [name]]
+ * --mailbox keeps serving until interrupted: commands published to `<device>/cmd/queue` wait for the device's next
+ * uplink on `<device>` and go out with it on `<device>/cmd`, the message below being the first for TOPIC, see
+ * mailbox.h. The devices are those whose uplink topics match the filter, TOPIC alone by default, e.g. NB/devices/+.
+ * --local relays to a TA on the same host through the shared memory ring of that name, SHM_RING_DEFAULT_NAME by
+ * default, and through the broker only when the ring cannot take a message, see shm_ring.h. */
 int main(int argc, char *argv[]) {
   rc_mosq_retcode_t ret;
   mosq_config_t cfg;
   struct mosquitto *mosq = NULL;
+  duplex_relay_t relay;
+  buf_pool_t pool;
+  mailbox_t *mailbox = NULL;
+  shm_ring_t ring;
+  const char *ring_name = NULL, *devices = NULL;
 
   // Initialize `mosq` and `cfg`
   // if we want to opertate this program under multi-threading, see https://github.com/eclipse/mosquitto/issues/450
@@ -25,6 +73,35 @@ int main(int argc, char *argv[]) {
     goto done;
   }
 
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--mailbox")) {
+      devices = i + 1 < argc && argv[i + 1][0] != '-' ? argv[++i] : TOPIC;
+    } else if (!strcmp(argv[i], "--local")) {
+      ring_name = i + 1 < argc && argv[i + 1][0] != '-' ? argv[++i] : SHM_RING_DEFAULT_NAME;
+    }
+  }
+  if (ring_name) {
+    // Without a consumer yet every message goes through the broker, the ring is attached once there is one
+    if (shm_ring_attach(&ring, ring_name)) {
+      fprintf(stderr, "Warning: No consumer on the local ring %s yet.\n", ring_name);
+    }
+    cfg.pub_config->ring = &ring;
+  }
+
+  if (devices) {
+    ret = subscribe_devices(&cfg, devices);
+    if (ret) {
+      goto done;
+    }
+    mailbox = mailbox_new(MAILBOX_DEFAULT_DEVICES);
+    if (!mailbox || mailbox_put(mailbox, TOPIC, strlen(TOPIC), MESSAGE, strlen(MESSAGE), 0, now_ms())) {
+      fprintf(stderr, "Error: Out of memory.\n");
+      ret = RC_MOS_INIT_ERROR;
+      goto done;
+    }
+    cfg.pub_config->mailbox = mailbox;
+  }
+
   // Set the message that is going to be sent. This function could be used in the function `duplex_loop`
   // We just put it here for demostration.
   ret = gossip_message_set(&cfg, MESSAGE);
@@ -33,6 +110,16 @@ int main(int argc, char *argv[]) {
     goto done;
   }
 
+  // What the sub side receives is forwarded to the pub topic along with the message above, without copying it between
+  // the stages in between
+  if (buf_pool_init(&pool, DUPLEX_POOL_SLOTS)) {
+    fprintf(stderr, "Error: Out of memory.\n");
+    ret = RC_MOS_INIT_ERROR;
+    goto done;
+  }
+  duplex_relay_init(&relay, &pool, cfg.general_config->debug);
+  cfg.pub_config->relay = &relay;
+
   // Set cfg as `userdata` field of `mosq` which allows the callback functions to use `cfg`.
   mosquitto_user_data_set(mosq, &cfg);
 
@@ -43,8 +130,20 @@ int main(int argc, char *argv[]) {
   if (ret) {
     fprintf(stderr, "Error: %s\n", mosquitto_strerror(ret));
   }
+  duplex_relay_stats(&relay, stdout);
+  duplex_relay_destroy(&relay);
+  buf_pool_destroy(&pool);
 
 done:
+  if (cfg.pub_config->ring) {
+    shm_ring_stats(&ring, stdout);
+    shm_ring_close(&ring);
+    cfg.pub_config->ring = NULL;
+  }
+  if (mailbox) {
+    mailbox_stats(mailbox, stdout);
+    mailbox_free(mailbox);
+  }
   mosquitto_destroy(mosq);
   mosquitto_lib_cleanup();
   mosq_config_cleanup(&cfg);
@@ -0,0 +1,112 @@
+#include "duplex_relay.h"
+#include <ctype.h>
+#include <string.h>
+#include "pub_utils.h"
+
+void duplex_relay_init(duplex_relay_t *relay, buf_pool_t *pool, bool log) {
+  memset(relay, 0, sizeof(duplex_relay_t));
+  relay->pool = pool;
+  relay->log = log;
+}
+
+void duplex_relay_destroy(duplex_relay_t *relay) {
+  while (relay->count > 0) {
+    buf_slice_release(&relay->queue[relay->head]);
+    relay->head = (relay->head + 1) % DUPLEX_RELAY_DEPTH;
+    relay->count--;
+  }
+  json_index_free(&relay->json);
+}
+
+/* Narrows `slice` to the relayed part of the payload, the bytes stay where they are. */
+static void translate(duplex_relay_t *relay, buf_slice_t *slice) {
+  const char *payload = (const char *)buf_slice_data(slice), *value;
+  size_t i = 0;
+  int value_len;
+
+  while (i < slice->len && isspace((unsigned char)payload[i])) i++;
+  if (i == slice->len || payload[i] != '{') return;
+  if (json_index_build(&relay->json, payload, slice->len) != JSON_OK) return;
+  if (!json_field(&relay->json, DUPLEX_RELAY_FIELD, &value, &value_len)) return;
+  slice->off += value - payload;
+  slice->len = value_len;
+  relay->translated++;
+}
+
+static void log_slice(const char *topic, const buf_slice_t *slice) {
+  printf("relay %s: ", topic);
+  fwrite(buf_slice_data(slice), 1, slice->len, stdout);
+  printf("\n");
+}
+
+/* Copies the payload into the pool and queues it for the next duplex_relay_flush(). Returns false when the queue is
+ * full or no buffer could be had, the message is not relayed then. */
+bool duplex_relay_receive(duplex_relay_t *relay, const struct mosquitto_message *message) {
+  buf_slice_t slice;
+  buf_t *buf;
+
+  relay->received++;
+  if (relay->count == DUPLEX_RELAY_DEPTH) {
+    relay->dropped++;
+    return false;
+  }
+  buf = buf_copy_in(relay->pool, message->payload, message->payloadlen);
+  if (!buf) {
+    relay->dropped++;
+    return false;
+  }
+  slice = buf_slice(buf, 0, buf->len);
+  translate(relay, &slice);
+  if (relay->log) log_slice(message->topic, &slice);
+  // The queue takes over the slice's reference
+  relay->queue[(relay->head + relay->count) % DUPLEX_RELAY_DEPTH] = slice;
+  relay->count++;
+  return true;
+}
+
+/* Pushes queued slices to the local ring until one does not go in, so they stay in order. Returns how many did. */
+int duplex_relay_flush_local(duplex_relay_t *relay, shm_ring_t *ring, const char *topic) {
+  buf_slice_t *slice;
+  int pushed = 0;
+
+  while (relay->count > 0) {
+    slice = &relay->queue[relay->head];
+    if (shm_ring_push(ring, topic, buf_slice_data(slice), slice->len)) break;
+    relay->relayed++;
+    relay->local++;
+    buf_slice_release(slice);
+    relay->head = (relay->head + 1) % DUPLEX_RELAY_DEPTH;
+    relay->count--;
+    pushed++;
+  }
+  return pushed;
+}
+
+/* Publishes every queued slice to the configured topic. libmosquitto copies the payload into its packet, so the
+ * buffers are back in the pool when this returns. */
+int duplex_relay_flush(duplex_relay_t *relay, struct mosquitto *mosq, mosq_config_t *cfg) {
+  buf_slice_t *slice;
+  int ret = MOSQ_ERR_SUCCESS;
+
+  if (cfg->pub_config->ring) duplex_relay_flush_local(relay, cfg->pub_config->ring, cfg->pub_config->topic);
+  while (relay->count > 0 && ret == MOSQ_ERR_SUCCESS) {
+    slice = &relay->queue[relay->head];
+    ret = publish_message(mosq, cfg, NULL, cfg->pub_config->topic, slice->len, (void *)buf_slice_data(slice),
+                          cfg->general_config->qos, false);
+    if (ret == MOSQ_ERR_SUCCESS) {
+      relay->relayed++;
+    } else {
+      relay->dropped++;
+    }
+    buf_slice_release(slice);
+    relay->head = (relay->head + 1) % DUPLEX_RELAY_DEPTH;
+    relay->count--;
+  }
+  return ret;
+}
+
+void duplex_relay_stats(duplex_relay_t *relay, FILE *out) {
+  fprintf(out, "relay: %lu received, %lu translated, %lu relayed (%lu locally), %lu dropped, %d queued\n",
+          relay->received, relay->translated, relay->relayed, relay->local, relay->dropped, relay->count);
+  buf_pool_stats(relay->pool, out);
+}
@@ -0,0 +1,42 @@
+#ifndef DUPLEX_RELAY_H
+#define DUPLEX_RELAY_H
+
+#include <mosquitto.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "buf_pool.h"
+#include "client_common.h"
+#include "json_index.h"
+#include "shm_ring.h"
+
+/* Forwards what the subscribing side of the duplex client receives to its publish topic. The payload is copied into
+ * the pool once on receipt, translated by narrowing its slice, logged and queued by reference, and published straight
+ * from the pool. A JSON object is forwarded as the value of DUPLEX_RELAY_FIELD when it has one, anything else as is.
+ * With a local ring the payloads go to the TA on the same host through it and only what it cannot take goes to the
+ * broker. */
+#define DUPLEX_RELAY_DEPTH 64
+#define DUPLEX_RELAY_FIELD "data"
+#define DUPLEX_POOL_SLOTS 16  // per size class
+
+typedef struct duplex_relay_s {
+  buf_pool_t *pool;
+  buf_slice_t queue[DUPLEX_RELAY_DEPTH];
+  int head;
+  int count;
+  json_index_t json;
+  bool log;
+  unsigned long received;
+  unsigned long translated;
+  unsigned long relayed;
+  unsigned long local;  // of relayed, through the local ring
+  unsigned long dropped;
+} duplex_relay_t;
+
+void duplex_relay_init(duplex_relay_t *relay, buf_pool_t *pool, bool log);
+void duplex_relay_destroy(duplex_relay_t *relay);
+bool duplex_relay_receive(duplex_relay_t *relay, const struct mosquitto_message *message);
+int duplex_relay_flush(duplex_relay_t *relay, struct mosquitto *mosq, mosq_config_t *cfg);
+int duplex_relay_flush_local(duplex_relay_t *relay, shm_ring_t *ring, const char *topic);
+void duplex_relay_stats(duplex_relay_t *relay, FILE *out);
+
+#endif
@@ -1,9 +1,51 @@
 #include "duplex_utils.h"
 #include <errno.h>
+#include <signal.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "mailbox.h"
 #include "pub_utils.h"
 #include "sub_utils.h"
 
+static volatile sig_atomic_t running = 1;
+
+static void stop_handler(int signum) { running = 0; }
+
+static double now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* With a mailbox the subscribing session serves every device until interrupted instead of ending after the first
+ * message, commands have to wait for uplinks that may be hours apart. */
+static rc_mosq_retcode_t mailbox_loop(struct mosquitto *loop_mosq, mosq_config_t *loop_cfg) {
+  mailbox_t *mailbox = loop_cfg->pub_config->mailbox;
+  double last_expire = now_ms();
+  rc_mosq_retcode_t ret;
+
+  ret = mosq_client_connect(loop_mosq, loop_cfg);
+  if (ret) {
+    return ret;
+  }
+  signal(SIGINT, stop_handler);
+  signal(SIGTERM, stop_handler);
+  while (running) {
+    if (mosquitto_loop(loop_mosq, 1000, 1) != MOSQ_ERR_SUCCESS && running) {
+      sleep(1);
+      mosquitto_reconnect(loop_mosq);
+    }
+    if (now_ms() - last_expire >= MAILBOX_EXPIRE_INTERVAL_MS) {
+      last_expire = now_ms();
+      mailbox_expire(mailbox, last_expire);
+    }
+  }
+  mosquitto_disconnect_v5(loop_mosq, 0, loop_cfg->property_config->disconnect_props);
+  return RC_MOS_OK;
+}
+
 rc_mosq_retcode_t duplex_config_init(struct mosquitto **config_mosq, mosq_config_t *config_cfg) {
   rc_mosq_retcode_t ret = RC_MOS_OK;
 
@@ -37,7 +79,7 @@ rc_mosq_retcode_t duplex_config_init(struct mosquitto **config_mosq, mosq_config
 rc_mosq_retcode_t gossip_channel_set(mosq_config_t *channel_cfg, char *host, char *sub_topic, char *pub_topic) {
   rc_mosq_retcode_t ret = RC_MOS_OK;
 
-  channel_cfg->general_config->host = strdup(host);
+  channel_cfg->general_config->host = cfg_strdup(channel_cfg, host);
   channel_cfg->general_config->client_type = client_pub;
   if (cfg_add_topic(channel_cfg, client_sub, sub_topic)) {
     ret = RC_MOS_CHANNEL_SETTING;
@@ -54,7 +96,7 @@ done:
 rc_mosq_retcode_t gossip_message_set(mosq_config_t *channel_cfg, char *message) {
   rc_mosq_retcode_t ret = RC_MOS_OK;
 
-  channel_cfg->pub_config->message = strdup(message);
+  channel_cfg->pub_config->message = cfg_strdup(channel_cfg, message);
   channel_cfg->pub_config->msglen = strlen(channel_cfg->pub_config->message);
   channel_cfg->pub_config->pub_mode = MSGMODE_CMD;
 
@@ -65,6 +107,9 @@ rc_mosq_retcode_t duplex_loop(struct mosquitto *loop_mosq, mosq_config_t *loop_c
   rc_mosq_retcode_t ret = MOSQ_ERR_SUCCESS;
 
   loop_cfg->general_config->client_type = client_sub;
+  if (loop_cfg->pub_config->mailbox) {
+    return mailbox_loop(loop_mosq, loop_cfg);
+  }
   ret = mosq_client_connect(loop_mosq, loop_cfg);
   if (ret) {
     goto done;
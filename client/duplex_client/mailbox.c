@@ -0,0 +1,305 @@
+#include "mailbox.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FNV64_OFFSET 14695981039346656037ull
+#define FNV64_PRIME 1099511628211ull
+#define INDEX_EMPTY -1
+#define INDEX_DELETED -2
+
+static uint64_t hash_key(const char *key, int key_len) {
+  uint64_t hash = FNV64_OFFSET;
+  for (int i = 0; i < key_len; i++) {
+    hash ^= (unsigned char)key[i];
+    hash *= FNV64_PRIME;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+static int record_size(uint32_t len) { return sizeof(mailbox_cmd_t) + ((len + 7) & ~7u); }
+
+// "<length>:<command>,"
+static int netstring_len(uint32_t len) {
+  int digits = 1;
+
+  for (uint32_t n = len; n >= 10; n /= 10) digits++;
+  return digits + len + 2;
+}
+
+mailbox_t *mailbox_new(int max_devices) {
+  mailbox_t *mailbox;
+  uint32_t index_size = 1;
+
+  if (max_devices <= 0) {
+    return NULL;
+  }
+  // Keep the index at most half full so probe chains stay short
+  while (index_size < (uint32_t)max_devices * 2) index_size <<= 1;
+
+  mailbox = calloc(1, sizeof(mailbox_t));
+  if (!mailbox) {
+    return NULL;
+  }
+  mailbox->devices = calloc(max_devices, sizeof(mailbox_device_t));
+  mailbox->index = malloc(index_size * sizeof(int32_t));
+  if (!mailbox->devices || !mailbox->index) {
+    mailbox_free(mailbox);
+    return NULL;
+  }
+  memset(mailbox->index, 0xff, index_size * sizeof(int32_t));
+  mailbox->index_mask = index_size - 1;
+  mailbox->capacity = max_devices;
+  return mailbox;
+}
+
+void mailbox_free(mailbox_t *mailbox) {
+  if (!mailbox) {
+    return;
+  }
+  if (mailbox->devices) {
+    for (int i = 0; i < mailbox->count; i++) {
+      free(mailbox->devices[i].topic);
+      free(mailbox->devices[i].buf);
+    }
+  }
+  free(mailbox->devices);
+  free(mailbox->index);
+  free(mailbox);
+}
+
+/* Returns the index slot holding the device for `topic`, or -1. */
+static int32_t find_slot(const mailbox_t *mailbox, uint64_t hash, const char *topic, int topic_len) {
+  uint32_t pos = (uint32_t)hash & mailbox->index_mask;
+  const mailbox_device_t *device;
+  int32_t n;
+
+  for (uint32_t i = 0; i <= mailbox->index_mask; i++, pos = (pos + 1) & mailbox->index_mask) {
+    n = mailbox->index[pos];
+    if (n == INDEX_EMPTY) {
+      return -1;
+    }
+    if (n == INDEX_DELETED) {
+      continue;
+    }
+    device = &mailbox->devices[n];
+    if (device->hash == hash && !strncmp(device->topic, topic, topic_len) && device->topic[topic_len] == '\0') {
+      return pos;
+    }
+  }
+  return -1;
+}
+
+static void insert_slot(mailbox_t *mailbox, uint64_t hash, int32_t n) {
+  uint32_t pos = (uint32_t)hash & mailbox->index_mask;
+
+  while (mailbox->index[pos] >= 0) pos = (pos + 1) & mailbox->index_mask;
+  if (mailbox->index[pos] == INDEX_DELETED) mailbox->tombstones--;
+  mailbox->index[pos] = n;
+}
+
+/* The last device moves into the freed place, so the table stays dense. */
+static void remove_device(mailbox_t *mailbox, int32_t n) {
+  mailbox_device_t *device = &mailbox->devices[n], *last = &mailbox->devices[mailbox->count - 1];
+
+  mailbox->index[find_slot(mailbox, device->hash, device->topic, strlen(device->topic))] = INDEX_DELETED;
+  mailbox->tombstones++;
+  mailbox->waiting -= device->count;
+  free(device->topic);
+  free(device->buf);
+  if (device != last) {
+    *device = *last;
+    mailbox->index[find_slot(mailbox, last->hash, last->topic, strlen(last->topic))] = n;
+  }
+  memset(last, 0, sizeof(mailbox_device_t));
+  mailbox->count--;
+  if (mailbox->tombstones > mailbox->count) {
+    // Tombstones lengthen every miss, once there are as many as live devices the index is rebuilt
+    memset(mailbox->index, 0xff, (mailbox->index_mask + 1) * sizeof(int32_t));
+    mailbox->tombstones = 0;
+    for (int32_t i = 0; i < mailbox->count; i++) insert_slot(mailbox, mailbox->devices[i].hash, i);
+  }
+}
+
+/* Packs the commands that have not expired to the front of the buffer. Returns how many were dropped. */
+static int drop_expired(mailbox_t *mailbox, mailbox_device_t *device, double now) {
+  mailbox_cmd_t *cmd;
+  int off = 0, kept = 0, size, dropped = 0;
+
+  while (off < device->used) {
+    cmd = (mailbox_cmd_t *)(device->buf + off);
+    size = record_size(cmd->len);
+    if (cmd->expires <= now) {
+      dropped++;
+    } else {
+      if (kept != off) memmove(device->buf + kept, cmd, size);
+      kept += size;
+    }
+    off += size;
+  }
+  device->used = kept;
+  device->count -= dropped;
+  mailbox->waiting -= dropped;
+  mailbox->expired += dropped;
+  return dropped;
+}
+
+/* Drops every expired command and forgets the devices left without any. Returns how many were dropped. */
+int mailbox_expire(mailbox_t *mailbox, double now) {
+  int dropped = 0;
+
+  // Backwards, removing a device moves the last one into its place
+  for (int32_t n = mailbox->count - 1; n >= 0; n--) {
+    dropped += drop_expired(mailbox, &mailbox->devices[n], now);
+    if (!mailbox->devices[n].count) remove_device(mailbox, n);
+  }
+  return dropped;
+}
+
+static mailbox_device_t *get_device(mailbox_t *mailbox, const char *topic, int topic_len, double now) {
+  uint64_t hash = hash_key(topic, topic_len);
+  int32_t slot = find_slot(mailbox, hash, topic, topic_len), n;
+  mailbox_device_t *device;
+
+  if (slot >= 0) {
+    return &mailbox->devices[mailbox->index[slot]];
+  }
+  if (mailbox->count == mailbox->capacity && !mailbox_expire(mailbox, now)) {
+    return NULL;
+  }
+  n = mailbox->count;
+  device = &mailbox->devices[n];
+  device->topic = strndup(topic, topic_len);
+  if (!device->topic) {
+    return NULL;
+  }
+  device->hash = hash;
+  insert_slot(mailbox, hash, n);
+  mailbox->count++;
+  return device;
+}
+
+/* Queues a command for the device publishing on the first `topic_len` bytes of `topic`. Returns -1 when it is longer
+ * than a batch, or the device already has MAILBOX_MAX_COMMANDS waiting, or there is no room for another device. */
+int mailbox_put(mailbox_t *mailbox, const char *topic, int topic_len, const void *command, int len, int ttl_sec,
+                double now) {
+  mailbox_device_t *device;
+  mailbox_cmd_t *cmd;
+  unsigned char *buf;
+  int size = record_size(len), new_size;
+
+  if (len < 0 || netstring_len(len) > MAILBOX_MAX_BATCH) {
+    goto reject;
+  }
+  device = get_device(mailbox, topic, topic_len, now);
+  if (!device || device->count == MAILBOX_MAX_COMMANDS) {
+    goto reject;
+  }
+  if (device->used + size > device->size) {
+    new_size = device->size ? device->size * 2 : size;
+    while (new_size < device->used + size) new_size *= 2;
+    buf = realloc(device->buf, new_size);
+    if (!buf) {
+      if (!device->count) remove_device(mailbox, device - mailbox->devices);
+      goto reject;
+    }
+    device->buf = buf;
+    device->size = new_size;
+  }
+  cmd = (mailbox_cmd_t *)(device->buf + device->used);
+  cmd->queued = now;
+  cmd->expires = now + (ttl_sec > 0 ? ttl_sec : MAILBOX_DEFAULT_TTL_SEC) * 1e3;
+  cmd->len = len;
+  memcpy(cmd + 1, command, len);
+  device->used += size;
+  device->count++;
+  mailbox->waiting++;
+  mailbox->queued++;
+  return 0;
+
+reject:
+  mailbox->rejected++;
+  return -1;
+}
+
+static void record_latency(mailbox_t *mailbox, double ms) {
+  int bucket = 0;
+
+  while (bucket < MAILBOX_LATENCY_BUCKETS - 1 && ms >= (double)(1 << bucket)) {
+    bucket++;
+  }
+  mailbox->latency[bucket]++;
+  if (ms > mailbox->latency_max) mailbox->latency_max = ms;
+}
+
+/* Called on every uplink. Sends what waits for the device publishing on `topic` as one batch, and keeps it when the
+ * send fails. Returns the number of commands sent, -1 when the send failed. */
+int mailbox_deliver(mailbox_t *mailbox, const char *topic, double now, mailbox_send_t send, void *userdata) {
+  unsigned char batch[MAILBOX_MAX_BATCH];
+  int topic_len = strlen(topic), end = 0, len = 0, sent = 0;
+  int32_t slot = find_slot(mailbox, hash_key(topic, topic_len), topic, topic_len), n;
+  mailbox_device_t *device;
+  mailbox_cmd_t *cmd;
+
+  if (slot < 0) {
+    return 0;
+  }
+  n = mailbox->index[slot];
+  device = &mailbox->devices[n];
+  drop_expired(mailbox, device, now);
+  while (end < device->used) {
+    cmd = (mailbox_cmd_t *)(device->buf + end);
+    if (len + netstring_len(cmd->len) > MAILBOX_MAX_BATCH) break;
+    len += sprintf((char *)batch + len, "%u:", cmd->len);
+    memcpy(batch + len, cmd + 1, cmd->len);
+    len += cmd->len;
+    batch[len++] = ',';
+    end += record_size(cmd->len);
+    sent++;
+  }
+  if (sent && send(userdata, device->topic, batch, len)) {
+    return -1;
+  }
+  for (int off = 0; off < end; off += record_size(cmd->len)) {
+    cmd = (mailbox_cmd_t *)(device->buf + off);
+    record_latency(mailbox, now - cmd->queued);
+  }
+  memmove(device->buf, device->buf + end, device->used - end);
+  device->used -= end;
+  device->count -= sent;
+  mailbox->waiting -= sent;
+  mailbox->delivered += sent;
+  if (sent) {
+    mailbox->batches++;
+    mailbox->batch_bytes += len;
+  }
+  if (!device->count) remove_device(mailbox, n);
+  return sent;
+}
+
+static double percentile_ms(const mailbox_t *mailbox, double pct) {
+  unsigned long target = (unsigned long)(mailbox->delivered * pct), seen = 0;
+
+  for (int i = 0; i < MAILBOX_LATENCY_BUCKETS; i++) {
+    seen += mailbox->latency[i];
+    if (seen > target) {
+      return (double)(1 << i);
+    }
+  }
+  return mailbox->latency_max;
+}
+
+void mailbox_stats(const mailbox_t *mailbox, FILE *out) {
+  fprintf(out,
+          "mailbox: %lu commands queued, %lu delivered in %lu downlinks of %.0f bytes on average, %lu expired, %lu "
+          "rejected, %d waiting for %d devices\n",
+          mailbox->queued, mailbox->delivered, mailbox->batches,
+          mailbox->batches ? (double)mailbox->batch_bytes / mailbox->batches : 0, mailbox->expired, mailbox->rejected,
+          mailbox->waiting, mailbox->count);
+  if (mailbox->delivered) {
+    fprintf(out, "mailbox latency: p50 <%.0f ms, p99 <%.0f ms, max %.0f ms\n", percentile_ms(mailbox, 0.5),
+            percentile_ms(mailbox, 0.99), mailbox->latency_max);
+  }
+}
@@ -0,0 +1,66 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Downlink mailboxes for devices that can only be reached for a moment after they transmit. Commands published to
+ * `<device topic>/cmd/queue` wait under the device's uplink topic and all go out as one message on `<device
+ * topic>/cmd` when its next uplink arrives. The batch holds them as netstrings, "<length>:<command>," each, at most
+ * MAILBOX_MAX_BATCH bytes of them; the rest waits for the uplink after. A command is dropped once it waited longer
+ * than its Message Expiry Interval, or MAILBOX_DEFAULT_TTL_SEC without one. A device's commands are packed into one
+ * buffer and the device is forgotten once it is empty. */
+#define MAILBOX_SUFFIX "/cmd"
+#define MAILBOX_QUEUE_SUFFIX "/cmd/queue"
+#define MAILBOX_DEFAULT_DEVICES 4096
+#define MAILBOX_MAX_COMMANDS 16  // per device
+#define MAILBOX_MAX_BATCH 1024
+#define MAILBOX_DEFAULT_TTL_SEC 86400
+#define MAILBOX_EXPIRE_INTERVAL_MS 60000
+#define MAILBOX_LATENCY_BUCKETS 28  // bucket i counts latencies below 2^i ms, the last about 37 hours
+
+typedef struct mailbox_cmd_s {
+  double queued;
+  double expires;
+  uint32_t len;  // the command follows, padded to 8 bytes
+} mailbox_cmd_t;
+
+typedef struct mailbox_device_s {
+  uint64_t hash;
+  char *topic;
+  unsigned char *buf;  // mailbox_cmd_t records
+  int used;
+  int size;
+  int count;
+} mailbox_device_t;
+
+typedef struct mailbox_s {
+  mailbox_device_t *devices;
+  int capacity;
+  int count;
+  int32_t *index;  // open addressing over device numbers
+  uint32_t index_mask;
+  int tombstones;
+  int waiting;  // commands in all mailboxes
+  unsigned long queued;
+  unsigned long delivered;
+  unsigned long batches;
+  unsigned long batch_bytes;
+  unsigned long expired;
+  unsigned long rejected;
+  unsigned long latency[MAILBOX_LATENCY_BUCKETS];  // from queueing to delivery
+  double latency_max;
+} mailbox_t;
+
+/* Publishes one batch for the device publishing on `topic`, returns 0 once it is on its way. */
+typedef int (*mailbox_send_t)(void *userdata, const char *topic, const void *batch, int len);
+
+mailbox_t *mailbox_new(int max_devices);
+void mailbox_free(mailbox_t *mailbox);
+int mailbox_put(mailbox_t *mailbox, const char *topic, int topic_len, const void *command, int len, int ttl_sec,
+                double now);
+int mailbox_deliver(mailbox_t *mailbox, const char *topic, double now, mailbox_send_t send, void *userdata);
+int mailbox_expire(mailbox_t *mailbox, double now);
+void mailbox_stats(const mailbox_t *mailbox, FILE *out);
+
+#endif
@@ -0,0 +1,86 @@
+#include <stdlib.h>
+#include <string.h>
+#include "mailbox.h"
+
+#define BENCH_PERIOD_SEC 900  // devices report every 15 min
+#define BENCH_JITTER_SEC 60
+#define BENCH_REACHABLE_SEC 10  // how long a device listens after it transmitted
+#define BENCH_COMMANDS_PER_HOUR 2.0
+#define BENCH_HOURS 24
+
+typedef struct downlinks_s {
+  unsigned long count;
+  unsigned long bytes;
+} downlinks_t;
+
+static int count_downlink(void *userdata, const char *topic, const void *batch, int len) {
+  downlinks_t *downlinks = (downlinks_t *)userdata;
+
+  downlinks->count++;
+  downlinks->bytes += len;
+  return 0;
+}
+
+/* Usage: mailbox_bench [devices]
+ * Devices report every BENCH_PERIOD_SEC and can be reached for BENCH_REACHABLE_SEC afterwards, while the TA sends each
+ * of them BENCH_COMMANDS_PER_HOUR commands at random times. Compares downlinks sent right away, which only arrive when
+ * they happen to hit that window, with the mailbox holding them for the next uplink. Runs in virtual time. */
+int main(int argc, char *argv[]) {
+  int devices = argc > 1 ? atoi(argv[1]) : 1000, len;
+  double *next_uplink, *last_uplink, next_command = 0, rate;
+  unsigned long commands = 0, direct = 0;
+  downlinks_t downlinks = {0};
+  char topic[64], command[64];
+  mailbox_t *mailbox;
+  int d;
+
+  if (devices <= 0) {
+    fprintf(stderr, "Usage: mailbox_bench [devices]\n");
+    return EXIT_FAILURE;
+  }
+  mailbox = mailbox_new(devices);
+  next_uplink = malloc(devices * sizeof(double));
+  last_uplink = malloc(devices * sizeof(double));
+  if (!mailbox || !next_uplink || !last_uplink) {
+    fprintf(stderr, "Error: Out of memory.\n");
+    return EXIT_FAILURE;
+  }
+  srand(1);
+  for (d = 0; d < devices; d++) {
+    next_uplink[d] = (double)rand() / RAND_MAX * BENCH_PERIOD_SEC;
+    last_uplink[d] = -BENCH_PERIOD_SEC;
+  }
+  rate = devices * BENCH_COMMANDS_PER_HOUR / 3600;
+
+  for (int t = 0; t < BENCH_HOURS * 3600; t++) {
+    for (d = 0; d < devices; d++) {
+      if (next_uplink[d] > t) continue;
+      snprintf(topic, sizeof(topic), "NB/dev%d", d);
+      mailbox_deliver(mailbox, topic, t * 1e3, count_downlink, &downlinks);
+      last_uplink[d] = t;
+      next_uplink[d] += BENCH_PERIOD_SEC + ((double)rand() / RAND_MAX - 0.5) * BENCH_JITTER_SEC;
+    }
+    while (next_command <= t) {
+      d = rand() % devices;
+      snprintf(topic, sizeof(topic), "NB/dev%d", d);
+      len = snprintf(command, sizeof(command), "{\"set\":\"interval\",\"value\":%d}", 60 + rand() % 900);
+      mailbox_put(mailbox, topic, strlen(topic), command, len, 0, t * 1e3);
+      if (t - last_uplink[d] <= BENCH_REACHABLE_SEC) direct++;
+      commands++;
+      next_command += 2.0 * rand() / RAND_MAX / rate;
+    }
+  }
+
+  printf("%d devices reporting every %d s, reachable for %d s after, %lu commands in %d h\n", devices,
+         BENCH_PERIOD_SEC, BENCH_REACHABLE_SEC, commands, BENCH_HOURS);
+  printf("sent right away: %lu downlinks, %lu arrived (%.1f%%)\n", commands, direct, direct * 100.0 / commands);
+  printf("mailbox:         %lu downlinks, %lu arrived (%.1f%%), %.2f commands and %.0f bytes per downlink\n",
+         downlinks.count, mailbox->delivered, mailbox->delivered * 100.0 / commands,
+         downlinks.count ? (double)mailbox->delivered / downlinks.count : 0,
+         downlinks.count ? (double)downlinks.bytes / downlinks.count : 0);
+  mailbox_stats(mailbox, stdout);
+  mailbox_free(mailbox);
+  free(next_uplink);
+  free(last_uplink);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "client_common.h"
+#include "duplex_relay.h"
+#include "fake_mosquitto.h"
+#include "pub_utils.h"
+
+#define BENCH_MESSAGES 1000000
+#define BENCH_DEVICES 64
+#define BENCH_BATCH (DUPLEX_RELAY_DEPTH / 2)  // messages received between two flushes
+
+/* A message copied whole at every stage, the way the path looks without the pool. */
+typedef struct copied_msg_s {
+  int len;
+  char data[];
+} copied_msg_t;
+
+typedef struct bench_s {
+  duplex_relay_t *relay;  // NULL copies at every stage
+  copied_msg_t *queue[DUPLEX_RELAY_DEPTH];
+  int count;
+  json_index_t json;
+  unsigned long copies;
+} bench_t;
+
+static double now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static copied_msg_t *copy_msg(bench_t *bench, const void *data, int len) {
+  copied_msg_t *msg = malloc(sizeof(copied_msg_t) + len);
+
+  if (!msg) return NULL;
+  memcpy(msg->data, data, len);
+  msg->len = len;
+  bench->copies++;
+  return msg;
+}
+
+/* Receive, translate and queue stages, each with its own copy. */
+static void receive_copying(bench_t *bench, const struct mosquitto_message *message) {
+  copied_msg_t *received, *translated;
+  const char *value;
+  int value_len;
+
+  received = copy_msg(bench, message->payload, message->payloadlen);
+  if (!received) return;
+  translated = received;
+  if (received->len && received->data[0] == '{' &&
+      json_index_build(&bench->json, received->data, received->len) == JSON_OK &&
+      json_field(&bench->json, DUPLEX_RELAY_FIELD, &value, &value_len)) {
+    translated = copy_msg(bench, value, value_len);
+    free(received);
+    if (!translated) return;
+  }
+  if (bench->count < DUPLEX_RELAY_DEPTH) {
+    bench->queue[bench->count++] = copy_msg(bench, translated->data, translated->len);
+  }
+  free(translated);
+}
+
+static void flush_copying(bench_t *bench, struct mosquitto *mosq, mosq_config_t *cfg) {
+  for (int i = 0; i < bench->count; i++) {
+    if (!bench->queue[i]) continue;
+    publish_message(mosq, cfg, NULL, cfg->pub_config->topic, bench->queue[i]->len, bench->queue[i]->data,
+                    cfg->general_config->qos, false);
+    free(bench->queue[i]);
+  }
+  bench->count = 0;
+}
+
+static void message_callback_bench_func(struct mosquitto *mosq, void *obj, const struct mosquitto_message *message,
+                                        const mosquitto_property *properties) {
+  bench_t *bench = (bench_t *)obj;
+
+  if (bench->relay) {
+    duplex_relay_receive(bench->relay, message);
+  } else {
+    receive_copying(bench, message);
+  }
+}
+
+static void run(FILE *out, const char *name, bench_t *bench, struct mosquitto *sub, struct mosquitto *pub,
+                mosq_config_t *cfg, unsigned long messages) {
+  const fake_stats_t *stats = fake_mosq_stats(pub);
+  unsigned long allocs = 0, copies = 0, published = 0, done;
+  double start = 0;
+
+  // The first tenth warms up the pool, the JSON index and the fake's ack ring
+  for (int pass = 0; pass < 2; pass++) {
+    unsigned long total = pass ? messages : messages / 10 + 1;
+
+    if (pass) {
+      allocs = fake_mosq_allocs();
+      copies = bench->relay ? bench->relay->pool->copies : bench->copies;
+      published = stats->published_bytes;
+      start = now_ms();
+    }
+    for (done = 0; done < total; done += BENCH_BATCH) {
+      fake_mosq_run(sub, BENCH_BATCH);
+      if (bench->relay) {
+        duplex_relay_flush(bench->relay, pub, cfg);
+      } else {
+        flush_copying(bench, pub, cfg);
+      }
+      fake_mosq_run(pub, 0);
+    }
+  }
+  copies = (bench->relay ? bench->relay->pool->copies : bench->copies) - copies;
+  fprintf(out, "  %-28s %7.1f ns/msg %5.2f copies/msg %5.2f allocs/msg %6.1f B published/msg\n", name,
+          (now_ms() - start) * 1e6 / done, (double)copies / done, (double)(fake_mosq_allocs() - allocs) / done,
+          (double)(stats->published_bytes - published) / done);
+}
+
+/* Usage: relay_bench [messages]
+ * Built against the fake libmosquitto, no broker is needed. Feeds scripted PUBLISH events through the duplex relay and
+ * publishes what it queued, first with a payload copy at every stage, then through the buffer pool, then through a
+ * pool without slots so every buffer comes from malloc. Reports payload copies and allocator calls per message. The
+ * real library adds one copy and allocation on receipt and one on publish to every case. */
+int main(int argc, char *argv[]) {
+  unsigned long messages = argc > 1 ? strtoul(argv[1], NULL, 10) : BENCH_MESSAGES;
+  struct mosquitto *sub = NULL, *pub = NULL;
+  fake_event_t script[BENCH_DEVICES];
+  char topics[BENCH_DEVICES][64], payloads[BENCH_DEVICES][256];
+  bench_t bench = {0};
+  duplex_relay_t relay;
+  buf_pool_t pool = {0}, empty = {0};
+  mosq_config_t cfg;
+  int ret = EXIT_FAILURE;
+
+  if (messages == 0) messages = 1;
+  mosquitto_lib_init();
+  init_mosq_config(&cfg, client_pub);
+  cfg.general_config->qos = 1;
+  if (cfg_add_topic(&cfg, client_pub, TOPIC_RES) || buf_pool_init(&pool, DUPLEX_POOL_SLOTS) ||
+      buf_pool_init(&empty, 0)) {
+    fprintf(stderr, "Error: Out of memory.\n");
+    goto cleanup;
+  }
+  // Half the devices wrap their reading in a JSON envelope the relay strips
+  for (int i = 0; i < BENCH_DEVICES; i++) {
+    snprintf(topics[i], sizeof(topics[i]), "%s/dev%03d/up", TOPIC, i);
+    script[i] = (fake_event_t){.type = FAKE_PUBLISH, .topic = topics[i], .qos = 1, .mid = i + 1};
+    script[i].payload = payloads[i];
+    if (i % 2) {
+      script[i].payloadlen = snprintf(payloads[i], sizeof(payloads[i]),
+                                      "{\"dev\":\"dev%03d\",\"seq\":%d,\"data\":{\"temp\":%d.%d,\"hum\":%d}}", i,
+                                      i, 15 + i % 20, i % 10, 40 + i % 50);
+    } else {
+      script[i].payloadlen = snprintf(payloads[i], sizeof(payloads[i]), "dev%03d temp=%d.%d hum=%d", i,
+                                      15 + i % 20, i % 10, 40 + i % 50);
+    }
+  }
+
+  sub = mosquitto_new(NULL, true, &bench);
+  pub = mosquitto_new(NULL, true, &cfg);
+  if (!sub || !pub || mosquitto_connect_bind_v5(sub, HOST, 1883, 60, NULL, NULL) ||
+      mosquitto_connect_bind_v5(pub, HOST, 1883, 60, NULL, NULL)) {
+    fprintf(stderr, "Error: Failed to set up the clients.\n");
+    goto cleanup;
+  }
+  mosquitto_message_v5_callback_set(sub, message_callback_bench_func);
+  fake_mosq_auto_ack(pub, true);
+  fake_mosq_run(sub, 0);
+  fake_mosq_run(pub, 0);
+  fake_mosq_script(sub, script, BENCH_DEVICES, 0);
+
+  printf("relay, %d devices, flushed every %d messages:\n", BENCH_DEVICES, BENCH_BATCH);
+  run(stdout, "copy at every stage", &bench, sub, pub, &cfg, messages);
+  duplex_relay_init(&relay, &pool, false);
+  bench.relay = &relay;
+  run(stdout, "buffer pool", &bench, sub, pub, &cfg, messages);
+  duplex_relay_destroy(&relay);
+  duplex_relay_init(&relay, &empty, false);
+  run(stdout, "buffer pool, malloc fallback", &bench, sub, pub, &cfg, messages);
+  duplex_relay_destroy(&relay);
+  buf_pool_stats(&pool, stdout);
+  ret = 0;
+
+cleanup:
+  json_index_free(&bench.json);
+  mosquitto_destroy(sub);
+  mosquitto_destroy(pub);
+  buf_pool_destroy(&pool);
+  buf_pool_destroy(&empty);
+  mosq_config_cleanup(&cfg);
+  mosquitto_lib_cleanup();
+  return ret;
+}
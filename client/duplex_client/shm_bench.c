@@ -0,0 +1,224 @@
+#include <mosquitto.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "shm_ring.h"
+
+#define BENCH_RING "shm_bench"
+#define BENCH_TOPIC "shm_bench/data"
+#define BENCH_PORT 1883
+#define BENCH_PAYLOAD 64          // a translated reading, the send time first
+#define BENCH_PACED_RATE 1000     // msg/s per producer for the latency runs
+#define BENCH_PACED_MESSAGES 5000  // per producer, at most
+#define BENCH_IDLE_MS 2000        // the consumer gives up once nothing arrived for that long
+#define BENCH_LATENCY_BUCKETS 24  // bucket i counts latencies below 2^i us
+
+typedef struct result_s {
+  unsigned long received;
+  unsigned long latency[BENCH_LATENCY_BUCKETS];
+  double latency_max;  // us
+  double last;
+  bool subscribed;
+} result_t;
+
+static double now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* CLOCK_MONOTONIC is the same in every process, so the consumer can tell how long a message took. */
+static void record(result_t *result, const void *payload, int len) {
+  double now = now_ms(), sent, us;
+  int i = 0;
+
+  if (len < (int)sizeof(double)) return;
+  memcpy(&sent, payload, sizeof(double));
+  us = (now - sent) * 1e3;
+  while (i < BENCH_LATENCY_BUCKETS - 1 && us >= (double)(1 << i)) i++;
+  result->latency[i]++;
+  if (us > result->latency_max) result->latency_max = us;
+  result->last = now;
+  result->received++;
+}
+
+static double percentile_us(const result_t *result, int percent) {
+  unsigned long target = result->received * percent / 100, seen = 0;
+
+  for (int i = 0; i < BENCH_LATENCY_BUCKETS; i++) {
+    seen += result->latency[i];
+    if (seen > target) return (double)(1 << i);
+  }
+  return result->latency_max;
+}
+
+static void report(const char *name, int rate, const result_t *result, unsigned long sent, double start) {
+  double elapsed = result->last > start ? result->last - start : 1;
+
+  printf("%-4s %-6s %8.0f msg/s, latency p50 <%6.0f us, p99 <%7.0f us, max %8.0f us, %lu of %lu lost\n", name,
+         rate ? "paced" : "flood", result->received / (elapsed / 1e3), percentile_us(result, 50),
+         percentile_us(result, 99), result->latency_max, sent - result->received, sent);
+}
+
+/* Spaces messages `rate` per second apart, or not at all for 0. */
+static void pace(double start, unsigned long i, int rate) {
+  struct timespec ts;
+  double wait;
+
+  if (!rate) return;
+  wait = start + i * 1e3 / rate - now_ms();
+  if (wait <= 0) return;
+  ts.tv_sec = (time_t)(wait / 1e3);
+  ts.tv_nsec = (long)((wait - ts.tv_sec * 1e3) * 1e6);
+  nanosleep(&ts, NULL);
+}
+
+static void produce_ring(unsigned long messages, int rate) {
+  char payload[BENCH_PAYLOAD] = {0};
+  double start = now_ms(), sent;
+  shm_ring_t ring;
+
+  if (shm_ring_attach(&ring, BENCH_RING)) {
+    fprintf(stderr, "Error: Unable to attach to the local ring.\n");
+    _exit(EXIT_FAILURE);
+  }
+  for (unsigned long i = 0; i < messages; i++) {
+    pace(start, i, rate);
+    sent = now_ms();
+    memcpy(payload, &sent, sizeof(double));
+    // The duplex client would use the broker when the ring is full, here the producer waits to measure the ring alone
+    while (shm_ring_push(&ring, BENCH_TOPIC, payload, sizeof(payload))) {
+      if (!ring.hdr) _exit(EXIT_FAILURE);
+      sched_yield();
+    }
+  }
+  shm_ring_close(&ring);
+  _exit(EXIT_SUCCESS);
+}
+
+static void on_ring(void *userdata, const char *topic, const void *payload, int len) {
+  record((result_t *)userdata, payload, len);
+}
+
+static void run_ring(int producers, unsigned long messages, int rate) {
+  unsigned long total = producers * messages;
+  result_t result = {0};
+  struct pollfd fds[2];
+  shm_ring_t ring;
+  bool busy = false;
+  double start;
+
+  if (shm_ring_create(&ring, BENCH_RING)) return;
+  fds[0].fd = ring.efd;
+  fds[1].fd = ring.listen_fd;
+  fds[0].events = fds[1].events = POLLIN;
+  start = now_ms();
+  for (int p = 0; p < producers; p++) {
+    if (fork() == 0) produce_ring(messages, rate);
+  }
+  while (result.received < total) {
+    if (poll(fds, 2, busy ? 0 : BENCH_IDLE_MS) == 0 && !busy) break;
+    if (fds[1].revents & POLLIN) shm_ring_serve(&ring);
+    busy = shm_ring_pop(&ring, on_ring, &result) == SHM_RING_BATCH;
+  }
+  while (wait(NULL) > 0) continue;
+  report("shm", rate, &result, total, start);
+  shm_ring_close(&ring);
+}
+
+static void produce_mqtt(const char *host, unsigned long messages, int rate) {
+  char payload[BENCH_PAYLOAD] = {0};
+  double start = now_ms(), sent;
+  struct mosquitto *mosq;
+
+  mosq = mosquitto_new(NULL, true, NULL);
+  if (!mosq || mosquitto_connect(mosq, host, BENCH_PORT, 60)) {
+    fprintf(stderr, "Error: Unable to connect to %s.\n", host);
+    _exit(EXIT_FAILURE);
+  }
+  for (unsigned long i = 0; i < messages; i++) {
+    pace(start, i, rate);
+    sent = now_ms();
+    memcpy(payload, &sent, sizeof(double));
+    // Written straight away unless the socket is full, the loop then writes what is left
+    if (mosquitto_publish(mosq, NULL, BENCH_TOPIC, sizeof(payload), payload, 0, false) != MOSQ_ERR_SUCCESS) break;
+    if (i % SHM_RING_BATCH == 0 && mosquitto_loop(mosq, 0, 1) != MOSQ_ERR_SUCCESS) break;
+  }
+  while (mosquitto_want_write(mosq) && mosquitto_loop(mosq, 10, 1) == MOSQ_ERR_SUCCESS) continue;
+  mosquitto_disconnect(mosq);
+  mosquitto_destroy(mosq);
+  _exit(EXIT_SUCCESS);
+}
+
+static void on_subscribe(struct mosquitto *mosq, void *userdata, int mid, int qos_count, const int *granted_qos) {
+  ((result_t *)userdata)->subscribed = true;
+}
+
+static void on_message(struct mosquitto *mosq, void *userdata, const struct mosquitto_message *message) {
+  record((result_t *)userdata, message->payload, message->payloadlen);
+}
+
+/* The same with the broker in between, both hops over loopback TCP at QoS 0. */
+static void run_mqtt(const char *host, int producers, unsigned long messages, int rate) {
+  unsigned long total = producers * messages;
+  result_t result = {0};
+  struct mosquitto *mosq;
+  double start, now;
+
+  mosq = mosquitto_new(NULL, true, &result);
+  if (!mosq) {
+    fprintf(stderr, "Error: Out of memory.\n");
+    return;
+  }
+  mosquitto_subscribe_callback_set(mosq, on_subscribe);
+  mosquitto_message_callback_set(mosq, on_message);
+  if (mosquitto_connect(mosq, host, BENCH_PORT, 60) || mosquitto_subscribe(mosq, NULL, BENCH_TOPIC, 0)) {
+    printf("mqtt: no broker at %s:%d, skipped\n", host, BENCH_PORT);
+    mosquitto_destroy(mosq);
+    return;
+  }
+  while (!result.subscribed && mosquitto_loop(mosq, 100, 1) == MOSQ_ERR_SUCCESS) continue;
+
+  start = now_ms();
+  for (int p = 0; p < producers; p++) {
+    if (fork() == 0) produce_mqtt(host, messages, rate);
+  }
+  while (result.received < total && mosquitto_loop(mosq, 100, 1) == MOSQ_ERR_SUCCESS) {
+    now = now_ms();
+    if (now - (result.last > start ? result.last : start) > BENCH_IDLE_MS) break;
+  }
+  while (wait(NULL) > 0) continue;
+  report("mqtt", rate, &result, total, start);
+  mosquitto_disconnect(mosq);
+  mosquitto_destroy(mosq);
+}
+
+/* Usage: shm_bench [producers] [messages] [broker host]
+ * Forks the producers, each sending the messages to a consumer in this process through the local ring, first paced
+ * at BENCH_PACED_RATE per second each to see the latency, at most BENCH_PACED_MESSAGES of them, then as fast as they
+ * can to see the throughput. With a broker host the same runs go through the broker for comparison. */
+int main(int argc, char *argv[]) {
+  int producers = argc > 1 ? atoi(argv[1]) : 2;
+  long messages = argc > 2 ? atol(argv[2]) : 100000;
+  const char *host = argc > 3 ? argv[3] : NULL;
+
+  if (producers <= 0 || messages <= 0) {
+    fprintf(stderr, "Usage: shm_bench [producers] [messages] [broker host]\n");
+    return EXIT_FAILURE;
+  }
+  printf("%d producers, %ld messages of %d bytes each\n", producers, messages, BENCH_PAYLOAD);
+  run_ring(producers, messages < BENCH_PACED_MESSAGES ? messages : BENCH_PACED_MESSAGES, BENCH_PACED_RATE);
+  run_ring(producers, messages, 0);
+  if (host) {
+    mosquitto_lib_init();
+    run_mqtt(host, producers, messages < BENCH_PACED_MESSAGES ? messages : BENCH_PACED_MESSAGES, BENCH_PACED_RATE);
+    run_mqtt(host, producers, messages, 0);
+    mosquitto_lib_cleanup();
+  }
+  return EXIT_SUCCESS;
+}
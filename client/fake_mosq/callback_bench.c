@@ -0,0 +1,211 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "client_common.h"
+#include "dedup_cache.h"
+#include "fake_mosquitto.h"
+#include "pub_utils.h"
+#include "sub_utils.h"
+#include "value_cache.h"
+
+#define BENCH_EVENTS 1000000
+#define BENCH_DEVICES 64
+#define BENCH_SEQ_SCRIPT (2 * DEDUP_DEFAULT_CAPACITY)  // replays of the script mostly miss the dedup cache
+
+typedef struct bench_client_s {
+  struct mosquitto *mosq;
+  mosq_config_t cfg;
+} bench_client_t;
+
+static double now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void report(FILE *out, const char *name, unsigned long events, double ms, unsigned long allocs,
+                   unsigned long callbacks) {
+  fprintf(out, "  %-30s %8.1f ns/event %6.2f allocs/event %5.2f callbacks/event\n", name, ms * 1e6 / events,
+          (double)allocs / events, (double)callbacks / events);
+}
+
+/* Replays the script until `events` scripted events went through the callbacks, after a tenth of that as warm-up so
+ * caches and lazily created state exist before the measurement. */
+static void run_script(FILE *out, bench_client_t *client, const char *name, const fake_event_t *script, int count,
+                       unsigned long events) {
+  const fake_stats_t *stats = fake_mosq_stats(client->mosq);
+  unsigned long allocs, callbacks;
+  double start;
+
+  fake_mosq_script(client->mosq, script, count, 0);
+  fake_mosq_run(client->mosq, events / 10 + 1);
+  allocs = fake_mosq_allocs();
+  callbacks = stats->callbacks;
+  start = now_ms();
+  fake_mosq_run(client->mosq, events);
+  report(out, name, events, now_ms() - start, fake_mosq_allocs() - allocs, stats->callbacks - callbacks);
+  fake_mosq_script(client->mosq, NULL, 0, 0);
+}
+
+/* publish_message() and the PUBACK the fake answers with, as in the publisher's repeat loop. */
+static void run_publish(FILE *out, bench_client_t *client, unsigned long events) {
+  mosq_config_t *cfg = &client->cfg;
+  const fake_stats_t *stats = fake_mosq_stats(client->mosq);
+  unsigned long allocs, callbacks;
+  double start;
+
+  allocs = fake_mosq_allocs();
+  callbacks = stats->callbacks;
+  start = now_ms();
+  for (unsigned long i = 0; i < events; i++) {
+    publish_message(client->mosq, cfg, &cfg->pub_config->mid_sent, cfg->pub_config->topic, cfg->pub_config->msglen,
+                    cfg->pub_config->message, cfg->general_config->qos, cfg->general_config->retain);
+    fake_mosq_run(client->mosq, 0);
+  }
+  report(out, "publish_message + PUBACK", events, now_ms() - start, fake_mosq_allocs() - allocs,
+         stats->callbacks - callbacks);
+}
+
+/* Configured as sub_client is, with one topic per device and MQTT v5 for the user properties. */
+static int sub_client_init(bench_client_t *client) {
+  mosq_config_t *cfg = &client->cfg;
+  char topic[128];
+
+  init_mosq_config(cfg, client_sub);
+  cfg->general_config->host = cfg_strdup(cfg, HOST);
+  cfg->general_config->qos = 1;
+  cfg->general_config->protocol_version = MQTT_PROTOCOL_V5;
+  for (int i = 0; i < BENCH_DEVICES; i++) {
+    snprintf(topic, sizeof(topic), "%s/dev%03d/up", TOPIC, i);
+    if (cfg_add_topic(cfg, client_sub, topic)) return -1;
+  }
+  client->mosq = mosquitto_new(NULL, true, cfg);
+  if (!client->mosq || mosq_opts_set(client->mosq, cfg)) return -1;
+  mosquitto_subscribe_callback_set(client->mosq, subscribe_callback_sub_func);
+  mosquitto_unsubscribe_callback_set(client->mosq, unsubscribe_callback_sub_func);
+  mosquitto_connect_v5_callback_set(client->mosq, connect_callback_sub_func);
+  mosquitto_message_v5_callback_set(client->mosq, message_callback_sub_func);
+  fake_mosq_auto_ack(client->mosq, true);
+  if (mosq_client_connect(client->mosq, cfg)) return -1;
+  fake_mosq_run(client->mosq, 0);
+  return 0;
+}
+
+/* Configured as pub_client is, in the repeat mode where a PUBACK does not end the session. */
+static int pub_client_init(bench_client_t *client) {
+  mosq_config_t *cfg = &client->cfg;
+
+  init_mosq_config(cfg, client_pub);
+  cfg->general_config->host = cfg_strdup(cfg, HOST);
+  cfg->general_config->qos = 1;
+  if (cfg_add_topic(cfg, client_pub, TOPIC)) return -1;
+  cfg->pub_config->message = cfg_strdup(cfg, MESSAGE);
+  cfg->pub_config->msglen = strlen(MESSAGE);
+  cfg->pub_config->pub_mode = MSGMODE_CMD;
+  cfg->pub_config->disconnect_sent = true;
+  client->mosq = mosquitto_new(NULL, true, cfg);
+  if (!client->mosq || mosq_opts_set(client->mosq, cfg)) return -1;
+  mosquitto_connect_v5_callback_set(client->mosq, connect_callback_pub_func);
+  mosquitto_disconnect_v5_callback_set(client->mosq, disconnect_callback_pub_func);
+  mosquitto_publish_v5_callback_set(client->mosq, publish_callback_pub_func);
+  mosquitto_message_v5_callback_set(client->mosq, message_callback_pub_func);
+  fake_mosq_auto_ack(client->mosq, true);
+  if (mosq_client_connect(client->mosq, cfg)) return -1;
+  fake_mosq_run(client->mosq, 0);
+  return 0;
+}
+
+static void client_cleanup(bench_client_t *client) {
+  mosquitto_destroy(client->mosq);
+  mosq_config_cleanup(&client->cfg);
+}
+
+/* Usage: callback_bench [events]
+ * Built against the fake libmosquitto, no broker is needed. Drives scripted CONNACK, PUBLISH and PUBACK events through
+ * the subscriber and publisher callbacks and reports time, allocations and callbacks per scripted event. What the
+ * callbacks print goes to /dev/null. The real library adds two allocations per received message, for the copies of
+ * topic and payload, which the fake does not make. */
+int main(int argc, char *argv[]) {
+  unsigned long events = argc > 1 ? strtoul(argv[1], NULL, 10) : BENCH_EVENTS;
+  bench_client_t sub = {0}, pub = {0};
+  fake_event_t connack = {.type = FAKE_CONNACK}, puback = {.type = FAKE_PUBACK};
+  fake_event_t *text = NULL, *json = NULL, *get = NULL;
+  char(*topics)[128] = NULL, (*payloads)[256] = NULL;
+  mosquitto_property **props = NULL;
+  char seq[16];
+  FILE *out;
+  int ret = EXIT_FAILURE;
+
+  out = fdopen(dup(STDOUT_FILENO), "w");
+  if (!out || !freopen("/dev/null", "w", stdout)) {
+    fprintf(stderr, "Error: Could not redirect the callbacks' output.\n");
+    return EXIT_FAILURE;
+  }
+  if (events == 0) events = 1;
+  mosquitto_lib_init();
+
+  text = calloc(BENCH_DEVICES, sizeof(fake_event_t));
+  get = calloc(BENCH_DEVICES, sizeof(fake_event_t));
+  json = calloc(BENCH_SEQ_SCRIPT, sizeof(fake_event_t));
+  topics = calloc(2 * BENCH_DEVICES, sizeof(*topics));
+  payloads = calloc(BENCH_SEQ_SCRIPT, sizeof(*payloads));
+  props = calloc(BENCH_SEQ_SCRIPT, sizeof(mosquitto_property *));
+  if (!text || !get || !json || !topics || !payloads || !props) {
+    fprintf(stderr, "Error: Out of memory.\n");
+    goto cleanup;
+  }
+  for (int i = 0; i < BENCH_DEVICES; i++) {
+    snprintf(topics[i], sizeof(topics[i]), "%s/dev%03d/up", TOPIC, i);
+    snprintf(topics[BENCH_DEVICES + i], sizeof(topics[i]), "%s/dev%03d/up%s", TOPIC, i, VCACHE_GET_SUFFIX);
+    text[i] = (fake_event_t){.type = FAKE_PUBLISH, .topic = topics[i], .payload = "21.5", .payloadlen = 4};
+    get[i] = (fake_event_t){.type = FAKE_PUBLISH, .topic = topics[BENCH_DEVICES + i]};
+  }
+  for (int i = 0; i < BENCH_SEQ_SCRIPT; i++) {
+    snprintf(seq, sizeof(seq), "%d", i);
+    if (mosquitto_property_add_string_pair(&props[i], MQTT_PROP_USER_PROPERTY, DEDUP_SEQ_PROPERTY, seq)) {
+      fprintf(stderr, "Error: Out of memory.\n");
+      goto cleanup;
+    }
+    json[i] = (fake_event_t){.type = FAKE_PUBLISH, .mid = i % 65535 + 1, .qos = 1, .props = props[i]};
+    json[i].topic = topics[i % BENCH_DEVICES];
+    json[i].payload = payloads[i];
+    json[i].payloadlen = snprintf(payloads[i], sizeof(payloads[i]),
+                                  "{\"dev\":\"dev%03d\",\"seq\":%d,\"temp\":%d.%d,\"hum\":%d,\"bat\":%d,\"ok\":true}",
+                                  i % BENCH_DEVICES, i, 15 + i % 20, i % 10, 40 + i % 50, 3000 + i % 600);
+  }
+
+  if (sub_client_init(&sub) || pub_client_init(&pub)) {
+    fprintf(stderr, "Error: Failed to set up the clients.\n");
+    goto cleanup;
+  }
+
+  fprintf(out, "subscriber, %d topics:\n", BENCH_DEVICES);
+  run_script(out, &sub, "CONNACK, clean session", &connack, 1, events);
+  connack.flags = 1;
+  run_script(out, &sub, "CONNACK, session present", &connack, 1, events);
+  run_script(out, &sub, "PUBLISH QoS 0, text", text, BENCH_DEVICES, events);
+  run_script(out, &sub, "PUBLISH QoS 1, JSON with seq", json, BENCH_SEQ_SCRIPT, events);
+  run_script(out, &sub, "PUBLISH GET, value cache hit", get, BENCH_DEVICES, events);
+  fprintf(out, "publisher:\n");
+  run_script(out, &pub, "PUBACK", &puback, 1, events);
+  run_publish(out, &pub, events);
+  ret = 0;
+
+cleanup:
+  if (sub.mosq) client_cleanup(&sub);
+  if (pub.mosq) client_cleanup(&pub);
+  for (int i = 0; props && i < BENCH_SEQ_SCRIPT; i++) {
+    mosquitto_property_free_all(&props[i]);
+  }
+  free(props);
+  free(payloads);
+  free(topics);
+  free(json);
+  free(get);
+  free(text);
+  mosquitto_lib_cleanup();
+  fclose(out);
+  return ret;
+}
@@ -0,0 +1,824 @@
+#include "fake_mosquitto.h"
+#include <errno.h>
+#include <mqtt_protocol.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FAKE_MAX_MID 65535
+#define FAKE_MAX_PAYLOAD 268435455  // largest remaining length MQTT can encode
+
+struct mqtt5__property {
+  struct mqtt5__property *next;
+  int identifier;
+  uint32_t number;  // byte, int16 and int32 values
+  char *name;       // string pairs
+  void *value;      // strings, terminated, and binary data
+  uint16_t len;
+};
+
+struct mosquitto {
+  void *userdata;
+  int protocol;
+  bool clean_session;
+  bool connected;
+  bool lost;     // the broker side went away, not a disconnect the client asked for
+  bool session;  // a CONNACK was accepted, the broker keeps a persistent session from then on
+  bool auto_ack;
+  int last_mid;
+  unsigned int max_inflight;
+  const fake_event_t *script;
+  int script_len;
+  int script_pos;
+  unsigned long repeat;
+  unsigned long pass;
+  fake_event_t acks[FAKE_MAX_ACKS];
+  int ack_head;
+  int ack_count;
+  fake_stats_t stats;
+  void (*on_connect)(struct mosquitto *, void *, int, int, const mosquitto_property *);
+  void (*on_disconnect)(struct mosquitto *, void *, int, const mosquitto_property *);
+  void (*on_publish)(struct mosquitto *, void *, int, int, const mosquitto_property *);
+  void (*on_message)(struct mosquitto *, void *, const struct mosquitto_message *, const mosquitto_property *);
+  void (*on_subscribe)(struct mosquitto *, void *, int, int, const int *);
+  void (*on_unsubscribe)(struct mosquitto *, void *, int);
+  void (*on_log)(struct mosquitto *, void *, int, const char *);
+};
+
+/* The target links with --wrap for these, so every allocation made by the client code and by the fake goes through
+ * here. Allocations glibc makes internally, such as stdio buffers, are not seen. */
+extern void *__real_malloc(size_t size);
+extern void *__real_calloc(size_t nmemb, size_t size);
+extern void *__real_realloc(void *ptr, size_t size);
+extern char *__real_strdup(const char *str);
+
+static unsigned long alloc_count;
+
+void *__wrap_malloc(size_t size) {
+  __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+  __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+  return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+  return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *str) {
+  __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+  return __real_strdup(str);
+}
+
+unsigned long fake_mosq_allocs(void) { return __atomic_load_n(&alloc_count, __ATOMIC_RELAXED); }
+
+/* Replays `events` `repeat` times, 0 repeats forever. */
+void fake_mosq_script(struct mosquitto *mosq, const fake_event_t *events, int count, unsigned long repeat) {
+  mosq->script = count > 0 ? events : NULL;
+  mosq->script_len = count;
+  mosq->script_pos = 0;
+  mosq->repeat = repeat;
+  mosq->pass = 0;
+}
+
+void fake_mosq_auto_ack(struct mosquitto *mosq, bool enable) { mosq->auto_ack = enable; }
+
+const fake_stats_t *fake_mosq_stats(const struct mosquitto *mosq) { return &mosq->stats; }
+
+static fake_event_t *queue_ack(struct mosquitto *mosq, fake_event_type_t type, int mid, int count, int qos) {
+  fake_event_t *ack;
+
+  if (mosq->ack_count == FAKE_MAX_ACKS) {
+    mosq->stats.dropped_acks++;
+    return NULL;
+  }
+  ack = &mosq->acks[(mosq->ack_head + mosq->ack_count++) % FAKE_MAX_ACKS];
+  memset(ack, 0, sizeof(fake_event_t));
+  ack->type = type;
+  ack->mid = mid;
+  ack->count = count;
+  ack->qos = qos;
+  return ack;
+}
+
+static int next_mid(struct mosquitto *mosq) {
+  mosq->last_mid = mosq->last_mid == FAKE_MAX_MID ? 1 : mosq->last_mid + 1;
+  return mosq->last_mid;
+}
+
+static void dispatch(struct mosquitto *mosq, const fake_event_t *event) {
+  struct mosquitto_message message;
+  int granted[FAKE_MAX_GRANTED];
+  int mid = event->mid ? event->mid : mosq->last_mid, count;
+
+  switch (event->type) {
+    case FAKE_CONNACK:
+      if (!event->rc) mosq->session = !mosq->clean_session;
+      if (mosq->on_connect) {
+        mosq->stats.callbacks++;
+        mosq->on_connect(mosq, mosq->userdata, event->rc, event->flags, event->props);
+      }
+      break;
+    case FAKE_PUBLISH:
+      // The real library hands over a copy of topic and payload, here the callback reads the script directly
+      message.mid = event->mid;
+      message.topic = (char *)event->topic;
+      message.payload = (void *)event->payload;
+      message.payloadlen = event->payloadlen;
+      message.qos = event->qos;
+      message.retain = event->retain;
+      if (mosq->on_message) {
+        mosq->stats.callbacks++;
+        mosq->on_message(mosq, mosq->userdata, &message, event->props);
+      }
+      break;
+    case FAKE_PUBACK:
+      if (mosq->on_publish) {
+        mosq->stats.callbacks++;
+        mosq->on_publish(mosq, mosq->userdata, mid, event->rc, event->props);
+      }
+      break;
+    case FAKE_SUBACK:
+      count = event->count < 1 ? 1 : event->count > FAKE_MAX_GRANTED ? FAKE_MAX_GRANTED : event->count;
+      for (int i = 0; i < count; i++) {
+        granted[i] = event->rc ? event->rc : event->qos;
+      }
+      if (mosq->on_subscribe) {
+        mosq->stats.callbacks++;
+        mosq->on_subscribe(mosq, mosq->userdata, mid, count, granted);
+      }
+      break;
+    case FAKE_UNSUBACK:
+      if (mosq->on_unsubscribe) {
+        mosq->stats.callbacks++;
+        mosq->on_unsubscribe(mosq, mosq->userdata, mid);
+      }
+      break;
+    case FAKE_DISCONNECT:
+      // Queued by mosquitto_disconnect_v5() the client is already offline, scripted ones come from the broker
+      if (mosq->connected) {
+        mosq->connected = false;
+        mosq->lost = true;
+        mosq->ack_count = 0;
+      }
+      if (mosq->on_disconnect) {
+        mosq->stats.callbacks++;
+        mosq->on_disconnect(mosq, mosq->userdata, event->rc, event->props);
+      }
+      break;
+  }
+}
+
+/* Delivers the oldest queued ack, or else the next scripted event. Returns false when there is neither. */
+bool fake_mosq_step(struct mosquitto *mosq) {
+  fake_event_t ack;
+  const fake_event_t *event;
+
+  if (mosq->ack_count) {
+    ack = mosq->acks[mosq->ack_head];
+    mosq->ack_head = (mosq->ack_head + 1) % FAKE_MAX_ACKS;
+    mosq->ack_count--;
+    dispatch(mosq, &ack);
+    return true;
+  }
+  if (!mosq->script || (mosq->repeat && mosq->pass >= mosq->repeat)) {
+    return false;
+  }
+  event = &mosq->script[mosq->script_pos];
+  if (++mosq->script_pos == mosq->script_len) {
+    mosq->script_pos = 0;
+    mosq->pass++;
+  }
+  dispatch(mosq, event);
+  return true;
+}
+
+/* Replays up to `max_events` scripted events regardless of the connection state, and the acks they cause. Returns the
+ * number of scripted events replayed. */
+unsigned long fake_mosq_run(struct mosquitto *mosq, unsigned long max_events) {
+  unsigned long replayed = 0;
+
+  while (replayed < max_events) {
+    while (mosq->ack_count) {
+      fake_mosq_step(mosq);
+    }
+    if (!fake_mosq_step(mosq)) {
+      break;
+    }
+    replayed++;
+  }
+  while (mosq->ack_count) {
+    fake_mosq_step(mosq);
+  }
+  return replayed;
+}
+
+int mosquitto_lib_init(void) { return MOSQ_ERR_SUCCESS; }
+
+int mosquitto_lib_cleanup(void) { return MOSQ_ERR_SUCCESS; }
+
+struct mosquitto *mosquitto_new(const char *id, bool clean_session, void *obj) {
+  struct mosquitto *mosq;
+
+  if (!clean_session && !id) {
+    errno = EINVAL;
+    return NULL;
+  }
+  mosq = calloc(1, sizeof(struct mosquitto));
+  if (!mosq) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  mosq->userdata = obj ? obj : mosq;
+  mosq->protocol = MQTT_PROTOCOL_V311;
+  mosq->clean_session = clean_session;
+  mosq->max_inflight = 20;
+  return mosq;
+}
+
+void mosquitto_destroy(struct mosquitto *mosq) { free(mosq); }
+
+void mosquitto_user_data_set(struct mosquitto *mosq, void *obj) { mosq->userdata = obj; }
+
+void *mosquitto_userdata(struct mosquitto *mosq) { return mosq->userdata; }
+
+int mosquitto_reconnect(struct mosquitto *mosq) {
+  fake_event_t *connack;
+
+  if (!mosq) return MOSQ_ERR_INVAL;
+  mosq->connected = true;
+  mosq->lost = false;
+  mosq->ack_count = 0;
+  mosq->stats.connects++;
+  if (mosq->auto_ack) {
+    connack = queue_ack(mosq, FAKE_CONNACK, 0, 0, 0);
+    if (connack) connack->flags = mosq->session;
+  }
+  return MOSQ_ERR_SUCCESS;
+}
+
+int mosquitto_connect_bind_v5(struct mosquitto *mosq, const char *host, int port, int keepalive,
+                              const char *bind_address, const mosquitto_property *properties) {
+  if (!mosq || !host || port < 0 || keepalive < 0) return MOSQ_ERR_INVAL;
+  if (properties && mosq->protocol != MQTT_PROTOCOL_V5) return MOSQ_ERR_NOT_SUPPORTED;
+  return mosquitto_reconnect(mosq);
+}
+
+int mosquitto_connect_srv(struct mosquitto *mosq, const char *host, int keepalive, const char *bind_address) {
+  return mosquitto_connect_bind_v5(mosq, host, 1883, keepalive, bind_address, NULL);
+}
+
+int mosquitto_disconnect_v5(struct mosquitto *mosq, int reason_code, const mosquitto_property *properties) {
+  if (!mosq) return MOSQ_ERR_INVAL;
+  if (!mosq->connected) return MOSQ_ERR_NO_CONN;
+  if (properties && mosq->protocol != MQTT_PROTOCOL_V5) return MOSQ_ERR_NOT_SUPPORTED;
+  mosq->connected = false;
+  mosq->ack_count = 0;
+  mosq->stats.disconnects++;
+  queue_ack(mosq, FAKE_DISCONNECT, 0, 0, 0);
+  return MOSQ_ERR_SUCCESS;
+}
+
+/* One packet per call, max_packets is unused as in libmosquitto. An exhausted script counts as a lost connection, so
+ * programs written against the real library end instead of spinning. */
+int mosquitto_loop(struct mosquitto *mosq, int timeout, int max_packets) {
+  if (!mosq) return MOSQ_ERR_INVAL;
+  if (!mosq->connected && !mosq->ack_count) {
+    return mosq->lost ? MOSQ_ERR_CONN_LOST : MOSQ_ERR_NO_CONN;
+  }
+  if (!fake_mosq_step(mosq)) {
+    mosq->connected = false;
+    mosq->lost = true;
+    if (mosq->on_disconnect) {
+      mosq->stats.callbacks++;
+      mosq->on_disconnect(mosq, mosq->userdata, MOSQ_ERR_CONN_LOST, NULL);
+    }
+    return MOSQ_ERR_CONN_LOST;
+  }
+  return MOSQ_ERR_SUCCESS;
+}
+
+/* Returns once the client disconnected, the real library would reconnect after a lost connection instead. */
+int mosquitto_loop_forever(struct mosquitto *mosq, int timeout, int max_packets) {
+  int ret;
+
+  if (!mosq) return MOSQ_ERR_INVAL;
+  if (!mosq->connected) return MOSQ_ERR_NO_CONN;
+  do {
+    ret = mosquitto_loop(mosq, timeout, max_packets);
+  } while (ret == MOSQ_ERR_SUCCESS);
+  return ret == MOSQ_ERR_NO_CONN ? MOSQ_ERR_SUCCESS : ret;
+}
+
+int mosquitto_publish_v5(struct mosquitto *mosq, int *mid, const char *topic, int payloadlen, const void *payload,
+                         int qos, bool retain, const mosquitto_property *properties) {
+  int new_mid;
+
+  if (!mosq || qos < 0 || qos > 2) return MOSQ_ERR_INVAL;
+  if (properties && mosq->protocol != MQTT_PROTOCOL_V5) return MOSQ_ERR_NOT_SUPPORTED;
+  if (!topic && !properties) return MOSQ_ERR_INVAL;
+  if (topic && mosquitto_pub_topic_check(topic)) return MOSQ_ERR_INVAL;
+  if (payloadlen < 0 || payloadlen > FAKE_MAX_PAYLOAD || (payloadlen && !payload)) return MOSQ_ERR_PAYLOAD_SIZE;
+  if (!mosq->connected && qos == 0) return MOSQ_ERR_NO_CONN;
+
+  new_mid = next_mid(mosq);
+  if (mid) *mid = new_mid;
+  mosq->stats.publishes++;
+  mosq->stats.published_bytes += payloadlen;
+  // QoS 0 messages get their publish callback from the library itself once they are written
+  if (mosq->connected && (qos == 0 || mosq->auto_ack)) {
+    queue_ack(mosq, FAKE_PUBACK, new_mid, 0, qos);
+  }
+  return MOSQ_ERR_SUCCESS;
+}
+
+int mosquitto_publish(struct mosquitto *mosq, int *mid, const char *topic, int payloadlen, const void *payload,
+                      int qos, bool retain) {
+  return mosquitto_publish_v5(mosq, mid, topic, payloadlen, payload, qos, retain, NULL);
+}
+
+int mosquitto_subscribe_multiple(struct mosquitto *mosq, int *mid, int sub_count, char *const *const sub, int qos,
+                                 int options, const mosquitto_property *properties) {
+  int new_mid;
+
+  if (!mosq || sub_count < 1 || !sub || qos < 0 || qos > 2) return MOSQ_ERR_INVAL;
+  if (properties && mosq->protocol != MQTT_PROTOCOL_V5) return MOSQ_ERR_NOT_SUPPORTED;
+  for (int i = 0; i < sub_count; i++) {
+    if (mosquitto_sub_topic_check(sub[i])) return MOSQ_ERR_INVAL;
+  }
+  if (!mosq->connected) return MOSQ_ERR_NO_CONN;
+
+  new_mid = next_mid(mosq);
+  if (mid) *mid = new_mid;
+  mosq->stats.subscribes += sub_count;
+  if (mosq->auto_ack) {
+    queue_ack(mosq, FAKE_SUBACK, new_mid, sub_count, qos);
+  }
+  return MOSQ_ERR_SUCCESS;
+}
+
+int mosquitto_subscribe_v5(struct mosquitto *mosq, int *mid, const char *sub, int qos, int options,
+                           const mosquitto_property *properties) {
+  return mosquitto_subscribe_multiple(mosq, mid, 1, (char *const *const)&sub, qos, options, properties);
+}
+
+int mosquitto_unsubscribe_multiple(struct mosquitto *mosq, int *mid, int sub_count, char *const *const sub,
+                                   const mosquitto_property *properties) {
+  int new_mid;
+
+  if (!mosq || sub_count < 1 || !sub) return MOSQ_ERR_INVAL;
+  if (properties && mosq->protocol != MQTT_PROTOCOL_V5) return MOSQ_ERR_NOT_SUPPORTED;
+  for (int i = 0; i < sub_count; i++) {
+    if (mosquitto_sub_topic_check(sub[i])) return MOSQ_ERR_INVAL;
+  }
+  if (!mosq->connected) return MOSQ_ERR_NO_CONN;
+
+  new_mid = next_mid(mosq);
+  if (mid) *mid = new_mid;
+  mosq->stats.unsubscribes += sub_count;
+  if (mosq->auto_ack) {
+    queue_ack(mosq, FAKE_UNSUBACK, new_mid, sub_count, 0);
+  }
+  return MOSQ_ERR_SUCCESS;
+}
+
+int mosquitto_unsubscribe_v5(struct mosquitto *mosq, int *mid, const char *sub, const mosquitto_property *properties) {
+  return mosquitto_unsubscribe_multiple(mosq, mid, 1, (char *const *const)&sub, properties);
+}
+
+int mosquitto_int_option(struct mosquitto *mosq, enum mosq_opt_t option, int value) {
+  if (!mosq) return MOSQ_ERR_INVAL;
+  if (option == MOSQ_OPT_PROTOCOL_VERSION) {
+    if (value != MQTT_PROTOCOL_V31 && value != MQTT_PROTOCOL_V311 && value != MQTT_PROTOCOL_V5) return MOSQ_ERR_INVAL;
+    mosq->protocol = value;
+  }
+  return MOSQ_ERR_SUCCESS;
+}
+
+int mosquitto_string_option(struct mosquitto *mosq, enum mosq_opt_t option, const char *value) {
+  return mosq ? MOSQ_ERR_SUCCESS : MOSQ_ERR_INVAL;
+}
+
+int mosquitto_void_option(struct mosquitto *mosq, enum mosq_opt_t option, void *value) {
+  return mosq ? MOSQ_ERR_SUCCESS : MOSQ_ERR_INVAL;
+}
+
+int mosquitto_max_inflight_messages_set(struct mosquitto *mosq, unsigned int max_inflight_messages) {
+  if (!mosq) return MOSQ_ERR_INVAL;
+  mosq->max_inflight = max_inflight_messages;
+  return MOSQ_ERR_SUCCESS;
+}
+
+int mosquitto_will_set_v5(struct mosquitto *mosq, const char *topic, int payloadlen, const void *payload, int qos,
+                          bool retain, mosquitto_property *properties) {
+  if (!mosq || !topic || mosquitto_pub_topic_check(topic) || qos < 0 || qos > 2) return MOSQ_ERR_INVAL;
+  if (payloadlen < 0 || payloadlen > FAKE_MAX_PAYLOAD) return MOSQ_ERR_PAYLOAD_SIZE;
+  return MOSQ_ERR_SUCCESS;
+}
+
+int mosquitto_username_pw_set(struct mosquitto *mosq, const char *username, const char *password) {
+  return mosq ? MOSQ_ERR_SUCCESS : MOSQ_ERR_INVAL;
+}
+
+/* There is no transport, TLS and proxy settings are accepted and ignored. */
+int mosquitto_tls_set(struct mosquitto *mosq, const char *cafile, const char *capath, const char *certfile,
+                      const char *keyfile, int (*pw_callback)(char *buf, int size, int rwflag, void *userdata)) {
+  return mosq ? MOSQ_ERR_SUCCESS : MOSQ_ERR_INVAL;
+}
+
+int mosquitto_tls_insecure_set(struct mosquitto *mosq, bool value) {
+  return mosq ? MOSQ_ERR_SUCCESS : MOSQ_ERR_INVAL;
+}
+
+int mosquitto_tls_opts_set(struct mosquitto *mosq, int cert_reqs, const char *tls_version, const char *ciphers) {
+  return mosq ? MOSQ_ERR_SUCCESS : MOSQ_ERR_INVAL;
+}
+
+int mosquitto_tls_psk_set(struct mosquitto *mosq, const char *psk, const char *identity, const char *ciphers) {
+  return mosq && psk && identity ? MOSQ_ERR_SUCCESS : MOSQ_ERR_INVAL;
+}
+
+int mosquitto_socks5_set(struct mosquitto *mosq, const char *host, int port, const char *username,
+                         const char *password) {
+  return mosq && host ? MOSQ_ERR_SUCCESS : MOSQ_ERR_INVAL;
+}
+
+void mosquitto_connect_v5_callback_set(struct mosquitto *mosq,
+                                       void (*on_connect)(struct mosquitto *, void *, int, int,
+                                                          const mosquitto_property *)) {
+  mosq->on_connect = on_connect;
+}
+
+void mosquitto_disconnect_v5_callback_set(struct mosquitto *mosq,
+                                          void (*on_disconnect)(struct mosquitto *, void *, int,
+                                                                const mosquitto_property *)) {
+  mosq->on_disconnect = on_disconnect;
+}
+
+void mosquitto_publish_v5_callback_set(struct mosquitto *mosq,
+                                       void (*on_publish)(struct mosquitto *, void *, int, int,
+                                                          const mosquitto_property *)) {
+  mosq->on_publish = on_publish;
+}
+
+void mosquitto_message_v5_callback_set(struct mosquitto *mosq,
+                                       void (*on_message)(struct mosquitto *, void *, const struct mosquitto_message *,
+                                                          const mosquitto_property *)) {
+  mosq->on_message = on_message;
+}
+
+void mosquitto_subscribe_callback_set(struct mosquitto *mosq,
+                                      void (*on_subscribe)(struct mosquitto *, void *, int, int, const int *)) {
+  mosq->on_subscribe = on_subscribe;
+}
+
+void mosquitto_unsubscribe_callback_set(struct mosquitto *mosq,
+                                        void (*on_unsubscribe)(struct mosquitto *, void *, int)) {
+  mosq->on_unsubscribe = on_unsubscribe;
+}
+
+void mosquitto_log_callback_set(struct mosquitto *mosq,
+                                void (*on_log)(struct mosquitto *, void *, int, const char *)) {
+  mosq->on_log = on_log;
+}
+
+const char *mosquitto_strerror(int mosq_errno) {
+  switch (mosq_errno) {
+    case MOSQ_ERR_SUCCESS:
+      return "No error.";
+    case MOSQ_ERR_NOMEM:
+      return "Out of memory.";
+    case MOSQ_ERR_PROTOCOL:
+      return "A network protocol error occurred when communicating with the broker.";
+    case MOSQ_ERR_INVAL:
+      return "Invalid function arguments provided.";
+    case MOSQ_ERR_NO_CONN:
+      return "The client is not currently connected.";
+    case MOSQ_ERR_CONN_REFUSED:
+      return "The connection was refused.";
+    case MOSQ_ERR_CONN_LOST:
+      return "The connection was lost.";
+    case MOSQ_ERR_PAYLOAD_SIZE:
+      return "Payload too large.";
+    case MOSQ_ERR_NOT_SUPPORTED:
+      return "This feature is not supported.";
+    case MOSQ_ERR_MALFORMED_UTF8:
+      return "Malformed UTF-8";
+    default:
+      return "Unknown error.";
+  }
+}
+
+const char *mosquitto_connack_string(int connack_code) {
+  switch (connack_code) {
+    case 0:
+      return "Connection Accepted.";
+    case 1:
+      return "Connection Refused: unacceptable protocol version.";
+    case 2:
+      return "Connection Refused: identifier rejected.";
+    case 3:
+      return "Connection Refused: broker unavailable.";
+    case 4:
+      return "Connection Refused: bad user name or password.";
+    case 5:
+      return "Connection Refused: not authorised.";
+    default:
+      return "Connection Refused: unknown reason.";
+  }
+}
+
+const char *mosquitto_reason_string(int reason_code) {
+  switch (reason_code) {
+    case MQTT_RC_SUCCESS:
+      return "Success";
+    case MQTT_RC_UNSPECIFIED:
+      return "Unspecified error";
+    case MQTT_RC_NOT_AUTHORIZED:
+      return "Not authorized";
+    case MQTT_RC_SERVER_UNAVAILABLE:
+      return "Server unavailable";
+    case MQTT_RC_QUOTA_EXCEEDED:
+      return "Quota exceeded";
+    default:
+      return "Unknown reason";
+  }
+}
+
+int mosquitto_validate_utf8(const char *str, int len) {
+  const unsigned char *s = (const unsigned char *)str;
+  uint32_t codepoint;
+  int i = 0, extra;
+
+  if (!str || len < 0 || len > 65535) return MOSQ_ERR_INVAL;
+  while (i < len) {
+    if (s[i] < 0x80) {
+      codepoint = s[i];
+      extra = 0;
+    } else if ((s[i] & 0xe0) == 0xc0) {
+      codepoint = s[i] & 0x1f;
+      extra = 1;
+    } else if ((s[i] & 0xf0) == 0xe0) {
+      codepoint = s[i] & 0x0f;
+      extra = 2;
+    } else if ((s[i] & 0xf8) == 0xf0) {
+      codepoint = s[i] & 0x07;
+      extra = 3;
+    } else {
+      return MOSQ_ERR_MALFORMED_UTF8;
+    }
+    if (len - i <= extra) return MOSQ_ERR_MALFORMED_UTF8;
+    for (int k = 1; k <= extra; k++) {
+      if ((s[i + k] & 0xc0) != 0x80) return MOSQ_ERR_MALFORMED_UTF8;
+      codepoint = codepoint << 6 | (s[i + k] & 0x3f);
+    }
+    // Overlong forms, surrogates, out of range and, as MQTT asks, control characters
+    if ((extra == 1 && codepoint < 0x80) || (extra == 2 && codepoint < 0x800) ||
+        (extra == 3 && (codepoint < 0x10000 || codepoint > 0x10ffff)) ||
+        (codepoint >= 0xd800 && codepoint <= 0xdfff) || codepoint <= 0x1f || (codepoint >= 0x7f && codepoint <= 0x9f)) {
+      return MOSQ_ERR_MALFORMED_UTF8;
+    }
+    i += extra + 1;
+  }
+  return MOSQ_ERR_SUCCESS;
+}
+
+int mosquitto_pub_topic_check(const char *topic) {
+  int len = 0;
+
+  if (!topic) return MOSQ_ERR_INVAL;
+  for (; topic[len]; len++) {
+    if (topic[len] == '+' || topic[len] == '#') return MOSQ_ERR_INVAL;
+  }
+  return len > 65535 ? MOSQ_ERR_INVAL : MOSQ_ERR_SUCCESS;
+}
+
+/* '+' has to fill a whole level and '#' the whole last level. */
+int mosquitto_sub_topic_check(const char *topic) {
+  int len = 0;
+
+  if (!topic) return MOSQ_ERR_INVAL;
+  for (char prev = '/'; topic[len]; prev = topic[len++]) {
+    if (topic[len] == '+' && (prev != '/' || (topic[len + 1] && topic[len + 1] != '/'))) return MOSQ_ERR_INVAL;
+    if (topic[len] == '#' && (prev != '/' || topic[len + 1])) return MOSQ_ERR_INVAL;
+  }
+  return len > 65535 ? MOSQ_ERR_INVAL : MOSQ_ERR_SUCCESS;
+}
+
+int mosquitto_topic_matches_sub(const char *sub, const char *topic, bool *result) {
+  if (!result) return MOSQ_ERR_INVAL;
+  *result = false;
+  if (!sub || !topic || !*sub || !*topic) return MOSQ_ERR_INVAL;
+  // Wildcards at the start of a filter do not match $SYS and other $ topics
+  if ((sub[0] == '$') != (topic[0] == '$')) return MOSQ_ERR_SUCCESS;
+
+  while (*sub) {
+    if (sub[0] == '#') {
+      *result = !sub[1];
+      return MOSQ_ERR_SUCCESS;
+    }
+    if (sub[0] == '+') {
+      while (*topic && *topic != '/') topic++;
+      sub++;
+    } else {
+      while (*sub && *sub != '/' && *sub == *topic) {
+        sub++;
+        topic++;
+      }
+      if ((*sub && *sub != '/') || (*topic && *topic != '/')) return MOSQ_ERR_SUCCESS;
+    }
+    if (!*sub) break;
+    if (!*topic) {
+      // "a/#" matches "a" as well
+      *result = !strcmp(sub, "/#");
+      return MOSQ_ERR_SUCCESS;
+    }
+    sub++;
+    topic++;
+  }
+  *result = !*topic;
+  return MOSQ_ERR_SUCCESS;
+}
+
+static int add_property(mosquitto_property **proplist, int identifier, uint32_t number, const char *name,
+                        const void *value, uint16_t len) {
+  mosquitto_property *prop, **tail;
+
+  if (!proplist) return MOSQ_ERR_INVAL;
+  prop = calloc(1, sizeof(mosquitto_property));
+  if (!prop) return MOSQ_ERR_NOMEM;
+  prop->identifier = identifier;
+  prop->number = number;
+  prop->len = len;
+  if (name) {
+    prop->name = malloc(strlen(name) + 1);
+    if (prop->name) strcpy(prop->name, name);
+  }
+  if (value) {
+    prop->value = malloc(len + 1);  // strings keep their terminator
+    if (prop->value) {
+      memcpy(prop->value, value, len);
+      ((char *)prop->value)[len] = '\0';
+    }
+  }
+  if ((name && !prop->name) || (value && !prop->value)) {
+    free(prop->name);
+    free(prop);
+    return MOSQ_ERR_NOMEM;
+  }
+  // Appended, the order of user properties is kept on the wire
+  for (tail = proplist; *tail; tail = &(*tail)->next) {
+  }
+  *tail = prop;
+  return MOSQ_ERR_SUCCESS;
+}
+
+int mosquitto_property_add_byte(mosquitto_property **proplist, int identifier, uint8_t value) {
+  return add_property(proplist, identifier, value, NULL, NULL, 0);
+}
+
+int mosquitto_property_add_int16(mosquitto_property **proplist, int identifier, uint16_t value) {
+  return add_property(proplist, identifier, value, NULL, NULL, 0);
+}
+
+int mosquitto_property_add_int32(mosquitto_property **proplist, int identifier, uint32_t value) {
+  return add_property(proplist, identifier, value, NULL, NULL, 0);
+}
+
+int mosquitto_property_add_binary(mosquitto_property **proplist, int identifier, const void *value, uint16_t len) {
+  return add_property(proplist, identifier, 0, NULL, value ? value : "", len);
+}
+
+int mosquitto_property_add_string(mosquitto_property **proplist, int identifier, const char *value) {
+  if (value && strlen(value) > 65535) return MOSQ_ERR_INVAL;
+  return add_property(proplist, identifier, 0, NULL, value ? value : "", value ? strlen(value) : 0);
+}
+
+int mosquitto_property_add_string_pair(mosquitto_property **proplist, int identifier, const char *name,
+                                       const char *value) {
+  if (!name || !value || strlen(name) > 65535 || strlen(value) > 65535) return MOSQ_ERR_INVAL;
+  return add_property(proplist, identifier, 0, name, value, strlen(value));
+}
+
+void mosquitto_property_free_all(mosquitto_property **proplist) {
+  mosquitto_property *prop, *next;
+
+  if (!proplist) return;
+  for (prop = *proplist; prop; prop = next) {
+    next = prop->next;
+    free(prop->name);
+    free(prop->value);
+    free(prop);
+  }
+  *proplist = NULL;
+}
+
+int mosquitto_property_copy_all(mosquitto_property **dest, const mosquitto_property *src) {
+  int rc = MOSQ_ERR_SUCCESS;
+
+  if (!dest) return MOSQ_ERR_INVAL;
+  *dest = NULL;
+  for (; src && !rc; src = src->next) {
+    rc = add_property(dest, src->identifier, src->number, src->name, src->value, src->len);
+  }
+  if (rc) mosquitto_property_free_all(dest);
+  return rc;
+}
+
+int mosquitto_property_check_all(int command, const mosquitto_property *properties) {
+  return MOSQ_ERR_SUCCESS;
+}
+
+static const mosquitto_property *find_property(const mosquitto_property *proplist, int identifier, bool skip_first) {
+  if (skip_first && proplist) proplist = proplist->next;
+  for (; proplist; proplist = proplist->next) {
+    if (proplist->identifier == identifier) return proplist;
+  }
+  return NULL;
+}
+
+// Returns a copy the caller frees, as libmosquitto does
+static void *copy_value(const void *value, size_t len) {
+  void *copy = malloc(len + 1);
+
+  if (copy) {
+    memcpy(copy, value, len);
+    ((char *)copy)[len] = '\0';
+  }
+  return copy;
+}
+
+const mosquitto_property *mosquitto_property_read_byte(const mosquitto_property *proplist, int identifier,
+                                                       uint8_t *value, bool skip_first) {
+  const mosquitto_property *prop = find_property(proplist, identifier, skip_first);
+
+  if (prop && value) *value = prop->number;
+  return prop;
+}
+
+const mosquitto_property *mosquitto_property_read_int16(const mosquitto_property *proplist, int identifier,
+                                                        uint16_t *value, bool skip_first) {
+  const mosquitto_property *prop = find_property(proplist, identifier, skip_first);
+
+  if (prop && value) *value = prop->number;
+  return prop;
+}
+
+const mosquitto_property *mosquitto_property_read_int32(const mosquitto_property *proplist, int identifier,
+                                                        uint32_t *value, bool skip_first) {
+  const mosquitto_property *prop = find_property(proplist, identifier, skip_first);
+
+  if (prop && value) *value = prop->number;
+  return prop;
+}
+
+const mosquitto_property *mosquitto_property_read_binary(const mosquitto_property *proplist, int identifier,
+                                                         void **value, uint16_t *len, bool skip_first) {
+  const mosquitto_property *prop = find_property(proplist, identifier, skip_first);
+
+  if (!prop) return NULL;
+  if (value) {
+    *value = copy_value(prop->value, prop->len);
+    if (!*value) return NULL;
+  }
+  if (len) *len = prop->len;
+  return prop;
+}
+
+const mosquitto_property *mosquitto_property_read_string(const mosquitto_property *proplist, int identifier,
+                                                         char **value, bool skip_first) {
+  const mosquitto_property *prop = find_property(proplist, identifier, skip_first);
+
+  if (!prop) return NULL;
+  if (value) {
+    *value = copy_value(prop->value, prop->len);
+    if (!*value) return NULL;
+  }
+  return prop;
+}
+
+const mosquitto_property *mosquitto_property_read_string_pair(const mosquitto_property *proplist, int identifier,
+                                                              char **name, char **value, bool skip_first) {
+  const mosquitto_property *prop = find_property(proplist, identifier, skip_first);
+
+  if (!prop) return NULL;
+  if (name) {
+    *name = copy_value(prop->name, strlen(prop->name));
+    if (!*name) return NULL;
+  }
+  if (value) {
+    *value = copy_value(prop->value, prop->len);
+    if (!*value) {
+      if (name) {
+        free(*name);
+        *name = NULL;
+      }
+      return NULL;
+    }
+  }
+  return prop;
+}
@@ -0,0 +1,58 @@
+#ifndef FAKE_MOSQUITTO_H
+#define FAKE_MOSQUITTO_H
+
+#include <mosquitto.h>
+#include <stdbool.h>
+
+/* In-memory stand-in for libmosquitto, linked instead of libmosquitto.so.1 (the `fake_mos_lib` target) so the client
+ * callbacks can be driven without a broker or a socket. Nothing happens on its own: incoming packets are a script of
+ * events that the program replays through mosquitto_loop()/mosquitto_loop_forever() or fake_mosq_run(), and with
+ * auto-ack the fake answers CONNECT, QoS 1/2 PUBLISH, SUBSCRIBE and UNSUBSCRIBE like a broker that accepts
+ * everything. Callbacks run on the caller's stack in a fixed order, so runs are deterministic. */
+#define FAKE_MAX_ACKS 1024    // queued broker answers, further ones are dropped and counted
+#define FAKE_MAX_GRANTED 256  // granted QoS values passed to one SUBACK callback
+
+typedef enum fake_event_type_s {
+  FAKE_CONNACK,
+  FAKE_PUBLISH,  // a message from the broker
+  FAKE_PUBACK,   // PUBACK or PUBCOMP, both end up in the publish callback
+  FAKE_SUBACK,
+  FAKE_UNSUBACK,
+  FAKE_DISCONNECT,
+} fake_event_type_t;
+
+/* One incoming packet. Acks with mid 0 refer to the newest mid the client was given. Strings, payload and properties
+ * are borrowed, the script has to outlive the replay. */
+typedef struct fake_event_s {
+  fake_event_type_t type;
+  int rc;     // CONNACK result, reason code of PUBACK and DISCONNECT, failure code of a SUBACK
+  int flags;  // CONNACK flags, 1 is session present
+  int mid;
+  int count;  // topics in a SUBACK
+  int qos;
+  bool retain;
+  const char *topic;
+  const void *payload;
+  int payloadlen;
+  const mosquitto_property *props;
+} fake_event_t;
+
+typedef struct fake_stats_s {
+  unsigned long callbacks;  // every callback the fake invoked
+  unsigned long connects;
+  unsigned long disconnects;
+  unsigned long publishes;
+  unsigned long published_bytes;
+  unsigned long subscribes;
+  unsigned long unsubscribes;
+  unsigned long dropped_acks;
+} fake_stats_t;
+
+void fake_mosq_script(struct mosquitto *mosq, const fake_event_t *events, int count, unsigned long repeat);
+void fake_mosq_auto_ack(struct mosquitto *mosq, bool enable);
+bool fake_mosq_step(struct mosquitto *mosq);
+unsigned long fake_mosq_run(struct mosquitto *mosq, unsigned long max_events);
+const fake_stats_t *fake_mosq_stats(const struct mosquitto *mosq);
+unsigned long fake_mosq_allocs(void);
+
+#endif
@@ -0,0 +1,257 @@
+#include "mqttsn_client.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static uint16_t next_msg_id(mqttsn_client_t *client) {
+  if (++client->next_msg_id == 0) client->next_msg_id = 1;
+  return client->next_msg_id;
+}
+
+static rc_mosq_retcode_t send_packet(mqttsn_client_t *client, const mqttsn_packet_t *pkt) {
+  unsigned char buf[MQTTSN_MAX_PACKET];
+  int len = mqttsn_encode(pkt, buf, sizeof(buf));
+
+  if (len < 0) {
+    fprintf(stderr, "Error: MQTT-SN packet does not fit into %d bytes.\n", MQTTSN_MAX_PACKET);
+    return RC_MOS_MESSAGE_SETTING;
+  }
+  if (send(client->sock, buf, len, 0) != len) {
+    fprintf(stderr, "Error: %s\n", strerror(errno));
+    return RC_MQTTSN_SOCKET;
+  }
+  client->bytes_sent += len;
+  client->packets_sent++;
+  return RC_MOS_OK;
+}
+
+static void handle_publish(mqttsn_client_t *client, const mqttsn_packet_t *pkt) {
+  mqttsn_packet_t ack = {.type = MQTTSN_PUBACK, .topic_id = pkt->topic_id, .msg_id = pkt->msg_id};
+
+  if (mqttsn_qos_from_flags(pkt->flags) == 1) {
+    send_packet(client, &ack);
+  }
+  if (client->on_message) {
+    client->on_message(client->userdata, pkt->topic_id, pkt->data, pkt->data_len);
+  }
+}
+
+/* Receives until a packet of `type` (and `msg_id` if non-zero) arrives, PUBLISH packets received meanwhile are handed to
+ * the message callback. The decoded packet points into `buf`. */
+static rc_mosq_retcode_t wait_for(mqttsn_client_t *client, uint8_t type, uint16_t msg_id, mqttsn_packet_t *pkt,
+                                  unsigned char *buf, int timeout_ms) {
+  struct pollfd pfd = {.fd = client->sock, .events = POLLIN};
+  int len;
+
+  while (poll(&pfd, 1, timeout_ms) > 0) {
+    len = recv(client->sock, buf, MQTTSN_MAX_PACKET, 0);
+    if (len <= 0) {
+      return RC_MQTTSN_SOCKET;
+    }
+    client->bytes_recv += len;
+    client->packets_recv++;
+    if (mqttsn_decode(buf, len, pkt)) {
+      continue;
+    }
+    if (pkt->type == type && (msg_id == 0 || pkt->msg_id == msg_id)) {
+      return RC_MOS_OK;
+    }
+    if (pkt->type == MQTTSN_PUBLISH) {
+      handle_publish(client, pkt);
+    }
+  }
+  return RC_MQTTSN_TIMEOUT;
+}
+
+static rc_mosq_retcode_t transact(mqttsn_client_t *client, const mqttsn_packet_t *req, uint8_t resp_type,
+                                  mqttsn_packet_t *resp, unsigned char *buf) {
+  rc_mosq_retcode_t ret = RC_MQTTSN_TIMEOUT;
+
+  for (int i = 0; i < MQTTSN_MAX_RETRIES && ret == RC_MQTTSN_TIMEOUT; i++) {
+    ret = send_packet(client, req);
+    if (ret) {
+      return ret;
+    }
+    ret = wait_for(client, resp_type, req->msg_id, resp, buf, MQTTSN_RETRY_TIMEOUT_MS);
+  }
+  return ret;
+}
+
+rc_mosq_retcode_t mqttsn_client_init(mqttsn_client_t *client, const char *host, int port, const char *client_id) {
+  struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM};
+  struct addrinfo *res;
+
+  memset(client, 0, sizeof(mqttsn_client_t));
+  client->sock = -1;
+  if (getaddrinfo(host, NULL, &hints, &res)) {
+    fprintf(stderr, "Error: Unable to resolve %s.\n", host);
+    return RC_MQTTSN_SOCKET;
+  }
+  memcpy(&client->gateway, res->ai_addr, sizeof(struct sockaddr_in));
+  client->gateway.sin_port = htons(port > 0 ? port : MQTTSN_DEFAULT_PORT);
+  freeaddrinfo(res);
+
+  client->sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (client->sock < 0 || connect(client->sock, (struct sockaddr *)&client->gateway, sizeof(client->gateway))) {
+    fprintf(stderr, "Error: %s\n", strerror(errno));
+    return RC_MQTTSN_SOCKET;
+  }
+  client->client_id = strdup(client_id);
+  if (!client->client_id) {
+    fprintf(stderr, "Error: Out of memory.\n");
+    return RC_MOS_INIT_ERROR;
+  }
+  return RC_MOS_OK;
+}
+
+void mqttsn_client_cleanup(mqttsn_client_t *client) {
+  if (client->sock >= 0) close(client->sock);
+  for (int i = 0; i < client->topic_count; i++) {
+    free(client->topics[i].name);
+  }
+  free(client->client_id);
+  client->sock = -1;
+  client->client_id = NULL;
+  client->topic_count = 0;
+}
+
+rc_mosq_retcode_t mqttsn_client_connect(mqttsn_client_t *client, uint16_t keepalive, bool clean_session) {
+  unsigned char buf[MQTTSN_MAX_PACKET];
+  mqttsn_packet_t resp;
+  mqttsn_packet_t req = {.type = MQTTSN_CONNECT,
+                         .flags = clean_session ? MQTTSN_FLAG_CLEAN : 0,
+                         .duration = keepalive,
+                         .str = client->client_id,
+                         .str_len = strlen(client->client_id)};
+  rc_mosq_retcode_t ret = transact(client, &req, MQTTSN_CONNACK, &resp, buf);
+
+  if (ret) {
+    return ret;
+  }
+  if (resp.return_code != MQTTSN_RC_ACCEPTED) {
+    fprintf(stderr, "Error: Gateway refused connection (%d).\n", resp.return_code);
+    return RC_MQTTSN_REJECTED;
+  }
+  return RC_MOS_OK;
+}
+
+static rc_mosq_retcode_t remember_topic(mqttsn_client_t *client, const char *topic, uint16_t topic_id) {
+  if (client->topic_count == MQTTSN_MAX_TOPICS) {
+    fprintf(stderr, "Error: Too many MQTT-SN topics.\n");
+    return RC_MOS_ADD_TOPIC;
+  }
+  client->topics[client->topic_count].name = strdup(topic);
+  client->topics[client->topic_count].id = topic_id;
+  client->topic_count++;
+  return RC_MOS_OK;
+}
+
+rc_mosq_retcode_t mqttsn_client_register(mqttsn_client_t *client, const char *topic, uint16_t *topic_id) {
+  unsigned char buf[MQTTSN_MAX_PACKET];
+  mqttsn_packet_t resp;
+  mqttsn_packet_t req = {.type = MQTTSN_REGISTER, .str = topic, .str_len = strlen(topic)};
+  rc_mosq_retcode_t ret;
+
+  for (int i = 0; i < client->topic_count; i++) {
+    if (!strcmp(client->topics[i].name, topic)) {
+      *topic_id = client->topics[i].id;
+      return RC_MOS_OK;
+    }
+  }
+
+  req.msg_id = next_msg_id(client);
+  ret = transact(client, &req, MQTTSN_REGACK, &resp, buf);
+  if (ret) {
+    return ret;
+  }
+  if (resp.return_code != MQTTSN_RC_ACCEPTED) {
+    fprintf(stderr, "Error: Gateway refused to register '%s' (%d).\n", topic, resp.return_code);
+    return RC_MQTTSN_REJECTED;
+  }
+  *topic_id = resp.topic_id;
+  return remember_topic(client, topic, resp.topic_id);
+}
+
+rc_mosq_retcode_t mqttsn_client_subscribe(mqttsn_client_t *client, const char *topic, int qos, uint16_t *topic_id) {
+  unsigned char buf[MQTTSN_MAX_PACKET];
+  mqttsn_packet_t resp;
+  mqttsn_packet_t req = {.type = MQTTSN_SUBSCRIBE,
+                         .flags = mqttsn_flags_from_qos(qos) | MQTTSN_TOPIC_NORMAL,
+                         .str = topic,
+                         .str_len = strlen(topic)};
+  rc_mosq_retcode_t ret;
+
+  req.msg_id = next_msg_id(client);
+  ret = transact(client, &req, MQTTSN_SUBACK, &resp, buf);
+  if (ret) {
+    return ret;
+  }
+  if (resp.return_code != MQTTSN_RC_ACCEPTED) {
+    fprintf(stderr, "Error: Gateway refused subscription to '%s' (%d).\n", topic, resp.return_code);
+    return RC_MQTTSN_REJECTED;
+  }
+  *topic_id = resp.topic_id;
+  return remember_topic(client, topic, resp.topic_id);
+}
+
+/* QoS -1 needs neither a connection nor a registered topic, only a predefined topic id. QoS 1 waits for the PUBACK. */
+rc_mosq_retcode_t mqttsn_client_publish(mqttsn_client_t *client, uint16_t topic_id, bool predefined,
+                                        const void *payload, int payloadlen, int qos, bool retain) {
+  unsigned char buf[MQTTSN_MAX_PACKET];
+  mqttsn_packet_t resp;
+  mqttsn_packet_t req = {.type = MQTTSN_PUBLISH, .topic_id = topic_id, .data = payload, .data_len = payloadlen};
+  rc_mosq_retcode_t ret;
+
+  if (qos == 2) {
+    fprintf(stderr, "Error: MQTT-SN QoS 2 is not supported.\n");
+    return RC_MOS_MESSAGE_SETTING;
+  }
+  if (qos < 0 && !predefined) {
+    fprintf(stderr, "Error: QoS -1 requires a predefined topic id.\n");
+    return RC_MOS_MESSAGE_SETTING;
+  }
+  req.flags = mqttsn_flags_from_qos(qos) | (retain ? MQTTSN_FLAG_RETAIN : 0) |
+              (predefined ? MQTTSN_TOPIC_PREDEFINED : MQTTSN_TOPIC_NORMAL);
+  if (qos <= 0) {
+    return send_packet(client, &req);
+  }
+
+  req.msg_id = next_msg_id(client);
+  ret = transact(client, &req, MQTTSN_PUBACK, &resp, buf);
+  if (!ret && resp.return_code != MQTTSN_RC_ACCEPTED) {
+    fprintf(stderr, "Warning: Publish %d refused by gateway (%d).\n", req.msg_id, resp.return_code);
+    ret = RC_MQTTSN_REJECTED;
+  }
+  return ret;
+}
+
+/* The gateway buffers messages for the client until it wakes up or the sleep duration passes. */
+rc_mosq_retcode_t mqttsn_client_sleep(mqttsn_client_t *client, uint16_t duration) {
+  unsigned char buf[MQTTSN_MAX_PACKET];
+  mqttsn_packet_t resp;
+  mqttsn_packet_t req = {.type = MQTTSN_DISCONNECT, .duration = duration};
+
+  return transact(client, &req, MQTTSN_DISCONNECT, &resp, buf);
+}
+
+/* Delivers the messages buffered while asleep to the message callback, then returns to sleep on PINGRESP. */
+rc_mosq_retcode_t mqttsn_client_wake(mqttsn_client_t *client) {
+  unsigned char buf[MQTTSN_MAX_PACKET];
+  mqttsn_packet_t resp;
+  mqttsn_packet_t req = {.type = MQTTSN_PINGREQ, .str = client->client_id, .str_len = strlen(client->client_id)};
+
+  return transact(client, &req, MQTTSN_PINGRESP, &resp, buf);
+}
+
+rc_mosq_retcode_t mqttsn_client_disconnect(mqttsn_client_t *client) {
+  unsigned char buf[MQTTSN_MAX_PACKET];
+  mqttsn_packet_t resp;
+  mqttsn_packet_t req = {.type = MQTTSN_DISCONNECT};
+
+  return transact(client, &req, MQTTSN_DISCONNECT, &resp, buf);
+}
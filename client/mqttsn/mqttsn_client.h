@@ -0,0 +1,46 @@
+#ifndef MQTTSN_CLIENT_H
+#define MQTTSN_CLIENT_H
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include "client_common.h"
+#include "mqttsn_packet.h"
+
+#define MQTTSN_MAX_TOPICS 16
+#define MQTTSN_RETRY_TIMEOUT_MS 2000
+#define MQTTSN_MAX_RETRIES 3
+
+typedef void (*mqttsn_message_func_t)(void *userdata, uint16_t topic_id, const unsigned char *payload, int payloadlen);
+
+typedef struct mqttsn_topic_s {
+  char *name;
+  uint16_t id;
+} mqttsn_topic_t;
+
+typedef struct mqttsn_client_s {
+  int sock;
+  struct sockaddr_in gateway;
+  char *client_id;
+  uint16_t next_msg_id;
+  mqttsn_topic_t topics[MQTTSN_MAX_TOPICS];
+  int topic_count;
+  mqttsn_message_func_t on_message;
+  void *userdata;
+  unsigned long bytes_sent;
+  unsigned long bytes_recv;
+  unsigned long packets_sent;
+  unsigned long packets_recv;
+} mqttsn_client_t;
+
+rc_mosq_retcode_t mqttsn_client_init(mqttsn_client_t *client, const char *host, int port, const char *client_id);
+void mqttsn_client_cleanup(mqttsn_client_t *client);
+rc_mosq_retcode_t mqttsn_client_connect(mqttsn_client_t *client, uint16_t keepalive, bool clean_session);
+rc_mosq_retcode_t mqttsn_client_register(mqttsn_client_t *client, const char *topic, uint16_t *topic_id);
+rc_mosq_retcode_t mqttsn_client_subscribe(mqttsn_client_t *client, const char *topic, int qos, uint16_t *topic_id);
+rc_mosq_retcode_t mqttsn_client_publish(mqttsn_client_t *client, uint16_t topic_id, bool predefined,
+                                        const void *payload, int payloadlen, int qos, bool retain);
+rc_mosq_retcode_t mqttsn_client_sleep(mqttsn_client_t *client, uint16_t duration);
+rc_mosq_retcode_t mqttsn_client_wake(mqttsn_client_t *client);
+rc_mosq_retcode_t mqttsn_client_disconnect(mqttsn_client_t *client);
+
+#endif
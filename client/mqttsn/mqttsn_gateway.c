@@ -0,0 +1,502 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "client_common.h"
+#include "mqttsn_packet.h"
+
+#define MQTTSN_GW_MAX_CLIENTS 64
+#define MQTTSN_GW_MAX_TOPICS 256
+#define MQTTSN_GW_QUEUE_LEN 8
+#define MQTTSN_GW_MAX_PAYLOAD (MQTTSN_MAX_PACKET - 8)  // the 7-byte short PUBLISH header has a 1-byte length
+#define MQTTSN_GW_CLIENT_ID_LEN 24
+#define MQTTSN_GW_RECONNECT_MIN_SEC 1  // doubled after every failed attempt to reconnect to the broker
+#define MQTTSN_GW_RECONNECT_MAX_SEC 60
+
+typedef enum gw_session_state_s { SESSION_FREE, SESSION_ACTIVE, SESSION_ASLEEP } gw_session_state_t;
+
+typedef struct gw_pending_s {
+  uint16_t topic_id;
+  int len;
+  unsigned char payload[MQTTSN_GW_MAX_PAYLOAD];
+} gw_pending_t;
+
+typedef struct gw_session_s {
+  gw_session_state_t state;
+  struct sockaddr_in addr;
+  char client_id[MQTTSN_GW_CLIENT_ID_LEN];
+  uint16_t duration;  // keepalive while active, sleep duration while asleep, 0 for none
+  time_t expires;
+  uint8_t subs[MQTTSN_GW_MAX_TOPICS / 8];
+  gw_pending_t queue[MQTTSN_GW_QUEUE_LEN];
+  int queue_head;
+  int queue_count;
+} gw_session_t;
+
+typedef struct gw_topic_s {
+  char *name;
+  uint8_t type;  // MQTTSN_TOPIC_*, how PUBLISHes to clients name the topic
+  int subscribers;
+} gw_topic_t;
+
+typedef struct gateway_s {
+  int sock;
+  struct mosquitto *mosq;
+  gw_session_t sessions[MQTTSN_GW_MAX_CLIENTS];
+  gw_topic_t topics[MQTTSN_GW_MAX_TOPICS];
+  int topic_count;
+  int predefined;  // the first topic ids, known to clients without REGISTER
+  unsigned long udp_bytes_in;
+  unsigned long udp_bytes_out;
+  unsigned long publish_in;
+  unsigned long publish_out;
+  unsigned long mqtt_bytes;  // what the same publishes would have cost as MQTT over TCP
+  unsigned long dropped;
+} gateway_t;
+
+static volatile sig_atomic_t run = 1;
+
+static void stop_func(int signum) { run = 0; }
+
+static bool send_packet(gateway_t *gw, const struct sockaddr_in *addr, const mqttsn_packet_t *pkt) {
+  unsigned char buf[MQTTSN_MAX_PACKET];
+  int len = mqttsn_encode(pkt, buf, sizeof(buf));
+
+  if (len > 0 && sendto(gw->sock, buf, len, 0, (const struct sockaddr *)addr, sizeof(*addr)) == len) {
+    gw->udp_bytes_out += len;
+    return true;
+  }
+  return false;
+}
+
+/* Fixed MQTT header, topic length prefix, topic, packet id for QoS>0, payload, plus the PUBACK. */
+static int mqtt_publish_cost(const char *topic, int payloadlen, int qos) {
+  int remaining = 2 + strlen(topic) + (qos > 0 ? 2 : 0) + payloadlen;
+  return 1 + (remaining > 127 ? 2 : 1) + remaining + (qos > 0 ? 4 : 0);
+}
+
+static uint16_t add_topic(gateway_t *gw, const char *name, int name_len, uint8_t type) {
+  if (gw->topic_count == MQTTSN_GW_MAX_TOPICS) {
+    return 0;
+  }
+  gw->topics[gw->topic_count].name = strndup(name, name_len);
+  if (!gw->topics[gw->topic_count].name) {
+    return 0;
+  }
+  gw->topics[gw->topic_count].type = type;
+  return ++gw->topic_count;
+}
+
+static uint16_t find_topic(gateway_t *gw, const char *name, int name_len, bool create) {
+  for (int i = 0; i < gw->topic_count; i++) {
+    if ((int)strlen(gw->topics[i].name) == name_len && !memcmp(gw->topics[i].name, name, name_len)) {
+      return i + 1;
+    }
+  }
+  return create ? add_topic(gw, name, name_len, MQTTSN_TOPIC_NORMAL) : 0;
+}
+
+static const char *topic_name(gateway_t *gw, uint16_t topic_id) {
+  return (topic_id > 0 && topic_id <= gw->topic_count) ? gw->topics[topic_id - 1].name : NULL;
+}
+
+/* The topic of a PUBLISH or SUBSCRIBE by the topic id type in its flags: an id from REGISTER or SUBACK, one of the
+ * predefined ids, or a two character name carried in place of the id, which is written to `short_name`. */
+static const char *resolve_topic(gateway_t *gw, uint8_t flags, uint16_t topic_id, char *short_name) {
+  switch (flags & MQTTSN_FLAG_TOPIC_MASK) {
+    case MQTTSN_TOPIC_NORMAL:
+      return topic_name(gw, topic_id);
+    case MQTTSN_TOPIC_PREDEFINED:
+      return topic_id <= gw->predefined ? topic_name(gw, topic_id) : NULL;
+    case MQTTSN_TOPIC_SHORT:
+      short_name[0] = topic_id >> 8;
+      short_name[1] = topic_id & 0xff;
+      short_name[2] = '\0';
+      return short_name[0] && short_name[1] ? short_name : NULL;
+  }
+  return NULL;
+}
+
+static gw_session_t *find_session(gateway_t *gw, const struct sockaddr_in *addr) {
+  for (int i = 0; i < MQTTSN_GW_MAX_CLIENTS; i++) {
+    gw_session_t *session = &gw->sessions[i];
+    if (session->state != SESSION_FREE && session->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+        session->addr.sin_port == addr->sin_port) {
+      return session;
+    }
+  }
+  return NULL;
+}
+
+/* A device waking up from PSM usually comes back with a new address, so sessions are matched by client id too. */
+static gw_session_t *find_session_by_id(gateway_t *gw, const char *client_id, int len) {
+  for (int i = 0; i < MQTTSN_GW_MAX_CLIENTS; i++) {
+    gw_session_t *session = &gw->sessions[i];
+    if (session->state != SESSION_FREE && (int)strlen(session->client_id) == len &&
+        !memcmp(session->client_id, client_id, len)) {
+      return session;
+    }
+  }
+  return NULL;
+}
+
+static void free_session(gateway_t *gw, gw_session_t *session) {
+  for (int id = 1; id <= gw->topic_count; id++) {
+    if (session->subs[(id - 1) / 8] & (1 << ((id - 1) % 8))) {
+      if (--gw->topics[id - 1].subscribers == 0) {
+        mosquitto_unsubscribe(gw->mosq, NULL, gw->topics[id - 1].name);
+      }
+    }
+  }
+  memset(session, 0, sizeof(gw_session_t));
+}
+
+/* Every packet from the client shows it is still there, not just CONNECT and DISCONNECT. */
+static void touch_session(gw_session_t *session, time_t now) {
+  session->expires = session->duration ? now + session->duration * 3 / 2 : 0x7fffffff;
+}
+
+static void send_publish(gateway_t *gw, gw_session_t *session, uint16_t topic_id, const void *payload, int len) {
+  const gw_topic_t *topic = &gw->topics[topic_id - 1];
+  mqttsn_packet_t pkt = {
+      .type = MQTTSN_PUBLISH, .flags = topic->type, .topic_id = topic_id, .data = payload, .data_len = len};
+
+  if (topic->type == MQTTSN_TOPIC_SHORT) {
+    pkt.topic_id = (uint8_t)topic->name[0] << 8 | (uint8_t)topic->name[1];
+  }
+  if (send_packet(gw, &session->addr, &pkt)) {
+    gw->publish_out++;
+  } else {
+    gw->dropped++;
+  }
+}
+
+static void handle_connect(gateway_t *gw, gw_session_t *session, const struct sockaddr_in *addr,
+                           const mqttsn_packet_t *pkt) {
+  mqttsn_packet_t ack = {.type = MQTTSN_CONNACK, .return_code = MQTTSN_RC_ACCEPTED};
+
+  if (!session) {
+    session = find_session_by_id(gw, pkt->str, pkt->str_len);
+    for (int i = 0; i < MQTTSN_GW_MAX_CLIENTS && !session; i++) {
+      if (gw->sessions[i].state == SESSION_FREE) session = &gw->sessions[i];
+    }
+  }
+  if (!session || pkt->str_len >= MQTTSN_GW_CLIENT_ID_LEN) {
+    ack.return_code = MQTTSN_RC_CONGESTION;
+    send_packet(gw, addr, &ack);
+    return;
+  }
+  if (pkt->flags & MQTTSN_FLAG_CLEAN) {
+    free_session(gw, session);
+  }
+  session->state = SESSION_ACTIVE;
+  session->addr = *addr;
+  memcpy(session->client_id, pkt->str, pkt->str_len);
+  session->client_id[pkt->str_len] = '\0';
+  session->duration = pkt->duration;
+  touch_session(session, time(NULL));
+  send_packet(gw, addr, &ack);
+}
+
+static void handle_publish(gateway_t *gw, gw_session_t *session, const struct sockaddr_in *addr,
+                           const mqttsn_packet_t *pkt) {
+  mqttsn_packet_t ack = {.type = MQTTSN_PUBACK, .topic_id = pkt->topic_id, .msg_id = pkt->msg_id};
+  char short_name[3];
+  const char *topic = resolve_topic(gw, pkt->flags, pkt->topic_id, short_name);
+  int qos = mqttsn_qos_from_flags(pkt->flags);
+
+  gw->publish_in++;
+  if (!topic || (!session && qos >= 0)) {
+    ack.return_code = MQTTSN_RC_INVALID_TOPIC;
+  } else if (mosquitto_publish_v5(gw->mosq, NULL, topic, pkt->data_len, pkt->data, qos < 0 ? 0 : qos,
+                                  pkt->flags & MQTTSN_FLAG_RETAIN, NULL)) {
+    ack.return_code = MQTTSN_RC_CONGESTION;
+  } else {
+    gw->mqtt_bytes += mqtt_publish_cost(topic, pkt->data_len, qos);
+  }
+  if (qos > 0 || (qos == 0 && ack.return_code != MQTTSN_RC_ACCEPTED)) {
+    send_packet(gw, addr, &ack);
+  }
+}
+
+static void handle_subscribe(gateway_t *gw, gw_session_t *session, const struct sockaddr_in *addr,
+                             const mqttsn_packet_t *pkt) {
+  mqttsn_packet_t ack = {.type = MQTTSN_SUBACK, .flags = pkt->flags & MQTTSN_FLAG_QOS_MASK, .msg_id = pkt->msg_id};
+  const char *name = pkt->str;
+  int name_len = pkt->str_len;
+  uint16_t topic_id = 0;
+  char short_name[3];
+
+  if ((pkt->flags & MQTTSN_FLAG_TOPIC_MASK) == MQTTSN_TOPIC_SHORT) {
+    name = resolve_topic(gw, pkt->flags, pkt->topic_id, short_name);
+    name_len = name ? 2 : 0;
+  }
+  if (name && (memchr(name, '+', name_len) || memchr(name, '#', name_len))) {
+    ack.return_code = MQTTSN_RC_NOT_SUPPORTED;
+    send_packet(gw, addr, &ack);
+    return;
+  }
+  switch (pkt->flags & MQTTSN_FLAG_TOPIC_MASK) {
+    case MQTTSN_TOPIC_NORMAL:
+      topic_id = find_topic(gw, name, name_len, true);
+      break;
+    case MQTTSN_TOPIC_PREDEFINED:
+      topic_id = resolve_topic(gw, pkt->flags, pkt->topic_id, short_name) ? pkt->topic_id : 0;
+      break;
+    case MQTTSN_TOPIC_SHORT:
+      // Published back to the client under the same two characters
+      topic_id = name ? find_topic(gw, name, name_len, false) : 0;
+      if (name && !topic_id) topic_id = add_topic(gw, name, name_len, MQTTSN_TOPIC_SHORT);
+      break;
+  }
+  if (!session || !topic_name(gw, topic_id)) {
+    ack.return_code = MQTTSN_RC_INVALID_TOPIC;
+  } else if (!(session->subs[(topic_id - 1) / 8] & (1 << ((topic_id - 1) % 8)))) {
+    session->subs[(topic_id - 1) / 8] |= 1 << ((topic_id - 1) % 8);
+    if (gw->topics[topic_id - 1].subscribers++ == 0) {
+      mosquitto_subscribe(gw->mosq, NULL, gw->topics[topic_id - 1].name, 1);
+    }
+  }
+  ack.topic_id = topic_id;
+  send_packet(gw, addr, &ack);
+}
+
+static void handle_pingreq(gateway_t *gw, gw_session_t *session, const struct sockaddr_in *addr) {
+  mqttsn_packet_t resp = {.type = MQTTSN_PINGRESP};
+
+  if (session && session->state == SESSION_ASLEEP) {
+    while (session->queue_count > 0) {
+      gw_pending_t *pending = &session->queue[session->queue_head];
+      send_publish(gw, session, pending->topic_id, pending->payload, pending->len);
+      session->queue_head = (session->queue_head + 1) % MQTTSN_GW_QUEUE_LEN;
+      session->queue_count--;
+    }
+  }
+  send_packet(gw, addr, &resp);
+}
+
+static void handle_disconnect(gateway_t *gw, gw_session_t *session, const struct sockaddr_in *addr,
+                              const mqttsn_packet_t *pkt) {
+  mqttsn_packet_t resp = {.type = MQTTSN_DISCONNECT};
+
+  if (session) {
+    if (pkt->duration) {
+      session->state = SESSION_ASLEEP;
+      session->duration = pkt->duration;
+      touch_session(session, time(NULL));
+    } else {
+      free_session(gw, session);
+    }
+  }
+  send_packet(gw, addr, &resp);
+}
+
+static void handle_udp(gateway_t *gw) {
+  unsigned char buf[MQTTSN_MAX_PACKET];
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  mqttsn_packet_t pkt, resp = {0};
+  gw_session_t *session;
+  int len;
+
+  len = recvfrom(gw->sock, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&addr, &addr_len);
+  if (len <= 0) {
+    return;
+  }
+  gw->udp_bytes_in += len;
+  if (mqttsn_decode(buf, len, &pkt)) {
+    return;
+  }
+  session = find_session(gw, &addr);
+  if (pkt.type == MQTTSN_PINGREQ && pkt.str_len > 0) {
+    // The PINGREQ of a waking client names it, its buffered messages go to wherever it wakes up from
+    session = find_session_by_id(gw, pkt.str, pkt.str_len);
+    if (session) session->addr = addr;
+  }
+  if (session) touch_session(session, time(NULL));
+
+  switch (pkt.type) {
+    case MQTTSN_CONNECT:
+      handle_connect(gw, session, &addr, &pkt);
+      break;
+    case MQTTSN_REGISTER:
+      resp.type = MQTTSN_REGACK;
+      resp.msg_id = pkt.msg_id;
+      resp.topic_id = session ? find_topic(gw, pkt.str, pkt.str_len, true) : 0;
+      resp.return_code = resp.topic_id ? MQTTSN_RC_ACCEPTED : MQTTSN_RC_CONGESTION;
+      send_packet(gw, &addr, &resp);
+      break;
+    case MQTTSN_PUBLISH:
+      handle_publish(gw, session, &addr, &pkt);
+      break;
+    case MQTTSN_SUBSCRIBE:
+      handle_subscribe(gw, session, &addr, &pkt);
+      break;
+    case MQTTSN_PINGREQ:
+      handle_pingreq(gw, session, &addr);
+      break;
+    case MQTTSN_DISCONNECT:
+      handle_disconnect(gw, session, &addr, &pkt);
+      break;
+  }
+}
+
+static void message_callback_gw_func(struct mosquitto *mosq, void *obj, const struct mosquitto_message *message,
+                                     const mosquitto_property *properties) {
+  gateway_t *gw = (gateway_t *)obj;
+  uint16_t topic_id = find_topic(gw, message->topic, strlen(message->topic), false);
+  gw_session_t *session;
+  gw_pending_t *pending;
+
+  if (!topic_id || message->payloadlen > MQTTSN_GW_MAX_PAYLOAD) {
+    return;
+  }
+  for (int i = 0; i < MQTTSN_GW_MAX_CLIENTS; i++) {
+    session = &gw->sessions[i];
+    if (!(session->subs[(topic_id - 1) / 8] & (1 << ((topic_id - 1) % 8)))) continue;
+
+    if (session->state == SESSION_ACTIVE) {
+      send_publish(gw, session, topic_id, message->payload, message->payloadlen);
+    } else if (session->state == SESSION_ASLEEP) {
+      // Keep the newest messages for sleeping clients
+      if (session->queue_count == MQTTSN_GW_QUEUE_LEN) {
+        session->queue_head = (session->queue_head + 1) % MQTTSN_GW_QUEUE_LEN;
+        session->queue_count--;
+        gw->dropped++;
+      }
+      pending = &session->queue[(session->queue_head + session->queue_count) % MQTTSN_GW_QUEUE_LEN];
+      pending->topic_id = topic_id;
+      pending->len = message->payloadlen;
+      memcpy(pending->payload, message->payload, message->payloadlen);
+      session->queue_count++;
+    }
+  }
+}
+
+static void connect_callback_gw_func(struct mosquitto *mosq, void *obj, int result, int flags,
+                                     const mosquitto_property *properties) {
+  gateway_t *gw = (gateway_t *)obj;
+
+  if (result) {
+    fprintf(stderr, "%s\n", mosquitto_connack_string(result));
+    return;
+  }
+  for (int i = 0; i < gw->topic_count; i++) {
+    if (gw->topics[i].subscribers > 0) {
+      mosquitto_subscribe(mosq, NULL, gw->topics[i].name, 1);
+    }
+  }
+  printf("MQTT-SN gateway connected to broker.\n");
+}
+
+static void expire_sessions(gateway_t *gw, time_t now) {
+  for (int i = 0; i < MQTTSN_GW_MAX_CLIENTS; i++) {
+    if (gw->sessions[i].state != SESSION_FREE && gw->sessions[i].expires < now) {
+      free_session(gw, &gw->sessions[i]);
+    }
+  }
+}
+
+static void print_stats(gateway_t *gw) {
+  printf("MQTT-SN uplink: %lu publishes, %lu UDP bytes in, %lu UDP bytes out\n", gw->publish_in, gw->udp_bytes_in,
+         gw->udp_bytes_out);
+  printf("MQTT over TCP would have needed %lu bytes for the same publishes\n", gw->mqtt_bytes);
+  printf("MQTT-SN downlink: %lu publishes, %lu dropped for sleeping clients or failed to send\n", gw->publish_out,
+         gw->dropped);
+}
+
+int main(int argc, char *argv[]) {
+  rc_mosq_retcode_t ret = RC_MOS_OK;
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY)};
+  int backoff = MQTTSN_GW_RECONNECT_MIN_SEC;
+  time_t now, reconnect_at = 0;
+  struct pollfd pfd[2];
+  mosq_config_t cfg;
+  gateway_t gw;
+
+  memset(&gw, 0, sizeof(gw));
+  addr.sin_port = htons(argc > 1 ? atoi(argv[1]) : MQTTSN_DEFAULT_PORT);
+  signal(SIGINT, stop_func);
+  signal(SIGTERM, stop_func);
+
+  // Predefined topic ids, usable with QoS -1 without REGISTER
+  add_topic(&gw, TOPIC, strlen(TOPIC), MQTTSN_TOPIC_PREDEFINED);
+  add_topic(&gw, TOPIC_RES, strlen(TOPIC_RES), MQTTSN_TOPIC_PREDEFINED);
+  gw.predefined = gw.topic_count;
+
+  init_mosq_config(&cfg, client_pub);
+  mosquitto_lib_init();
+  cfg.general_config->host = strdup(HOST);
+  cfg.general_config->id_prefix = strdup("mqttsn_gw_");
+  if (generate_client_id(&cfg)) {
+    goto cleanup;
+  }
+
+  gw.sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (gw.sock < 0 || bind(gw.sock, (struct sockaddr *)&addr, sizeof(addr))) {
+    fprintf(stderr, "Error: %s\n", strerror(errno));
+    ret = RC_MQTTSN_SOCKET;
+    goto cleanup;
+  }
+
+  gw.mosq = mosquitto_new(cfg.general_config->id, true, &gw);
+  if (!gw.mosq || mosq_opts_set(gw.mosq, &cfg)) {
+    ret = RC_MOS_INIT_ERROR;
+    goto cleanup;
+  }
+  mosquitto_connect_v5_callback_set(gw.mosq, connect_callback_gw_func);
+  mosquitto_message_v5_callback_set(gw.mosq, message_callback_gw_func);
+  ret = mosq_client_connect(gw.mosq, &cfg);
+  if (ret) {
+    goto cleanup;
+  }
+
+  while (run) {
+    pfd[0].fd = gw.sock;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = mosquitto_socket(gw.mosq);
+    pfd[1].events = POLLIN | (mosquitto_want_write(gw.mosq) ? POLLOUT : 0);
+
+    if (poll(pfd, 2, 1000) < 0 && errno != EINTR) {
+      break;
+    }
+    if (pfd[0].revents & POLLIN) {
+      handle_udp(&gw);
+    }
+    // A read or write error closes the socket, the broker is then reconnected below
+    if (pfd[1].revents & (POLLIN | POLLERR | POLLHUP)) {
+      mosquitto_loop_read(gw.mosq, 1);
+    }
+    if (pfd[1].revents & POLLOUT && mosquitto_socket(gw.mosq) >= 0) {
+      mosquitto_loop_write(gw.mosq, 1);
+    }
+    mosquitto_loop_misc(gw.mosq);
+    now = time(NULL);
+    // Publishes from clients are answered with congestion until the broker is back
+    if (mosquitto_socket(gw.mosq) < 0 && now >= reconnect_at) {
+      if (mosquitto_reconnect(gw.mosq) == MOSQ_ERR_SUCCESS) {
+        backoff = MQTTSN_GW_RECONNECT_MIN_SEC;
+      } else {
+        fprintf(stderr, "Warning: Unable to reconnect to the broker, retrying in %d s.\n", backoff);
+        reconnect_at = now + backoff;
+        backoff = backoff * 2 < MQTTSN_GW_RECONNECT_MAX_SEC ? backoff * 2 : MQTTSN_GW_RECONNECT_MAX_SEC;
+      }
+    }
+    expire_sessions(&gw, now);
+  }
+  print_stats(&gw);
+
+cleanup:
+  if (gw.sock > 0) close(gw.sock);
+  for (int i = 0; i < gw.topic_count; i++) {
+    free(gw.topics[i].name);
+  }
+  mosquitto_destroy(gw.mosq);
+  mosquitto_lib_cleanup();
+  mosq_config_cleanup(&cfg);
+  return ret;
+}
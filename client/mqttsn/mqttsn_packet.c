@@ -0,0 +1,225 @@
+#include "mqttsn_packet.h"
+#include <string.h>
+
+static unsigned char *put_u16(unsigned char *buf, uint16_t val) {
+  buf[0] = val >> 8;
+  buf[1] = val & 0xff;
+  return buf + 2;
+}
+
+static uint16_t get_u16(const unsigned char *buf) { return (uint16_t)(buf[0] << 8 | buf[1]); }
+
+static int body_len(const mqttsn_packet_t *pkt) {
+  switch (pkt->type) {
+    case MQTTSN_CONNECT:
+      return 4 + pkt->str_len;
+    case MQTTSN_CONNACK:
+      return 1;
+    case MQTTSN_REGISTER:
+      return 4 + pkt->str_len;
+    case MQTTSN_REGACK:
+    case MQTTSN_PUBACK:
+      return 5;
+    case MQTTSN_PUBLISH:
+      return 5 + pkt->data_len;
+    case MQTTSN_SUBSCRIBE:
+      return 3 + ((pkt->flags & MQTTSN_FLAG_TOPIC_MASK) == MQTTSN_TOPIC_NORMAL ? pkt->str_len : 2);
+    case MQTTSN_SUBACK:
+      return 6;
+    case MQTTSN_PINGREQ:
+      return pkt->str_len;
+    case MQTTSN_PINGRESP:
+      return 0;
+    case MQTTSN_DISCONNECT:
+      return pkt->duration ? 2 : 0;
+  }
+  return -1;
+}
+
+/* Returns the encoded length, or -1 if the packet is unknown or does not fit into `buf`. */
+int mqttsn_encode(const mqttsn_packet_t *pkt, unsigned char *buf, int buf_len) {
+  int len = body_len(pkt);
+  unsigned char *p = buf;
+
+  if (len < 0) {
+    return -1;
+  }
+  len += (len + 2 > 255) ? 4 : 2;
+  if (len > buf_len || len > 0xffff) {
+    return -1;
+  }
+  if (len > 255) {
+    *p++ = 0x01;
+    p = put_u16(p, len);
+  } else {
+    *p++ = len;
+  }
+  *p++ = pkt->type;
+
+  switch (pkt->type) {
+    case MQTTSN_CONNECT:
+      *p++ = pkt->flags;
+      *p++ = MQTTSN_PROTOCOL_ID;
+      p = put_u16(p, pkt->duration);
+      memcpy(p, pkt->str, pkt->str_len);
+      break;
+    case MQTTSN_CONNACK:
+      *p++ = pkt->return_code;
+      break;
+    case MQTTSN_REGISTER:
+      p = put_u16(p, pkt->topic_id);
+      p = put_u16(p, pkt->msg_id);
+      memcpy(p, pkt->str, pkt->str_len);
+      break;
+    case MQTTSN_REGACK:
+    case MQTTSN_PUBACK:
+      p = put_u16(p, pkt->topic_id);
+      p = put_u16(p, pkt->msg_id);
+      *p++ = pkt->return_code;
+      break;
+    case MQTTSN_PUBLISH:
+      *p++ = pkt->flags;
+      p = put_u16(p, pkt->topic_id);
+      p = put_u16(p, pkt->msg_id);
+      memcpy(p, pkt->data, pkt->data_len);
+      break;
+    case MQTTSN_SUBSCRIBE:
+      *p++ = pkt->flags;
+      p = put_u16(p, pkt->msg_id);
+      if ((pkt->flags & MQTTSN_FLAG_TOPIC_MASK) == MQTTSN_TOPIC_NORMAL) {
+        memcpy(p, pkt->str, pkt->str_len);
+      } else {
+        p = put_u16(p, pkt->topic_id);
+      }
+      break;
+    case MQTTSN_SUBACK:
+      *p++ = pkt->flags;
+      p = put_u16(p, pkt->topic_id);
+      p = put_u16(p, pkt->msg_id);
+      *p++ = pkt->return_code;
+      break;
+    case MQTTSN_PINGREQ:
+      memcpy(p, pkt->str, pkt->str_len);
+      break;
+    case MQTTSN_DISCONNECT:
+      if (pkt->duration) p = put_u16(p, pkt->duration);
+      break;
+  }
+  return len;
+}
+
+/* The decoded packet points into `buf`, which must outlive it. Returns 0 on success, -1 for a malformed packet. */
+int mqttsn_decode(const unsigned char *buf, int len, mqttsn_packet_t *pkt) {
+  const unsigned char *p = buf;
+  int pkt_len, remaining;
+
+  memset(pkt, 0, sizeof(mqttsn_packet_t));
+  if (len < 2) {
+    return -1;
+  }
+  if (buf[0] == 0x01) {
+    if (len < 4) return -1;
+    pkt_len = get_u16(buf + 1);
+    p += 3;
+  } else {
+    pkt_len = buf[0];
+    p += 1;
+  }
+  if (pkt_len > len || pkt_len < (int)(p - buf) + 1) {
+    return -1;
+  }
+  pkt->type = *p++;
+  remaining = pkt_len - (int)(p - buf);
+
+  switch (pkt->type) {
+    case MQTTSN_CONNECT:
+      if (remaining < 4 || p[1] != MQTTSN_PROTOCOL_ID) return -1;
+      pkt->flags = p[0];
+      pkt->duration = get_u16(p + 2);
+      pkt->str = (const char *)p + 4;
+      pkt->str_len = remaining - 4;
+      break;
+    case MQTTSN_CONNACK:
+      if (remaining < 1) return -1;
+      pkt->return_code = p[0];
+      break;
+    case MQTTSN_REGISTER:
+      if (remaining < 5) return -1;
+      pkt->topic_id = get_u16(p);
+      pkt->msg_id = get_u16(p + 2);
+      pkt->str = (const char *)p + 4;
+      pkt->str_len = remaining - 4;
+      break;
+    case MQTTSN_REGACK:
+    case MQTTSN_PUBACK:
+      if (remaining < 5) return -1;
+      pkt->topic_id = get_u16(p);
+      pkt->msg_id = get_u16(p + 2);
+      pkt->return_code = p[4];
+      break;
+    case MQTTSN_PUBLISH:
+      if (remaining < 5) return -1;
+      pkt->flags = p[0];
+      pkt->topic_id = get_u16(p + 1);
+      pkt->msg_id = get_u16(p + 3);
+      pkt->data = p + 5;
+      pkt->data_len = remaining - 5;
+      break;
+    case MQTTSN_SUBSCRIBE:
+      // Flags, message id, then a topic name of at least one character or a two byte topic id
+      if (remaining < 4) return -1;
+      pkt->flags = p[0];
+      pkt->msg_id = get_u16(p + 1);
+      if ((pkt->flags & MQTTSN_FLAG_TOPIC_MASK) == MQTTSN_TOPIC_NORMAL) {
+        pkt->str = (const char *)p + 3;
+        pkt->str_len = remaining - 3;
+      } else {
+        if (remaining < 5) return -1;
+        pkt->topic_id = get_u16(p + 3);
+      }
+      break;
+    case MQTTSN_SUBACK:
+      if (remaining < 6) return -1;
+      pkt->flags = p[0];
+      pkt->topic_id = get_u16(p + 1);
+      pkt->msg_id = get_u16(p + 3);
+      pkt->return_code = p[5];
+      break;
+    case MQTTSN_PINGREQ:
+      pkt->str = (const char *)p;
+      pkt->str_len = remaining;
+      break;
+    case MQTTSN_PINGRESP:
+      break;
+    case MQTTSN_DISCONNECT:
+      if (remaining >= 2) pkt->duration = get_u16(p);
+      break;
+    default:
+      return -1;
+  }
+  return 0;
+}
+
+int mqttsn_qos_from_flags(uint8_t flags) {
+  switch (flags & MQTTSN_FLAG_QOS_MASK) {
+    case 0x00:
+      return 0;
+    case 0x20:
+      return 1;
+    case 0x40:
+      return 2;
+  }
+  return -1;
+}
+
+uint8_t mqttsn_flags_from_qos(int qos) {
+  switch (qos) {
+    case 0:
+      return 0x00;
+    case 1:
+      return 0x20;
+    case 2:
+      return 0x40;
+  }
+  return 0x60;
+}
@@ -0,0 +1,61 @@
+#ifndef MQTTSN_PACKET_H
+#define MQTTSN_PACKET_H
+
+#include <stdint.h>
+
+/* MQTT-SN v1.2 wire format, only the messages used by the client and the gateway are supported. */
+#define MQTTSN_DEFAULT_PORT 1885
+#define MQTTSN_MAX_PACKET 256
+#define MQTTSN_PROTOCOL_ID 0x01
+
+#define MQTTSN_CONNECT 0x04
+#define MQTTSN_CONNACK 0x05
+#define MQTTSN_REGISTER 0x0A
+#define MQTTSN_REGACK 0x0B
+#define MQTTSN_PUBLISH 0x0C
+#define MQTTSN_PUBACK 0x0D
+#define MQTTSN_SUBSCRIBE 0x12
+#define MQTTSN_SUBACK 0x13
+#define MQTTSN_PINGREQ 0x16
+#define MQTTSN_PINGRESP 0x17
+#define MQTTSN_DISCONNECT 0x18
+
+#define MQTTSN_FLAG_DUP 0x80
+#define MQTTSN_FLAG_QOS_MASK 0x60
+#define MQTTSN_FLAG_RETAIN 0x10
+#define MQTTSN_FLAG_WILL 0x08
+#define MQTTSN_FLAG_CLEAN 0x04
+#define MQTTSN_FLAG_TOPIC_MASK 0x03
+
+#define MQTTSN_TOPIC_NORMAL 0x00
+#define MQTTSN_TOPIC_PREDEFINED 0x01
+#define MQTTSN_TOPIC_SHORT 0x02
+
+#define MQTTSN_RC_ACCEPTED 0x00
+#define MQTTSN_RC_CONGESTION 0x01
+#define MQTTSN_RC_INVALID_TOPIC 0x02
+#define MQTTSN_RC_NOT_SUPPORTED 0x03
+
+/* Topic ids known to both sides without a REGISTER, required for QoS -1 */
+#define MQTTSN_PREDEFINED_TOPIC 1
+#define MQTTSN_PREDEFINED_TOPIC_RES 2
+
+typedef struct mqttsn_packet_s {
+  uint8_t type;
+  uint8_t flags;
+  uint8_t return_code;
+  uint16_t topic_id;
+  uint16_t msg_id;
+  uint16_t duration;
+  const char *str;  // client id, topic name
+  int str_len;
+  const unsigned char *data;  // publish payload
+  int data_len;
+} mqttsn_packet_t;
+
+int mqttsn_encode(const mqttsn_packet_t *pkt, unsigned char *buf, int buf_len);
+int mqttsn_decode(const unsigned char *buf, int len, mqttsn_packet_t *pkt);
+int mqttsn_qos_from_flags(uint8_t flags);
+uint8_t mqttsn_flags_from_qos(int qos);
+
+#endif
@@ -0,0 +1,173 @@
+#include <linux/tcp.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "client_common.h"
+#include "mqttsn_client.h"
+
+#define TCP_CONNECT_TIMEOUT_MS 5000
+
+typedef struct tcp_state_s {
+  bool connected;
+  int acked_mid;
+} tcp_state_t;
+
+static double elapsed_us(const struct timespec *start, const struct timespec *end) {
+  return (end->tv_sec - start->tv_sec) * 1e6 + (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+static void connect_callback(struct mosquitto *mosq, void *obj, int result) {
+  ((tcp_state_t *)obj)->connected = !result;
+}
+
+static void publish_callback(struct mosquitto *mosq, void *obj, int mid) { ((tcp_state_t *)obj)->acked_mid = mid; }
+
+/* What went over the broker connection so far, as counted by the kernel. Returns -1 where TCP_INFO is too old. */
+static int tcp_bytes(struct mosquitto *mosq, unsigned long *sent, unsigned long *recv) {
+  struct tcp_info info;
+  socklen_t len = sizeof(info);
+
+  if (getsockopt(mosquitto_socket(mosq), IPPROTO_TCP, TCP_INFO, &info, &len) ||
+      len < offsetof(struct tcp_info, tcpi_bytes_sent) + sizeof(info.tcpi_bytes_sent)) {
+    return -1;
+  }
+  *sent = info.tcpi_bytes_sent;
+  *recv = info.tcpi_bytes_received;
+  return 0;
+}
+
+/* The same publishes as MQTT over TCP straight to the broker, QoS -1 as QoS 0. Bytes are the MQTT bytes on the
+ * connection, like the UDP payload bytes counted for MQTT-SN. */
+static rc_mosq_retcode_t run_tcp(const char *host, int count, int qos) {
+  unsigned long setup_sent, setup_recv, sent, recv;
+  double total_us = 0, max_us = 0, us, waited;
+  struct timespec start, end;
+  tcp_state_t state = {0};
+  struct mosquitto *mosq = NULL;
+  rc_mosq_retcode_t ret;
+  mosq_config_t cfg;
+  int mid;
+
+  init_mosq_config(&cfg, client_pub);
+  mosquitto_lib_init();
+  cfg.general_config->host = strdup(host);
+  ret = generate_client_id(&cfg);
+  if (ret) {
+    goto done;
+  }
+  mosq = mosquitto_new(cfg.general_config->id, true, &state);
+  if (!mosq || mosq_opts_set(mosq, &cfg)) {
+    ret = RC_MOS_INIT_ERROR;
+    goto done;
+  }
+  mosquitto_connect_callback_set(mosq, connect_callback);
+  mosquitto_publish_callback_set(mosq, publish_callback);
+  ret = mosq_client_connect(mosq, &cfg);
+  for (waited = 0; !ret && !state.connected && waited < TCP_CONNECT_TIMEOUT_MS; waited += 100) {
+    ret = mosquitto_loop(mosq, 100, 1);
+  }
+  if (ret || !state.connected) {
+    fprintf(stderr, "Error: No broker at %s, MQTT over TCP skipped.\n", host);
+    ret = RC_CLIENT_CONNTECT;
+    goto done;
+  }
+  if (tcp_bytes(mosq, &setup_sent, &setup_recv)) {
+    fprintf(stderr, "Warning: The kernel does not count TCP bytes, only latency is measured.\n");
+    setup_sent = setup_recv = 0;
+  }
+
+  for (int i = 0; i < count && !ret; i++) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = mosquitto_publish(mosq, &mid, TOPIC, strlen(MESSAGE), MESSAGE, qos > 0 ? qos : 0, false);
+    while (!ret && qos > 0 && state.acked_mid != mid) {
+      ret = mosquitto_loop(mosq, 100, 1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    us = elapsed_us(&start, &end);
+    total_us += us;
+    if (us > max_us) max_us = us;
+  }
+  if (ret) {
+    fprintf(stderr, "Error: %s\n", mosquitto_strerror(ret));
+    goto done;
+  }
+  // QoS 0 returns as soon as the packet is queued, the rest is written before counting
+  while (mosquitto_want_write(mosq) && mosquitto_loop(mosq, 10, 1) == MOSQ_ERR_SUCCESS) continue;
+  if (setup_sent && !tcp_bytes(mosq, &sent, &recv)) {
+    printf("MQTT/TCP: %.1f bytes sent and %.1f bytes received per message, %lu bytes to connect\n",
+           (double)(sent - setup_sent) / count, (double)(recv - setup_recv) / count, setup_sent + setup_recv);
+  }
+  printf("MQTT/TCP latency per message: avg %.1f us, max %.1f us\n", total_us / count, max_us);
+  mosquitto_disconnect(mosq);
+
+done:
+  mosquitto_destroy(mosq);
+  mosquitto_lib_cleanup();
+  mosq_config_cleanup(&cfg);
+  return ret;
+}
+
+/* Usage: mqttsn_pub [gateway host] [count] [qos] [broker host]
+ * Publishes MESSAGE to TOPIC `count` times and reports bytes and latency per message. With QoS -1 the predefined topic
+ * id is used and no connection is set up at all. With a broker host the same messages are then published over MQTT
+ * to it for comparison, through the gateway's broker when both run on the same host. */
+int main(int argc, char *argv[]) {
+  const char *host = argc > 1 ? argv[1] : "localhost", *broker = argc > 4 ? argv[4] : NULL;
+  unsigned long setup_sent = 0, setup_recv = 0;
+  int count = argc > 2 ? atoi(argv[2]) : 1;
+  int qos = argc > 3 ? atoi(argv[3]) : 1;
+  struct timespec start, end;
+  mqttsn_client_t client;
+  char client_id[MQTTSN_MAX_PACKET];
+  rc_mosq_retcode_t ret;
+  uint16_t topic_id = MQTTSN_PREDEFINED_TOPIC;
+  double total_us = 0, max_us = 0, us;
+
+  if (count < 1) count = 1;
+  snprintf(client_id, sizeof(client_id), "mqttsn_pub_%d", getpid());
+  ret = mqttsn_client_init(&client, host, MQTTSN_DEFAULT_PORT, client_id);
+  if (ret) {
+    goto done;
+  }
+  if (qos >= 0) {
+    ret = mqttsn_client_connect(&client, 60, true);
+    if (!ret) ret = mqttsn_client_register(&client, TOPIC, &topic_id);
+    if (ret) {
+      goto done;
+    }
+  }
+  setup_sent = client.bytes_sent;
+  setup_recv = client.bytes_recv;
+
+  for (int i = 0; i < count; i++) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = mqttsn_client_publish(&client, topic_id, qos < 0, MESSAGE, strlen(MESSAGE), qos, false);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (ret) {
+      goto done;
+    }
+    us = elapsed_us(&start, &end);
+    total_us += us;
+    if (us > max_us) max_us = us;
+  }
+  if (qos >= 0) {
+    mqttsn_client_disconnect(&client);
+  }
+
+  printf("%d messages, QoS %d\n", count, qos);
+  printf("MQTT-SN: %.1f bytes sent and %.1f bytes received per message, %lu bytes to connect\n",
+         (double)(client.bytes_sent - setup_sent) / count, (double)(client.bytes_recv - setup_recv) / count,
+         setup_sent + setup_recv);
+  printf("MQTT-SN latency per message: avg %.1f us, max %.1f us\n", total_us / count, max_us);
+  if (broker) {
+    ret = run_tcp(broker, count, qos);
+  }
+
+done:
+  mqttsn_client_cleanup(&client);
+  return ret;
+}
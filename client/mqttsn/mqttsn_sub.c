@@ -0,0 +1,76 @@
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "client_common.h"
+#include "mqttsn_client.h"
+
+static volatile sig_atomic_t running = 1;
+
+static void stop_handler(int signum) { running = 0; }
+
+static void message_callback(void *userdata, uint16_t topic_id, const unsigned char *payload, int payloadlen) {
+  (*(unsigned long *)userdata)++;
+  printf("%u %.*s\n", topic_id, payloadlen, (const char *)payload);
+  fflush(stdout);
+}
+
+/* Usage: mqttsn_sub [gateway host] [topic] [period] [cycles]
+ * Subscribes to `topic`, TOPIC by default, and goes to sleep at the gateway, which then holds the messages for it.
+ * Every `period` seconds, 10 by default, it wakes up with a PINGREQ, takes what was held and sleeps again, for `cycles`
+ * wake-ups or until interrupted. Reports the bytes each wake-up cost next to the messages it brought. */
+int main(int argc, char *argv[]) {
+  const char *host = argc > 1 ? argv[1] : "localhost", *topic = argc > 2 ? argv[2] : TOPIC;
+  int period = argc > 3 ? atoi(argv[3]) : 10, cycles = argc > 4 ? atoi(argv[4]) : 0;
+  unsigned long received = 0, setup_sent, setup_recv;
+  char client_id[MQTTSN_MAX_PACKET];
+  mqttsn_client_t client;
+  rc_mosq_retcode_t ret;
+  uint16_t topic_id;
+  int woken = 0;
+
+  if (period < 1 || period > 0xffff / 2) {
+    fprintf(stderr, "Error: Invalid period %s.\n", argv[3]);
+    return RC_MOS_MESSAGE_SETTING;
+  }
+  snprintf(client_id, sizeof(client_id), "mqttsn_sub_%d", getpid());
+  ret = mqttsn_client_init(&client, host, MQTTSN_DEFAULT_PORT, client_id);
+  if (ret) {
+    goto done;
+  }
+  client.on_message = message_callback;
+  client.userdata = &received;
+  ret = mqttsn_client_connect(&client, 60, true);
+  if (!ret) ret = mqttsn_client_subscribe(&client, topic, 1, &topic_id);
+  // Twice the period, so the gateway keeps the session across a late wake-up
+  if (!ret) ret = mqttsn_client_sleep(&client, period * 2);
+  if (ret) {
+    goto done;
+  }
+  setup_sent = client.bytes_sent;
+  setup_recv = client.bytes_recv;
+
+  signal(SIGINT, stop_handler);
+  signal(SIGTERM, stop_handler);
+  while (running && (!cycles || woken < cycles)) {
+    sleep(period);
+    if (!running) break;
+    ret = mqttsn_client_wake(&client);
+    if (ret) {
+      goto done;
+    }
+    woken++;
+  }
+  mqttsn_client_disconnect(&client);
+
+  if (woken) {
+    printf("%d wake-ups, %lu messages on topic id %u\n", woken, received, topic_id);
+    printf("MQTT-SN: %.1f bytes sent and %.1f bytes received per wake-up, %lu bytes to connect and subscribe\n",
+           (double)(client.bytes_sent - setup_sent) / woken, (double)(client.bytes_recv - setup_recv) / woken,
+           setup_sent + setup_recv);
+  }
+
+done:
+  mqttsn_client_cleanup(&client);
+  return ret;
+}
@@ -0,0 +1,237 @@
+#include "link_emu.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* NB-IoT in good coverage, what a proxy without a scenario emulates. */
+static const link_params_t nbiot_up = {.latency_ms = 300, .jitter_ms = 100, .rate_bps = 20000, .loss = 0.01,
+                                       .burst = 2, .rto_ms = 1000, .mss = 1200, .queue = 32768};
+static const link_params_t nbiot_down = {.latency_ms = 300, .jitter_ms = 100, .rate_bps = 25000, .loss = 0.01,
+                                         .burst = 2, .rto_ms = 1000, .mss = 1200, .queue = 32768};
+
+void link_emu_init(link_emu_t *emu) {
+  memset(emu, 0, sizeof(link_emu_t));
+  emu->up = nbiot_up;
+  emu->down = nbiot_down;
+  emu->scenario.seed = 1;
+}
+
+static int set_param(link_params_t *params, const char *key, double value) {
+  if (!strcmp(key, "latency")) {
+    params->latency_ms = value;
+  } else if (!strcmp(key, "jitter")) {
+    params->jitter_ms = value;
+  } else if (!strcmp(key, "rate")) {
+    params->rate_bps = value;
+  } else if (!strcmp(key, "loss") && value <= 1) {
+    params->loss = value;
+  } else if (!strcmp(key, "burst") && value >= 1) {
+    params->burst = value;
+  } else if (!strcmp(key, "rto") && value > 0) {
+    params->rto_ms = value;
+  } else if (!strcmp(key, "mss") && value >= 1) {
+    params->mss = (int)value;
+  } else if (!strcmp(key, "queue") && value >= 1) {
+    params->queue = (int)value;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+/* Applies one `key=value`. Times are in ms, rate in bit/s, mss and queue in bytes, loss a probability per segment:
+ *   latency jitter rate loss burst rto mss queue  for both directions, or one with an `up.` or `down.` prefix
+ *   blackout_every blackout_for blackout_offset   in ms, blackout_reset 1 resets the connections
+ *   seed                                          of the random numbers, runs with the same seed and traffic match */
+int link_emu_set(link_emu_t *emu, const char *assignment) {
+  char key[64], *end;
+  const char *eq = strchr(assignment, '=');
+  double value;
+  int ret = 0;
+
+  if (!eq || eq == assignment || eq - assignment >= (int)sizeof(key)) return -1;
+  memcpy(key, assignment, eq - assignment);
+  key[eq - assignment] = '\0';
+  value = strtod(eq + 1, &end);
+  if (end == eq + 1 || *end || value < 0) return -1;
+
+  if (!strncmp(key, "up.", 3)) return set_param(&emu->up, key + 3, value);
+  if (!strncmp(key, "down.", 5)) return set_param(&emu->down, key + 5, value);
+  if (!strcmp(key, "blackout_every")) {
+    emu->blackout.every_ms = value;
+  } else if (!strcmp(key, "blackout_for")) {
+    emu->blackout.for_ms = value;
+  } else if (!strcmp(key, "blackout_offset")) {
+    emu->blackout.offset_ms = value;
+  } else if (!strcmp(key, "blackout_reset")) {
+    emu->blackout.reset = value != 0;
+  } else if (!strcmp(key, "seed")) {
+    emu->scenario.seed = (uint64_t)value;
+  } else {
+    ret = set_param(&emu->up, key, value);
+    if (!ret) ret = set_param(&emu->down, key, value);
+  }
+  return ret;
+}
+
+/* Applies every assignment of a step's line. */
+static int apply_line(link_emu_t *emu, const char *line) {
+  char copy[LINK_MAX_LINE], *token, *save;
+
+  snprintf(copy, sizeof(copy), "%s", line);
+  for (token = strtok_r(copy, " \t", &save); token; token = strtok_r(NULL, " \t", &save)) {
+    if (!strcmp(token, "loop")) continue;
+    if (link_emu_set(emu, token)) {
+      fprintf(stderr, "Error: Unknown or invalid setting %s.\n", token);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Reads a scenario: one step per line, `<seconds> <key>=<value>...` in time order, with `#` starting a comment. A step
+ * with `loop` among its settings starts the scenario over at its time. Nothing is applied before the first
+ * link_scenario_advance(). */
+int link_scenario_load(link_emu_t *emu, const char *path) {
+  link_scenario_t *scenario = &emu->scenario;
+  char line[LINK_MAX_LINE], *settings, *hash;
+  FILE *fp = fopen(path, "r");
+  link_emu_t scratch = *emu;
+  link_step_t *step;
+  int lineno = 0, ret = 0;
+  double at;
+
+  if (!fp) {
+    fprintf(stderr, "Error: Unable to open scenario %s.\n", path);
+    return -1;
+  }
+  while (!ret && fgets(line, sizeof(line), fp)) {
+    lineno++;
+    if ((hash = strchr(line, '#'))) *hash = '\0';
+    line[strcspn(line, "\r\n")] = '\0';
+    if (strspn(line, " \t") == strlen(line)) continue;
+    at = strtod(line, &settings);
+    if (settings == line || at < 0 || scenario->count == LINK_MAX_SCENARIO_STEPS ||
+        (scenario->count && at * 1000 < scenario->steps[scenario->count - 1].at_ms)) {
+      ret = -1;
+    } else {
+      // Checked on a copy now, so a mistake does not turn up hours into a run
+      ret = apply_line(&scratch, settings);
+    }
+    if (ret) {
+      fprintf(stderr, "Error: %s:%d is not `<seconds> <key>=<value>...` in time order.\n", path, lineno);
+      break;
+    }
+    step = &scenario->steps[scenario->count++];
+    step->at_ms = at * 1000;
+    snprintf(step->line, sizeof(step->line), "%s", settings + strspn(settings, " \t"));
+    if (strstr(step->line, "loop")) scenario->loop_ms = step->at_ms;
+  }
+  fclose(fp);
+  return ret;
+}
+
+/* Applies the steps that are due, the first call starts the scenario and its blackout schedule. Returns true when a
+ * step was applied. */
+bool link_scenario_advance(link_emu_t *emu, double now) {
+  link_scenario_t *scenario = &emu->scenario;
+  bool applied = false;
+
+  if (!scenario->started) scenario->started = now;
+  if (scenario->loop_ms > 0 && scenario->next == scenario->count && now - scenario->started >= scenario->loop_ms) {
+    scenario->started += scenario->loop_ms * floor((now - scenario->started) / scenario->loop_ms);
+    scenario->next = 0;
+  }
+  while (scenario->next < scenario->count && scenario->steps[scenario->next].at_ms <= now - scenario->started) {
+    printf("scenario %.1f s: %s\n", scenario->steps[scenario->next].at_ms / 1e3, scenario->steps[scenario->next].line);
+    apply_line(emu, scenario->steps[scenario->next++].line);
+    applied = true;
+  }
+  return applied;
+}
+
+/* When the next step is due, 0 when none is left. */
+double link_scenario_due(const link_emu_t *emu) {
+  const link_scenario_t *scenario = &emu->scenario;
+
+  if (scenario->next < scenario->count) return scenario->started + scenario->steps[scenario->next].at_ms;
+  return scenario->loop_ms > 0 ? scenario->started + scenario->loop_ms : 0;
+}
+
+/* Directions of different connections get different streams, all following from the scenario's seed. */
+void link_dir_init(link_dir_t *dir, const char *name, const link_params_t *params, uint64_t seed) {
+  memset(dir, 0, sizeof(link_dir_t));
+  dir->name = name;
+  dir->params = params;
+  // splitmix64, so neighbouring seeds give unrelated streams
+  seed += 0x9e3779b97f4a7c15ull;
+  seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ull;
+  seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebull;
+  dir->rng = (seed ^ (seed >> 31)) | 1;
+}
+
+/* Uniform in [0, 1), xorshift64*. */
+static double uniform(link_dir_t *dir) {
+  dir->rng ^= dir->rng >> 12;
+  dir->rng ^= dir->rng << 25;
+  dir->rng ^= dir->rng >> 27;
+  return ((dir->rng * 0x2545f4914f6cdd1dull) >> 11) * 0x1.0p-53;
+}
+
+bool link_blackout_at(const link_emu_t *emu, double now, double *ends) {
+  const link_blackout_t *blackout = &emu->blackout;
+  double t = now - emu->scenario.started - blackout->offset_ms, phase;
+
+  if (blackout->every_ms <= 0 || blackout->for_ms <= 0 || t < 0) return false;
+  phase = fmod(t, blackout->every_ms);
+  if (phase >= blackout->for_ms) return false;
+  *ends = now + blackout->for_ms - phase;
+  return true;
+}
+
+/* When a segment of `len` bytes read at `now` arrives at the other end. */
+double link_dir_schedule(link_dir_t *dir, const link_emu_t *emu, int len, double now) {
+  const link_params_t *params = dir->params;
+  double start = now > dir->link_free ? now : dir->link_free, rto = params->rto_ms, arrival, ends;
+  bool held = false;
+
+  // The radio does not send during a blackout either
+  if (link_blackout_at(emu, start, &ends)) {
+    start = ends;
+    held = true;
+  }
+  dir->link_free = start + (params->rate_bps > 0 ? len * 8e3 / params->rate_bps : 0);
+  arrival = dir->link_free + params->latency_ms + (uniform(dir) * 2 - 1) * params->jitter_ms;
+  if (arrival < dir->link_free) arrival = dir->link_free;
+  // Gilbert-Elliott: every transmission in the bad state is lost and sent again after the backed off timeout
+  for (;;) {
+    if (!dir->in_burst) {
+      dir->in_burst = params->loss > 0 && uniform(dir) < params->loss;
+    } else if (uniform(dir) < 1 / params->burst) {
+      dir->in_burst = false;
+    }
+    if (!dir->in_burst) break;
+    dir->lost++;
+    arrival += rto;
+    rto = rto * 2 < LINK_MAX_RTO_MS ? rto * 2 : LINK_MAX_RTO_MS;
+  }
+  // Segments on their way when a blackout starts are lost with it and resent when it ends
+  if (link_blackout_at(emu, arrival, &ends)) {
+    arrival = ends + params->latency_ms;
+    held = true;
+  }
+  if (arrival < dir->last_arrival) arrival = dir->last_arrival;
+  dir->last_arrival = arrival;
+  dir->segments++;
+  dir->bytes += len;
+  if (held) dir->held++;
+  dir->delay_ms += arrival - now;
+  if (arrival - now > dir->max_delay_ms) dir->max_delay_ms = arrival - now;
+  return arrival;
+}
+
+void link_dir_report(const link_dir_t *dir, FILE *out) {
+  fprintf(out, "  %-4s %7lu segments %9lu B, %5lu retransmitted, %4lu held by blackouts, delay avg %8.1f ms max %8.1f "
+          "ms\n", dir->name, dir->segments, dir->bytes, dir->lost, dir->held,
+          dir->segments ? dir->delay_ms / dir->segments : 0, dir->max_delay_ms);
+}
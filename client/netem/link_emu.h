@@ -0,0 +1,87 @@
+#ifndef LINK_EMU_H
+#define LINK_EMU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Model of one direction of an NB-IoT link, applied by nbproxy to the bytes of a TCP connection. Data is cut into
+ * segments of at most `mss` bytes. Each segment waits until the link is free, takes len * 8 / rate to send, then
+ * arrives `latency` plus a uniform jitter of up to +-`jitter` later. Segments never overtake each other, since TCP
+ * would hold them back anyway. Loss follows a Gilbert-Elliott model: a segment sent in the good state enters a burst
+ * with probability `loss`, a burst lasts `burst` segments on average, and every segment lost in a burst costs a
+ * retransmission timeout starting at `rto` and doubling as TCP's would, because the proxy can delay TCP data but
+ * never drop it. During a blackout nothing arrives, and with `blackout_reset` the connections are reset as well.
+ * At most `queue` bytes wait in the link, beyond that the proxy stops reading and the sender's TCP backs off. */
+#define LINK_MAX_SCENARIO_STEPS 256
+#define LINK_MAX_RTO_MS 60000.0
+#define LINK_MAX_LINE 512
+
+typedef struct link_params_s {
+  double latency_ms;
+  double jitter_ms;
+  double rate_bps;  // 0 is unlimited
+  double loss;      // chance that a segment starts a loss burst
+  double burst;     // mean length of a burst in segments
+  double rto_ms;
+  int mss;
+  int queue;  // bytes
+} link_params_t;
+
+/* Shared by both directions, a blackout cuts the whole link. */
+typedef struct link_blackout_s {
+  double every_ms;  // 0 disables blackouts
+  double for_ms;
+  double offset_ms;  // into the scenario, of the first one
+  bool reset;
+} link_blackout_t;
+
+typedef struct link_dir_s {
+  const char *name;
+  const link_params_t *params;  // the emulator's, so scenario steps apply to open connections too
+  uint64_t rng;
+  bool in_burst;
+  double link_free;     // when the segment being sent is through
+  double last_arrival;  // of the previous segment, later ones arrive after it
+  unsigned long segments;
+  unsigned long bytes;
+  unsigned long lost;  // retransmissions
+  unsigned long held;  // segments that arrived late because of a blackout
+  double delay_ms;     // from being read to arriving, summed over segments
+  double max_delay_ms;
+} link_dir_t;
+
+/* One line of a scenario file: `<seconds> <key>=<value>...`, applied when the scenario reaches that time. Keys set
+ * both directions unless prefixed with `up.` (client to broker) or `down.`, see link_scenario_load(). */
+typedef struct link_step_s {
+  double at_ms;
+  char line[LINK_MAX_LINE];
+} link_step_t;
+
+typedef struct link_scenario_s {
+  link_step_t steps[LINK_MAX_SCENARIO_STEPS];
+  int count;
+  int next;
+  double loop_ms;  // the scenario starts over after this long, 0 runs it once
+  double started;
+  uint64_t seed;
+} link_scenario_t;
+
+typedef struct link_emu_s {
+  link_params_t up;
+  link_params_t down;
+  link_blackout_t blackout;
+  link_scenario_t scenario;
+} link_emu_t;
+
+void link_emu_init(link_emu_t *emu);
+int link_emu_set(link_emu_t *emu, const char *assignment);
+int link_scenario_load(link_emu_t *emu, const char *path);
+bool link_scenario_advance(link_emu_t *emu, double now);
+double link_scenario_due(const link_emu_t *emu);
+void link_dir_init(link_dir_t *dir, const char *name, const link_params_t *params, uint64_t seed);
+double link_dir_schedule(link_dir_t *dir, const link_emu_t *emu, int len, double now);
+bool link_blackout_at(const link_emu_t *emu, double now, double *ends);
+void link_dir_report(const link_dir_t *dir, FILE *out);
+
+#endif
@@ -0,0 +1,338 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "link_emu.h"
+
+#define PROXY_MAX_CONNS 64
+#define PROXY_MAX_POLL_MS 1000
+
+/* Bytes read from one side, waiting to be written to the other when the link delivers them. */
+typedef struct segment_s {
+  struct segment_s *next;
+  double due;
+  int len;
+  int off;  // already written
+  unsigned char data[];
+} segment_t;
+
+typedef struct pipe_s {
+  int from;
+  int to;
+  link_dir_t dir;
+  segment_t *head;
+  segment_t *tail;
+  int queued;    // bytes in the segments
+  bool eof;      // from was shut down, to follows once the queue is empty
+  bool blocked;  // to is full, written again on POLLOUT
+} pipe_t;
+
+typedef struct conn_s {
+  bool used;
+  int id;
+  double opened;
+  pipe_t up;    // client to broker
+  pipe_t down;  // broker to client
+} conn_t;
+
+static volatile sig_atomic_t run = 1;
+static link_emu_t emu;
+static conn_t conns[PROXY_MAX_CONNS];
+
+static void stop_func(int signum) { run = 0; }
+
+static double now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int set_nonblocking(int fd) { return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK); }
+
+static void pipe_init(pipe_t *p, int from, int to, const char *name, const link_params_t *params, uint64_t seed) {
+  memset(p, 0, sizeof(pipe_t));
+  p->from = from;
+  p->to = to;
+  link_dir_init(&p->dir, name, params, seed);
+}
+
+static void pipe_clear(pipe_t *p) {
+  segment_t *seg;
+
+  while ((seg = p->head)) {
+    p->head = seg->next;
+    free(seg);
+  }
+  p->tail = NULL;
+  p->queued = 0;
+}
+
+/* Reads at most one segment. Returns -1 when the connection is to be closed. */
+static int pipe_read(pipe_t *p, double now) {
+  unsigned char buf[65536];
+  int want = p->dir.params->mss < (int)sizeof(buf) ? p->dir.params->mss : (int)sizeof(buf);
+  segment_t *seg;
+  ssize_t len;
+
+  len = read(p->from, buf, want);
+  if (len < 0) return errno == EAGAIN || errno == EINTR ? 0 : -1;
+  if (len == 0) {
+    p->eof = true;
+    return 0;
+  }
+  seg = malloc(sizeof(segment_t) + len);
+  if (!seg) {
+    fprintf(stderr, "Error: Out of memory.\n");
+    return -1;
+  }
+  seg->next = NULL;
+  seg->due = link_dir_schedule(&p->dir, &emu, len, now);
+  seg->len = len;
+  seg->off = 0;
+  memcpy(seg->data, buf, len);
+  if (p->tail) {
+    p->tail->next = seg;
+  } else {
+    p->head = seg;
+  }
+  p->tail = seg;
+  p->queued += len;
+  return 0;
+}
+
+/* Writes what the link has delivered by now. Returns -1 when the connection is to be closed. */
+static int pipe_flush(pipe_t *p, double now) {
+  segment_t *seg;
+  ssize_t len;
+
+  while ((seg = p->head) && seg->due <= now) {
+    len = write(p->to, seg->data + seg->off, seg->len - seg->off);
+    if (len < 0) {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN) return -1;
+      p->blocked = true;
+      return 0;
+    }
+    p->blocked = false;
+    seg->off += len;
+    if (seg->off < seg->len) continue;
+    p->head = seg->next;
+    if (!p->head) p->tail = NULL;
+    p->queued -= seg->len;
+    free(seg);
+  }
+  if (!p->head && p->eof && p->to >= 0) {
+    shutdown(p->to, SHUT_WR);
+    p->to = -1;  // only marks the direction done, the descriptor belongs to the other pipe
+  }
+  return 0;
+}
+
+static void conn_close(conn_t *conn, bool reset, const char *why) {
+  struct linger lin = {.l_onoff = 1, .l_linger = 0};
+
+  printf("connection %d closed after %.1f s (%s)\n", conn->id, (now_ms() - conn->opened) / 1e3, why);
+  link_dir_report(&conn->up.dir, stdout);
+  link_dir_report(&conn->down.dir, stdout);
+  if (reset) {
+    // An RST, as a device sees it when the network drops its context
+    setsockopt(conn->up.from, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+    setsockopt(conn->down.from, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+  }
+  close(conn->up.from);
+  close(conn->down.from);
+  pipe_clear(&conn->up);
+  pipe_clear(&conn->down);
+  conn->used = false;
+}
+
+static int broker_connect(const struct addrinfo *broker) {
+  const struct addrinfo *ai;
+  int fd, one = 1;
+
+  for (ai = broker; ai; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) continue;
+    if (!connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+      // The link model does the batching, Nagle on top of it would only add its own delay
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      return fd;
+    }
+    close(fd);
+  }
+  return -1;
+}
+
+static void accept_conn(int listener, const struct addrinfo *broker, double now) {
+  static int next_id;
+  struct linger lin = {.l_onoff = 1, .l_linger = 0};
+  int client, server, i, one = 1;
+  conn_t *conn = NULL;
+  double ends;
+
+  client = accept(listener, NULL, NULL);
+  if (client < 0) return;
+  for (i = 0; i < PROXY_MAX_CONNS && !conn; i++) {
+    if (!conns[i].used) conn = &conns[i];
+  }
+  if (!conn || (emu.blackout.reset && link_blackout_at(&emu, now, &ends))) {
+    printf("refusing a connection: %s\n", conn ? "blackout" : "too many connections");
+    setsockopt(client, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+    close(client);
+    return;
+  }
+  server = broker_connect(broker);
+  if (server < 0) {
+    fprintf(stderr, "Error: Unable to connect to the broker: %s\n", strerror(errno));
+    close(client);
+    return;
+  }
+  setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  set_nonblocking(client);
+  set_nonblocking(server);
+  conn->used = true;
+  conn->id = next_id++;
+  conn->opened = now;
+  pipe_init(&conn->up, client, server, "up", &emu.up, emu.scenario.seed + 2 * conn->id);
+  pipe_init(&conn->down, server, client, "down", &emu.down, emu.scenario.seed + 2 * conn->id + 1);
+  printf("connection %d opened\n", conn->id);
+}
+
+/* When the blackout schedule next changes state, 0 without blackouts. */
+static double blackout_change(double now) {
+  double t = now - emu.scenario.started - emu.blackout.offset_ms, ends, phase;
+
+  if (emu.blackout.every_ms <= 0 || emu.blackout.for_ms <= 0) return 0;
+  if (link_blackout_at(&emu, now, &ends)) return ends;
+  if (t < 0) return now - t;
+  phase = fmod(t, emu.blackout.every_ms);
+  return now + emu.blackout.every_ms - phase;
+}
+
+static int poll_timeout(double now) {
+  double next = now + PROXY_MAX_POLL_MS, due;
+  int i;
+
+  for (i = 0; i < PROXY_MAX_CONNS; i++) {
+    if (!conns[i].used) continue;
+    if (conns[i].up.head && !conns[i].up.blocked && conns[i].up.head->due < next) next = conns[i].up.head->due;
+    if (conns[i].down.head && !conns[i].down.blocked && conns[i].down.head->due < next) next = conns[i].down.head->due;
+  }
+  due = link_scenario_due(&emu);
+  if (due > 0 && due < next) next = due;
+  due = emu.blackout.reset ? blackout_change(now) : 0;
+  if (due > 0 && due < next) next = due;
+  return next > now ? (int)ceil(next - now) : 0;
+}
+
+/* Asks poll for what a pipe waits on: reading while its queue has room, writing while the other side is full. */
+static void pipe_events(const pipe_t *p, struct pollfd *from, struct pollfd *to) {
+  if (!p->eof && p->queued < p->dir.params->queue) from->events |= POLLIN;
+  if (p->blocked && p->to >= 0) to->events |= POLLOUT;
+}
+
+/* Usage: nbproxy <listen port> <broker host> <broker port> [scenario file]
+ * Relays every connection to the broker through an emulated NB-IoT link, each connection over a link of its own.
+ * Clients are pointed at it with MQTT_PROXY=<proxy host>:<listen port>. Without a scenario the link is NB-IoT in good
+ * coverage, scenario files are described in link_emu.h and netem/scenarios holds a few. */
+int main(int argc, char *argv[]) {
+  struct pollfd pfd[1 + 2 * PROXY_MAX_CONNS];
+  struct addrinfo hints = {.ai_socktype = SOCK_STREAM}, *broker = NULL;
+  struct sockaddr_in addr = {.sin_family = AF_INET};
+  struct sigaction stop = {.sa_handler = stop_func};
+  int listener, i, n, one = 1, ret = EXIT_FAILURE;
+  bool blackout, was_blackout = false;
+  double now, ends;
+
+  if (argc < 4 || atoi(argv[1]) <= 0) {
+    fprintf(stderr, "Usage: nbproxy <listen port> <broker host> <broker port> [scenario file]\n");
+    return EXIT_FAILURE;
+  }
+  link_emu_init(&emu);
+  if (argc > 4 && link_scenario_load(&emu, argv[4])) return EXIT_FAILURE;
+  if (getaddrinfo(argv[2], argv[3], &hints, &broker)) {
+    fprintf(stderr, "Error: Unable to resolve %s.\n", argv[2]);
+    return EXIT_FAILURE;
+  }
+  listener = socket(AF_INET, SOCK_STREAM, 0);
+  addr.sin_port = htons(atoi(argv[1]));
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) || listen(listener, 16) ||
+      set_nonblocking(listener)) {
+    fprintf(stderr, "Error: Unable to listen on port %s: %s\n", argv[1], strerror(errno));
+    goto cleanup;
+  }
+
+  // Without SA_RESTART, so poll returns at once on Ctrl-C
+  sigaction(SIGINT, &stop, NULL);
+  sigaction(SIGTERM, &stop, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  printf("relaying port %s to %s:%s\n", argv[1], argv[2], argv[3]);
+  while (run) {
+    now = now_ms();
+    link_scenario_advance(&emu, now);
+    blackout = link_blackout_at(&emu, now, &ends);
+    if (blackout && !was_blackout) printf("blackout for %.1f s\n", (ends - now) / 1e3);
+    if (!blackout && was_blackout) printf("blackout over\n");
+    was_blackout = blackout;
+    for (i = 0; i < PROXY_MAX_CONNS; i++) {
+      if (!conns[i].used) continue;
+      if (blackout && emu.blackout.reset) {
+        conn_close(&conns[i], true, "blackout");
+      } else if (pipe_flush(&conns[i].up, now) || pipe_flush(&conns[i].down, now)) {
+        conn_close(&conns[i], false, strerror(errno));
+      } else if (conns[i].up.to < 0 && conns[i].down.to < 0) {
+        conn_close(&conns[i], false, "closed by both sides");
+      }
+    }
+
+    pfd[0].fd = listener;
+    pfd[0].events = POLLIN;
+    for (i = 0, n = 1; i < PROXY_MAX_CONNS; i++) {
+      if (!conns[i].used) continue;
+      pfd[n] = (struct pollfd){.fd = conns[i].up.from};
+      pfd[n + 1] = (struct pollfd){.fd = conns[i].down.from};
+      pipe_events(&conns[i].up, &pfd[n], &pfd[n + 1]);
+      pipe_events(&conns[i].down, &pfd[n + 1], &pfd[n]);
+      // A hung up socket would wake poll at once until its queue drains, so it is left out while nothing is wanted
+      if (!pfd[n].events) pfd[n].fd = -1;
+      if (!pfd[n + 1].events) pfd[n + 1].fd = -1;
+      n += 2;
+    }
+    if (poll(pfd, n, poll_timeout(now)) < 0) {
+      if (errno == EINTR) continue;
+      fprintf(stderr, "Error: poll: %s\n", strerror(errno));
+      break;
+    }
+
+    now = now_ms();
+    for (i = 0, n = 1; i < PROXY_MAX_CONNS; i++) {
+      if (!conns[i].used) continue;
+      if (((pfd[n].events & POLLIN) && pfd[n].revents && pipe_read(&conns[i].up, now)) ||
+          ((pfd[n + 1].events & POLLIN) && pfd[n + 1].revents && pipe_read(&conns[i].down, now))) {
+        conn_close(&conns[i], false, strerror(errno));
+      }
+      n += 2;
+    }
+    if (pfd[0].revents & POLLIN) accept_conn(listener, broker, now);
+  }
+  ret = 0;
+
+cleanup:
+  for (i = 0; i < PROXY_MAX_CONNS; i++) {
+    if (conns[i].used) conn_close(&conns[i], false, "proxy stopped");
+  }
+  if (listener >= 0) close(listener);
+  freeaddrinfo(broker);
+  return ret;
+}
@@ -0,0 +1,246 @@
+#include <errno.h>
+#include <mqtt_protocol.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "ack_spool.h"
+#include "at_modem.h"
+#include "client_common.h"
+#include "psm_sched.h"
+#include "pub_utils.h"
+#include "uart_utils.h"
+
+#define PSM_REPORT_INTERVAL 600
+#define PSM_MAX_LINE 1024
+
+static volatile sig_atomic_t run = 1;
+
+static void stop_func(int signum) { run = 0; }
+
+// Set with --cumack, messages then go out at QoS 0 and are acknowledged in bulk
+static ack_spool_t spool;
+static bool cumack;
+
+static double now_sec(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_timers(const modem_timers_t *timers) {
+  if (timers->psm) {
+    printf("PSM: TAU %d s, active time %d s\n", timers->tau_sec, timers->active_sec);
+  } else {
+    printf("PSM: not granted\n");
+  }
+  if (timers->edrx) {
+    printf("eDRX: cycle %.2f s, paging window %.2f s\n", timers->edrx_sec, timers->ptw_sec);
+  } else {
+    printf("eDRX: not granted\n");
+  }
+}
+
+static void queue_reading(psm_sched_t *sched, char *line, int len) {
+  bool urgent;
+
+  if (len > 0 && line[len - 1] == '\r') len--;
+  if (len == 0) return;
+  urgent = len >= (int)strlen(PSM_URGENT_PREFIX) && !strncmp(line, PSM_URGENT_PREFIX, strlen(PSM_URGENT_PREFIX));
+  if (!psm_sched_push(sched, line, len, urgent, now_sec())) {
+    fprintf(stderr, "Error: Reading dropped, the queue is full.\n");
+  }
+}
+
+/* One reading per line, a line longer than PSM_MAX_LINE is split. */
+static void read_readings(psm_sched_t *sched, bool *eof) {
+  static char buf[PSM_MAX_LINE];
+  static int used;
+  char *start, *nl;
+  int len;
+
+  len = read(STDIN_FILENO, buf + used, sizeof(buf) - used);
+  if (len <= 0) {
+    if (len < 0 && errno == EINTR) return;
+    queue_reading(sched, buf, used);
+    used = 0;
+    *eof = true;
+    return;
+  }
+  used += len;
+  start = buf;
+  while ((nl = memchr(start, '\n', used - (start - buf)))) {
+    queue_reading(sched, start, nl - start);
+    start = nl + 1;
+  }
+  used -= start - buf;
+  memmove(buf, start, used);
+  if (used == sizeof(buf)) {
+    queue_reading(sched, buf, used);
+    used = 0;
+  }
+}
+
+static double now_ms(void) { return now_sec() * 1e3; }
+
+static int send_numbered(void *userdata, uint32_t seq, uint32_t base, const void *payload, int len) {
+  struct mosquitto *mosq = (struct mosquitto *)userdata;
+  mosquitto_property *props = NULL;
+  char value[24];
+  int ret;
+
+  cum_seq_format(value, sizeof(value), seq, base);
+  ret = mosquitto_property_add_string_pair(&props, MQTT_PROP_USER_PROPERTY, CUMACK_SEQ_PROPERTY, value);
+  if (!ret) ret = mosquitto_publish_v5(mosq, NULL, TOPIC, len, payload, 0, false, props);
+  mosquitto_property_free_all(&props);
+  return ret;
+}
+
+static void connect_callback_func(struct mosquitto *mosq, void *obj, int result, int flags,
+                                  const mosquitto_property *properties) {
+  if (result == 0) mosquitto_subscribe(mosq, NULL, TOPIC CUMACK_SUFFIX, 0);
+}
+
+static void ack_callback_func(struct mosquitto *mosq, void *obj, const struct mosquitto_message *message,
+                              const mosquitto_property *properties) {
+  if (strcmp(message->topic, TOPIC CUMACK_SUFFIX)) return;
+  if (ack_spool_on_ack(&spool, message->payload, message->payloadlen, now_ms(), send_numbered, mosq) < 0) {
+    fprintf(stderr, "Warning: Malformed ack on %s.\n", message->topic);
+  }
+}
+
+/* Usage: psm_pub [serial port] [host] [--cumack <spool file>]
+ * Reads the PSM/eDRX timers the network granted from the modem on `serial port`, then publishes the lines read from
+ * stdin to TOPIC in batches, one per wake window. Lines starting with "ALARM " are sent immediately. Try it without a
+ * modem by running modem_sim and passing the pty it prints. --cumack publishes at QoS 0 instead, numbered and kept in
+ * the spool file until the TA acknowledges them on TOPIC/ack, which saves the PUBACK downlink that keeps the radio
+ * awake after every message, see ack_spool.h. */
+int main(int argc, char *argv[]) {
+  const char *port = "/dev/ttyUSB0", *host = HOST, *spool_path = NULL;
+  struct mosquitto *mosq = NULL;
+  struct pollfd pfd[2];
+  modem_timers_t timers;
+  psm_sched_t sched;
+  mosq_config_t cfg;
+  psm_msg_t msg;
+  double now, last_report;
+  bool eof = false;
+  int fd, ret = EXIT_FAILURE, positional = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--cumack") && i + 1 < argc) {
+      spool_path = argv[++i];
+    } else if (positional++ == 0) {
+      port = argv[i];
+    } else {
+      host = argv[i];
+    }
+  }
+  if (spool_path) {
+    if (ack_spool_open(&spool, spool_path)) return EXIT_FAILURE;
+    cumack = true;
+  }
+  fd = uart_open(port, B115200);
+  if (fd < 0) {
+    if (cumack) ack_spool_close(&spool);
+    return EXIT_FAILURE;
+  }
+  ret = at_query_timers(fd, &timers);
+  close(fd);
+  if (ret) {
+    if (cumack) ack_spool_close(&spool);
+    return EXIT_FAILURE;
+  }
+  print_timers(&timers);
+  now = last_report = now_sec();
+  psm_sched_init(&sched, &timers, now);
+
+  init_mosq_config(&cfg, client_pub);
+  cfg.general_config->host = cfg_strdup(&cfg, host);
+  cfg.general_config->keepalive = psm_sched_keepalive(&sched);
+  cfg.general_config->qos = 1;
+  if (cumack) {
+    // The sequence numbers travel as user properties
+    cfg.general_config->protocol_version = MQTT_PROTOCOL_V5;
+    cfg.general_config->qos = 0;
+  }
+  mosquitto_lib_init();
+  if (generate_client_id(&cfg)) {
+    ret = EXIT_FAILURE;
+    goto cleanup;
+  }
+  mosq = mosquitto_new(cfg.general_config->id, true, &cfg);
+  if (!mosq || mosq_opts_set(mosq, &cfg)) {
+    ret = EXIT_FAILURE;
+    goto cleanup;
+  }
+  mosquitto_disconnect_v5_callback_set(mosq, disconnect_callback_pub_func);
+  if (cumack) {
+    mosquitto_connect_v5_callback_set(mosq, connect_callback_func);
+    mosquitto_message_v5_callback_set(mosq, ack_callback_func);
+  }
+  ret = mosq_client_connect(mosq, &cfg);
+  if (ret) {
+    goto cleanup;
+  }
+  printf("wake period %.1f s, window %.1f s, keepalive %d s\n", sched.period, sched.window,
+         cfg.general_config->keepalive);
+
+  signal(SIGINT, stop_func);
+  signal(SIGTERM, stop_func);
+  while (run && !(eof && sched.count == 0)) {
+    now = now_sec();
+    while (psm_sched_pop(&sched, &msg, now)) {
+      if (!cumack) {
+        publish_message(mosq, &cfg, NULL, TOPIC, msg.len, msg.payload, cfg.general_config->qos, false);
+      } else if (ack_spool_publish(&spool, msg.payload, msg.len, now * 1e3, send_numbered, mosq)) {
+        fprintf(stderr, "Error: Reading dropped, the spool is full or cannot be written.\n");
+      }
+      free(msg.payload);
+    }
+    if (cumack) ack_spool_poll(&spool, now * 1e3, send_numbered, mosq);
+
+    pfd[0].fd = mosquitto_socket(mosq);
+    pfd[0].events = POLLIN | (mosquitto_want_write(mosq) ? POLLOUT : 0);
+    pfd[1].fd = eof ? -1 : STDIN_FILENO;
+    pfd[1].events = POLLIN;
+    // mosquitto_loop_misc has to run at least once a second for the keepalive
+    ret = psm_sched_timeout_ms(&sched, now);
+    if (poll(pfd, 2, ret < 1000 ? ret : 1000) < 0 && errno != EINTR) {
+      break;
+    }
+    if (pfd[1].revents & (POLLIN | POLLHUP)) {
+      read_readings(&sched, &eof);
+    }
+    if (pfd[0].revents & POLLIN && mosquitto_loop_read(mosq, 1)) {
+      mosquitto_reconnect(mosq);
+    }
+    if (pfd[0].revents & POLLOUT) {
+      mosquitto_loop_write(mosq, 1);
+    }
+    mosquitto_loop_misc(mosq);
+
+    if (now - last_report >= PSM_REPORT_INTERVAL) {
+      psm_sched_report(&sched, now, stdout);
+      last_report = now;
+    }
+  }
+  // Let the last batch reach the broker before the connection goes down
+  while (mosquitto_want_write(mosq) && mosquitto_loop(mosq, 100, 1) == MOSQ_ERR_SUCCESS) {
+  }
+  mosquitto_disconnect_v5(mosq, 0, NULL);
+  psm_sched_report(&sched, now_sec(), stdout);
+  if (cumack) ack_spool_report(&spool, stdout);
+  ret = 0;
+
+cleanup:
+  if (cumack) ack_spool_close(&spool);
+  psm_sched_destroy(&sched);
+  mosquitto_destroy(mosq);
+  mosquitto_lib_cleanup();
+  mosq_config_cleanup(&cfg);
+  return ret;
+}
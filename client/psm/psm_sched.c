@@ -0,0 +1,137 @@
+#include "psm_sched.h"
+#include <stdlib.h>
+#include <string.h>
+
+void psm_sched_init(psm_sched_t *sched, const modem_timers_t *timers, double now) {
+  memset(sched, 0, sizeof(psm_sched_t));
+  sched->timers = *timers;
+  if (timers->psm) {
+    sched->period = timers->tau_sec;
+    sched->window = timers->active_sec;
+  } else if (timers->edrx) {
+    sched->period = timers->edrx_sec;
+    sched->window = timers->ptw_sec;
+  } else {
+    sched->period = PSM_DEFAULT_PERIOD;
+  }
+  if (sched->window < PSM_MIN_WINDOW) sched->window = PSM_MIN_WINDOW;
+  sched->started = now;
+  sched->next_wake = now + sched->period;
+}
+
+void psm_sched_destroy(psm_sched_t *sched) {
+  while (sched->count > 0) {
+    free(sched->queue[sched->head].payload);
+    sched->head = (sched->head + 1) % PSM_QUEUE_LEN;
+    sched->count--;
+  }
+}
+
+/* The broker must not drop the session while the modem sleeps through a whole period. The client pings at most once
+ * per keepalive, and only when nothing else was sent, so a keepalive of one period puts the PINGREQ into a wake window
+ * that is open anyway. */
+int psm_sched_keepalive(const psm_sched_t *sched) {
+  int keepalive = (int)(sched->period + sched->window);
+
+  return keepalive > PSM_MAX_KEEPALIVE ? PSM_MAX_KEEPALIVE : keepalive;
+}
+
+static void open_window(psm_sched_t *sched, double now) {
+  if (sched->window_end) return;
+  sched->window_end = now + sched->window;
+  sched->window_used = false;
+  sched->windows++;
+}
+
+bool psm_sched_push(psm_sched_t *sched, const char *payload, int len, bool urgent, double now) {
+  psm_msg_t *msg;
+
+  if (sched->count == PSM_QUEUE_LEN) return false;
+  msg = &sched->queue[(sched->head + sched->count) % PSM_QUEUE_LEN];
+  msg->payload = malloc(len);
+  if (!msg->payload) return false;
+  memcpy(msg->payload, payload, len);
+  msg->len = len;
+  msg->urgent = urgent;
+  msg->queued = now;
+  sched->count++;
+  if (urgent) sched->urgent++;
+  if ((urgent || sched->count == PSM_QUEUE_LEN) && !sched->window_end) {
+    open_window(sched, now);
+    sched->early_windows++;
+  }
+  return true;
+}
+
+/* Advances the wake schedule to `now`, returns whether the radio is up. A window closes after its active time, the
+ * next one opens a full period after the scheduled wake so an early urgent window does not shift the TAU rhythm. */
+bool psm_sched_awake(psm_sched_t *sched, double now) {
+  if (sched->window_end && now >= sched->window_end) {
+    sched->window_end = 0;
+  }
+  if (now >= sched->next_wake) {
+    while (sched->next_wake <= now) sched->next_wake += sched->period;
+    open_window(sched, now);
+  }
+  return sched->window_end != 0;
+}
+
+static void record_latency(psm_sched_t *sched, double sec) {
+  int bucket = 0;
+
+  while (bucket < PSM_LATENCY_BUCKETS - 1 && sec >= (double)(1 << bucket)) {
+    bucket++;
+  }
+  sched->latency_buckets[bucket]++;
+  sched->latency_sum += sec;
+  if (sec > sched->latency_max) sched->latency_max = sec;
+}
+
+/* Takes the oldest queued message if a window is open, the caller owns msg->payload. */
+bool psm_sched_pop(psm_sched_t *sched, psm_msg_t *msg, double now) {
+  if (!psm_sched_awake(sched, now) || sched->count == 0) return false;
+  *msg = sched->queue[sched->head];
+  sched->head = (sched->head + 1) % PSM_QUEUE_LEN;
+  sched->count--;
+  if (!sched->window_used) {
+    sched->window_used = true;
+    sched->uplinks++;
+  }
+  sched->messages++;
+  record_latency(sched, now - msg->queued);
+  return true;
+}
+
+/* How long the main loop may block: until the window closes or the next one opens. */
+int psm_sched_timeout_ms(const psm_sched_t *sched, double now) {
+  double until = sched->window_end ? sched->window_end : sched->next_wake;
+
+  if (sched->window_end && sched->count > 0) return 0;
+  return until > now ? (int)((until - now) * 1000) + 1 : 0;
+}
+
+static double percentile_sec(const psm_sched_t *sched, double pct) {
+  unsigned long target = (unsigned long)(sched->messages * pct), seen = 0;
+
+  for (int i = 0; i < PSM_LATENCY_BUCKETS; i++) {
+    seen += sched->latency_buckets[i];
+    if (seen > target) {
+      return (double)(1 << i);
+    }
+  }
+  return sched->latency_max;
+}
+
+void psm_sched_report(const psm_sched_t *sched, double now, FILE *out) {
+  double hours = (now - sched->started) / 3600;
+
+  if (hours <= 0) return;
+  fprintf(out, "period %.1f s window %.1f s keepalive %d s, queued %d\n", sched->period, sched->window,
+          psm_sched_keepalive(sched), sched->count);
+  fprintf(out, "%lu messages (%lu urgent) in %lu uplinks: %.1f uplinks/h, %.1f messages/uplink, %lu early windows\n",
+          sched->messages, sched->urgent, sched->uplinks, sched->uplinks / hours,
+          sched->uplinks ? (double)sched->messages / sched->uplinks : 0.0, sched->early_windows);
+  fprintf(out, "latency avg %.1f s p50 <%.0f s p99 <%.0f s max %.1f s\n",
+          sched->messages ? sched->latency_sum / sched->messages : 0.0, percentile_sec(sched, 0.5),
+          percentile_sec(sched, 0.99), sched->latency_max);
+}
@@ -0,0 +1,56 @@
+#ifndef PSM_SCHED_H
+#define PSM_SCHED_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "at_modem.h"
+
+/* Every uplink wakes the radio for the whole T3324 active time, which costs about as much as the few bytes of one
+ * reading. Non-urgent messages are therefore held until the next wake window and sent together, an urgent one opens a
+ * window right away and takes everything queued along. Without PSM the eDRX cycle is used as period, without either
+ * PSM_DEFAULT_PERIOD. */
+#define PSM_DEFAULT_PERIOD 60.0
+#define PSM_MIN_WINDOW 2.0       // seconds the connection needs to flush a batch and receive the PUBACKs
+#define PSM_MAX_KEEPALIVE 65535  // the keepalive field of CONNECT is 16 bits
+#define PSM_QUEUE_LEN 256        // a full queue opens a window early instead of dropping readings
+#define PSM_LATENCY_BUCKETS 16   // bucket i counts latencies below 2^i s
+#define PSM_URGENT_PREFIX "ALARM "
+
+typedef struct psm_msg_s {
+  char *payload;
+  int len;
+  bool urgent;
+  double queued;
+} psm_msg_t;
+
+typedef struct psm_sched_s {
+  modem_timers_t timers;
+  double period;
+  double window;
+  double next_wake;
+  double window_end;  // 0 while the radio sleeps
+  bool window_used;
+  psm_msg_t queue[PSM_QUEUE_LEN];
+  int head;
+  int count;
+  double started;
+  unsigned long windows;
+  unsigned long uplinks;
+  unsigned long early_windows;
+  unsigned long messages;
+  unsigned long urgent;
+  double latency_sum;
+  double latency_max;
+  unsigned long latency_buckets[PSM_LATENCY_BUCKETS];
+} psm_sched_t;
+
+void psm_sched_init(psm_sched_t *sched, const modem_timers_t *timers, double now);
+void psm_sched_destroy(psm_sched_t *sched);
+int psm_sched_keepalive(const psm_sched_t *sched);
+bool psm_sched_push(psm_sched_t *sched, const char *payload, int len, bool urgent, double now);
+bool psm_sched_awake(psm_sched_t *sched, double now);
+bool psm_sched_pop(psm_sched_t *sched, psm_msg_t *msg, double now);
+int psm_sched_timeout_ms(const psm_sched_t *sched, double now);
+void psm_sched_report(const psm_sched_t *sched, double now, FILE *out);
+
+#endif
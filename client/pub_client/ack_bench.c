@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ack_spool.h"
+#include "cum_ack.h"
+
+#define BENCH_TOPIC "bench/device"
+#define BENCH_INTERVAL_MS 10000  // a reading every 10 s
+#define BENCH_STEP_MS 1000
+#define BENCH_MAX_DOWNLINKS 64
+
+/* Both directions of the radio link in virtual time. Acks are held until the TA's flush returns, the device answers
+ * them with retransmissions that must not reach the tracker in the middle of its flush. */
+typedef struct link_s {
+  cum_ack_tracker_t *tracker;
+  ack_spool_t *spool;
+  double loss;
+  double now;
+  unsigned long uplinks;
+  unsigned long downlinks;
+  int held;
+  char acks[BENCH_MAX_DOWNLINKS][CUMACK_MAX_LEN];
+  int ack_lens[BENCH_MAX_DOWNLINKS];
+} link_t;
+
+static bool lost(double loss) { return rand() < loss * RAND_MAX; }
+
+static int uplink(void *userdata, uint32_t seq, uint32_t base, const void *payload, int len) {
+  link_t *link = (link_t *)userdata;
+
+  link->uplinks++;
+  if (!lost(link->loss)) cum_ack_receive(link->tracker, BENCH_TOPIC, seq, base, link->now);
+  return 0;
+}
+
+static void downlink(void *userdata, const char *topic, const char *ack, int ack_len) {
+  link_t *link = (link_t *)userdata;
+
+  link->downlinks++;
+  if (lost(link->loss) || link->held == BENCH_MAX_DOWNLINKS) return;
+  memcpy(link->acks[link->held], ack, ack_len);
+  link->ack_lens[link->held++] = ack_len;
+}
+
+static void step(link_t *link) {
+  cum_ack_flush(link->tracker, link->now, downlink, link);
+  for (int i = 0; i < link->held; i++) {
+    ack_spool_on_ack(link->spool, link->acks[i], link->ack_lens[i], link->now, uplink, link);
+  }
+  link->held = 0;
+  ack_spool_poll(link->spool, link->now, uplink, link);
+}
+
+static int run(const char *path, int messages, double loss) {
+  char payload[64];
+  ack_spool_t spool;
+  link_t link;
+  int len;
+  double drain;
+
+  unlink(path);
+  memset(&link, 0, sizeof(link));
+  link.loss = loss;
+  link.spool = &spool;
+  link.tracker = cum_ack_tracker_new(1, CUMACK_DEFAULT_EVERY, CUMACK_DEFAULT_DELAY_MS);
+  if (!link.tracker || ack_spool_open(&spool, path)) {
+    cum_ack_tracker_free(link.tracker);
+    return -1;
+  }
+  for (int i = 0; i < messages; i++) {
+    len = snprintf(payload, sizeof(payload), "{\"temp\":%d.%d}", 20 + i % 5, i % 10);
+    if (ack_spool_publish(&spool, payload, len, link.now, uplink, &link)) {
+      fprintf(stderr, "Error: The spool is full.\n");
+      break;
+    }
+    for (int t = 0; t < BENCH_INTERVAL_MS; t += BENCH_STEP_MS) {
+      link.now += BENCH_STEP_MS;
+      step(&link);
+    }
+  }
+  // Long enough for a few rounds of the device's resend timer
+  for (drain = 0; ack_spool_pending(&spool) && drain < 20 * SPOOL_RESEND_MS; drain += BENCH_STEP_MS) {
+    link.now += BENCH_STEP_MS;
+    step(&link);
+  }
+
+  printf("loss %4.1f%%: %lu uplinks for %d messages, %lu downlinks, %.1f downlinks per 1000 messages instead of 1000, "
+         "%d unacknowledged\n",
+         loss * 100, link.uplinks, messages, link.downlinks, link.downlinks * 1000.0 / messages,
+         ack_spool_pending(&spool));
+  printf("  ");
+  ack_spool_report(&spool, stdout);
+  printf("  ");
+  cum_ack_stats(link.tracker, stdout);
+  ack_spool_close(&spool);
+  cum_ack_tracker_free(link.tracker);
+  unlink(path);
+  return 0;
+}
+
+/* Usage: ack_bench [messages] [spool file]
+ * One device sends a reading every 10 s through its spool at QoS 0 and the TA acknowledges them cumulatively, over a
+ * link losing the given share of uplinks and downlinks alike. Everything runs in virtual time, so hours of readings
+ * take a moment. QoS 1 would have cost 1000 downlinks per 1000 messages. */
+int main(int argc, char *argv[]) {
+  int messages = argc > 1 ? atoi(argv[1]) : 2000;
+  const char *path = argc > 2 ? argv[2] : "ack_bench.spool";
+  const double losses[] = {0, 0.01, 0.05, 0.2};
+
+  srand(1);
+  for (int i = 0; i < (int)(sizeof(losses) / sizeof(losses[0])); i++) {
+    if (run(path, messages, losses[i])) return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
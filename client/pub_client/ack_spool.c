@@ -0,0 +1,291 @@
+#include "ack_spool.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SPOOL_MAGIC "ACKSPL1\n"
+#define SPOOL_MAGIC_LEN 8
+#define SPOOL_HEADER_LEN 9  // type, then two 32-bit fields
+#define SPOOL_DATA 'D'      // sequence number, length, payload
+#define SPOOL_ACK 'A'       // 0, length, the ack as received
+#define SPOOL_SEQ 'S'       // next sequence number, 0, written first by a compaction
+
+static void put_u32(unsigned char *buf, uint32_t val) {
+  buf[0] = val >> 24;
+  buf[1] = (val >> 16) & 0xff;
+  buf[2] = (val >> 8) & 0xff;
+  buf[3] = val & 0xff;
+}
+
+static uint32_t get_u32(const unsigned char *buf) {
+  return (uint32_t)buf[0] << 24 | (uint32_t)buf[1] << 16 | (uint32_t)buf[2] << 8 | buf[3];
+}
+
+static int write_record(int fd, char type, uint32_t a, const void *data, uint32_t len) {
+  unsigned char header[SPOOL_HEADER_LEN];
+
+  header[0] = type;
+  put_u32(header + 1, a);
+  put_u32(header + 5, len);
+  // The header alone would be read back as a torn record and cut off, so two writes are fine
+  if (write(fd, header, SPOOL_HEADER_LEN) != SPOOL_HEADER_LEN || (len && write(fd, data, len) != (ssize_t)len)) {
+    return -1;
+  }
+  return 0;
+}
+
+/* Drops the acknowledged entries at the front, the oldest unacknowledged one is the base devices send along. */
+static void trim(ack_spool_t *spool) {
+  while (spool->head < spool->count && spool->entries[spool->head].acked) spool->head++;
+  if (spool->head == spool->count) spool->head = spool->count = 0;
+}
+
+static int apply_ack(ack_spool_t *spool, const cum_ack_t *ack) {
+  spool_entry_t *entry;
+  int acked = 0;
+
+  for (int i = spool->head; i < spool->count; i++) {
+    entry = &spool->entries[i];
+    if (entry->seq > ack->top) break;
+    if (!entry->acked && cum_ack_covers(ack, entry->seq)) {
+      entry->acked = true;
+      spool->live -= SPOOL_HEADER_LEN + entry->len;
+      acked++;
+    }
+  }
+  trim(spool);
+  return acked;
+}
+
+static int add_entry(ack_spool_t *spool, uint32_t seq, int len, off_t off) {
+  spool_entry_t *entry;
+
+  if (spool->count == SPOOL_MAX_PENDING && spool->head) {
+    memmove(spool->entries, spool->entries + spool->head, (spool->count - spool->head) * sizeof(spool_entry_t));
+    spool->count -= spool->head;
+    spool->head = 0;
+  }
+  if (spool->count == SPOOL_MAX_PENDING) {
+    return -1;
+  }
+  entry = &spool->entries[spool->count++];
+  entry->seq = seq;
+  entry->len = len;
+  entry->off = off;
+  entry->sent_ms = 0;
+  entry->acked = false;
+  spool->live += SPOOL_HEADER_LEN + len;
+  if (seq >= spool->next_seq) spool->next_seq = seq + 1;
+  return 0;
+}
+
+/* Replays the records of an existing spool. A record torn by a crash is cut off, whatever it held was never sent. */
+static int load(ack_spool_t *spool) {
+  unsigned char header[SPOOL_HEADER_LEN];
+  char ack_text[CUMACK_MAX_LEN];
+  off_t off = SPOOL_MAGIC_LEN;
+  uint32_t a, len;
+  cum_ack_t ack;
+
+  while (pread(spool->fd, header, SPOOL_HEADER_LEN, off) == SPOOL_HEADER_LEN) {
+    a = get_u32(header + 1);
+    len = get_u32(header + 5);
+    if (off + SPOOL_HEADER_LEN + (off_t)len > spool->size) break;
+    if (header[0] == SPOOL_DATA) {
+      if (add_entry(spool, a, len, off + SPOOL_HEADER_LEN)) break;
+    } else if (header[0] == SPOOL_ACK && len < sizeof(ack_text)) {
+      if (pread(spool->fd, ack_text, len, off + SPOOL_HEADER_LEN) != (ssize_t)len) break;
+      if (!cum_ack_parse(&ack, ack_text, len)) apply_ack(spool, &ack);
+    } else if (header[0] == SPOOL_SEQ) {
+      if (a > spool->next_seq) spool->next_seq = a;
+    } else {
+      break;
+    }
+    off += SPOOL_HEADER_LEN + len;
+  }
+  if (off < spool->size) {
+    fprintf(stderr, "Warning: Cut %ld bytes of a torn record off %s.\n", (long)(spool->size - off), spool->path);
+    if (ftruncate(spool->fd, off)) return -1;
+    spool->size = off;
+  }
+  return 0;
+}
+
+int ack_spool_open(ack_spool_t *spool, const char *path) {
+  char magic[SPOOL_MAGIC_LEN];
+
+  memset(spool, 0, sizeof(ack_spool_t));
+  spool->next_seq = 1;
+  spool->path = strdup(path);
+  spool->entries = malloc(SPOOL_MAX_PENDING * sizeof(spool_entry_t));
+  spool->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (!spool->path || !spool->entries || spool->fd < 0) {
+    fprintf(stderr, "Error: Unable to open spool %s: %s\n", path, strerror(errno));
+    goto error;
+  }
+  spool->size = lseek(spool->fd, 0, SEEK_END);
+  if (spool->size == 0) {
+    if (write(spool->fd, SPOOL_MAGIC, SPOOL_MAGIC_LEN) != SPOOL_MAGIC_LEN) goto error;
+    spool->size = SPOOL_MAGIC_LEN;
+  } else if (pread(spool->fd, magic, SPOOL_MAGIC_LEN, 0) != SPOOL_MAGIC_LEN ||
+             memcmp(magic, SPOOL_MAGIC, SPOOL_MAGIC_LEN)) {
+    fprintf(stderr, "Error: %s is not a spool file.\n", path);
+    goto error;
+  }
+  if (load(spool)) goto error;
+  if (spool->count) {
+    printf("spool: %d unacknowledged messages, next sequence number %u\n", ack_spool_pending(spool), spool->next_seq);
+  }
+  return 0;
+
+error:
+  ack_spool_close(spool);
+  return -1;
+}
+
+void ack_spool_close(ack_spool_t *spool) {
+  if (spool->fd >= 0) close(spool->fd);
+  free(spool->entries);
+  free(spool->path);
+  spool->fd = -1;
+  spool->entries = NULL;
+  spool->path = NULL;
+}
+
+/* Writes the unacknowledged messages to a new file and renames it over the spool, so a crash leaves either. */
+static int compact(ack_spool_t *spool) {
+  char tmp[4096];
+  unsigned char *buf = NULL;
+  spool_entry_t *entry;
+  off_t off = SPOOL_MAGIC_LEN + SPOOL_HEADER_LEN;
+  int fd, ret = -1;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", spool->path);
+  fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  if (fd < 0) return -1;
+  if (write(fd, SPOOL_MAGIC, SPOOL_MAGIC_LEN) != SPOOL_MAGIC_LEN ||
+      write_record(fd, SPOOL_SEQ, spool->next_seq, NULL, 0)) {
+    goto done;
+  }
+  for (int i = spool->head; i < spool->count; i++) {
+    entry = &spool->entries[i];
+    if (entry->acked) continue;
+    free(buf);
+    buf = malloc(entry->len ? entry->len : 1);
+    if (!buf || pread(spool->fd, buf, entry->len, entry->off) != entry->len ||
+        write_record(fd, SPOOL_DATA, entry->seq, buf, entry->len)) {
+      goto done;
+    }
+  }
+  if (fdatasync(fd) || rename(tmp, spool->path)) goto done;
+  // Offsets only change once the new file is in place
+  for (int i = spool->head; i < spool->count; i++) {
+    entry = &spool->entries[i];
+    if (entry->acked) continue;
+    entry->off = off + SPOOL_HEADER_LEN;
+    off += SPOOL_HEADER_LEN + entry->len;
+  }
+  close(spool->fd);
+  spool->fd = fd;
+  fd = -1;
+  spool->size = spool->live = off;
+  spool->compactions++;
+  ret = 0;
+
+done:
+  if (fd >= 0) {
+    close(fd);
+    unlink(tmp);
+  }
+  free(buf);
+  return ret;
+}
+
+static uint32_t base(const ack_spool_t *spool) { return spool->count ? spool->entries[spool->head].seq : 0; }
+
+static void resend(ack_spool_t *spool, spool_entry_t *entry, double now, ack_spool_send_t send, void *userdata) {
+  unsigned char *buf = malloc(entry->len ? entry->len : 1);
+
+  if (buf && pread(spool->fd, buf, entry->len, entry->off) == entry->len) {
+    send(userdata, entry->seq, base(spool), buf, entry->len);
+    entry->sent_ms = now;
+    spool->resent++;
+  }
+  free(buf);
+}
+
+/* Numbers the message and appends it before sending it. Returns -1 when the spool is full or cannot be written, the
+ * message is then not sent either. */
+int ack_spool_publish(ack_spool_t *spool, const void *payload, int len, double now, ack_spool_send_t send,
+                      void *userdata) {
+  uint32_t seq = spool->next_seq;
+
+  if (spool->count - spool->head == SPOOL_MAX_PENDING || write_record(spool->fd, SPOOL_DATA, seq, payload, len) ||
+      add_entry(spool, seq, len, spool->size + SPOOL_HEADER_LEN)) {
+    return -1;
+  }
+  spool->size += SPOOL_HEADER_LEN + len;
+  spool->entries[spool->count - 1].sent_ms = now;
+  spool->messages++;
+  send(userdata, seq, base(spool), payload, len);
+  return 0;
+}
+
+/* Applies an ack received on `<topic>/ack` and sends the gaps it lists again. Returns the number of messages it
+ * acknowledged, -1 when it is malformed. */
+int ack_spool_on_ack(ack_spool_t *spool, const char *text, int len, double now, ack_spool_send_t send, void *userdata) {
+  spool_entry_t *entry;
+  cum_ack_t ack;
+  int acked;
+
+  if (cum_ack_parse(&ack, text, len)) return -1;
+  spool->acks++;
+  spool->ack_bytes += len;
+  spool->last_ack_ms = now;
+  acked = apply_ack(spool, &ack);
+  if (acked) {
+    if (write_record(spool->fd, SPOOL_ACK, 0, text, len)) {
+      fprintf(stderr, "Warning: Failed to record an ack in %s, a restart sends its messages again.\n", spool->path);
+    } else {
+      spool->size += SPOOL_HEADER_LEN + len;
+    }
+  }
+  for (int i = spool->head; i < spool->count; i++) {
+    entry = &spool->entries[i];
+    if (entry->seq > ack.top) break;
+    if (!entry->acked && now - entry->sent_ms >= SPOOL_MIN_RESEND_MS) resend(spool, entry, now, send, userdata);
+  }
+  if (spool->size > SPOOL_COMPACT_BYTES && spool->live * 2 < spool->size && compact(spool)) {
+    fprintf(stderr, "Warning: Failed to compact %s.\n", spool->path);
+  }
+  return acked;
+}
+
+/* The oldest message goes out again when nothing was heard for SPOOL_RESEND_MS, the TA answers it either way. */
+void ack_spool_poll(ack_spool_t *spool, double now, ack_spool_send_t send, void *userdata) {
+  spool_entry_t *entry;
+
+  if (spool->head == spool->count) return;
+  entry = &spool->entries[spool->head];
+  if (now - entry->sent_ms >= SPOOL_RESEND_MS && now - spool->last_ack_ms >= SPOOL_RESEND_MS) {
+    resend(spool, entry, now, send, userdata);
+  }
+}
+
+int ack_spool_pending(const ack_spool_t *spool) {
+  int pending = 0;
+
+  for (int i = spool->head; i < spool->count; i++) pending += !spool->entries[i].acked;
+  return pending;
+}
+
+/* QoS 1 would have cost a PUBACK downlink per message. */
+void ack_spool_report(const ack_spool_t *spool, FILE *out) {
+  fprintf(out,
+          "spool: %lu messages, %lu sent again, %lu acks of %lu bytes, %d unacknowledged, %lu compactions, %.0f radio "
+          "round trips saved per 1000 messages\n",
+          spool->messages, spool->resent, spool->acks, spool->ack_bytes, ack_spool_pending(spool), spool->compactions,
+          spool->messages ? 1000 - spool->acks * 1000.0 / spool->messages : 0);
+}
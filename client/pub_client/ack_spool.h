@@ -0,0 +1,58 @@
+#ifndef ACK_SPOOL_H
+#define ACK_SPOOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "cum_ack.h"
+
+/* Device side of the cumulative acknowledgements in cum_ack.h. Every message is numbered and appended to a spool file
+ * before it is sent at QoS 0, and stays there until an ack covers it; acks are appended too, so a restarted device
+ * picks up its unacknowledged messages and sequence numbers where it left off. The gaps an ack lists are sent again
+ * right away. When no ack came for SPOOL_RESEND_MS the oldest message goes out once more, which the TA answers with an
+ * ack whether it lost the message or only its own ack got lost. The file is rewritten with only the unacknowledged
+ * messages once it is mostly acknowledged ones. */
+#define SPOOL_MAX_PENDING 4096
+#define SPOOL_RESEND_MS (2 * CUMACK_DEFAULT_DELAY_MS)
+#define SPOOL_MIN_RESEND_MS 5000  // a gap is not sent again sooner, later acks may still list it
+#define SPOOL_COMPACT_BYTES (64 * 1024)
+
+typedef struct spool_entry_s {
+  uint32_t seq;
+  int len;
+  off_t off;  // of the payload in the file
+  double sent_ms;
+  bool acked;
+} spool_entry_t;
+
+/* Publishes one message, `base` is the oldest sequence number not acknowledged yet. */
+typedef int (*ack_spool_send_t)(void *userdata, uint32_t seq, uint32_t base, const void *payload, int len);
+
+typedef struct ack_spool_s {
+  char *path;
+  int fd;
+  off_t size;
+  off_t live;  // bytes of records still needed
+  spool_entry_t *entries;
+  int head;  // oldest unacknowledged entry
+  int count;
+  uint32_t next_seq;
+  double last_ack_ms;
+  unsigned long messages;
+  unsigned long resent;
+  unsigned long acks;
+  unsigned long ack_bytes;
+  unsigned long compactions;
+} ack_spool_t;
+
+int ack_spool_open(ack_spool_t *spool, const char *path);
+void ack_spool_close(ack_spool_t *spool);
+int ack_spool_publish(ack_spool_t *spool, const void *payload, int len, double now, ack_spool_send_t send,
+                      void *userdata);
+int ack_spool_on_ack(ack_spool_t *spool, const char *ack, int len, double now, ack_spool_send_t send, void *userdata);
+void ack_spool_poll(ack_spool_t *spool, double now, ack_spool_send_t send, void *userdata);
+int ack_spool_pending(const ack_spool_t *spool);
+void ack_spool_report(const ack_spool_t *spool, FILE *out);
+
+#endif
@@ -0,0 +1,91 @@
+#include "inflight_ctl.h"
+#include <string.h>
+
+void inflight_ctl_init(inflight_ctl_t *ctl, int max_window) {
+  memset(ctl, 0, sizeof(inflight_ctl_t));
+  ctl->max_window = max_window > INFLIGHT_MIN_WINDOW ? max_window : INFLIGHT_MIN_WINDOW;
+  ctl->cwnd = INFLIGHT_INITIAL_WINDOW < ctl->max_window ? INFLIGHT_INITIAL_WINDOW : ctl->max_window;
+}
+
+int inflight_ctl_window(const inflight_ctl_t *ctl) {
+  if (ctl->probing && ctl->cwnd > INFLIGHT_PROBE_WINDOW) {
+    return INFLIGHT_PROBE_WINDOW;
+  }
+  return (int)ctl->cwnd;
+}
+
+// RFC 6298, before the first sample the timeout is left to the broker
+double inflight_ctl_rto_ms(const inflight_ctl_t *ctl) {
+  double rto = ctl->srtt_ms + 4 * ctl->rttvar_ms;
+
+  if (ctl->samples == 0) {
+    return 0;
+  }
+  return rto > INFLIGHT_MIN_RTO_MS ? rto : INFLIGHT_MIN_RTO_MS;
+}
+
+static void decrease(inflight_ctl_t *ctl, double now_ms) {
+  ctl->cwnd *= INFLIGHT_DECREASE;
+  if (ctl->cwnd < INFLIGHT_MIN_WINDOW) ctl->cwnd = INFLIGHT_MIN_WINDOW;
+  ctl->last_decrease = now_ms;
+  ctl->decreases++;
+}
+
+void inflight_ctl_on_ack(inflight_ctl_t *ctl, double rtt_ms, double now_ms) {
+  int before = (int)ctl->cwnd;
+
+  if (ctl->samples++ == 0) {
+    ctl->srtt_ms = rtt_ms;
+    ctl->rttvar_ms = rtt_ms / 2;
+  } else {
+    double err = rtt_ms - ctl->srtt_ms;
+    ctl->rttvar_ms += ((err < 0 ? -err : err) - ctl->rttvar_ms) / 4;
+    ctl->srtt_ms += err / 8;
+  }
+  if (ctl->min_rtt_ms == 0 || rtt_ms <= ctl->min_rtt_ms) {
+    ctl->min_rtt_ms = rtt_ms;
+    ctl->min_rtt_at = now_ms;
+  }
+
+  if (ctl->probing) {
+    if (rtt_ms < ctl->probe_min_ms) ctl->probe_min_ms = rtt_ms;
+    if (now_ms - ctl->probe_started < 2 * ctl->srtt_ms) {
+      return;
+    }
+    ctl->min_rtt_ms = ctl->probe_min_ms;
+    ctl->min_rtt_at = now_ms;
+    ctl->probing = false;
+  } else if (now_ms - ctl->min_rtt_at > INFLIGHT_MIN_RTT_WINDOW_MS) {
+    ctl->probing = true;
+    ctl->probe_started = now_ms;
+    ctl->probe_min_ms = rtt_ms;
+    return;
+  }
+
+  if (ctl->srtt_ms > ctl->min_rtt_ms * INFLIGHT_DELAY_FACTOR + INFLIGHT_DELAY_SLACK_MS) {
+    // At most one decrease per round trip, the acks still in flight were sent with the old window
+    if (now_ms - ctl->last_decrease > ctl->srtt_ms) decrease(ctl, now_ms);
+    return;
+  }
+  ctl->cwnd += 1.0 / ctl->cwnd;
+  if (ctl->cwnd > ctl->max_window) ctl->cwnd = ctl->max_window;
+  if ((int)ctl->cwnd > before) ctl->increases++;
+}
+
+/* A PUBACK overdue by a whole RTO is the signal that the broker or the cell drops messages, back off before the
+ * broker starts seeing retries. */
+void inflight_ctl_on_timeout(inflight_ctl_t *ctl, double now_ms) {
+  if (now_ms - ctl->last_decrease <= inflight_ctl_rto_ms(ctl)) {
+    return;
+  }
+  ctl->timeouts++;
+  decrease(ctl, now_ms);
+}
+
+void inflight_ctl_report(const inflight_ctl_t *ctl, FILE *out) {
+  fprintf(out,
+          "window %d/%d (cwnd %.2f%s) min_rtt %.1f ms srtt %.1f ms rto %.1f ms, %lu samples, +%lu -%lu, %lu "
+          "timeouts\n",
+          inflight_ctl_window(ctl), ctl->max_window, ctl->cwnd, ctl->probing ? ", probing rtt" : "", ctl->min_rtt_ms,
+          ctl->srtt_ms, inflight_ctl_rto_ms(ctl), ctl->samples, ctl->increases, ctl->decreases, ctl->timeouts);
+}
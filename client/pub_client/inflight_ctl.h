@@ -0,0 +1,44 @@
+#ifndef INFLIGHT_CTL_H
+#define INFLIGHT_CTL_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/* AIMD window over the number of unacknowledged QoS 1/2 publishes. The window grows by one per window of PUBACKs while
+ * the smoothed RTT stays close to the lowest RTT seen recently, and shrinks as soon as acknowledgements queue up behind
+ * each other or one does not arrive within the retransmission timeout. A full window keeps the RTT inflated, so like
+ * BBR's ProbeRTT the window drops to INFLIGHT_PROBE_WINDOW for two round trips whenever min_rtt has to be refreshed. */
+#define INFLIGHT_INITIAL_WINDOW 4
+#define INFLIGHT_MIN_WINDOW 1
+#define INFLIGHT_DECREASE 0.7
+#define INFLIGHT_DELAY_FACTOR 1.5  // srtt above min_rtt * factor + slack means the link is queueing
+#define INFLIGHT_DELAY_SLACK_MS 5.0
+#define INFLIGHT_MIN_RTT_WINDOW_MS 10000  // min_rtt is re-measured after this long so a route change is picked up
+#define INFLIGHT_PROBE_WINDOW 2
+#define INFLIGHT_MIN_RTO_MS 200.0
+
+typedef struct inflight_ctl_s {
+  double cwnd;
+  int max_window;
+  double min_rtt_ms;
+  double min_rtt_at;
+  double srtt_ms;
+  double rttvar_ms;
+  double last_decrease;
+  bool probing;
+  double probe_started;
+  double probe_min_ms;
+  unsigned long samples;
+  unsigned long increases;
+  unsigned long decreases;
+  unsigned long timeouts;
+} inflight_ctl_t;
+
+void inflight_ctl_init(inflight_ctl_t *ctl, int max_window);
+int inflight_ctl_window(const inflight_ctl_t *ctl);
+double inflight_ctl_rto_ms(const inflight_ctl_t *ctl);
+void inflight_ctl_on_ack(inflight_ctl_t *ctl, double rtt_ms, double now_ms);
+void inflight_ctl_on_timeout(inflight_ctl_t *ctl, double now_ms);
+void inflight_ctl_report(const inflight_ctl_t *ctl, FILE *out);
+
+#endif
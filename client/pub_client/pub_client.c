@@ -1,25 +1,38 @@
 #include <errno.h>
 #include <string.h>
 #include "client_common.h"
+#include "pub_oneshot.h"
 #include "pub_utils.h"
 
+/* Usage: pub_client [--once]
+ * --once publishes a single message over a cached broker address and exits on PUBACK, for devices that wake up for
+ * one reading. */
 int main(int argc, char *argv[]) {
+  bool once = argc > 1 && !strcmp(argv[1], "--once");
   struct mosquitto *mosq = NULL;
+  oneshot_timing_t timing;
   mosq_config_t cfg;
   mosq_retcode_t ret;
 
   init_mosq_config(&cfg, client_pub);
-  mosquitto_lib_init();
 
   // set the configures and message for testing
-  cfg.general_config->host = strdup(HOST);
+  cfg.general_config->host = cfg_strdup(&cfg, HOST);
   if (cfg_add_topic(&cfg, client_pub, TOPIC)) {
     return EXIT_FAILURE;
   }
-  cfg.pub_config->message = strdup(MESSAGE);
+  cfg.pub_config->message = cfg_strdup(&cfg, MESSAGE);
   cfg.pub_config->msglen = strlen(cfg.pub_config->message);
   cfg.pub_config->pub_mode = MSGMODE_CMD;
 
+  if (once) {
+    ret = oneshot_publish(&cfg, &timing);
+    oneshot_report(&timing, stdout);
+    mosq_config_cleanup(&cfg);
+    return ret;
+  }
+  mosquitto_lib_init();
+
   if (generate_client_id(&cfg)) {
     goto cleanup;
   }
@@ -49,6 +62,7 @@ int main(int argc, char *argv[]) {
   mosquitto_connect_v5_callback_set(mosq, connect_callback_pub_func);
   mosquitto_disconnect_v5_callback_set(mosq, disconnect_callback_pub_func);
   mosquitto_publish_v5_callback_set(mosq, publish_callback_pub_func);
+  mosquitto_message_v5_callback_set(mosq, message_callback_pub_func);
 
   ret = mosq_client_connect(mosq, &cfg);
   if (ret) {
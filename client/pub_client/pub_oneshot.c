@@ -0,0 +1,325 @@
+#include "pub_oneshot.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_DISCONNECT 0xE0
+#define ONESHOT_MID 1
+
+static double now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static unsigned char *put_u16(unsigned char *buf, uint16_t val) {
+  buf[0] = val >> 8;
+  buf[1] = val & 0xff;
+  return buf + 2;
+}
+
+static unsigned char *put_string(unsigned char *buf, const char *str, int len) {
+  buf = put_u16(buf, len);
+  memcpy(buf, str, len);
+  return buf + len;
+}
+
+static unsigned char *put_remaining_length(unsigned char *buf, int len) {
+  do {
+    unsigned char byte = len % 128;
+    len /= 128;
+    *buf++ = len > 0 ? byte | 0x80 : byte;
+  } while (len > 0);
+  return buf;
+}
+
+static bool read_cache(const char *host, int port, struct sockaddr_storage *addr, socklen_t *addr_len) {
+  char cached_host[256], ip[INET6_ADDRSTRLEN];
+  int cached_port;
+  long expires;
+  FILE *cache = fopen(ONESHOT_CACHE_PATH, "r");
+  bool found = false;
+
+  if (!cache) {
+    return false;
+  }
+  if (fscanf(cache, "%255s %45s %d %ld", cached_host, ip, &cached_port, &expires) == 4 && !strcmp(cached_host, host) &&
+      cached_port == port && expires > time(NULL)) {
+    struct sockaddr_in *in4 = (struct sockaddr_in *)addr;
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)addr;
+
+    memset(addr, 0, sizeof(*addr));
+    if (inet_pton(AF_INET, ip, &in4->sin_addr) == 1) {
+      in4->sin_family = AF_INET;
+      in4->sin_port = htons(port);
+      *addr_len = sizeof(*in4);
+      found = true;
+    } else if (inet_pton(AF_INET6, ip, &in6->sin6_addr) == 1) {
+      in6->sin6_family = AF_INET6;
+      in6->sin6_port = htons(port);
+      *addr_len = sizeof(*in6);
+      found = true;
+    }
+  }
+  fclose(cache);
+  return found;
+}
+
+// Written to a temporary file first, a device losing power mid-write must not leave half an address behind
+static void write_cache(const char *host, int port, const struct sockaddr_storage *addr) {
+  char ip[INET6_ADDRSTRLEN], tmp[sizeof(ONESHOT_CACHE_PATH) + 16];
+  const void *src = addr->ss_family == AF_INET ? (const void *)&((const struct sockaddr_in *)addr)->sin_addr
+                                               : (const void *)&((const struct sockaddr_in6 *)addr)->sin6_addr;
+  FILE *cache;
+
+  if (!inet_ntop(addr->ss_family, src, ip, sizeof(ip))) {
+    return;
+  }
+  snprintf(tmp, sizeof(tmp), "%s.%d", ONESHOT_CACHE_PATH, getpid());
+  cache = fopen(tmp, "w");
+  if (!cache) {
+    return;
+  }
+  fprintf(cache, "%s %s %d %ld\n", host, ip, port, (long)time(NULL) + ONESHOT_CACHE_TTL);
+  if (fclose(cache) || rename(tmp, ONESHOT_CACHE_PATH)) {
+    unlink(tmp);
+  }
+}
+
+static int resolve(const char *host, int port, struct sockaddr_storage *addr, socklen_t *addr_len) {
+  struct addrinfo hints, *res;
+  char port_str[12];  // any int
+  int ret;
+
+  if (port < 0 || port > 65535) {
+    fprintf(stderr, "Error: Invalid port %d.\n", port);
+    return -1;
+  }
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(port_str, sizeof(port_str), "%d", port);
+  ret = getaddrinfo(host, port_str, &hints, &res);
+  if (ret) {
+    fprintf(stderr, "Error: Unable to resolve %s: %s\n", host, gai_strerror(ret));
+    return -1;
+  }
+  memcpy(addr, res->ai_addr, res->ai_addrlen);
+  *addr_len = res->ai_addrlen;
+  freeaddrinfo(res);
+  write_cache(host, port, addr);
+  return 0;
+}
+
+static int connect_tcp(const struct sockaddr_storage *addr, socklen_t addr_len) {
+  struct timeval timeout = {.tv_sec = ONESHOT_TIMEOUT_MS / 1000, .tv_usec = ONESHOT_TIMEOUT_MS % 1000 * 1000};
+  int fd = socket(addr->ss_family, SOCK_STREAM, 0), one = 1;
+
+  if (fd < 0) {
+    return -1;
+  }
+  // Linux applies the send timeout to connect() as well
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (connect(fd, (const struct sockaddr *)addr, addr_len)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* CONNECT, PUBLISH and, for QoS 0, DISCONNECT in one buffer. MQTT allows a client to send before the CONNACK arrives,
+ * the broker processes the PUBLISH right after accepting the connection. */
+static unsigned char *build_packets(mosq_config_t *cfg, int qos, int *len) {
+  mosq_general_config_t *general = cfg->general_config;
+  mosq_pub_config_t *pub_config = cfg->pub_config;
+  const char *id = general->id ? general->id : "";
+  int id_len = strlen(id), topic_len = strlen(pub_config->topic);
+  int user_len = general->username ? strlen(general->username) : 0;
+  int pass_len = general->password ? strlen(general->password) : 0;
+  int connect_len = 10 + 2 + id_len, publish_len = 2 + topic_len + (qos ? 2 : 0) + pub_config->msglen;
+  unsigned char *buf, *p, flags = 0x02;
+
+  if (general->username) {
+    flags |= 0x80;
+    connect_len += 2 + user_len;
+    if (general->password) {
+      flags |= 0x40;
+      connect_len += 2 + pass_len;
+    }
+  }
+  buf = malloc(1 + 4 + connect_len + 1 + 4 + publish_len + 2);
+  if (!buf) {
+    return NULL;
+  }
+
+  p = buf;
+  *p++ = MQTT_CONNECT;
+  p = put_remaining_length(p, connect_len);
+  p = put_string(p, "MQTT", 4);
+  *p++ = 4;  // protocol level 3.1.1
+  *p++ = flags;
+  p = put_u16(p, general->keepalive);
+  p = put_string(p, id, id_len);
+  if (general->username) {
+    p = put_string(p, general->username, user_len);
+    if (general->password) p = put_string(p, general->password, pass_len);
+  }
+
+  *p++ = MQTT_PUBLISH | qos << 1 | (general->retain ? 1 : 0);
+  p = put_remaining_length(p, publish_len);
+  p = put_string(p, pub_config->topic, topic_len);
+  if (qos) p = put_u16(p, ONESHOT_MID);
+  memcpy(p, pub_config->message, pub_config->msglen);
+  p += pub_config->msglen;
+
+  if (!qos) {
+    *p++ = MQTT_DISCONNECT;
+    *p++ = 0;
+  }
+  *len = p - buf;
+  return buf;
+}
+
+static int write_all(int fd, const unsigned char *buf, int len) {
+  int sent;
+
+  while (len > 0) {
+    sent = send(fd, buf, len, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) continue;
+    if (sent <= 0) return -1;
+    buf += sent;
+    len -= sent;
+  }
+  return 0;
+}
+
+/* Returns the packet type and copies at most `size` bytes of the body, -1 on timeout or a closed connection. */
+static int read_packet(int fd, unsigned char *body, int size, int *body_len) {
+  unsigned char byte, type, discard[64];
+  int len = 0, shift = 0, chunk;
+
+  if (recv(fd, &type, 1, MSG_WAITALL) != 1) return -1;
+  do {
+    if (recv(fd, &byte, 1, MSG_WAITALL) != 1 || shift > 21) return -1;
+    len |= (byte & 0x7f) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+
+  *body_len = len;
+  if (len > 0 && recv(fd, body, len < size ? len : size, MSG_WAITALL) != (len < size ? len : size)) return -1;
+  for (len -= size; len > 0; len -= chunk) {
+    chunk = recv(fd, discard, len < (int)sizeof(discard) ? len : (int)sizeof(discard), 0);
+    if (chunk <= 0) return -1;
+  }
+  return type & 0xF0;
+}
+
+static rc_mosq_retcode_t wait_for(int fd, int expected, unsigned char *body, int *body_len) {
+  int type;
+
+  do {
+    type = read_packet(fd, body, ONESHOT_MAX_PACKET, body_len);
+    if (type < 0) {
+      fprintf(stderr, "Error: No %s from the broker.\n", expected == MQTT_CONNACK ? "CONNACK" : "PUBACK");
+      return RC_ONESHOT_TIMEOUT;
+    }
+  } while (type != expected);
+  return RC_MOS_OK;
+}
+
+rc_mosq_retcode_t oneshot_publish(mosq_config_t *cfg, oneshot_timing_t *timing) {
+  mosq_general_config_t *general = cfg->general_config;
+  int port, qos = general->qos, fd = -1, len, body_len;
+  unsigned char body[ONESHOT_MAX_PACKET], *packets = NULL;
+  rc_mosq_retcode_t ret = RC_MOS_OK;
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+  double started = now_ms(), phase = started;
+  const char *host;
+  char proxy[256];
+
+  memset(timing, 0, sizeof(oneshot_timing_t));
+  if (qos > 1) {
+    fprintf(stderr, "Error: Single-shot mode supports QoS 0 and 1.\n");
+    return RC_MOS_INIT_ERROR;
+  }
+  if (mosq_connect_target(cfg, proxy, sizeof(proxy), &host, &port)) {
+    return RC_CLIENT_CONNTECT;
+  }
+
+  timing->cached = read_cache(host, port, &addr, &addr_len);
+  if (!timing->cached && resolve(host, port, &addr, &addr_len)) {
+    return RC_ONESHOT_RESOLVE;
+  }
+  timing->resolve_ms = now_ms() - phase;
+
+  phase = now_ms();
+  fd = connect_tcp(&addr, addr_len);
+  if (fd < 0 && timing->cached) {
+    // The broker may have moved, resolve once more before giving up
+    unlink(ONESHOT_CACHE_PATH);
+    timing->cached = false;
+    if (!resolve(host, port, &addr, &addr_len)) fd = connect_tcp(&addr, addr_len);
+  }
+  if (fd < 0) {
+    fprintf(stderr, "Error: Unable to connect to %s: %s\n", host, strerror(errno));
+    return RC_CLIENT_CONNTECT;
+  }
+  timing->tcp_ms = now_ms() - phase;
+
+  phase = now_ms();
+  packets = build_packets(cfg, qos, &len);
+  if (!packets || write_all(fd, packets, len)) {
+    fprintf(stderr, "Error: Unable to send to %s.\n", host);
+    ret = RC_CLIENT_CONNTECT;
+    goto done;
+  }
+  timing->write_ms = now_ms() - phase;
+  if (qos == 0) {
+    goto done;
+  }
+
+  phase = now_ms();
+  ret = wait_for(fd, MQTT_CONNACK, body, &body_len);
+  if (ret) goto done;
+  if (body_len < 2 || body[1] != 0) {
+    fprintf(stderr, "Error: %s\n", mosquitto_connack_string(body_len < 2 ? -1 : body[1]));
+    ret = RC_ONESHOT_REJECTED;
+    goto done;
+  }
+  timing->connack_ms = now_ms() - phase;
+
+  phase = now_ms();
+  ret = wait_for(fd, MQTT_PUBACK, body, &body_len);
+  if (ret) goto done;
+  timing->puback_ms = now_ms() - phase;
+  body[0] = MQTT_DISCONNECT;
+  body[1] = 0;
+  write_all(fd, body, 2);
+
+done:
+  timing->total_ms = now_ms() - started;
+  free(packets);
+  if (fd >= 0) close(fd);
+  return ret;
+}
+
+void oneshot_report(const oneshot_timing_t *timing, FILE *out) {
+  fprintf(out, "oneshot: resolve %.3f ms (%s), tcp %.3f ms, write %.3f ms, connack %.3f ms, puback %.3f ms, total %.3f ms\n",
+          timing->resolve_ms, timing->cached ? "cached" : "dns", timing->tcp_ms, timing->write_ms, timing->connack_ms,
+          timing->puback_ms, timing->total_ms);
+}
@@ -0,0 +1,29 @@
+#ifndef PUB_ONESHOT_H
+#define PUB_ONESHOT_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "client_common.h"
+
+/* Single-shot publish for duty-cycled devices: one TCP connection, CONNECT and PUBLISH written back to back with one
+ * send(), exit on PUBACK (QoS 1) or once the write completed (QoS 0). It speaks MQTT 3.1.1 directly and never calls
+ * mosquitto_lib_init(), so none of the library setup is paid on every wake-up. */
+#define ONESHOT_CACHE_PATH "/var/tmp/pub_client.addr"
+#define ONESHOT_CACHE_TTL (24 * 60 * 60)
+#define ONESHOT_TIMEOUT_MS 5000
+#define ONESHOT_MAX_PACKET 4096
+
+typedef struct oneshot_timing_s {
+  double resolve_ms;
+  double tcp_ms;
+  double write_ms;
+  double connack_ms;
+  double puback_ms;
+  double total_ms;
+  bool cached;
+} oneshot_timing_t;
+
+rc_mosq_retcode_t oneshot_publish(mosq_config_t *cfg, oneshot_timing_t *timing);
+void oneshot_report(const oneshot_timing_t *timing, FILE *out);
+
+#endif
@@ -0,0 +1,218 @@
+#include "pub_queue.h"
+#include <stdlib.h>
+#include <string.h>
+#include "pub_utils.h"
+
+static const pub_class_config_t default_classes[PUB_CLASS_MAX] = {
+    {.name = "alarm", .qos = 1, .retain = false, .strict = true, .weight = 0, .capacity = 32},
+    {.name = "control", .qos = 1, .retain = false, .strict = false, .weight = 4, .capacity = 64},
+    {.name = "telemetry", .qos = 0, .retain = false, .strict = false, .weight = 1, .capacity = 256},
+};
+
+int pub_queue_init(pub_queue_t *pq, int max_inflight) {
+  memset(pq, 0, sizeof(pub_queue_t));
+  memcpy(pq->classes, default_classes, sizeof(default_classes));
+  pq->max_inflight = (max_inflight > 0 && max_inflight <= PUB_QUEUE_MAX_INFLIGHT) ? max_inflight : 20;
+  for (int i = 0; i < PUB_CLASS_MAX; i++) {
+    if (bqueue_init(&pq->queues[i], pq->classes[i].capacity)) {
+      return -1;
+    }
+    pq->credits[i] = pq->classes[i].weight;
+  }
+  inflight_ctl_init(&pq->ctl, pq->max_inflight);
+  return 0;
+}
+
+void pub_queue_destroy(pub_queue_t *pq) {
+  pub_item_t *item;
+
+  for (int i = 0; i < PUB_CLASS_MAX; i++) {
+    while ((item = bqueue_try_pop(&pq->queues[i]))) {
+      pub_item_free(item);
+    }
+    bqueue_destroy(&pq->queues[i]);
+  }
+  for (int i = 0; i < pq->inflight_count; i++) {
+    pub_item_free(pq->inflight[i]);
+  }
+  pq->inflight_count = 0;
+}
+
+pub_item_t *pub_item_new(pub_class_t cls, const char *topic, const void *payload, int payloadlen) {
+  pub_item_t *item = calloc(1, sizeof(pub_item_t));
+
+  if (!item) {
+    return NULL;
+  }
+  item->cls = cls;
+  item->topic = strdup(topic);
+  item->payload = malloc(payloadlen > 0 ? payloadlen : 1);
+  if (!item->topic || !item->payload) {
+    pub_item_free(item);
+    return NULL;
+  }
+  memcpy(item->payload, payload, payloadlen);
+  item->payloadlen = payloadlen;
+  return item;
+}
+
+void pub_item_free(pub_item_t *item) {
+  if (item) {
+    free(item->topic);
+    free(item->payload);
+    free(item);
+  }
+}
+
+/* Blocks while the class queue is full, so a congested link slows the producer down instead of growing memory. */
+bool pub_queue_push(pub_queue_t *pq, pub_item_t *item) {
+  clock_gettime(CLOCK_MONOTONIC, &item->enqueued);
+  return bqueue_push(&pq->queues[item->cls], item);
+}
+
+void pub_queue_close(pub_queue_t *pq) {
+  for (int i = 0; i < PUB_CLASS_MAX; i++) {
+    bqueue_close(&pq->queues[i]);
+  }
+}
+
+static pub_item_t *next_item(pub_queue_t *pq) {
+  pub_item_t *item;
+  bool refill = false;
+
+  for (int i = 0; i < PUB_CLASS_MAX; i++) {
+    if (pq->classes[i].strict && (item = bqueue_try_pop(&pq->queues[i]))) {
+      return item;
+    }
+  }
+
+  // Weighted round robin, every class spends its credits before the credits of all classes are refilled
+  for (int round = 0; round < 2; round++) {
+    for (int n = 0; n < PUB_CLASS_MAX; n++) {
+      int cls = (pq->rr_next + n) % PUB_CLASS_MAX;
+      if (pq->classes[cls].strict) continue;
+      if (pq->credits[cls] == 0) {
+        refill = true;
+        continue;
+      }
+      if ((item = bqueue_try_pop(&pq->queues[cls]))) {
+        if (--pq->credits[cls] == 0) pq->rr_next = (cls + 1) % PUB_CLASS_MAX;
+        return item;
+      }
+    }
+    if (!refill) break;
+    for (int cls = 0; cls < PUB_CLASS_MAX; cls++) {
+      pq->credits[cls] = pq->classes[cls].weight;
+    }
+  }
+  return NULL;
+}
+
+static double elapsed_ms(const struct timespec *since, const struct timespec *now) {
+  return (now->tv_sec - since->tv_sec) * 1e3 + (now->tv_nsec - since->tv_nsec) / 1e6;
+}
+
+static double timespec_ms(const struct timespec *ts) { return ts->tv_sec * 1e3 + ts->tv_nsec / 1e6; }
+
+/* Fills the inflight window from the class queues, called from the thread running the mosquitto loop. */
+mosq_retcode_t pub_queue_dispatch(pub_queue_t *pq, struct mosquitto *mosq, mosq_config_t *cfg) {
+  mosq_retcode_t ret = MOSQ_ERR_SUCCESS;
+  pub_class_config_t *cls;
+  struct timespec now;
+  double rto;
+  pub_item_t *item;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  rto = inflight_ctl_rto_ms(&pq->ctl);
+  for (int i = 0; rto > 0 && i < pq->inflight_count; i++) {
+    if (pq->classes[pq->inflight[i]->cls].qos > 0 && elapsed_ms(&pq->inflight[i]->sent, &now) > rto) {
+      inflight_ctl_on_timeout(&pq->ctl, timespec_ms(&now));
+      break;
+    }
+  }
+
+  while (pq->inflight_count < inflight_ctl_window(&pq->ctl) && (item = next_item(pq))) {
+    cls = &pq->classes[item->cls];
+    clock_gettime(CLOCK_MONOTONIC, &item->sent);
+    ret = publish_message(mosq, cfg, &item->mid, item->topic, item->payloadlen, item->payload, cls->qos, cls->retain);
+    if (ret) {
+      pub_item_free(item);
+      return ret;
+    }
+    pq->inflight[pq->inflight_count++] = item;
+  }
+  return ret;
+}
+
+static void record_latency(pub_latency_t *latency, const struct timespec *enqueued) {
+  struct timespec now;
+  double ms;
+  int bucket = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  ms = (now.tv_sec - enqueued->tv_sec) * 1e3 + (now.tv_nsec - enqueued->tv_nsec) / 1e6;
+  while (bucket < PUB_LATENCY_BUCKETS - 1 && ms >= (double)(1 << bucket)) {
+    bucket++;
+  }
+  latency->buckets[bucket]++;
+  latency->count++;
+  latency->sum_ms += ms;
+  if (ms > latency->max_ms) latency->max_ms = ms;
+}
+
+/* Completes the message with `mid`: PUBACK for QoS 1, the socket write for QoS 0. */
+bool pub_queue_on_publish(pub_queue_t *pq, int mid) {
+  for (int i = 0; i < pq->inflight_count; i++) {
+    if (pq->inflight[i]->mid == mid) {
+      record_latency(&pq->latency[pq->inflight[i]->cls], &pq->inflight[i]->enqueued);
+      // QoS 0 completes on the socket write, only PUBACKs say something about the path to the broker
+      if (pq->classes[pq->inflight[i]->cls].qos > 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        inflight_ctl_on_ack(&pq->ctl, elapsed_ms(&pq->inflight[i]->sent, &now), timespec_ms(&now));
+      }
+      pub_item_free(pq->inflight[i]);
+      pq->inflight[i] = pq->inflight[--pq->inflight_count];
+      return true;
+    }
+  }
+  return false;
+}
+
+/* libmosquitto resends unacknowledged QoS 1 messages after a reconnect, but forgets QoS 0 ones it had not written yet
+ * and never calls back for them. They would hold their window slot forever. */
+void pub_queue_on_disconnect(pub_queue_t *pq) {
+  for (int i = 0; i < pq->inflight_count;) {
+    if (pq->classes[pq->inflight[i]->cls].qos > 0) {
+      i++;
+      continue;
+    }
+    pq->latency[pq->inflight[i]->cls].lost++;
+    pub_item_free(pq->inflight[i]);
+    pq->inflight[i] = pq->inflight[--pq->inflight_count];
+  }
+}
+
+double pub_latency_percentile_ms(const pub_latency_t *latency, double pct) {
+  unsigned long target = (unsigned long)(latency->count * pct), seen = 0;
+
+  for (int i = 0; i < PUB_LATENCY_BUCKETS; i++) {
+    seen += latency->buckets[i];
+    if (seen > target) {
+      return (double)(1 << i);
+    }
+  }
+  return latency->max_ms;
+}
+
+void pub_queue_report(pub_queue_t *pq, FILE *out) {
+  for (int i = 0; i < PUB_CLASS_MAX; i++) {
+    pub_latency_t *latency = &pq->latency[i];
+    fprintf(out, "%-10s depth %3d/%-3d sent %6lu lost %4lu avg %8.1f ms p50 <%6.0f ms p99 <%6.0f ms max %8.1f ms\n",
+            pq->classes[i].name, bqueue_depth(&pq->queues[i]), pq->classes[i].capacity, latency->count, latency->lost,
+            latency->count ? latency->sum_ms / latency->count : 0.0, pub_latency_percentile_ms(latency, 0.5),
+            pub_latency_percentile_ms(latency, 0.99), latency->max_ms);
+  }
+  fprintf(out, "inflight %d ", pq->inflight_count);
+  inflight_ctl_report(&pq->ctl, out);
+}
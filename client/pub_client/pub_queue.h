@@ -0,0 +1,68 @@
+#ifndef PUB_QUEUE_H
+#define PUB_QUEUE_H
+
+#include <mosquitto.h>
+#include <stdio.h>
+#include <time.h>
+#include "bqueue.h"
+#include "client_common.h"
+#include "inflight_ctl.h"
+
+#define PUB_QUEUE_MAX_INFLIGHT 64
+#define PUB_LATENCY_BUCKETS 16  // bucket i counts latencies below 2^i ms
+
+/* Alarms are always sent first, the remaining classes share the inflight window by weight. */
+typedef enum pub_class_s { PUB_CLASS_ALARM, PUB_CLASS_CONTROL, PUB_CLASS_TELEMETRY, PUB_CLASS_MAX } pub_class_t;
+
+typedef struct pub_class_config_s {
+  const char *name;
+  int qos;
+  bool retain;
+  bool strict;
+  int weight;
+  int capacity;
+} pub_class_config_t;
+
+typedef struct pub_item_s {
+  pub_class_t cls;
+  char *topic;
+  void *payload;
+  int payloadlen;
+  int mid;
+  struct timespec enqueued;
+  struct timespec sent;
+} pub_item_t;
+
+typedef struct pub_latency_s {
+  unsigned long count;
+  unsigned long lost;  // QoS 0 messages dropped with the connection before they were written
+  double sum_ms;
+  double max_ms;
+  unsigned long buckets[PUB_LATENCY_BUCKETS];
+} pub_latency_t;
+
+typedef struct pub_queue_s {
+  pub_class_config_t classes[PUB_CLASS_MAX];
+  bqueue_t queues[PUB_CLASS_MAX];
+  int credits[PUB_CLASS_MAX];
+  int rr_next;
+  pub_item_t *inflight[PUB_QUEUE_MAX_INFLIGHT];
+  int inflight_count;
+  int max_inflight;
+  inflight_ctl_t ctl;  // the actual window, max_inflight is its upper bound
+  pub_latency_t latency[PUB_CLASS_MAX];
+} pub_queue_t;
+
+int pub_queue_init(pub_queue_t *pq, int max_inflight);
+void pub_queue_destroy(pub_queue_t *pq);
+pub_item_t *pub_item_new(pub_class_t cls, const char *topic, const void *payload, int payloadlen);
+void pub_item_free(pub_item_t *item);
+bool pub_queue_push(pub_queue_t *pq, pub_item_t *item);
+void pub_queue_close(pub_queue_t *pq);
+mosq_retcode_t pub_queue_dispatch(pub_queue_t *pq, struct mosquitto *mosq, mosq_config_t *cfg);
+bool pub_queue_on_publish(pub_queue_t *pq, int mid);
+void pub_queue_on_disconnect(pub_queue_t *pq);
+double pub_latency_percentile_ms(const pub_latency_t *latency, double pct);
+void pub_queue_report(pub_queue_t *pq, FILE *out);
+
+#endif
@@ -0,0 +1,215 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "capture.h"
+#include "client_common.h"
+#include "pub_utils.h"
+
+#define REPLAY_MAX_OUTSTANDING 1000  // unacknowledged QoS>0 publishes before a max-speed replay waits for the broker
+#define REPLAY_DRAIN_TIMEOUT 10
+#define REPLAY_REPORT_INTERVAL 5
+#define REPLAY_MID_SPACE 65536  // MQTT message ids are 16 bits
+
+typedef struct replay_s {
+  mosq_config_t *cfg;
+  bool connected;
+  unsigned long published;
+  unsigned long outstanding;
+  unsigned char awaiting[REPLAY_MID_SPACE / 8];  // mids of QoS>0 publishes not acknowledged yet, QoS 0 also calls back
+  unsigned long bytes;
+  long max_lag_us;
+  long total_lag_us;
+} replay_t;
+
+static volatile sig_atomic_t run = 1;
+
+static void stop_func(int signum) { run = 0; }
+
+static long now_us(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void connect_callback_replay_func(struct mosquitto *mosq, void *obj, int result, int flags,
+                                         const mosquitto_property *properties) {
+  replay_t *replay = (replay_t *)obj;
+
+  if (result) {
+    fprintf(stderr, "Error: %s\n", mosquitto_connack_string(result));
+    run = 0;
+    return;
+  }
+  replay->connected = true;
+}
+
+static void publish_callback_replay_func(struct mosquitto *mosq, void *obj, int mid, int reason_code,
+                                         const mosquitto_property *properties) {
+  replay_t *replay = (replay_t *)obj;
+  unsigned char bit = 1 << (mid & 7);
+
+  if (mid < 0 || mid >= REPLAY_MID_SPACE || !(replay->awaiting[mid / 8] & bit)) return;
+  replay->awaiting[mid / 8] &= ~bit;
+  replay->outstanding--;
+}
+
+static void report(const replay_t *replay, long elapsed_us) {
+  double seconds = elapsed_us / 1000000.0;
+
+  printf("replayed %lu messages, %lu bytes in %.1f s: %.1f msg/s, lag avg %.1f ms max %.1f ms\n", replay->published,
+         replay->bytes, seconds, seconds > 0 ? replay->published / seconds : 0.0,
+         replay->published ? replay->total_lag_us / 1000.0 / replay->published : 0.0, replay->max_lag_us / 1000.0);
+  fflush(stdout);
+}
+
+/* Sleeps in the network loop until `due`, so acknowledgements keep flowing while a 1x replay waits for the next gap. */
+static int wait_until(struct mosquitto *mosq, long due) {
+  long remaining;
+
+  while (run && (remaining = due - now_us()) > 0) {
+    if (mosquitto_loop(mosq, remaining > 100000 ? 100 : (int)(remaining / 1000), 1) != MOSQ_ERR_SUCCESS) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Usage: pub_replay <capture file> [speed|max] [skip seconds]
+ * Republishes a capture taken by `sub_client --capture <file>` with the original topics, QoS and retain flags. The gaps
+ * between messages are divided by the speed factor, `max` ignores them. */
+int main(int argc, char *argv[]) {
+  double speed = 1;
+  long skip_sec = argc > 3 ? atol(argv[3]) : 0;
+  rc_mosq_retcode_t ret = RC_MOS_OK;
+  struct mosquitto *mosq = NULL;
+  capture_reader_t *reader;
+  capture_record_t record;
+  uint64_t first_ts = 0;
+  long started, due, lag, next_report, drain_until;
+  mosq_config_t cfg;
+  replay_t replay;
+  char *end;
+  int rc, mid;
+
+  if (argc < 2) {
+    fprintf(stderr, "Error: Usage: pub_replay <capture file> [speed|max] [skip seconds]\n");
+    return EXIT_FAILURE;
+  }
+  if (argc > 2 && !strcmp(argv[2], "max")) {
+    speed = 0;
+  } else if (argc > 2) {
+    errno = 0;
+    speed = strtod(argv[2], &end);
+    if (errno || end == argv[2] || *end || !(speed > 0)) {
+      fprintf(stderr, "Error: Invalid speed %s, expected a factor above 0 or max.\n", argv[2]);
+      return EXIT_FAILURE;
+    }
+  }
+  reader = capture_reader_open(argv[1]);
+  if (!reader) {
+    return EXIT_FAILURE;
+  }
+  rc = capture_read(reader, &record);
+  if (rc <= 0) {
+    fprintf(stderr, "Error: %s holds no messages.\n", argv[1]);
+    capture_reader_close(reader);
+    return EXIT_FAILURE;
+  }
+  // Seeking also rewinds to the first record when nothing is skipped
+  first_ts = record.ts_us + (skip_sec > 0 ? skip_sec * 1000000 : 0);
+  if (capture_seek(reader, first_ts) <= 0) {
+    fprintf(stderr, "Error: %s ends within the first %ld seconds.\n", argv[1], skip_sec);
+    capture_reader_close(reader);
+    return EXIT_FAILURE;
+  }
+
+  memset(&replay, 0, sizeof(replay));
+  signal(SIGINT, stop_func);
+  signal(SIGTERM, stop_func);
+  init_mosq_config(&cfg, client_pub);
+  mosquitto_lib_init();
+  cfg.general_config->host = strdup(HOST);
+  cfg.general_config->id_prefix = strdup("replay_");
+  replay.cfg = &cfg;
+  if (generate_client_id(&cfg)) {
+    ret = RC_MOS_INIT_ERROR;
+    goto cleanup;
+  }
+  mosq = mosquitto_new(cfg.general_config->id, true, &replay);
+  if (!mosq || mosq_opts_set(mosq, &cfg)) {
+    ret = RC_MOS_INIT_ERROR;
+    goto cleanup;
+  }
+  mosquitto_connect_v5_callback_set(mosq, connect_callback_replay_func);
+  mosquitto_publish_v5_callback_set(mosq, publish_callback_replay_func);
+  ret = mosq_client_connect(mosq, &cfg);
+  if (ret) {
+    goto cleanup;
+  }
+  while (run && !replay.connected) {
+    if (mosquitto_loop(mosq, 100, 1) != MOSQ_ERR_SUCCESS) {
+      ret = RC_CLIENT_CONNTECT;
+      goto cleanup;
+    }
+  }
+
+  started = now_us();
+  next_report = started + REPLAY_REPORT_INTERVAL * 1000000L;
+  while (run && (rc = capture_read(reader, &record)) > 0) {
+    if (speed > 0) {
+      due = started + (long)((int64_t)(record.ts_us - first_ts) / speed);
+      if (wait_until(mosq, due)) break;
+      lag = now_us() - due;
+      replay.total_lag_us += lag;
+      if (lag > replay.max_lag_us) replay.max_lag_us = lag;
+    } else {
+      while (run && replay.outstanding >= REPLAY_MAX_OUTSTANDING) {
+        if (mosquitto_loop(mosq, 10, 1) != MOSQ_ERR_SUCCESS) break;
+      }
+    }
+
+    if (publish_message(mosq, &cfg, &mid, record.topic, record.payload_len, record.payload, record.qos,
+                        record.retain) != MOSQ_ERR_SUCCESS) {
+      fprintf(stderr, "Warning: Failed to publish record %lu on %s.\n", reader->records, record.topic);
+      continue;
+    }
+    replay.published++;
+    replay.bytes += record.payload_len;
+    if (record.qos > 0 && mid >= 0 && mid < REPLAY_MID_SPACE && !(replay.awaiting[mid / 8] & (1 << (mid & 7)))) {
+      replay.awaiting[mid / 8] |= 1 << (mid & 7);
+      replay.outstanding++;
+    }
+    // Flushes the socket even when a max-speed replay never has to wait
+    if (speed == 0 && replay.published % 64 == 0) mosquitto_loop(mosq, 0, 1);
+
+    if (now_us() >= next_report) {
+      report(&replay, now_us() - started);
+      next_report += REPLAY_REPORT_INTERVAL * 1000000L;
+    }
+  }
+  if (rc < 0) {
+    ret = RC_MOS_INIT_ERROR;
+  }
+
+  drain_until = now_us() + REPLAY_DRAIN_TIMEOUT * 1000000L;
+  while (run && replay.outstanding > 0 && now_us() < drain_until) {
+    if (mosquitto_loop(mosq, 100, 1) != MOSQ_ERR_SUCCESS) break;
+  }
+  report(&replay, now_us() - started);
+  if (replay.outstanding > 0) {
+    fprintf(stderr, "Warning: %lu publishes were not acknowledged.\n", replay.outstanding);
+  }
+  mosquitto_disconnect_v5(mosq, 0, cfg.property_config->disconnect_props);
+  mosquitto_loop(mosq, 100, 1);
+
+cleanup:
+  capture_reader_close(reader);
+  mosquitto_destroy(mosq);
+  mosquitto_lib_cleanup();
+  mosq_config_cleanup(&cfg);
+  return ret;
+}
@@ -1,8 +1,11 @@
 #include "pub_utils.h"
+#include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
 #include <time.h>
 #include "config.h"
+#include "fragment.h"
+#include "topic_set.h"
 
 static void set_repeat_time(mosq_config_t *cfg) {
   gettimeofday(&cfg->pub_config->next_publish_tv, NULL);
@@ -39,6 +42,28 @@ mosq_retcode_t publish_message(struct mosquitto *mosq, mosq_config_t *cfg, int *
   }
 }
 
+static mosq_retcode_t publish_fragmented(struct mosquitto *mosq, mosq_config_t *cfg) {
+  mosq_pub_config_t *pub_config = cfg->pub_config;
+  char nack_topic[FRAG_MAX_TOPIC_LEN + sizeof(FRAG_NACK_SUFFIX)];
+
+  pub_config->frag = (frag_sender_t *)cfg_calloc(cfg, sizeof(frag_sender_t));
+  if (!pub_config->frag) {
+    return MOSQ_ERR_NOMEM;
+  }
+  if (frag_sender_init(pub_config->frag, pub_config->topic, pub_config->message, pub_config->msglen, pub_config->mtu,
+                       FRAG_DEFAULT_WINDOW, cfg->general_config->qos, frag_device_id(cfg->general_config->id))) {
+    cfg_free(cfg, pub_config->frag);
+    pub_config->frag = NULL;
+    return MOSQ_ERR_PAYLOAD_SIZE;
+  }
+
+  // The receiver asks for missing chunks on `<topic>/nack`
+  snprintf(nack_topic, sizeof(nack_topic), "%s%s", pub_config->topic, FRAG_NACK_SUFFIX);
+  mosquitto_subscribe_v5(mosq, NULL, nack_topic, 1, 0, cfg->property_config->subscribe_props);
+
+  return frag_sender_pump(pub_config->frag, mosq, cfg);
+}
+
 void log_callback_pub_func(struct mosquitto *mosq, void *obj, int level, const char *str) {
   UNUSED(level);
 
@@ -61,8 +86,12 @@ void connect_callback_pub_func(struct mosquitto *mosq, void *obj, int result, in
   UNUSED(properties);
 
   if (!result && cfg->pub_config->pub_mode == MSGMODE_CMD) {
-    ret = publish_message(mosq, cfg, &cfg->pub_config->mid_sent, cfg->pub_config->topic, cfg->pub_config->msglen,
-                          cfg->pub_config->message, cfg->general_config->qos, cfg->general_config->retain);
+    if (cfg->pub_config->mtu > 0 && cfg->pub_config->msglen > cfg->pub_config->mtu) {
+      ret = publish_fragmented(mosq, cfg);
+    } else {
+      ret = publish_message(mosq, cfg, &cfg->pub_config->mid_sent, cfg->pub_config->topic, cfg->pub_config->msglen,
+                            cfg->pub_config->message, cfg->general_config->qos, cfg->general_config->retain);
+    }
     if (ret) {
       {
         switch (ret) {
@@ -109,6 +138,18 @@ void publish_callback_pub_func(struct mosquitto *mosq, void *obj, int mid, int r
     { fprintf(stderr, "Warning: Publish %d failed: %s.\n", mid, mosquitto_reason_string(reason_code)); }
   }
 
+  if (cfg->pub_config->frag) {
+    frag_sender_on_publish(cfg->pub_config->frag, mid);
+    if (frag_sender_done(cfg->pub_config->frag)) {
+      // Chunks sent with QoS 0 may still be lost, so wait a while for a NACK before disconnecting
+      cfg->pub_config->frag_linger_until = time(NULL) + (cfg->pub_config->frag->qos ? 0 : FRAG_TIMEOUT_SEC);
+    } else if (frag_sender_pump(cfg->pub_config->frag, mosq, cfg)) {
+      fprintf(stderr, "Error: Failed to publish message chunk.\n");
+      mosquitto_disconnect_v5(mosq, 0, cfg->property_config->disconnect_props);
+    }
+    return;
+  }
+
   if (cfg->pub_config->disconnect_sent == false) {
     mosquitto_disconnect_v5(mosq, 0, cfg->property_config->disconnect_props);
     cfg->pub_config->disconnect_sent = true;
@@ -120,6 +161,17 @@ void publish_callback_pub_func(struct mosquitto *mosq, void *obj, int mid, int r
   fprintf(stdout, "Publisher publish pub callback.\n");
 }
 
+void message_callback_pub_func(struct mosquitto *mosq, void *obj, const struct mosquitto_message *message,
+                               const mosquitto_property *properties) {
+  mosq_config_t *cfg = (mosq_config_t *)obj;
+  UNUSED(properties);
+
+  if (cfg->pub_config->frag && frag_sender_on_nack(cfg->pub_config->frag, message->payload, message->payloadlen) > 0) {
+    fprintf(stdout, "Retransmitting %d missing chunks.\n", cfg->pub_config->frag->count - cfg->pub_config->frag->done);
+    frag_sender_pump(cfg->pub_config->frag, mosq, cfg);
+  }
+}
+
 mosq_retcode_t publish_loop(struct mosquitto *mosq, mosq_config_t *cfg) {
   mosq_retcode_t ret = MOSQ_ERR_SUCCESS;
   int pos;
@@ -134,6 +186,11 @@ mosq_retcode_t publish_loop(struct mosquitto *mosq, mosq_config_t *cfg) {
 
   do {
     ret = mosquitto_loop(mosq, loop_delay, 1);
+    if (cfg->pub_config->frag && !cfg->pub_config->disconnect_sent && frag_sender_done(cfg->pub_config->frag) &&
+        time(NULL) >= cfg->pub_config->frag_linger_until) {
+      mosquitto_disconnect_v5(mosq, 0, cfg->property_config->disconnect_props);
+      cfg->pub_config->disconnect_sent = true;
+    }
     if (cfg->pub_config->ready_for_repeat && check_repeat_time(cfg)) {
       ret = MOSQ_ERR_SUCCESS;
       switch (cfg->pub_config->pub_mode) {
@@ -209,7 +266,7 @@ mosq_retcode_t init_check_error(mosq_config_t *cfg, client_type_t client_type) {
   }
 
   if (client_type == client_sub) {
-    if (cfg->sub_config->topic_count == 0) {
+    if (topic_set_count(cfg->sub_config->topics) == 0) {
       fprintf(stderr, "Error: You must specify a topic to subscribe to.\n");
       return EXIT_FAILURE;
     }
@@ -14,6 +14,8 @@ void connect_callback_pub_func(struct mosquitto *mosq, void *obj, int result, in
                                const mosquitto_property *properties);
 void publish_callback_pub_func(struct mosquitto *mosq, void *obj, int mid, int reason_code,
                                const mosquitto_property *properties);
+void message_callback_pub_func(struct mosquitto *mosq, void *obj, const struct mosquitto_message *message,
+                               const mosquitto_property *properties);
 mosq_retcode_t publish_message(struct mosquitto *mosq, mosq_config_t *cfg, int *mid, const char *topic, int payloadlen,
                                void *payload, int qos, bool retain);
 mosq_retcode_t publish_loop(struct mosquitto *mosq, mosq_config_t *cfg);
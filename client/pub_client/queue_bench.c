@@ -0,0 +1,120 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "client_common.h"
+#include "fake_mosquitto.h"
+#include "pub_queue.h"
+
+#define BENCH_LINK_RATE 2000  // messages per second the simulated uplink completes, in the order they were sent
+#define BENCH_ALARM_RATE 20   // alarms per second, at every load
+#define BENCH_STEP_MS 3000
+#define BENCH_PAYLOAD 48
+#define BENCH_FLAT_BUCKETS 1  // the alarm p99 may rise by one latency bucket over its value at the lowest overload
+
+/* Telemetry offered as a multiple of the link rate. Everything from 1 on keeps the link saturated. */
+static const double loads[] = {0.25, 0.5, 1, 2, 4, 8};
+
+typedef struct bench_state_s {
+  pub_queue_t pq;
+  mosq_config_t cfg;
+  unsigned long dropped[PUB_CLASS_MAX];
+} bench_state_t;
+
+static double now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void publish_callback(struct mosquitto *mosq, void *obj, int mid, int reason_code,
+                             const mosquitto_property *properties) {
+  pub_queue_on_publish(&((bench_state_t *)obj)->pq, mid);
+}
+
+/* As the uart gateway's translator would, except that a full class queue drops the message instead of blocking the
+ * only thread. */
+static void offer(bench_state_t *state, pub_class_t cls) {
+  char payload[BENCH_PAYLOAD] = {0};
+  pub_item_t *item = pub_item_new(cls, TOPIC, payload, sizeof(payload));
+
+  if (!item) return;
+  clock_gettime(CLOCK_MONOTONIC, &item->enqueued);
+  if (!bqueue_try_push(&state->pq.queues[cls], item)) {
+    pub_item_free(item);
+    state->dropped[cls]++;
+  }
+}
+
+/* The fake completes publishes in order, one per fake_mosq_step(), so stepping it at BENCH_LINK_RATE turns it into a
+ * link of that rate with the inflight window queueing in front of it. */
+static double run_load(struct mosquitto *mosq, bench_state_t *state, double load) {
+  double start = now_ms(), now = start, next_alarm = start, next_telemetry = start, link_next = start, p99;
+  struct timespec idle = {0, 100000};
+
+  memset(state->pq.latency, 0, sizeof(state->pq.latency));
+  memset(state->dropped, 0, sizeof(state->dropped));
+  while (now - start < BENCH_STEP_MS) {
+    for (; next_telemetry <= now; next_telemetry += 1e3 / (BENCH_LINK_RATE * load)) offer(state, PUB_CLASS_TELEMETRY);
+    for (; next_alarm <= now; next_alarm += 1e3 / BENCH_ALARM_RATE) offer(state, PUB_CLASS_ALARM);
+    pub_queue_dispatch(&state->pq, mosq, &state->cfg);
+    while (link_next <= now) {
+      if (!fake_mosq_step(mosq)) {
+        link_next = now;
+        break;
+      }
+      link_next += 1e3 / BENCH_LINK_RATE;
+    }
+    nanosleep(&idle, NULL);
+    now = now_ms();
+  }
+
+  p99 = pub_latency_percentile_ms(&state->pq.latency[PUB_CLASS_ALARM], 0.99);
+  printf("%5.2fx telemetry %6lu sent %7lu dropped, alarm %3lu sent p50 <%4.0f ms p99 <%4.0f ms max %5.1f ms", load,
+         state->pq.latency[PUB_CLASS_TELEMETRY].count, state->dropped[PUB_CLASS_TELEMETRY],
+         state->pq.latency[PUB_CLASS_ALARM].count, pub_latency_percentile_ms(&state->pq.latency[PUB_CLASS_ALARM], 0.5),
+         p99, state->pq.latency[PUB_CLASS_ALARM].max_ms);
+  printf(", window %d\n", inflight_ctl_window(&state->pq.ctl));
+  return p99;
+}
+
+/* Usage: queue_bench
+ * Built against the fake libmosquitto, no broker is needed. Offers telemetry at rising multiples of a simulated link
+ * rate next to a steady trickle of alarms, through the uart gateway's publish queue. Once the link is saturated the
+ * extra telemetry has to wait in its own class queue, so the alarm tail latency must stay where it is. Fails when the
+ * alarm p99 at any overload exceeds the one at the lowest overload by more than BENCH_FLAT_BUCKETS buckets. */
+int main(int argc, char *argv[]) {
+  double p99, limit = 0;
+  struct mosquitto *mosq;
+  bench_state_t state;
+  int ret = EXIT_SUCCESS;
+
+  memset(&state, 0, sizeof(state));
+  init_mosq_config(&state.cfg, client_pub);
+  state.cfg.general_config->host = cfg_strdup(&state.cfg, HOST);
+  if (pub_queue_init(&state.pq, PUB_QUEUE_MAX_INFLIGHT)) return EXIT_FAILURE;
+  mosq = mosquitto_new(NULL, true, &state);
+  if (!mosq || mosq_opts_set(mosq, &state.cfg)) return EXIT_FAILURE;
+  mosquitto_publish_v5_callback_set(mosq, publish_callback);
+  fake_mosq_auto_ack(mosq, true);
+  if (mosq_client_connect(mosq, &state.cfg)) return EXIT_FAILURE;
+  fake_mosq_run(mosq, 0);
+
+  printf("link %d msg/s, alarms %d/s, %d ms per load\n", BENCH_LINK_RATE, BENCH_ALARM_RATE, BENCH_STEP_MS);
+  for (size_t i = 0; i < sizeof(loads) / sizeof(loads[0]); i++) {
+    p99 = run_load(mosq, &state, loads[i]);
+    if (loads[i] < 1) continue;
+    if (!limit) {
+      limit = p99 * (1 << BENCH_FLAT_BUCKETS);
+    } else if (p99 > limit) {
+      printf("FAIL: alarm p99 <%.0f ms at %.2fx, the limit is %.0f ms\n", p99, loads[i], limit);
+      ret = EXIT_FAILURE;
+    }
+  }
+  if (ret == EXIT_SUCCESS) printf("alarm p99 flat under overload\n");
+
+  pub_queue_destroy(&state.pq);
+  mosquitto_destroy(mosq);
+  mosq_config_cleanup(&state.cfg);
+  return ret;
+}
@@ -0,0 +1,325 @@
+#include "retain_bulk.h"
+#include <mqtt_protocol.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *phase_names[] = {"connect", "snapshot", "purge", "verify", "done"};
+
+static double now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* The writer and reader, when the caller sets them, are closed by retain_bulk_destroy(). */
+int retain_bulk_init(retain_bulk_t *rb, retain_mode_t mode, mosq_config_t *cfg, const char *filter) {
+  memset(rb, 0, sizeof(retain_bulk_t));
+  rb->mode = mode;
+  rb->cfg = cfg;
+  rb->filter = filter;
+  rb->marker = malloc(strlen(RETAIN_MARKER_PREFIX) + strlen(cfg->general_config->id) + 1);
+  if (!rb->marker) return -1;
+  sprintf(rb->marker, "%s%s", RETAIN_MARKER_PREFIX, cfg->general_config->id);
+  inflight_ctl_init(&rb->ctl, RETAIN_MAX_WINDOW);
+  return 0;
+}
+
+void retain_bulk_destroy(retain_bulk_t *rb) {
+  for (int i = 0; i < rb->topic_count; i++) free(rb->topics[i]);
+  free(rb->topics);
+  free(rb->marker);
+  if (rb->writer) capture_close(rb->writer);
+  if (rb->reader) capture_reader_close(rb->reader);
+}
+
+static int add_topic(retain_bulk_t *rb, const char *topic) {
+  int capacity = rb->topic_capacity ? rb->topic_capacity * 2 : 1024;
+  char **topics;
+
+  if (rb->topic_count == rb->topic_capacity) {
+    topics = realloc(rb->topics, capacity * sizeof(char *));
+    if (!topics) return -1;
+    rb->topics = topics;
+    rb->topic_capacity = capacity;
+  }
+  rb->topics[rb->topic_count] = strdup(topic);
+  if (!rb->topics[rb->topic_count]) return -1;
+  return rb->topic_count++;
+}
+
+static void enter(retain_bulk_t *rb, retain_phase_t phase) {
+  rb->phase = phase;
+  rb->phase_started = rb->last_event = rb->next_report = now_ms();
+  rb->next_report += RETAIN_REPORT_INTERVAL_MS;
+}
+
+/* Subscribes the filter and the marker in one SUBSCRIBE, the marker is published once it is acknowledged. */
+static void subscribe(retain_bulk_t *rb, struct mosquitto *mosq, retain_phase_t phase) {
+  char *topics[2] = {(char *)rb->filter, rb->marker};
+
+  enter(rb, phase);
+  rb->subscribed = false;
+  if (mosquitto_subscribe_multiple(mosq, &rb->sub_mid, 2, topics, RETAIN_SUB_QOS, 0,
+                                   rb->cfg->property_config->subscribe_props)) {
+    fprintf(stderr, "Error: Failed to subscribe to %s.\n", rb->filter);
+    rb->error = true;
+    enter(rb, RETAIN_DONE);
+  }
+}
+
+static void unsubscribe(retain_bulk_t *rb, struct mosquitto *mosq) {
+  char *topics[2] = {(char *)rb->filter, rb->marker};
+
+  mosquitto_unsubscribe_multiple(mosq, NULL, 2, topics, rb->cfg->property_config->unsubscribe_props);
+}
+
+static double rate(unsigned long count, double since) {
+  double seconds = (now_ms() - since) / 1e3;
+
+  return seconds > 0 ? count / seconds : 0;
+}
+
+static void end_collection(retain_bulk_t *rb, struct mosquitto *mosq) {
+  unsubscribe(rb, mosq);
+  if (rb->phase == RETAIN_VERIFYING) {
+    printf("verify: %lu retained topics under %s\n", rb->remaining, rb->filter);
+    enter(rb, RETAIN_DONE);
+    return;
+  }
+  printf("snapshot: %lu retained topics, %lu payload bytes in %.1f s, %.1f topics/s\n", rb->found, rb->bytes,
+         (now_ms() - rb->phase_started) / 1e3, rate(rb->found, rb->phase_started));
+  enter(rb, rb->mode == RETAIN_PURGE ? RETAIN_SENDING : RETAIN_DONE);
+}
+
+static void end_sending(retain_bulk_t *rb, struct mosquitto *mosq) {
+  const char *name = rb->mode == RETAIN_PURGE ? "purge" : "restore";
+
+  rb->unconfirmed = rb->inflight_count;
+  rb->inflight_count = 0;
+  printf("%s: %lu of %d topics acknowledged, %lu refused, %lu unconfirmed in %.1f s, %.1f topics/s\n", name,
+         rb->acked, rb->topic_count, rb->failed, rb->unconfirmed, (now_ms() - rb->phase_started) / 1e3,
+         rate(rb->acked, rb->phase_started));
+  inflight_ctl_report(&rb->ctl, stdout);
+  if (rb->filter) {
+    subscribe(rb, mosq, RETAIN_VERIFYING);
+  } else {
+    enter(rb, RETAIN_DONE);
+  }
+}
+
+static void connect_callback_retain_func(struct mosquitto *mosq, void *obj, int result, int flags,
+                                         const mosquitto_property *properties) {
+  retain_bulk_t *rb = (retain_bulk_t *)obj;
+
+  if (result) {
+    fprintf(stderr, "Error: %s\n", mosquitto_connack_string(result));
+    rb->error = true;
+    enter(rb, RETAIN_DONE);
+    return;
+  }
+  switch (rb->phase) {
+    case RETAIN_CONNECTING:
+      if (rb->mode == RETAIN_RESTORE) {
+        enter(rb, RETAIN_SENDING);
+      } else {
+        subscribe(rb, mosq, RETAIN_COLLECTING);
+      }
+      break;
+    case RETAIN_COLLECTING:
+    case RETAIN_VERIFYING:
+      // Retained messages of the lost subscription cannot be told apart from those of a new one
+      fprintf(stderr, "Error: The connection dropped during the %s, run it again.\n", phase_names[rb->phase]);
+      rb->error = true;
+      enter(rb, RETAIN_DONE);
+      break;
+    default:
+      // libmosquitto sends the unacknowledged publishes again, they keep their mids
+      break;
+  }
+}
+
+static void subscribe_callback_retain_func(struct mosquitto *mosq, void *obj, int mid, int qos_count,
+                                           const int *granted_qos) {
+  retain_bulk_t *rb = (retain_bulk_t *)obj;
+
+  if (mid != rb->sub_mid || (rb->phase != RETAIN_COLLECTING && rb->phase != RETAIN_VERIFYING)) return;
+  for (int i = 0; i < qos_count; i++) {
+    if (granted_qos[i] >= 0x80) {
+      fprintf(stderr, "Error: The broker refused the subscription to %s.\n", i ? rb->marker : rb->filter);
+      rb->error = true;
+      enter(rb, RETAIN_DONE);
+      return;
+    }
+  }
+  rb->subscribed = true;
+  rb->last_event = now_ms();
+  mosquitto_publish_v5(mosq, NULL, rb->marker, 0, NULL, 1, false, rb->cfg->property_config->publish_props);
+}
+
+static void message_callback_retain_func(struct mosquitto *mosq, void *obj, const struct mosquitto_message *message,
+                                         const mosquitto_property *properties) {
+  retain_bulk_t *rb = (retain_bulk_t *)obj;
+
+  if (rb->phase != RETAIN_COLLECTING && rb->phase != RETAIN_VERIFYING) return;
+  if (!strcmp(message->topic, rb->marker)) {
+    end_collection(rb, mosq);
+    return;
+  }
+  // Live messages lose the retain flag on the way, and an empty retained message is not stored
+  if (!message->retain || !message->payloadlen) return;
+  rb->last_event = now_ms();
+  if (rb->phase == RETAIN_VERIFYING) {
+    rb->remaining++;
+    return;
+  }
+  rb->found++;
+  rb->bytes += message->payloadlen;
+  if (rb->writer && capture_append(rb->writer, message->topic, message->payload, message->payloadlen, message->qos,
+                                   true, capture_now_us())) {
+    fprintf(stderr, "Error: Failed to write %s to the snapshot.\n", message->topic);
+    rb->error = true;
+  }
+  if (rb->mode == RETAIN_PURGE && add_topic(rb, message->topic) < 0) {
+    fprintf(stderr, "Error: Out of memory.\n");
+    rb->error = true;
+  }
+  if (rb->error) enter(rb, RETAIN_DONE);
+}
+
+static void publish_callback_retain_func(struct mosquitto *mosq, void *obj, int mid, int reason_code,
+                                         const mosquitto_property *properties) {
+  retain_bulk_t *rb = (retain_bulk_t *)obj;
+  retain_inflight_t *inflight;
+  double now;
+
+  for (int i = 0; i < rb->inflight_count; i++) {
+    inflight = &rb->inflight[i];
+    if (inflight->mid != mid) continue;
+    now = now_ms();
+    if (reason_code >= MQTT_RC_UNSPECIFIED) {
+      fprintf(stderr, "Warning: The broker refused %s: %s.\n", rb->topics[inflight->topic],
+              mosquitto_reason_string(reason_code));
+      rb->failed++;
+    } else {
+      rb->acked++;
+    }
+    inflight_ctl_on_ack(&rb->ctl, now - inflight->sent_ms, now);
+    rb->last_event = now;
+    *inflight = rb->inflight[--rb->inflight_count];
+    return;
+  }
+}
+
+void retain_bulk_callbacks_set(struct mosquitto *mosq) {
+  mosquitto_connect_v5_callback_set(mosq, connect_callback_retain_func);
+  mosquitto_subscribe_callback_set(mosq, subscribe_callback_retain_func);
+  mosquitto_message_v5_callback_set(mosq, message_callback_retain_func);
+  mosquitto_publish_v5_callback_set(mosq, publish_callback_retain_func);
+}
+
+/* The next topic to send, with its payload for a restore. Returns -1 when there is none left. */
+static int next_topic(retain_bulk_t *rb, capture_record_t *record) {
+  int rc;
+
+  if (rb->mode == RETAIN_PURGE) {
+    if (rb->next < rb->topic_count) return rb->next++;
+    rb->exhausted = true;
+    return -1;
+  }
+  // A capture of live traffic can be restored too, only its retained messages are
+  do {
+    rc = capture_read(rb->reader, record);
+  } while (rc > 0 && !record->retain);
+  if (rc < 0) {
+    fprintf(stderr, "Error: %s is damaged after %lu records.\n", rb->reader->path, rb->reader->records);
+    rb->error = true;
+  }
+  if (rc <= 0 || add_topic(rb, record->topic) < 0) {
+    rb->exhausted = true;
+    return -1;
+  }
+  return rb->topic_count - 1;
+}
+
+static void fill_window(retain_bulk_t *rb, struct mosquitto *mosq, double now) {
+  const mosquitto_property *props = rb->cfg->property_config->publish_props;
+  capture_record_t record;
+  retain_inflight_t *inflight;
+  int topic, ret;
+
+  while (rb->inflight_count < inflight_ctl_window(&rb->ctl) && (topic = next_topic(rb, &record)) >= 0) {
+    inflight = &rb->inflight[rb->inflight_count];
+    // Every publish names its topic, a topic alias would only stand for the first one
+    if (rb->mode == RETAIN_PURGE) {
+      ret = mosquitto_publish_v5(mosq, &inflight->mid, rb->topics[topic], 0, NULL, 1, true, props);
+    } else {
+      ret = mosquitto_publish_v5(mosq, &inflight->mid, rb->topics[topic], record.payload_len, record.payload,
+                                 record.qos, true, props);
+    }
+    if (ret) {
+      fprintf(stderr, "Warning: Failed to publish to %s: %s.\n", rb->topics[topic], mosquitto_strerror(ret));
+      rb->failed++;
+      continue;
+    }
+    inflight->topic = topic;
+    inflight->sent_ms = now;
+    rb->inflight_count++;
+    rb->sent++;
+  }
+}
+
+/* Advances whatever is in progress, called from the loop after every mosquitto_loop(). */
+void retain_bulk_poll(retain_bulk_t *rb, struct mosquitto *mosq) {
+  double now = now_ms(), rto;
+
+  switch (rb->phase) {
+    case RETAIN_COLLECTING:
+    case RETAIN_VERIFYING:
+      if (rb->subscribed && now - rb->last_event > RETAIN_IDLE_MS) {
+        fprintf(stderr, "Warning: The marker did not come back, ending the %s after %d ms without a message.\n",
+                phase_names[rb->phase], RETAIN_IDLE_MS);
+        end_collection(rb, mosq);
+      }
+      break;
+    case RETAIN_SENDING:
+      rto = inflight_ctl_rto_ms(&rb->ctl);
+      for (int i = 0; rto > 0 && i < rb->inflight_count; i++) {
+        if (now - rb->inflight[i].sent_ms > rto) {
+          inflight_ctl_on_timeout(&rb->ctl, now);
+          break;
+        }
+      }
+      fill_window(rb, mosq, now);
+      if (rb->error || (rb->exhausted && (!rb->inflight_count || now - rb->last_event > RETAIN_DRAIN_MS))) {
+        end_sending(rb, mosq);
+      }
+      break;
+    default:
+      return;
+  }
+  if (now >= rb->next_report && rb->phase != RETAIN_DONE) {
+    retain_bulk_report(rb, stdout);
+    rb->next_report += RETAIN_REPORT_INTERVAL_MS;
+  }
+}
+
+void retain_bulk_report(const retain_bulk_t *rb, FILE *out) {
+  switch (rb->phase) {
+    case RETAIN_COLLECTING:
+      fprintf(out, "snapshot: %lu retained topics so far, %.1f topics/s\n", rb->found,
+              rate(rb->found, rb->phase_started));
+      break;
+    case RETAIN_SENDING:
+      fprintf(out, "%s: %lu topics acknowledged, %d in flight in a window of %d, %.1f topics/s\n",
+              rb->mode == RETAIN_PURGE ? "purge" : "restore", rb->acked, rb->inflight_count,
+              inflight_ctl_window(&rb->ctl), rate(rb->acked, rb->phase_started));
+      break;
+    case RETAIN_VERIFYING:
+      fprintf(out, "verify: %lu retained topics so far\n", rb->remaining);
+      break;
+    default:
+      break;
+  }
+}
@@ -0,0 +1,77 @@
+#ifndef RETAIN_BULK_H
+#define RETAIN_BULK_H
+
+#include <mosquitto.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "capture.h"
+#include "client_common.h"
+#include "inflight_ctl.h"
+
+/* Bulk maintenance of the retained messages under a filter: snapshot them into a capture file, purge them, or restore
+ * a snapshot. The broker sends the retained messages of a new subscription right after its SUBACK, so a QoS 1 publish
+ * to a marker topic subscribed in the same SUBSCRIBE comes back behind the last of them and ends the collection; a
+ * quiet RETAIN_IDLE_MS ends it as well, for brokers that do not keep that order. Purges and restores are pipelined
+ * within an inflight_ctl window of at most RETAIN_MAX_WINDOW publishes and each one is tracked to its PUBACK, then the
+ * filter is subscribed once more to count what the broker actually holds. */
+#define RETAIN_MAX_WINDOW 256
+#define RETAIN_IDLE_MS 2000
+#define RETAIN_DRAIN_MS 10000  // without an ack before the publishes still in flight count as unconfirmed
+#define RETAIN_REPORT_INTERVAL_MS 5000
+#define RETAIN_MARKER_PREFIX "retained-end/"
+#define RETAIN_SUB_QOS 2  // retained messages come at their own QoS up to this one, and are restored at it
+
+typedef enum retain_mode_s { RETAIN_SNAPSHOT, RETAIN_PURGE, RETAIN_RESTORE } retain_mode_t;
+
+typedef enum retain_phase_s {
+  RETAIN_CONNECTING,
+  RETAIN_COLLECTING,
+  RETAIN_SENDING,
+  RETAIN_VERIFYING,
+  RETAIN_DONE,
+} retain_phase_t;
+
+typedef struct retain_inflight_s {
+  int mid;
+  int topic;  // index into topics
+  double sent_ms;
+} retain_inflight_t;
+
+typedef struct retain_bulk_s {
+  retain_mode_t mode;
+  retain_phase_t phase;
+  mosq_config_t *cfg;
+  const char *filter;  // NULL restores without verifying
+  char *marker;
+  int sub_mid;
+  bool subscribed;
+  capture_writer_t *writer;  // snapshot being written, NULL when none is kept
+  capture_reader_t *reader;  // snapshot being restored
+  char **topics;             // collected for a purge, restored for a restore
+  int topic_count;
+  int topic_capacity;
+  int next;        // topic a purge publishes next
+  bool exhausted;  // nothing left to send, only acks to wait for
+  retain_inflight_t inflight[RETAIN_MAX_WINDOW];
+  int inflight_count;
+  inflight_ctl_t ctl;
+  double phase_started;
+  double last_event;  // retained message while collecting, ack while sending
+  double next_report;
+  unsigned long found;
+  unsigned long bytes;
+  unsigned long sent;
+  unsigned long acked;
+  unsigned long failed;
+  unsigned long unconfirmed;
+  unsigned long remaining;  // retained topics the verification found
+  bool error;
+} retain_bulk_t;
+
+int retain_bulk_init(retain_bulk_t *rb, retain_mode_t mode, mosq_config_t *cfg, const char *filter);
+void retain_bulk_destroy(retain_bulk_t *rb);
+void retain_bulk_callbacks_set(struct mosquitto *mosq);
+void retain_bulk_poll(retain_bulk_t *rb, struct mosquitto *mosq);
+void retain_bulk_report(const retain_bulk_t *rb, FILE *out);
+
+#endif
@@ -0,0 +1,116 @@
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "client_common.h"
+#include "retain_bulk.h"
+
+#define RETAINED_RECONNECT_DELAY 1
+
+static volatile sig_atomic_t run = 1;
+
+static void stop_func(int signum) { run = 0; }
+
+static void usage(void) {
+  fprintf(stderr, "Usage: retained snapshot <filter> <file>\n"
+                  "       retained purge <filter> [snapshot file]\n"
+                  "       retained restore <snapshot file> [filter]\n");
+}
+
+/* Usage: retained snapshot <filter> <file>
+ *        retained purge <filter> [snapshot file]
+ *        retained restore <snapshot file> [filter]
+ * snapshot writes every retained message under the filter to a capture file, purge clears them all, after taking a
+ * snapshot first when given a file, and restore publishes the retained messages of a snapshot or capture again. A
+ * filter after restore counts what the broker holds under it afterwards. Exits with 1 unless every topic was
+ * acknowledged and a purge left nothing behind. */
+int main(int argc, char *argv[]) {
+  const char *filter = NULL, *file = NULL;
+  struct mosquitto *mosq = NULL;
+  retain_mode_t mode;
+  mosq_config_t cfg;
+  retain_bulk_t rb;
+  int ret = EXIT_FAILURE, rc;
+
+  if (argc < 3) {
+    usage();
+    return EXIT_FAILURE;
+  }
+  if (!strcmp(argv[1], "snapshot") && argc > 3) {
+    mode = RETAIN_SNAPSHOT;
+    filter = argv[2];
+    file = argv[3];
+  } else if (!strcmp(argv[1], "purge")) {
+    mode = RETAIN_PURGE;
+    filter = argv[2];
+    file = argc > 3 ? argv[3] : NULL;
+  } else if (!strcmp(argv[1], "restore")) {
+    mode = RETAIN_RESTORE;
+    file = argv[2];
+    filter = argc > 3 ? argv[3] : NULL;
+  } else {
+    usage();
+    return EXIT_FAILURE;
+  }
+  if (filter && mosquitto_sub_topic_check(filter)) {
+    fprintf(stderr, "Error: %s is not a valid topic filter.\n", filter);
+    return EXIT_FAILURE;
+  }
+
+  signal(SIGINT, stop_func);
+  signal(SIGTERM, stop_func);
+  init_mosq_config(&cfg, client_sub);
+  mosquitto_lib_init();
+  cfg.general_config->host = cfg_strdup(&cfg, HOST);
+  cfg.general_config->id_prefix = cfg_strdup(&cfg, "retained_");
+  // libmosquitto would otherwise hold back everything beyond its default of 20 unacknowledged publishes
+  cfg.general_config->max_inflight = RETAIN_MAX_WINDOW;
+  if (generate_client_id(&cfg) || retain_bulk_init(&rb, mode, &cfg, filter)) {
+    fprintf(stderr, "Error: Out of memory.\n");
+    mosq_config_cleanup(&cfg);
+    return EXIT_FAILURE;
+  }
+  if (mode == RETAIN_RESTORE) {
+    rb.reader = capture_reader_open(file);
+    if (!rb.reader) goto cleanup;
+  } else if (file) {
+    rb.writer = capture_open(file);
+    if (!rb.writer) goto cleanup;
+  }
+
+  mosq = mosquitto_new(cfg.general_config->id, true, &rb);
+  if (!mosq || mosq_opts_set(mosq, &cfg)) {
+    fprintf(stderr, "Error: Failed to set up the client.\n");
+    goto cleanup;
+  }
+  retain_bulk_callbacks_set(mosq);
+  rc = mosq_client_connect(mosq, &cfg);
+  if (rc) {
+    fprintf(stderr, "Error: %s\n", mosquitto_strerror(rc));
+    goto cleanup;
+  }
+
+  while (run && rb.phase != RETAIN_DONE) {
+    if (mosquitto_loop(mosq, 10, 1) != MOSQ_ERR_SUCCESS) {
+      sleep(RETAINED_RECONNECT_DELAY);
+      mosquitto_reconnect(mosq);
+      continue;
+    }
+    retain_bulk_poll(&rb, mosq);
+  }
+  if (rb.phase != RETAIN_DONE) {
+    retain_bulk_report(&rb, stdout);
+    fprintf(stderr, "Error: Interrupted.\n");
+  } else if (!rb.error && !rb.failed && !rb.unconfirmed && (mode != RETAIN_PURGE || !rb.remaining)) {
+    ret = 0;
+  }
+  mosquitto_disconnect_v5(mosq, 0, cfg.property_config->disconnect_props);
+  mosquitto_loop(mosq, 100, 1);
+
+cleanup:
+  retain_bulk_destroy(&rb);
+  mosquitto_destroy(mosq);
+  mosquitto_lib_cleanup();
+  mosq_config_cleanup(&cfg);
+  return ret;
+}
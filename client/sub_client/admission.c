@@ -0,0 +1,284 @@
+#include "admission.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *class_names[ADMIT_PRIORITIES] = {"p0", "p1", "p2", "p3"};
+
+int admit_init(admit_queue_t *q, int capacity, admit_policy_t policy) {
+  memset(q, 0, sizeof(admit_queue_t));
+  q->policy = policy;
+  q->capacity = capacity;
+  q->target_ms = ADMIT_TARGET_MS;
+  q->interval_ms = ADMIT_INTERVAL_MS;
+  // Any one priority may take up the whole queue
+  for (int i = 0; i < ADMIT_PRIORITIES; i++) {
+    q->classes[i].items = calloc(capacity, sizeof(admit_item_t *));
+    if (!q->classes[i].items) {
+      admit_destroy(q);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void item_free(admit_item_t *item) {
+  free(item->msg.topic);
+  free(item->msg.payload);
+  mosquitto_property_free_all(&item->props);
+  free(item);
+}
+
+void admit_destroy(admit_queue_t *q) {
+  admit_class_t *cls;
+
+  for (int i = 0; i < ADMIT_PRIORITIES; i++) {
+    cls = &q->classes[i];
+    for (int j = 0; j < cls->count; j++) item_free(cls->items[(cls->head + j) % q->capacity]);
+    free(cls->items);
+    cls->items = NULL;
+    cls->count = 0;
+  }
+  for (int i = 0; i < q->route_count; i++) free(q->routes[i].filter);
+  q->route_count = q->count = 0;
+}
+
+int admit_policy_parse(const char *name, admit_policy_t *policy) {
+  if (!strcmp(name, "oldest")) {
+    *policy = ADMIT_DROP_OLDEST;
+  } else if (!strcmp(name, "low")) {
+    *policy = ADMIT_DROP_LOW;
+  } else if (!strcmp(name, "retry")) {
+    *policy = ADMIT_RETRY_LATER;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+/* `<filter>=<priority>`, routes are matched in the order they were added. */
+int admit_route_add(admit_queue_t *q, const char *spec) {
+  const char *eq = strrchr(spec, '=');
+  char *end;
+  long priority;
+
+  if (!eq || eq == spec || q->route_count == ADMIT_MAX_ROUTES) return -1;
+  priority = strtol(eq + 1, &end, 10);
+  if (end == eq + 1 || *end || priority < 0 || priority >= ADMIT_PRIORITIES) return -1;
+  q->routes[q->route_count].filter = strndup(spec, eq - spec);
+  if (!q->routes[q->route_count].filter || mosquitto_sub_topic_check(q->routes[q->route_count].filter)) {
+    free(q->routes[q->route_count].filter);
+    return -1;
+  }
+  q->routes[q->route_count++].priority = priority;
+  return 0;
+}
+
+static int priority_of(const admit_queue_t *q, const char *topic) {
+  bool match;
+
+  for (int i = 0; i < q->route_count; i++) {
+    if (!mosquitto_topic_matches_sub(q->routes[i].filter, topic, &match) && match) return q->routes[i].priority;
+  }
+  return ADMIT_DEFAULT_PRIORITY;
+}
+
+static admit_item_t *head_of(const admit_queue_t *q, int priority) {
+  const admit_class_t *cls = &q->classes[priority];
+  return cls->count ? cls->items[cls->head] : NULL;
+}
+
+static admit_item_t *take_head(admit_queue_t *q, int priority) {
+  admit_class_t *cls = &q->classes[priority];
+  admit_item_t *item = cls->items[cls->head];
+
+  cls->head = (cls->head + 1) % q->capacity;
+  cls->count--;
+  q->count--;
+  return item;
+}
+
+static int oldest_class(const admit_queue_t *q) {
+  int oldest = -1;
+
+  for (int i = 0; i < ADMIT_PRIORITIES; i++) {
+    if (!q->classes[i].count) continue;
+    if (oldest < 0 || head_of(q, i)->enqueued < head_of(q, oldest)->enqueued) oldest = i;
+  }
+  return oldest;
+}
+
+/* The oldest message of all, or for ADMIT_DROP_LOW the oldest of the lowest priority. */
+static int victim_class(const admit_queue_t *q) {
+  if (q->policy == ADMIT_DROP_LOW) {
+    for (int i = ADMIT_PRIORITIES - 1; i >= 0; i--) {
+      if (q->classes[i].count) return i;
+    }
+  }
+  return oldest_class(q);
+}
+
+static void shed_item(admit_queue_t *q, admit_item_t *item, admit_shed_t shed, void *userdata) {
+  q->classes[item->priority].shed++;
+  if (shed) shed(userdata, item, q->policy == ADMIT_RETRY_LATER);
+  item_free(item);
+}
+
+/* Queues a copy of the message. When the queue is full something is shed first: with ADMIT_RETRY_LATER the newcomer,
+ * told to retry, with ADMIT_DROP_LOW the newcomer if nothing queued is of lower priority. With ADMIT_RETRY_LATER
+ * newcomers are also turned away while CoDel is shedding. Returns false when the message itself was shed. */
+bool admit_push(admit_queue_t *q, const struct mosquitto_message *message, const mosquitto_property *props,
+                double now, admit_shed_t shed, void *userdata) {
+  admit_item_t *item = calloc(1, sizeof(admit_item_t));
+  admit_class_t *cls;
+  int victim;
+
+  if (!item) return false;
+  item->msg = *message;
+  item->msg.topic = strdup(message->topic);
+  item->msg.payload = malloc(message->payloadlen ? message->payloadlen : 1);
+  if (!item->msg.topic || !item->msg.payload || mosquitto_property_copy_all(&item->props, props)) {
+    item_free(item);
+    return false;
+  }
+  memcpy(item->msg.payload, message->payload, message->payloadlen);
+  item->priority = priority_of(q, message->topic);
+  item->enqueued = now;
+  if (!q->last_report) q->last_report = now;
+  cls = &q->classes[item->priority];
+  cls->offered++;
+
+  // A device told to retry loses least with a message that has not waited yet
+  if (q->policy == ADMIT_RETRY_LATER && q->dropping) {
+    q->codel_drops++;
+    shed_item(q, item, shed, userdata);
+    return false;
+  }
+  if (q->count == q->capacity) {
+    q->full_drops++;
+    victim = victim_class(q);
+    if (q->policy == ADMIT_RETRY_LATER || (q->policy == ADMIT_DROP_LOW && victim < item->priority)) {
+      shed_item(q, item, shed, userdata);
+      return false;
+    }
+    shed_item(q, take_head(q, victim), shed, userdata);
+  }
+  cls->items[(cls->head + cls->count++) % q->capacity] = item;
+  q->count++;
+  return true;
+}
+
+/* 1/sqrt(n) by Newton's method, as the kernel's CoDel computes it, which keeps libm out of every subscriber. Starting
+ * below the root it climbs to it monotonically. */
+static double inv_sqrt(unsigned int n) {
+  double x = 1.0 / n, prev = 0;
+
+  while (x - prev > 1e-9) {
+    prev = x;
+    x = x * (3 - n * x * x) / 2;
+  }
+  return x;
+}
+
+/* CoDel's test: the delay counts as standing once it stayed above the target for a whole interval. It is judged by
+ * the oldest message queued, high priority messages are taken out early and would hide the backlog. */
+static bool ok_to_drop(admit_queue_t *q, const admit_item_t *item, double now) {
+  if (now - item->enqueued < q->target_ms) {
+    q->first_above = 0;
+    return false;
+  }
+  if (!q->first_above) {
+    q->first_above = now + q->interval_ms;
+    return false;
+  }
+  return now >= q->first_above;
+}
+
+/* Returns the next message to process, highest priority first, shedding on the way while the queueing delay stands
+ * above the target. The caller hands it back to admit_done(). */
+admit_item_t *admit_pop(admit_queue_t *q, double now, admit_shed_t shed, void *userdata) {
+  int priority;
+  bool drop;
+
+  for (;;) {
+    for (priority = 0; priority < ADMIT_PRIORITIES && !q->classes[priority].count; priority++) {
+    }
+    if (priority == ADMIT_PRIORITIES) {
+      q->first_above = 0;
+      q->dropping = false;
+      return NULL;
+    }
+    drop = ok_to_drop(q, head_of(q, oldest_class(q)), now);
+    if (q->dropping) {
+      if (!drop) {
+        q->dropping = false;
+      } else if (now >= q->drop_next) {
+        q->drop_count++;
+        q->drop_next += q->interval_ms * inv_sqrt(q->drop_count);
+        q->codel_drops++;
+        shed_item(q, take_head(q, victim_class(q)), shed, userdata);
+        continue;
+      }
+    } else if (drop) {
+      // Picks up near the previous drop rate when the last dropping state ended only a little while ago
+      q->drop_count = q->drop_count > 2 && now - q->drop_next < 16 * q->interval_ms ? q->drop_count - 2 : 1;
+      q->drop_next = now + q->interval_ms * inv_sqrt(q->drop_count);
+      q->dropping = true;
+      q->codel_drops++;
+      shed_item(q, take_head(q, victim_class(q)), shed, userdata);
+      continue;
+    }
+    return take_head(q, priority);
+  }
+}
+
+/* Records how long the message took from arrival to the end of its processing and frees it. */
+void admit_done(admit_queue_t *q, admit_item_t *item, double now) {
+  admit_class_t *cls = &q->classes[item->priority];
+  double ms = now - item->enqueued;
+  int bucket = 0;
+
+  while (bucket < ADMIT_LATENCY_BUCKETS - 1 && ms >= (double)(1 << bucket)) {
+    bucket++;
+  }
+  cls->latency[bucket]++;
+  cls->processed++;
+  if (ms > cls->latency_max) cls->latency_max = ms;
+  item_free(item);
+}
+
+static double percentile_ms(const admit_class_t *cls, double pct) {
+  unsigned long target = (unsigned long)(cls->processed * pct), seen = 0;
+
+  for (int i = 0; i < ADMIT_LATENCY_BUCKETS; i++) {
+    seen += cls->latency[i];
+    if (seen > target) {
+      return (double)(1 << i);
+    }
+  }
+  return cls->latency_max;
+}
+
+/* Goodput is what got processed since the previous report, latencies are since the start. */
+void admit_report(admit_queue_t *q, double now, FILE *out) {
+  unsigned long offered = 0, processed = 0;
+  double secs = q->last_report ? (now - q->last_report) / 1e3 : 0;
+  const admit_class_t *cls;
+
+  for (int i = 0; i < ADMIT_PRIORITIES; i++) {
+    cls = &q->classes[i];
+    offered += cls->offered;
+    processed += cls->processed;
+    if (!cls->offered) continue;
+    fprintf(out, "  %s depth %4d offered %8lu processed %8lu shed %7lu p50 <%6.0f ms p99 <%6.0f ms max %8.1f ms\n",
+            class_names[i], cls->count, cls->offered, cls->processed, cls->shed, percentile_ms(cls, 0.5),
+            percentile_ms(cls, 0.99), cls->latency_max);
+  }
+  if (secs > 0) {
+    fprintf(out, "admission: %.0f msg/s offered, %.0f msg/s goodput, %lu shed when full, %lu by CoDel%s\n",
+            (offered - q->reported_offered) / secs, (processed - q->reported_processed) / secs, q->full_drops,
+            q->codel_drops, q->dropping ? ", shedding" : "");
+  }
+  q->last_report = now;
+  q->reported_offered = offered;
+  q->reported_processed = processed;
+}
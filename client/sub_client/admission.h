@@ -0,0 +1,86 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <mosquitto.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Overload control for the TA consumer. Messages are taken off the socket as fast as they come and wait here instead
+ * of in the broker, which queues without limit, so overload becomes visible and can be shed before every device's
+ * latency collapses. Each topic gets the priority of the first route matching it and higher priorities are processed
+ * first. Shedding starts when the queue is full, or the CoDel way: once the time messages spend queued stayed above
+ * ADMIT_TARGET_MS for a whole ADMIT_INTERVAL_MS, one message is shed and the next after interval / sqrt(n) until the
+ * delay falls below the target again. The policy picks what is shed: the oldest message, the oldest of the lowest
+ * priority, or with a "retry later" reply to its response topic, or `<topic>/retry` without one, the newcomer while the
+ * queue is full or CoDel is shedding. */
+#define ADMIT_DEFAULT_CAPACITY 1024
+#define ADMIT_TARGET_MS 50.0
+#define ADMIT_INTERVAL_MS 500.0
+#define ADMIT_PRIORITIES 4  // 0 is the highest
+#define ADMIT_DEFAULT_PRIORITY 2
+#define ADMIT_MAX_ROUTES 16
+#define ADMIT_LATENCY_BUCKETS 16  // bucket i counts latencies below 2^i ms
+#define ADMIT_RETRY_SUFFIX "/retry"
+#define ADMIT_RETRY_PAYLOAD "retry later"
+#define ADMIT_REPORT_INTERVAL_MS 10000
+
+typedef enum admit_policy_s { ADMIT_DROP_OLDEST, ADMIT_DROP_LOW, ADMIT_RETRY_LATER } admit_policy_t;
+
+typedef struct admit_item_s {
+  struct mosquitto_message msg;  // topic and payload owned by the item
+  mosquitto_property *props;
+  int priority;
+  double enqueued;
+} admit_item_t;
+
+typedef struct admit_route_s {
+  char *filter;
+  int priority;
+} admit_route_t;
+
+typedef struct admit_class_s {
+  admit_item_t **items;  // ring of `capacity`
+  int head;
+  int count;
+  unsigned long offered;
+  unsigned long processed;
+  unsigned long shed;
+  unsigned long latency[ADMIT_LATENCY_BUCKETS];  // from arrival to the end of processing
+  double latency_max;
+} admit_class_t;
+
+/* Called for a message that is shed, before it is freed. `retry` asks for a "retry later" reply. */
+typedef void (*admit_shed_t)(void *userdata, const admit_item_t *item, bool retry);
+
+typedef struct admit_queue_s {
+  admit_policy_t policy;
+  int capacity;
+  int count;
+  admit_class_t classes[ADMIT_PRIORITIES];
+  admit_route_t routes[ADMIT_MAX_ROUTES];
+  int route_count;
+  double target_ms;
+  double interval_ms;
+  // CoDel state
+  double first_above;  // when the delay may count as standing, 0 while it is below the target
+  bool dropping;
+  double drop_next;
+  unsigned int drop_count;
+  unsigned long full_drops;
+  unsigned long codel_drops;
+  double last_report;
+  unsigned long reported_processed;
+  unsigned long reported_offered;
+} admit_queue_t;
+
+int admit_init(admit_queue_t *q, int capacity, admit_policy_t policy);
+void admit_destroy(admit_queue_t *q);
+int admit_policy_parse(const char *name, admit_policy_t *policy);
+int admit_route_add(admit_queue_t *q, const char *spec);
+bool admit_push(admit_queue_t *q, const struct mosquitto_message *message, const mosquitto_property *props,
+                double now, admit_shed_t shed, void *userdata);
+admit_item_t *admit_pop(admit_queue_t *q, double now, admit_shed_t shed, void *userdata);
+void admit_done(admit_queue_t *q, admit_item_t *item, double now);
+void admit_report(admit_queue_t *q, double now, FILE *out);
+
+#endif
@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <string.h>
+#include "admission.h"
+
+#define BENCH_SERVICE_MS 1.0  // processing time per message, the TA handles 1000 msg/s
+#define BENCH_DURATION_MS 60000.0
+#define BENCH_DEADLINE_MS 1000.0  // a reply later than this is of no use to the device
+#define BENCH_ALARM_PERCENT 10
+
+typedef struct result_s {
+  unsigned long useful;  // processed within BENCH_DEADLINE_MS
+  unsigned long retries;
+} result_t;
+
+static void on_shed(void *userdata, const admit_item_t *item, bool retry) {
+  if (retry) ((result_t *)userdata)->retries++;
+}
+
+static double p99_ms(const admit_class_t *cls) {
+  unsigned long target = cls->processed * 99 / 100, seen = 0;
+
+  for (int i = 0; i < ADMIT_LATENCY_BUCKETS; i++) {
+    seen += cls->latency[i];
+    if (seen > target) return (double)(1 << i);
+  }
+  return cls->latency_max;
+}
+
+/* Arrivals are spaced uniformly between 0 and twice their mean, in virtual time. `capacity` 0 stands for the
+ * unbounded FIFO every message waits in without admission control. */
+static void run(double load, const char *name, admit_policy_t policy, int capacity) {
+  double rate = load / BENCH_SERVICE_MS, now = 1, next_arrival = 1, busy_until = 1, enqueued = 0;
+  struct mosquitto_message msg;
+  admit_item_t *current = NULL;
+  result_t result = {0};
+  admit_queue_t q;
+  unsigned long shed = 0, arrivals = 0;
+
+  if (admit_init(&q, capacity ? capacity : (int)(rate * BENCH_DURATION_MS) + 1, policy)) {
+    fprintf(stderr, "Error: Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (!capacity) q.target_ms = BENCH_DURATION_MS * 2;
+  admit_route_add(&q, "alarm/#=0");
+  memset(&msg, 0, sizeof(msg));
+  msg.payload = "{\"temp\":21.5}";
+  msg.payloadlen = strlen(msg.payload);
+
+  while (now < BENCH_DURATION_MS) {
+    if (next_arrival <= busy_until) {
+      now = next_arrival;
+      msg.topic = arrivals++ % 100 < BENCH_ALARM_PERCENT ? "alarm/dev" : "reading/dev";
+      admit_push(&q, &msg, NULL, now, on_shed, &result);
+      next_arrival += 2.0 * rand() / RAND_MAX / rate;
+      continue;
+    }
+    now = busy_until;
+    if (current) {
+      if (now - enqueued < BENCH_DEADLINE_MS) result.useful++;
+      admit_done(&q, current, now);
+    }
+    current = admit_pop(&q, now, on_shed, &result);
+    if (current) {
+      enqueued = current->enqueued;
+      busy_until = now + BENCH_SERVICE_MS;
+    } else {
+      busy_until = next_arrival;
+    }
+  }
+  for (int i = 0; i < ADMIT_PRIORITIES; i++) shed += q.classes[i].shed;
+  printf("%4.1fx %-9s %6.0f msg/s in time, alarms p99 <%6.0f ms, readings p99 <%6.0f ms, %7lu shed, %7lu told to "
+         "retry\n",
+         load, name, result.useful / (BENCH_DURATION_MS / 1e3), p99_ms(&q.classes[0]),
+         p99_ms(&q.classes[ADMIT_DEFAULT_PRIORITY]), shed, result.retries);
+  if (current) admit_done(&q, current, now);
+  admit_destroy(&q);
+}
+
+/* Usage: admit_bench [queue size]
+ * Offers the TA from half to three times the load it can process, BENCH_ALARM_PERCENT of it alarms routed to the
+ * highest priority, and compares how many messages each admission policy gets processed within BENCH_DEADLINE_MS,
+ * and at what latency, against an unbounded FIFO. */
+int main(int argc, char *argv[]) {
+  int capacity = argc > 1 ? atoi(argv[1]) : ADMIT_DEFAULT_CAPACITY;
+  const double loads[] = {0.5, 0.9, 1.2, 2, 3};
+
+  if (capacity <= 0) {
+    fprintf(stderr, "Usage: admit_bench [queue size]\n");
+    return EXIT_FAILURE;
+  }
+  srand(1);
+  for (int i = 0; i < (int)(sizeof(loads) / sizeof(loads[0])); i++) {
+    run(loads[i], "fifo", ADMIT_DROP_OLDEST, 0);
+    run(loads[i], "oldest", ADMIT_DROP_OLDEST, capacity);
+    run(loads[i], "low", ADMIT_DROP_LOW, capacity);
+    run(loads[i], "retry", ADMIT_RETRY_LATER, capacity);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,121 @@
+#include "consumer_group.h"
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sub_utils.h"
+#include "topic_set.h"
+
+static volatile sig_atomic_t draining;
+static group_stats_t worker_stats;
+static struct timespec last_message;
+
+static void drain_func(int signum) { draining = 1; }
+
+static long elapsed_ms(const struct timespec *since) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+rc_mosq_retcode_t cfg_add_shared_topic(mosq_config_t *cfg, const char *group, const char *topic) {
+  char shared[256];
+
+  if (snprintf(shared, sizeof(shared), "$share/%s/%s", group, topic) >= (int)sizeof(shared) || strchr(group, '/') ||
+      strchr(group, '+') || strchr(group, '#')) {
+    fprintf(stderr, "Error: Invalid shared subscription group '%s'.\n", group);
+    return RC_MOS_ADD_TOPIC;
+  }
+  return cfg_add_topic(cfg, client_sub, shared);
+}
+
+static void message_callback_group_func(struct mosquitto *mosq, void *obj, const struct mosquitto_message *message,
+                                        const mosquitto_property *properties) {
+  worker_stats.messages++;
+  worker_stats.bytes += message->payloadlen;
+  clock_gettime(CLOCK_MONOTONIC, &last_message);
+  message_callback_sub_func(mosq, obj, message, properties);
+}
+
+static void report_stats(int stats_fd) {
+  if (write(stats_fd, &worker_stats, sizeof(worker_stats)) != sizeof(worker_stats)) {
+    fprintf(stderr, "Warning: Worker %d failed to report stats.\n", worker_stats.worker);
+  }
+}
+
+/* Runs in the forked worker process until the supervisor sends SIGTERM. The worker then unsubscribes so the broker
+ * routes the group's messages to the remaining members, and keeps processing until nothing arrived for a while. */
+int consumer_worker_run(int worker, int stats_fd, const char *group) {
+  rc_mosq_retcode_t ret = RC_MOS_OK;
+  struct mosquitto *mosq = NULL;
+  struct timespec started, last_report;
+  char id_prefix[64];
+  mosq_config_t cfg;
+
+  signal(SIGTERM, drain_func);
+  signal(SIGINT, SIG_IGN);  // Ctrl-C reaches the whole process group, only the supervisor decides when to drain
+  worker_stats.worker = worker;
+  worker_stats.pid = getpid();
+
+  init_mosq_config(&cfg, client_sub);
+  mosquitto_lib_init();
+  cfg.general_config->host = strdup(HOST);
+  cfg.general_config->protocol_version = MQTT_PROTOCOL_V5;
+  cfg.general_config->qos = 1;
+  snprintf(id_prefix, sizeof(id_prefix), "%s_%d_", group, worker);
+  cfg.general_config->id_prefix = strdup(id_prefix);
+  if (cfg_add_shared_topic(&cfg, group, TOPIC) || generate_client_id(&cfg)) {
+    ret = RC_MOS_INIT_ERROR;
+    goto cleanup;
+  }
+
+  mosq = mosquitto_new(cfg.general_config->id, cfg.general_config->clean_session, &cfg);
+  if (!mosq || mosq_opts_set(mosq, &cfg)) {
+    ret = RC_MOS_INIT_ERROR;
+    goto cleanup;
+  }
+  mosquitto_connect_v5_callback_set(mosq, connect_callback_sub_func);
+  mosquitto_message_v5_callback_set(mosq, message_callback_group_func);
+  mosquitto_subscribe_callback_set(mosq, subscribe_callback_sub_func);
+  mosquitto_unsubscribe_callback_set(mosq, unsubscribe_callback_sub_func);
+  // A broker that is not up yet is waited for here, a worker exiting early would only be restarted
+  while ((ret = mosq_client_connect(mosq, &cfg))) {
+    mosquitto_lib_init();  // mosq_client_connect() gave up the library reference
+    if (draining) goto cleanup;
+    sleep(1);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &last_report);
+  while (!draining) {
+    if (mosquitto_loop(mosq, 100, 1) != MOSQ_ERR_SUCCESS && !draining) {
+      sleep(1);
+      mosquitto_reconnect(mosq);
+    }
+    sub_poll(mosq, &cfg);
+    if (elapsed_ms(&last_report) >= GROUP_STATS_INTERVAL * 1000) {
+      report_stats(stats_fd);
+      clock_gettime(CLOCK_MONOTONIC, &last_report);
+    }
+  }
+
+  topic_set_remove_all(cfg.sub_config->topics);
+  topic_set_flush(cfg.sub_config->topics, mosq, &cfg);
+  clock_gettime(CLOCK_MONOTONIC, &started);
+  last_message = started;
+  while (elapsed_ms(&last_message) < GROUP_DRAIN_IDLE_MS && elapsed_ms(&started) < GROUP_DRAIN_TIMEOUT * 1000) {
+    if (mosquitto_loop(mosq, 100, 1) != MOSQ_ERR_SUCCESS) break;
+  }
+  mosquitto_disconnect_v5(mosq, 0, cfg.property_config->disconnect_props);
+  mosquitto_loop(mosq, 100, 1);
+  // Only a drained worker is done, the supervisor restarts one that exited any other way
+  worker_stats.final = true;
+
+cleanup:
+  report_stats(stats_fd);
+  close(stats_fd);
+  mosquitto_destroy(mosq);
+  mosquitto_lib_cleanup();
+  mosq_config_cleanup(&cfg);
+  return ret;
+}
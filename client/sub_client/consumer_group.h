@@ -0,0 +1,34 @@
+#ifndef CONSUMER_GROUP_H
+#define CONSUMER_GROUP_H
+
+#include <sys/types.h>
+#include "client_common.h"
+
+#define GROUP_MAX_WORKERS 32
+#define GROUP_DEFAULT_NAME "ta"
+#define GROUP_STATS_INTERVAL 1
+#define GROUP_DRAIN_IDLE_MS 500
+#define GROUP_DRAIN_TIMEOUT 10
+
+/* Sent by every worker to the supervisor once per interval and once more after draining. The struct is smaller than
+ * PIPE_BUF, so reports from one worker never interleave. */
+typedef struct group_stats_s {
+  int worker;
+  pid_t pid;
+  unsigned long messages;
+  unsigned long bytes;
+  bool final;
+} group_stats_t;
+
+typedef struct group_worker_s {
+  pid_t pid;
+  int stats_fd;
+  int restarts;
+  group_stats_t stats;
+  group_stats_t last;
+} group_worker_t;
+
+rc_mosq_retcode_t cfg_add_shared_topic(mosq_config_t *cfg, const char *group, const char *topic);
+int consumer_worker_run(int worker, int stats_fd, const char *group);
+
+#endif
@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "client_common.h"
+#include "sub_utils.h"
+#include "topic_set.h"
+
+#define BENCH_ROUNDS 5
+#define BENCH_TIMEOUT_MS 60000
+#define BENCH_CHURN_PERCENT 10
+
+static double now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* Runs the client until the set went through `resubscribes` full resubscriptions and nothing is left unacknowledged. */
+static int run_until_done(struct mosquitto *mosq, topic_set_t *set, unsigned long resubscribes) {
+  double deadline = now_ms() + BENCH_TIMEOUT_MS;
+
+  while (now_ms() < deadline) {
+    if (set->resubscribes >= resubscribes && !set->resub_pending && topic_set_idle(set)) {
+      return 0;
+    }
+    if (mosquitto_loop(mosq, 100, 1) != MOSQ_ERR_SUCCESS) {
+      return -1;
+    }
+  }
+  fprintf(stderr, "Error: Timed out, %d SUBSCRIBE packets still unacknowledged.\n", set->chunks_inflight);
+  return -1;
+}
+
+static int reconnect_round(struct mosquitto *mosq, mosq_config_t *cfg, topic_set_t *set, double *ms) {
+  unsigned long packets = set->packets;
+
+  mosquitto_disconnect_v5(mosq, 0, cfg->property_config->disconnect_props);
+  while (mosquitto_loop(mosq, 100, 1) == MOSQ_ERR_SUCCESS) {
+  }
+  if (mosquitto_reconnect(mosq) || run_until_done(mosq, set, set->resubscribes + 1)) {
+    return -1;
+  }
+  *ms = set->resub_ms;
+  printf("  %d topics in %lu packets: %.1f ms\n", topic_set_count(set), set->packets - packets, *ms);
+  return 0;
+}
+
+/* Usage: resub_bench [topics] [topics per packet] [host]
+ * Subscribes one topic per simulated device, then measures how long the full resubscription after a reconnect takes
+ * with chunked SUBSCRIBE packets and with one packet per topic, and how long an incremental update of
+ * BENCH_CHURN_PERCENT of the devices takes. */
+int main(int argc, char *argv[]) {
+  int count = argc > 1 ? atoi(argv[1]) : 10000;
+  int chunk = argc > 2 ? atoi(argv[2]) : TOPIC_SET_CHUNK_TOPICS;
+  struct mosquitto *mosq = NULL;
+  char topic[128];
+  topic_set_t *set;
+  mosq_config_t cfg;
+  double start, ms, best, naive_bytes = 0;
+  int ret = EXIT_FAILURE, churn;
+
+  init_mosq_config(&cfg, client_sub);
+  mosquitto_lib_init();
+  cfg.general_config->host = cfg_strdup(&cfg, argc > 3 ? argv[3] : "localhost");
+  cfg.general_config->qos = 1;
+  set = cfg.sub_config->topics;
+  set->chunk_topics = chunk > 0 ? chunk : 1;
+
+  start = now_ms();
+  for (int i = 0; i < count; i++) {
+    snprintf(topic, sizeof(topic), "%s/dev%06d/up", TOPIC, i);
+    if (topic_set_add(set, topic) < 0) {
+      fprintf(stderr, "Error: Out of memory.\n");
+      goto cleanup;
+    }
+    // what the old realloc'd char * table with one strdup per topic needed, counting malloc's 16 bytes overhead
+    naive_bytes += sizeof(char *) + ((strlen(topic) + 1 + 8 + 15) & ~15);
+  }
+  printf("added %d topics in %.2f ms: %zu bytes in 4 allocations (%.0f bytes in %d allocations as a char * table)\n",
+         count, now_ms() - start, topic_set_memory(set), naive_bytes, count + 1);
+
+  if (generate_client_id(&cfg)) {
+    goto cleanup;
+  }
+  mosq = mosquitto_new(cfg.general_config->id, true, &cfg);
+  if (!mosq || mosq_opts_set(mosq, &cfg)) {
+    goto cleanup;
+  }
+  mosquitto_connect_v5_callback_set(mosq, connect_callback_sub_func);
+  mosquitto_subscribe_callback_set(mosq, subscribe_callback_sub_func);
+  mosquitto_unsubscribe_callback_set(mosq, unsubscribe_callback_sub_func);
+  if (mosq_client_connect(mosq, &cfg) || run_until_done(mosq, set, 1)) {
+    goto cleanup;
+  }
+  printf("initial subscribe: %.1f ms in %lu packets\n", set->resub_ms, set->packets);
+
+  printf("resubscribe, %d topics per packet:\n", set->chunk_topics);
+  best = 0;
+  for (int i = 0; i < BENCH_ROUNDS; i++) {
+    if (reconnect_round(mosq, &cfg, set, &ms)) goto cleanup;
+    if (i == 0 || ms < best) best = ms;
+  }
+  printf("best %.1f ms, %.0f topics/s\n", best, count / best * 1000);
+
+  printf("resubscribe, 1 topic per packet:\n");
+  set->chunk_topics = 1;
+  if (reconnect_round(mosq, &cfg, set, &ms)) goto cleanup;
+  printf("%.1fx slower than chunked\n", ms / best);
+  set->chunk_topics = chunk > 0 ? chunk : 1;
+
+  // Devices leaving and joining while connected, only the difference goes to the broker
+  churn = count * BENCH_CHURN_PERCENT / 100;
+  start = now_ms();
+  for (int i = 0; i < churn; i++) {
+    snprintf(topic, sizeof(topic), "%s/dev%06d/up", TOPIC, i);
+    topic_set_remove(set, topic);
+    snprintf(topic, sizeof(topic), "%s/dev%06d/up", TOPIC, count + i);
+    topic_set_add(set, topic);
+  }
+  topic_set_flush(set, mosq, &cfg);
+  if (run_until_done(mosq, set, set->resubscribes)) goto cleanup;
+  printf("incremental: %d unsubscribed and %d subscribed in %.1f ms\n", churn, churn, now_ms() - start);
+
+  mosquitto_disconnect_v5(mosq, 0, cfg.property_config->disconnect_props);
+  mosquitto_loop(mosq, 100, 1);
+  ret = 0;
+
+cleanup:
+  mosquitto_destroy(mosq);
+  mosquitto_lib_cleanup();
+  mosq_config_cleanup(&cfg);
+  return ret;
+}
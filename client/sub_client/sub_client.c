@@ -1,24 +1,207 @@
 #include <errno.h>
+#include <mqtt_protocol.h>
+#include <poll.h>
 #include <signal.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include "admission.h"
 #include "client_common.h"
+#include "dedup_cache.h"
+#include "shm_ring.h"
 #include "sub_utils.h"
+#include "value_cache.h"
 
+#define SUB_MAX_READS 256  // socket reads per round while messages keep arriving
+
+static volatile sig_atomic_t running = 1;
+
+static void stop_handler(int signum) { running = 0; }
+
+typedef struct local_ctx_s {
+  struct mosquitto *mosq;
+  mosq_config_t *cfg;
+} local_ctx_t;
+
+/* A message from a publisher on the same host goes the way of one from the broker, at QoS 0. */
+static void deliver_local(void *userdata, const char *topic, const void *payload, int len) {
+  local_ctx_t *ctx = (local_ctx_t *)userdata;
+  struct mosquitto_message msg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.topic = (char *)topic;
+  msg.payload = (void *)payload;
+  msg.payloadlen = len;
+  message_callback_sub_func(ctx->mosq, ctx->cfg, &msg, NULL);
+}
+
+/* mosquitto_loop() only waits on the broker's socket, so with a local ring the wait is done here on both, and
+ * libmosquitto is then only asked to handle what is ready. Sets `*local` when the ring may hold more. */
+static mosq_retcode_t loop_once(struct mosquitto *mosq, mosq_config_t *cfg, int timeout, bool *local) {
+  shm_ring_t *ring = cfg->sub_config->ring;
+  local_ctx_t ctx = {mosq, cfg};
+  struct pollfd fds[3];
+
+  if (!ring) return mosquitto_loop(mosq, timeout, 1);
+  fds[0].fd = ring->efd;
+  fds[1].fd = ring->listen_fd;
+  fds[2].fd = mosquitto_socket(mosq);
+  fds[0].events = fds[1].events = fds[2].events = POLLIN;
+  if (mosquitto_want_write(mosq)) fds[2].events |= POLLOUT;
+  if (poll(fds, fds[2].fd >= 0 ? 3 : 2, *local ? 0 : timeout) > 0 && (fds[1].revents & POLLIN)) {
+    shm_ring_serve(ring);
+  }
+  *local = shm_ring_pop(ring, deliver_local, &ctx) == SHM_RING_BATCH;
+  return mosquitto_loop(mosq, 0, 1);
+}
+
+/* Takes messages off the socket as fast as they arrive, so the backlog waits in the admission queue rather than in
+ * the broker or the kernel, and processes them in between. sub_poll() also runs the timers of acks and reassembly. */
+static mosq_retcode_t run_loop(struct mosquitto *mosq, mosq_config_t *cfg) {
+  admit_queue_t *admit = cfg->sub_config->admit;
+  mosq_retcode_t ret;
+  int reads, queued;
+  bool local = false;
+
+  signal(SIGINT, stop_handler);
+  signal(SIGTERM, stop_handler);
+  while (running) {
+    reads = 0;
+    // libmosquitto reads a few packets per call, so the socket is read again for as long as that queued more
+    do {
+      queued = admit ? admit->count : 0;
+      ret = loop_once(mosq, cfg, queued ? 0 : 100, &local);
+    } while (ret == MOSQ_ERR_SUCCESS && admit && ++reads < SUB_MAX_READS && admit->count > queued &&
+             admit->count < admit->capacity);
+    if (ret == MOSQ_ERR_NO_CONN) return MOSQ_ERR_SUCCESS;
+    if (ret != MOSQ_ERR_SUCCESS && running) {
+      sleep(1);
+      mosquitto_reconnect(mosq);
+    }
+    sub_poll(mosq, cfg);
+  }
+  return MOSQ_ERR_SUCCESS;
+}
+
+/* Options that take a value, missing it is an error rather than the next argument being taken as the value. */
+static const char *const value_options[] = {"--capture", "--store", "--admit", "--route", "--queue"};
+
+static bool takes_value(const char *arg) {
+  for (size_t i = 0; i < sizeof(value_options) / sizeof(value_options[0]); i++) {
+    if (!strcmp(arg, value_options[i])) return true;
+  }
+  return false;
+}
+
+/* Usage: sub_client [--capture <file>] [hex|HEX] [--store <directory>] [--admit <oldest|low|retry>] [--route
+ * <filter>=<priority>]... [--queue <messages>] [--acks] [--cache] [--validate] [--dedup] [--dedup-payload]
+ * [--local [name]]
+ * --capture records every message to the file for pub_replay, see capture.h. hex prints payloads as lowercase hex, HEX
+ * as uppercase, for devices that send binary. --store decodes the readings in every payload into the per-device
+ * time-series store in the directory, see ts_store.h. --admit queues messages and sheds them under overload with the
+ * given policy, --route gives topics a priority from 0, the highest, to 3, and --queue sets the queue size, see
+ * admission.h. --acks acknowledges numbered QoS 0 messages cumulatively on `<topic>/ack`, see cum_ack.h. --cache keeps
+ * the latest value of every topic for VCACHE_DEFAULT_TTL and answers `<topic>/get` requests from it, see value_cache.h.
+ * --validate drops JSON payloads that are malformed JSON or UTF-8, and other payloads the publisher declared UTF-8 that
+ * are not, see json_index.h. --dedup drops QoS 1 redeliveries whose seq property was seen on the topic within
+ * DEDUP_DEFAULT_TTL, --dedup-payload also those without a seq property that repeat a payload. --local also takes
+ * messages from publishers on the same host through the shared memory ring of that name, SHM_RING_DEFAULT_NAME by
+ * default, see shm_ring.h. */
 int main(int argc, char *argv[]) {
   mosq_retcode_t ret = MOSQ_ERR_SUCCESS;
   struct mosquitto *mosq = NULL;
   mosq_config_t cfg;
   struct sigaction sigact;
+  admit_queue_t admit;
+  shm_ring_t ring;
+  const char *ring_name = NULL;
+  admit_policy_t policy = ADMIT_DROP_OLDEST;
+  bool admission = false;
+  char *routes[ADMIT_MAX_ROUTES];
+  int route_count = 0, queue_size = ADMIT_DEFAULT_CAPACITY;
 
   init_mosq_config(&cfg, client_sub);
   mosquitto_lib_init();
 
   // set the configures and message for testing
-  cfg.general_config->host = strdup(HOST);
+  cfg.general_config->host = cfg_strdup(&cfg, HOST);
   if (cfg_add_topic(&cfg, client_sub, TOPIC)) {
     return EXIT_FAILURE;
   }
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "hex") || !strcmp(argv[i], "HEX")) {
+      cfg.sub_config->hex = argv[i][0] == 'h' ? 1 : 2;
+    } else if (!strcmp(argv[i], "--store") && i + 1 < argc) {
+      cfg.sub_config->store_path = cfg_strdup(&cfg, argv[++i]);
+    } else if (!strcmp(argv[i], "--admit") && i + 1 < argc) {
+      if (admit_policy_parse(argv[++i], &policy)) {
+        fprintf(stderr, "Error: Unknown admission policy %s.\n", argv[i]);
+        ret = MOSQ_ERR_INVAL;
+        goto cleanup;
+      }
+      admission = true;
+    } else if (!strcmp(argv[i], "--route") && i + 1 < argc) {
+      if (route_count == ADMIT_MAX_ROUTES) {
+        fprintf(stderr, "Error: At most %d routes.\n", ADMIT_MAX_ROUTES);
+        ret = MOSQ_ERR_INVAL;
+        goto cleanup;
+      }
+      routes[route_count++] = argv[++i];
+      admission = true;
+    } else if (!strcmp(argv[i], "--queue") && i + 1 < argc) {
+      queue_size = atoi(argv[++i]);
+      admission = true;
+    } else if (!strcmp(argv[i], "--acks")) {
+      // The sequence numbers travel as user properties
+      cfg.general_config->protocol_version = MQTT_PROTOCOL_V5;
+      cfg.sub_config->cum_acks = true;
+    } else if (!strcmp(argv[i], "--cache")) {
+      cfg.sub_config->vcache_ttl = VCACHE_DEFAULT_TTL;
+    } else if (!strcmp(argv[i], "--validate")) {
+      cfg.sub_config->validate = true;
+    } else if (!strcmp(argv[i], "--dedup")) {
+      cfg.sub_config->dedup_ttl = DEDUP_DEFAULT_TTL;
+    } else if (!strcmp(argv[i], "--dedup-payload")) {
+      cfg.sub_config->dedup_ttl = DEDUP_DEFAULT_TTL;
+      cfg.sub_config->dedup_payload = true;
+    } else if (!strcmp(argv[i], "--local")) {
+      ring_name = i + 1 < argc && argv[i + 1][0] != '-' ? argv[++i] : SHM_RING_DEFAULT_NAME;
+    } else if (!strcmp(argv[i], "--capture") && i + 1 < argc) {
+      cfg.sub_config->capture_path = cfg_strdup(&cfg, argv[++i]);
+    } else {
+      if (takes_value(argv[i])) {
+        fprintf(stderr, "Error: %s needs a value.\n", argv[i]);
+      } else {
+        fprintf(stderr, "Error: Unknown argument %s.\n", argv[i]);
+      }
+      ret = MOSQ_ERR_INVAL;
+      goto cleanup;
+    }
+  }
+
+  if (admission) {
+    if (queue_size <= 0 || admit_init(&admit, queue_size, policy)) {
+      fprintf(stderr, "Error: Unable to create an admission queue of %d messages.\n", queue_size);
+      ret = MOSQ_ERR_INVAL;
+      goto cleanup;
+    }
+    cfg.sub_config->admit = &admit;
+    for (int i = 0; i < route_count; i++) {
+      if (admit_route_add(&admit, routes[i])) {
+        fprintf(stderr, "Error: Invalid route %s, expected <filter>=<0-%d>.\n", routes[i], ADMIT_PRIORITIES - 1);
+        ret = MOSQ_ERR_INVAL;
+        goto cleanup;
+      }
+    }
+  }
+
+  if (ring_name) {
+    if (shm_ring_create(&ring, ring_name)) {
+      ret = MOSQ_ERR_ERRNO;
+      goto cleanup;
+    }
+    cfg.sub_config->ring = &ring;
+  }
 
   if (cfg.sub_config->no_retain && cfg.sub_config->retained_only) {
     fprintf(stderr, "\nError: Combining '-R' and '--retained-only' makes no sense.\n");
@@ -52,8 +235,9 @@ int main(int argc, char *argv[]) {
 
   if (cfg.general_config->debug) {
     mosquitto_log_callback_set(mosq, log_callback_sub_func);
-    mosquitto_subscribe_callback_set(mosq, subscribe_callback_sub_func);
   }
+  mosquitto_subscribe_callback_set(mosq, subscribe_callback_sub_func);
+  mosquitto_unsubscribe_callback_set(mosq, unsubscribe_callback_sub_func);
   mosquitto_connect_v5_callback_set(mosq, connect_callback_sub_func);
   mosquitto_message_v5_callback_set(mosq, message_callback_sub_func);
 
@@ -76,7 +260,7 @@ int main(int argc, char *argv[]) {
     alarm(cfg.sub_config->timeout);
   }
 
-  ret = mosquitto_loop_forever(mosq, -1, 1);
+  ret = run_loop(mosq, &cfg);
   if (ret == MOSQ_ERR_NO_CONN) {
     ret = MOSQ_ERR_SUCCESS;
   }
@@ -86,6 +270,16 @@ int main(int argc, char *argv[]) {
   }
 
 cleanup:
+  if (cfg.sub_config->admit) {
+    admit_report(&admit, admit.last_report, stdout);
+    admit_destroy(&admit);
+    cfg.sub_config->admit = NULL;
+  }
+  if (cfg.sub_config->ring) {
+    shm_ring_stats(&ring, stdout);
+    shm_ring_close(&ring);
+    cfg.sub_config->ring = NULL;
+  }
   mosquitto_destroy(mosq);
   mosquitto_lib_cleanup();
   mosq_config_cleanup(&cfg);
@@ -0,0 +1,156 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "client_common.h"
+#include "consumer_group.h"
+
+#define GROUP_REPORT_INTERVAL 5
+
+static volatile sig_atomic_t stopping;
+
+static void stop_func(int signum) { stopping = 1; }
+
+static int spawn_worker(group_worker_t *workers, int index, int worker_count, const char *group) {
+  int fds[2];
+  pid_t pid;
+
+  if (pipe(fds)) {
+    perror("pipe");
+    return -1;
+  }
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    for (int i = 0; i < worker_count; i++) {
+      if (workers[i].stats_fd > 0) close(workers[i].stats_fd);
+    }
+    exit(consumer_worker_run(index, fds[1], group));
+  }
+
+  close(fds[1]);
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  if (workers[index].stats_fd > 0) close(workers[index].stats_fd);
+  workers[index].pid = pid;
+  workers[index].stats_fd = fds[0];
+  // Counters restart from zero in a respawned worker, keep what the previous one reported
+  workers[index].last.messages += workers[index].stats.messages;
+  workers[index].last.bytes += workers[index].stats.bytes;
+  memset(&workers[index].stats, 0, sizeof(group_stats_t));
+  return 0;
+}
+
+static void read_stats(group_worker_t *worker) {
+  group_stats_t stats;
+
+  while (read(worker->stats_fd, &stats, sizeof(stats)) == sizeof(stats)) {
+    worker->stats = stats;
+  }
+}
+
+static unsigned long total_messages(const group_worker_t *worker) {
+  return worker->last.messages + worker->stats.messages;
+}
+
+static void report(group_worker_t *workers, int worker_count, unsigned long *prev, double interval) {
+  unsigned long total = 0, messages;
+
+  for (int i = 0; i < worker_count; i++) {
+    messages = total_messages(&workers[i]);
+    printf("worker %2d pid %6d: %10lu messages %9.1f msg/s restarts %d\n", i, workers[i].pid, messages,
+           (messages - prev[i]) / interval, workers[i].restarts);
+    total += messages;
+  }
+  for (int i = 0; i < worker_count; i++) {
+    total -= prev[i];
+    prev[i] = total_messages(&workers[i]);
+  }
+  printf("group: %d workers, %.1f msg/s\n", worker_count, total / interval);
+  fflush(stdout);
+}
+
+/* Usage: sub_group [workers] [group]
+ * Spawns a consumer group sharing `$share/<group>/TOPIC`, restarts crashed workers and drains all of them on SIGINT or
+ * SIGTERM. The aggregated rate shows how throughput scales with the number of workers. */
+int main(int argc, char *argv[]) {
+  int worker_count = argc > 1 ? atoi(argv[1]) : 4;
+  const char *group = argc > 2 ? argv[2] : GROUP_DEFAULT_NAME;
+  group_worker_t workers[GROUP_MAX_WORKERS];
+  unsigned long prev[GROUP_MAX_WORKERS] = {0};
+  struct pollfd pfds[GROUP_MAX_WORKERS];
+  time_t last_report = time(NULL);
+  int alive = 0, status;
+  bool signalled = false;
+  pid_t pid;
+
+  if (worker_count < 1 || worker_count > GROUP_MAX_WORKERS) {
+    fprintf(stderr, "Error: The number of workers must be between 1 and %d.\n", GROUP_MAX_WORKERS);
+    return EXIT_FAILURE;
+  }
+  memset(workers, 0, sizeof(workers));
+  signal(SIGINT, stop_func);
+  signal(SIGTERM, stop_func);
+
+  for (int i = 0; i < worker_count; i++) {
+    if (spawn_worker(workers, i, worker_count, group)) {
+      stopping = 1;
+      break;
+    }
+    alive++;
+  }
+
+  while (alive > 0) {
+    if (stopping && !signalled) {
+      for (int i = 0; i < worker_count; i++) {
+        if (workers[i].pid > 0) kill(workers[i].pid, SIGTERM);
+      }
+      signalled = true;
+    }
+
+    for (int i = 0; i < worker_count; i++) {
+      pfds[i].fd = workers[i].pid > 0 ? workers[i].stats_fd : -1;
+      pfds[i].events = POLLIN;
+    }
+    if (poll(pfds, worker_count, 1000) > 0) {
+      for (int i = 0; i < worker_count; i++) {
+        if (pfds[i].revents & POLLIN) read_stats(&workers[i]);
+      }
+    }
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+      for (int i = 0; i < worker_count; i++) {
+        if (workers[i].pid != pid) continue;
+        read_stats(&workers[i]);
+        workers[i].pid = 0;
+        if (!stopping && !workers[i].stats.final) {
+          fprintf(stderr, "Warning: Worker %d exited unexpectedly, restarting it.\n", i);
+          workers[i].restarts++;
+          if (!spawn_worker(workers, i, worker_count, group)) break;
+        }
+        alive--;
+      }
+    }
+
+    if (time(NULL) - last_report >= GROUP_REPORT_INTERVAL) {
+      report(workers, worker_count, prev, time(NULL) - last_report);
+      last_report = time(NULL);
+    }
+  }
+
+  report(workers, worker_count, prev, time(NULL) - last_report > 0 ? time(NULL) - last_report : 1);
+  for (int i = 0; i < worker_count; i++) {
+    if (workers[i].stats_fd > 0) close(workers[i].stats_fd);
+  }
+  return EXIT_SUCCESS;
+}
@@ -1,50 +1,357 @@
 #include "sub_utils.h"
+#include <ctype.h>
+#include <mqtt_protocol.h>
 #include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "admission.h"
+#include "capture.h"
 #include "config.h"
+#include "cum_ack.h"
+#include "dedup_cache.h"
+#include "fragment.h"
+#include "hex.h"
+#include "json_index.h"
+#include "topic_set.h"
+#include "ts_store.h"
+#include "value_cache.h"
+
+#define SUB_HEX_CHUNK 2048  // payload bytes encoded per fwrite in hex output
+#define SUB_POLL_SLICE_MS 10  // queued messages processed per sub_poll before the socket is read again
+
+static double now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
 
 static void write_payload(const unsigned char *payload, int payloadlen, int hex) {
+  char buf[HEX_ENCODED_LEN(SUB_HEX_CHUNK)];
+  int len;
+
   if (hex == 0) {
     (void)fwrite(payload, 1, payloadlen, stdout);
   } else if (hex == 1 || hex == 2) {
-    for (int i = 0; i < payloadlen; i++) {
-      fprintf(stdout, "%02x", payload[i]);
+    for (int i = 0; i < payloadlen; i += len) {
+      len = payloadlen - i < SUB_HEX_CHUNK ? payloadlen - i : SUB_HEX_CHUNK;
+      hex_encode(buf, payload + i, len, hex == 2);
+      (void)fwrite(buf, 1, HEX_ENCODED_LEN(len), stdout);
     }
   }
 }
 
 static void print_message(mosq_config_t *cfg, const struct mosquitto_message *message) {
   if (message->payloadlen) {
-    write_payload(message->payload, message->payloadlen, false);
+    write_payload(message->payload, message->payloadlen, cfg->sub_config->hex);
     printf("\n");
     fflush(stdout);
   }
 }
 
-void signal_handler_func(int signum) {
-  if (signum == SIGALRM) {
-    // TODO: Find some way else to break a loop or disconnect the client, in which way we don't
-    // need to use variable `mosq`, `cfg`
-    // mosquitto_disconnect_v5(mosq, MQTT_RC_DISCONNECT_WITH_WILL_MSG, cfg.property_config->disconnect_props);
+static void publish_nack(void *userdata, const char *topic, const unsigned char *nack, int nack_len) {
+  struct mosquitto *mosq = (struct mosquitto *)userdata;
+  char nack_topic[FRAG_MAX_TOPIC_LEN + sizeof(FRAG_NACK_SUFFIX)];
+
+  snprintf(nack_topic, sizeof(nack_topic), "%s%s", topic, FRAG_NACK_SUFFIX);
+  mosquitto_publish(mosq, NULL, nack_topic, nack_len, nack, 1, false);
+}
+
+/* Returns true when the message was a chunk of a fragmented payload, complete payloads are printed as one message.
+ * Transfers that stopped receiving chunks are NACKed and expired by sub_poll(). */
+static bool handle_fragment(struct mosquitto *mosq, mosq_config_t *cfg, const struct mosquitto_message *message) {
+  mosq_sub_config_t *sub_config = cfg->sub_config;
+  time_t now = time(NULL);
+  frag_retcode_t ret;
+  int slot_id;
+
+#ifdef MOSQ_LOW_FOOTPRINT
+  // The reassembly slab alone is larger than the whole footprint budget, chunks are printed as they arrive
+  return false;
+#endif
+  if (message->payloadlen < FRAG_HEADER_LEN || ((const unsigned char *)message->payload)[0] != FRAG_MAGIC) {
+    return false;
   }
+  if (!sub_config->reasm) {
+    sub_config->reasm = frag_reasm_new(FRAG_TIMEOUT_SEC);
+    if (!sub_config->reasm) {
+      fprintf(stderr, "Error: Out of memory.\n");
+      return true;
+    }
+  }
+
+  ret = frag_reasm_feed(sub_config->reasm, message->topic, message->payload, message->payloadlen, now, &slot_id);
+  if (ret == FRAG_COMPLETE) {
+    frag_slot_t *slot = &sub_config->reasm->slots[slot_id];
+    write_payload(slot->data, slot->total_len, sub_config->hex);
+    printf("\n");
+    fflush(stdout);
+    frag_reasm_release(sub_config->reasm, slot_id);
+  } else if (ret == FRAG_NO_SLOT) {
+    fprintf(stderr, "Warning: No free reassembly slot, dropped a chunk on %s.\n", message->topic);
+  } else if (ret == FRAG_NOT_FRAGMENT || ret == FRAG_MALFORMED) {
+    // Binary payloads may start with FRAG_MAGIC by chance, whatever does not decode as a chunk is an ordinary message
+    return false;
+  }
+  frag_reasm_gc(sub_config->reasm, now, publish_nack, mosq);
+  return true;
 }
 
-void publish_callback_sub_func(struct mosquitto *mosq, void *obj, int mid, int reason_code,
-                               const mosquitto_property *properties) {
-  mosq_config_t *cfg = (mosq_config_t *)obj;
-  UNUSED(reason_code);
-  UNUSED(properties);
+/* QoS 1 redeliveries after a reconnect are recognised by the device sequence number the publisher sets. Without one
+ * a redelivery looks the same as a repeated reading or GET request, so those are only deduplicated by payload hash
+ * when dedup_payload asks for it. */
+static bool is_duplicate(mosq_config_t *cfg, const struct mosquitto_message *message,
+                         const mosquitto_property *properties) {
+  mosq_sub_config_t *sub_config = cfg->sub_config;
+  char *name = NULL, *value = NULL;
+  const mosquitto_property *prop;
+  uint64_t key = 0;
 
-  if ((mid == cfg->general_config->last_mid || cfg->general_config->last_mid == 0)) {
-    mosquitto_disconnect_v5(mosq, 0, cfg->property_config->disconnect_props);
+  if (message->qos == 0 || sub_config->dedup_ttl <= 0) {
+    return false;
   }
 
-  printf("publish_callback_sub_func \n");
+  for (prop = mosquitto_property_read_string_pair(properties, MQTT_PROP_USER_PROPERTY, &name, &value, false); prop;
+       prop = mosquitto_property_read_string_pair(prop, MQTT_PROP_USER_PROPERTY, &name, &value, true)) {
+    if (!key && !strcmp(name, DEDUP_SEQ_PROPERTY)) {
+      key = dedup_key_seq(message->topic, value);
+    }
+    free(name);
+    free(value);
+  }
+  if (!key && !sub_config->dedup_payload) {
+    return false;
+  }
+  if (!key) {
+    key = dedup_key_message(message->topic, message->payload, message->payloadlen);
+  }
+  if (!sub_config->dedup) {
+    sub_config->dedup = dedup_cache_new(DEDUP_DEFAULT_CAPACITY, sub_config->dedup_ttl);
+    if (!sub_config->dedup) {
+      sub_config->dedup_ttl = 0;
+      return false;
+    }
+  }
+  return dedup_cache_check(sub_config->dedup, key, (uint32_t)time(NULL));
 }
 
-void message_callback_sub_func(struct mosquitto *mosq, void *obj, const struct mosquitto_message *message,
-                               const mosquitto_property *properties) {
+/* A message on `<resource>/get` asks for the latest value of `<resource>`. When the cache holds one that has not
+ * expired it is published straight back to the request's response topic, or to `<resource>/value`, and the request
+ * never reaches the device. Returns true when the request was answered. */
+static bool serve_from_cache(struct mosquitto *mosq, mosq_config_t *cfg, const struct mosquitto_message *message,
+                             const mosquitto_property *properties) {
+  mosq_sub_config_t *sub_config = cfg->sub_config;
+  int topic_len = strlen(message->topic), key_len = topic_len - (int)strlen(VCACHE_GET_SUFFIX);
+  mosquitto_property *reply_props = NULL;
+  const vcache_entry_t *entry;
+  char *response_topic = NULL, *reply_topic;
+  void *correlation = NULL;
+  uint16_t correlation_len = 0;
+
+  if (sub_config->vcache_ttl <= 0 || !sub_config->vcache || key_len <= 0 ||
+      strcmp(message->topic + key_len, VCACHE_GET_SUFFIX)) {
+    return false;
+  }
+  entry = vcache_get(sub_config->vcache, message->topic, key_len, time(NULL));
+  if (!entry) {
+    return false;
+  }
+
+  mosquitto_property_read_string(properties, MQTT_PROP_RESPONSE_TOPIC, &response_topic, false);
+  if (mosquitto_property_read_binary(properties, MQTT_PROP_CORRELATION_DATA, &correlation, &correlation_len, false)) {
+    mosquitto_property_add_binary(&reply_props, MQTT_PROP_CORRELATION_DATA, correlation, correlation_len);
+  }
+  reply_topic = response_topic;
+  if (!reply_topic) {
+    reply_topic = malloc(key_len + sizeof(VCACHE_VALUE_SUFFIX));
+    if (reply_topic) sprintf(reply_topic, "%.*s%s", key_len, message->topic, VCACHE_VALUE_SUFFIX);
+  }
+  if (reply_topic) {
+    mosquitto_publish_v5(mosq, NULL, reply_topic, entry->value_len, entry->value, message->qos, false, reply_props);
+  }
+  free(reply_topic);
+  free(correlation);
+  mosquitto_property_free_all(&reply_props);
+  return true;
+}
+
+/* Payloads that look like JSON are checked for UTF-8 and JSON structure, and `*json` is set to their structural index
+ * for field lookups further down. It stays NULL when no complete index of this payload was built. Other payloads are
+ * only checked when the publisher declared them UTF-8 through the payload format indicator. Returns false when the
+ * message has to be dropped. */
+static bool validate_payload(mosq_config_t *cfg, const struct mosquitto_message *message,
+                             const mosquitto_property *properties, const json_index_t **json) {
+  mosq_sub_config_t *sub_config = cfg->sub_config;
+  const char *payload = message->payload;
+  json_retcode_t ret;
+  uint8_t format = 0;
+  int i = 0;
+
+  *json = NULL;
+  if (!sub_config->validate || !message->payloadlen) {
+    return true;
+  }
+  while (i < message->payloadlen && isspace((unsigned char)payload[i])) i++;
+  if (i < message->payloadlen && (payload[i] == '{' || payload[i] == '[')) {
+    if (!sub_config->json) {
+      sub_config->json = calloc(1, sizeof(json_index_t));
+      if (!sub_config->json) return true;
+    }
+    ret = json_index_build(sub_config->json, payload, message->payloadlen);
+    if (ret == JSON_OK) *json = sub_config->json;
+    if (ret == JSON_OK || ret == JSON_NOMEM) {
+      return true;
+    }
+    fprintf(stderr, "Warning: Dropped a message on %s: %s.\n", message->topic, json_strerror(ret));
+  } else {
+    mosquitto_property_read_byte(properties, MQTT_PROP_PAYLOAD_FORMAT_INDICATOR, &format, false);
+    if (format != 1 || utf8_valid(message->payload, message->payloadlen)) {
+      return true;
+    }
+    fprintf(stderr, "Warning: Dropped a message on %s: malformed UTF-8.\n", message->topic);
+  }
+  sub_config->invalid++;
+  return false;
+}
+
+static void update_cache(mosq_config_t *cfg, const struct mosquitto_message *message) {
+  mosq_sub_config_t *sub_config = cfg->sub_config;
+  int topic_len = strlen(message->topic), suffix_len = strlen(VCACHE_GET_SUFFIX);
+
+  if (sub_config->vcache_ttl <= 0 || !message->payloadlen ||
+      (topic_len > suffix_len && !strcmp(message->topic + topic_len - suffix_len, VCACHE_GET_SUFFIX))) {
+    return;
+  }
+  if (!sub_config->vcache) {
+    sub_config->vcache = vcache_new(VCACHE_DEFAULT_ENTRIES, VCACHE_DEFAULT_BUDGET, sub_config->vcache_ttl);
+    if (!sub_config->vcache) {
+      sub_config->vcache_ttl = 0;
+      return;
+    }
+  }
+  vcache_put(sub_config->vcache, message->topic, message->payload, message->payloadlen, time(NULL));
+}
+
+static void capture_message(mosq_config_t *cfg, const struct mosquitto_message *message) {
+  mosq_sub_config_t *sub_config = cfg->sub_config;
+
+  if (!sub_config->capture) {
+    sub_config->capture = capture_open(sub_config->capture_path);
+    if (!sub_config->capture) {
+      free(sub_config->capture_path);
+      sub_config->capture_path = NULL;
+      return;
+    }
+  }
+  if (capture_append(sub_config->capture, message->topic, message->payload, message->payloadlen, message->qos,
+                     message->retain, capture_now_us())) {
+    fprintf(stderr, "Warning: Failed to capture a message on %s.\n", message->topic);
+  }
+}
+
+/* Readings go into the store after validation, so a JSON payload's index is only built once. `json` is the index
+ * validation built for this message, NULL has the store build its own. */
+static void store_readings(mosq_config_t *cfg, const struct mosquitto_message *message, const json_index_t *json) {
+  mosq_sub_config_t *sub_config = cfg->sub_config;
+
+  if (!sub_config->store) {
+    sub_config->store = ts_store_open(sub_config->store_path);
+    if (!sub_config->store) {
+      cfg_free(cfg, sub_config->store_path);
+      sub_config->store_path = NULL;
+      return;
+    }
+  }
+  if (ts_store_ingest(sub_config->store, message->topic, message->payload, message->payloadlen, json,
+                      ts_store_now_ms()) < 0) {
+    fprintf(stderr, "Warning: Failed to store the readings on %s.\n", message->topic);
+  }
+}
+
+/* Numbered QoS 0 messages are acknowledged cumulatively instead of one PUBACK each, see cum_ack.h. Returns false for
+ * a message that must not be processed: one seen before, one too far ahead, or one of our own acks. */
+static bool track_sequence(mosq_config_t *cfg, const struct mosquitto_message *message,
+                           const mosquitto_property *properties) {
+  mosq_sub_config_t *sub_config = cfg->sub_config;
+  int topic_len = strlen(message->topic), suffix_len = strlen(CUMACK_SUFFIX);
+  char *name = NULL, *value = NULL;
+  const mosquitto_property *prop;
+  uint32_t seq = 0, base = 0;
+  cum_ack_retcode_t ret;
+
+  if (!sub_config->cum_acks || message->qos != 0) {
+    return true;
+  }
+  if (topic_len > suffix_len && !strcmp(message->topic + topic_len - suffix_len, CUMACK_SUFFIX)) {
+    return false;
+  }
+  for (prop = mosquitto_property_read_string_pair(properties, MQTT_PROP_USER_PROPERTY, &name, &value, false); prop;
+       prop = mosquitto_property_read_string_pair(prop, MQTT_PROP_USER_PROPERTY, &name, &value, true)) {
+    if (!seq && !strcmp(name, CUMACK_SEQ_PROPERTY) && cum_seq_parse(value, &seq, &base)) {
+      seq = 0;
+    }
+    free(name);
+    free(value);
+  }
+  if (!seq) {
+    return true;
+  }
+  if (!sub_config->acks) {
+    sub_config->acks = cum_ack_tracker_new(CUMACK_DEFAULT_DEVICES, CUMACK_DEFAULT_EVERY, CUMACK_DEFAULT_DELAY_MS);
+    if (!sub_config->acks) {
+      fprintf(stderr, "Error: Out of memory.\n");
+      sub_config->cum_acks = false;
+      return true;
+    }
+  }
+  ret = cum_ack_receive(sub_config->acks, message->topic, seq, base, now_ms());
+  return ret == CUMACK_NEW || ret == CUMACK_UNTRACKED;
+}
+
+static void publish_ack(void *userdata, const char *topic, const char *ack, int ack_len) {
+  struct mosquitto *mosq = (struct mosquitto *)userdata;
+  char *ack_topic = malloc(strlen(topic) + sizeof(CUMACK_SUFFIX));
+
+  if (!ack_topic) return;
+  sprintf(ack_topic, "%s%s", topic, CUMACK_SUFFIX);
+  mosquitto_publish(mosq, NULL, ack_topic, ack_len, ack, 0, false);
+  free(ack_topic);
+}
+
+/* With ADMIT_RETRY_LATER the device is told to retry on the message's response topic, or on `<topic>/retry`. */
+static void on_shed(void *userdata, const admit_item_t *item, bool retry) {
+  struct mosquitto *mosq = (struct mosquitto *)userdata;
+  mosquitto_property *reply_props = NULL;
+  char *reply_topic = NULL;
+  void *correlation = NULL;
+  uint16_t correlation_len = 0;
+
+  if (!retry) return;
+  mosquitto_property_read_string(item->props, MQTT_PROP_RESPONSE_TOPIC, &reply_topic, false);
+  if (mosquitto_property_read_binary(item->props, MQTT_PROP_CORRELATION_DATA, &correlation, &correlation_len, false)) {
+    mosquitto_property_add_binary(&reply_props, MQTT_PROP_CORRELATION_DATA, correlation, correlation_len);
+  }
+  if (!reply_topic) {
+    reply_topic = malloc(strlen(item->msg.topic) + sizeof(ADMIT_RETRY_SUFFIX));
+    if (reply_topic) sprintf(reply_topic, "%s%s", item->msg.topic, ADMIT_RETRY_SUFFIX);
+  }
+  if (reply_topic) {
+    mosquitto_publish_v5(mosq, NULL, reply_topic, strlen(ADMIT_RETRY_PAYLOAD), ADMIT_RETRY_PAYLOAD, 0, false,
+                         reply_props);
+  }
+  free(reply_topic);
+  free(correlation);
+  mosquitto_property_free_all(&reply_props);
+}
+
+/* Everything after the capture, run from the callback or, with admission control, from sub_poll. Returns false when
+ * the message was dropped or already answered, true when it was taken. Chunks of a fragmented payload are taken as
+ * they are, whoever the message goes on to reassembles them. */
+static bool process_message(struct mosquitto *mosq, mosq_config_t *cfg, const struct mosquitto_message *message,
+                            const mosquitto_property *properties) {
+  const json_index_t *json;
   bool res;
-  mosq_config_t *cfg = (mosq_config_t *)obj;
 
   if (cfg->sub_config->remove_retained && message->retain) {
     mosquitto_publish(mosq, &cfg->general_config->last_mid, message->topic, 0, NULL, 1, true);
@@ -54,36 +361,107 @@ void message_callback_sub_func(struct mosquitto *mosq, void *obj, const struct m
     if (cfg->general_config->last_mid == 0) {
       mosquitto_disconnect_v5(mosq, 0, cfg->property_config->disconnect_props);
     }
-    return;
+    return false;
   }
 
-  if (message->retain && cfg->sub_config->no_retain) return;
+  if (message->retain && cfg->sub_config->no_retain) return false;
+  if (is_duplicate(cfg, message, properties)) return false;
   if (cfg->sub_config->filter_outs) {
     for (int i = 0; i < cfg->sub_config->filter_out_count; i++) {
       mosquitto_topic_matches_sub(cfg->sub_config->filter_outs[i], message->topic, &res);
-      if (res) return;
+      if (res) return false;
     }
   }
+  if (!track_sequence(cfg, message, properties)) return false;
+
+  if (serve_from_cache(mosq, cfg, message, properties)) return false;
+  if (handle_fragment(mosq, cfg, message)) return true;
+  if (!validate_payload(cfg, message, properties, &json)) return false;
 
+  update_cache(cfg, message);
+  if (cfg->sub_config->store_path) store_readings(cfg, message, json);
   print_message(cfg, message);
 
   // Uncomment the following code would cause: once we received a message, then disconnect the connection.
   // mosquitto_disconnect_v5(mosq, 0, cfg->property_config->disconnect_props);
 
   printf("message_callback_sub_func \n");
+  return true;
+}
+
+/* Processes queued messages for up to SUB_POLL_SLICE_MS, so the socket keeps being read under overload, then sends
+ * the acks and NACKs that are due. Called from the client's own loop after every mosquitto_loop(). */
+void sub_poll(struct mosquitto *mosq, mosq_config_t *cfg) {
+  mosq_sub_config_t *sub_config = cfg->sub_config;
+  double start = now_ms(), now = start;
+  admit_item_t *item;
+
+  if (sub_config->admit) {
+    while (now - start < SUB_POLL_SLICE_MS && (item = admit_pop(sub_config->admit, now, on_shed, mosq))) {
+      process_message(mosq, cfg, &item->msg, item->props);
+      now = now_ms();
+      admit_done(sub_config->admit, item, now);
+    }
+    if (sub_config->admit->last_report && now - sub_config->admit->last_report >= ADMIT_REPORT_INTERVAL_MS) {
+      admit_report(sub_config->admit, now, stdout);
+    }
+  }
+  if (sub_config->acks) cum_ack_flush(sub_config->acks, now, publish_ack, mosq);
+  // The usual failure is a transfer whose last chunks are lost, no further chunk arrives to run this from the callback
+  if (sub_config->reasm) frag_reasm_gc(sub_config->reasm, time(NULL), publish_nack, mosq);
+}
+
+void signal_handler_func(int signum) {
+  if (signum == SIGALRM) {
+    // TODO: Find some way else to break a loop or disconnect the client, in which way we don't
+    // need to use variable `mosq`, `cfg`
+    // mosquitto_disconnect_v5(mosq, MQTT_RC_DISCONNECT_WITH_WILL_MSG, cfg.property_config->disconnect_props);
+  }
+}
+
+void publish_callback_sub_func(struct mosquitto *mosq, void *obj, int mid, int reason_code,
+                               const mosquitto_property *properties) {
+  mosq_config_t *cfg = (mosq_config_t *)obj;
+  UNUSED(reason_code);
+  UNUSED(properties);
+
+  if ((mid == cfg->general_config->last_mid || cfg->general_config->last_mid == 0)) {
+    mosquitto_disconnect_v5(mosq, 0, cfg->property_config->disconnect_props);
+  }
+
+  printf("publish_callback_sub_func \n");
+}
+
+/* The message callback for clients that go on with a message the subscriber kept, such as the duplex relay. Returns
+ * false when the message was dropped or answered here. With admission control the message is only queued, that
+ * counts as taken. */
+bool sub_receive(struct mosquitto *mosq, mosq_config_t *cfg, const struct mosquitto_message *message,
+                 const mosquitto_property *properties) {
+  // Captured before any filtering, a replay has to reproduce what the broker delivered
+  if (cfg->sub_config->capture_path) capture_message(cfg, message);
+
+  if (cfg->sub_config->admit) {
+    admit_push(cfg->sub_config->admit, message, properties, now_ms(), on_shed, mosq);
+    return true;
+  }
+  return process_message(mosq, cfg, message, properties);
+}
+
+void message_callback_sub_func(struct mosquitto *mosq, void *obj, const struct mosquitto_message *message,
+                               const mosquitto_property *properties) {
+  sub_receive(mosq, (mosq_config_t *)obj, message, properties);
 }
 
 void connect_callback_sub_func(struct mosquitto *mosq, void *obj, int result, int flags,
                                const mosquitto_property *properties) {
   mosq_config_t *cfg = (mosq_config_t *)obj;
 
-  UNUSED(flags);
   UNUSED(properties);
 
   if (!result) {
-    mosquitto_subscribe_multiple(mosq, NULL, cfg->sub_config->topic_count, cfg->sub_config->topics,
-                                 cfg->general_config->qos, cfg->sub_config->sub_opts,
-                                 cfg->property_config->subscribe_props);
+    // With a persistent session the broker kept the subscriptions, only changes since the disconnect are sent
+    topic_set_on_connect(cfg->sub_config->topics, flags & 1);
+    topic_set_flush(cfg->sub_config->topics, mosq, cfg);
 
     for (int i = 0; i < cfg->sub_config->unsub_topic_count; i++) {
       mosquitto_unsubscribe_v5(mosq, NULL, cfg->sub_config->unsub_topics[i], cfg->property_config->unsubscribe_props);
@@ -104,18 +482,32 @@ void connect_callback_sub_func(struct mosquitto *mosq, void *obj, int result, in
 
 void subscribe_callback_sub_func(struct mosquitto *mosq, void *obj, int mid, int qos_count, const int *granted_qos) {
   mosq_config_t *cfg = (mosq_config_t *)obj;
+  topic_set_t *topics = cfg->sub_config->topics;
 
-  printf("Subscribed (mid: %d): %d", mid, granted_qos[0]);
-  for (int i = 1; i < qos_count; i++) {
-    printf(", %d", granted_qos[i]);
+  // The SUBACK frees a slot for the next chunk of a large subscription set
+  if (topic_set_on_ack(topics, mid, qos_count, granted_qos)) {
+    topic_set_flush(topics, mosq, cfg);
+  }
+  if (cfg->general_config->debug) {
+    printf("Subscribed (mid: %d): %d", mid, granted_qos[0]);
+    for (int i = 1; i < qos_count; i++) {
+      printf(", %d", granted_qos[i]);
+    }
+    printf("\n");
+    printf("subscribe_callback_sub_func \n");
   }
-  printf("\n");
 
-  if (cfg->sub_config->exit_after_sub) {
+  if (cfg->sub_config->exit_after_sub && topic_set_idle(topics)) {
     mosquitto_disconnect_v5(mosq, 0, cfg->property_config->disconnect_props);
   }
+}
+
+void unsubscribe_callback_sub_func(struct mosquitto *mosq, void *obj, int mid) {
+  mosq_config_t *cfg = (mosq_config_t *)obj;
 
-  printf("subscribe_callback_sub_func \n");
+  if (topic_set_on_ack(cfg->sub_config->topics, mid, 0, NULL)) {
+    topic_set_flush(cfg->sub_config->topics, mosq, cfg);
+  }
 }
 
 void log_callback_sub_func(struct mosquitto *mosq, void *obj, int level, const char *str) {
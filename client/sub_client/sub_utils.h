@@ -12,6 +12,10 @@ void message_callback_sub_func(struct mosquitto *mosq, void *obj, const struct m
 void connect_callback_sub_func(struct mosquitto *mosq, void *obj, int result, int flags,
                                const mosquitto_property *properties);
 void subscribe_callback_sub_func(struct mosquitto *mosq, void *obj, int mid, int qos_count, const int *granted_qos);
+void unsubscribe_callback_sub_func(struct mosquitto *mosq, void *obj, int mid);
 void log_callback_sub_func(struct mosquitto *mosq, void *obj, int level, const char *str);
+bool sub_receive(struct mosquitto *mosq, mosq_config_t *cfg, const struct mosquitto_message *message,
+                 const mosquitto_property *properties);
+void sub_poll(struct mosquitto *mosq, mosq_config_t *cfg);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,97 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ts_store.h"
+
+#define BENCH_PAYLOADS 1000000
+#define BENCH_DEVICES 64
+#define BENCH_INTERVAL_MS 1000  // between two payloads of a device
+#define BENCH_WINDOW_MS (5 * 60 * 1000)
+#define BENCH_SCANS 1000
+
+typedef struct scan_sum_s {
+  long rows;
+  double sum;
+} scan_sum_t;
+
+static double now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static bool sum_callback(void *arg, int64_t ts, int metric, double value) {
+  scan_sum_t *sum = (scan_sum_t *)arg;
+
+  sum->rows++;
+  sum->sum += value;
+  return true;
+}
+
+/* Usage: ts_bench <store directory> [payloads]
+ * Ingests scripted payloads from BENCH_DEVICES devices into a store, half of them JSON with a nested object and half
+ * key=value text, three readings each, one payload per device every BENCH_INTERVAL_MS of simulated time. Then scans the
+ * last BENCH_WINDOW_MS of one metric of random devices. Reports readings per second, timestamp column bytes per row and
+ * scan latency. Run it on an empty directory, the timestamps start from the current time. */
+int main(int argc, char *argv[]) {
+  unsigned long payloads = argc > 2 ? strtoul(argv[2], NULL, 10) : BENCH_PAYLOADS;
+  char topics[BENCH_DEVICES][64], payload[256];
+  unsigned long ts_bytes = 0, rows = 0;
+  int64_t base = ts_store_now_ms(), ts = base;
+  scan_sum_t sum = {0};
+  ts_store_t *store;
+  double start, ms;
+  int len, metric;
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: ts_bench <store directory> [payloads]\n");
+    return EXIT_FAILURE;
+  }
+  store = ts_store_open(argv[1]);
+  if (!store) return EXIT_FAILURE;
+  for (int i = 0; i < BENCH_DEVICES; i++) snprintf(topics[i], sizeof(topics[i]), "ta/dev%03d/up", i);
+
+  start = now_ms();
+  for (unsigned long n = 0; n < payloads; n++) {
+    int dev = n % BENCH_DEVICES;
+    unsigned long seq = n / BENCH_DEVICES;
+
+    // Devices report on a steady interval with a few ms of jitter
+    ts = base + seq * BENCH_INTERVAL_MS + (seq * 7 + dev) % 5;
+    if (dev % 2) {
+      len = snprintf(payload, sizeof(payload), "{\"dev\":\"dev%03d\",\"seq\":%lu,\"data\":{\"temp\":%d.%d,\"hum\":%d}}",
+                     dev, seq, 15 + (int)(seq % 20), dev % 10, 40 + (int)(seq % 50));
+    } else {
+      len = snprintf(payload, sizeof(payload), "dev%03d seq=%lu temp=%d.%d hum=%d", dev, seq, 15 + (int)(seq % 20),
+                     dev % 10, 40 + (int)(seq % 50));
+    }
+    if (ts_store_ingest(store, topics[dev], payload, len, NULL, ts) < 0) {
+      ts_store_close(store);
+      return EXIT_FAILURE;
+    }
+  }
+  ms = now_ms() - start;
+  for (int i = 0; i < store->device_capacity; i++) {
+    if (!store->devices[i] || !store->devices[i]->tail.header) continue;
+    ts_bytes += store->devices[i]->tail.header->ts_bytes;
+    rows += store->devices[i]->tail.header->rows;
+  }
+  printf("ingest: %lu readings in %.0f ms, %.0f readings/s, %.2f timestamp bytes/row\n", store->readings, ms,
+         store->readings * 1e3 / ms, rows ? (double)ts_bytes / rows : 0);
+
+  metric = ts_store_metric(store, "data.temp", strlen("data.temp"), false);
+  srand(1);
+  start = now_ms();
+  for (int i = 0; i < BENCH_SCANS; i++) {
+    // Only the JSON devices, the odd ones, report data.temp
+    ts_store_scan(store, topics[rand() % (BENCH_DEVICES / 2) * 2 + 1], metric, ts - BENCH_WINDOW_MS, ts, sum_callback,
+                  &sum);
+  }
+  ms = now_ms() - start;
+  printf("scan: last %d s of data.temp, %.1f rows and %.1f us per scan\n", BENCH_WINDOW_MS / 1000,
+         (double)sum.rows / BENCH_SCANS, ms * 1e3 / BENCH_SCANS);
+  ts_store_stats(store, stdout);
+  ts_store_close(store);
+  return 0;
+}
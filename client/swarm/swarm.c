@@ -0,0 +1,641 @@
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include "client_common.h"
+
+/* Every virtual device is a separate libmosquitto client with its own socket and client id. None of them runs its own
+ * network thread, the sockets are multiplexed on one epoll loop and publishes are driven from a min-heap of due times,
+ * so a single core can keep thousands of mostly idle NB-IoT devices alive. One extra sink client subscribes to the
+ * swarm topics and measures end-to-end latency from the timestamp that leads every payload. */
+#define SWARM_MAX_DEVICES 50000
+#define SWARM_TOPIC TOPIC "/swarm"
+#define SWARM_REPORT_INTERVAL 5
+#define SWARM_RECONNECT_DELAY_MS 1000
+#define SWARM_MAX_PAYLOAD 1024
+#define SWARM_MAX_EVENTS 256
+#define SWARM_HIST_BUCKETS 32
+
+typedef enum payload_kind_e { PAYLOAD_FIXED, PAYLOAD_RANDOM, PAYLOAD_JSON } payload_kind_t;
+
+static const char *payload_names[] = {"fixed", "random", "json"};
+
+typedef struct swarm_profile_s {
+  const char *name;
+  int period_ms;
+  int jitter_ms;
+  payload_kind_t payload;
+  int payload_len;
+  int qos;
+  int churn_sec;  // mean time between forced reconnects, 0 keeps connections up
+} swarm_profile_t;
+
+static const swarm_profile_t profiles[] = {
+    {.name = "nbiot", .period_ms = 60000, .jitter_ms = 10000, .payload = PAYLOAD_JSON, .payload_len = 64, .qos = 1,
+     .churn_sec = 3600},
+    {.name = "burst", .period_ms = 1000, .jitter_ms = 100, .payload = PAYLOAD_RANDOM, .payload_len = 16, .qos = 0,
+     .churn_sec = 0},
+    {.name = "churn", .period_ms = 10000, .jitter_ms = 2000, .payload = PAYLOAD_FIXED, .payload_len = 32, .qos = 1,
+     .churn_sec = 60},
+};
+
+typedef struct swarm_hist_s {
+  unsigned long buckets[SWARM_HIST_BUCKETS];  // log2 microseconds
+  unsigned long count;
+  long max_us;
+} swarm_hist_t;
+
+typedef struct swarm_device_s {
+  struct mosquitto *mosq;
+  struct swarm_s *swarm;
+  int index;
+  int fd;
+  uint32_t events;  // what fd is registered for
+  bool connected;
+  bool sink;
+  uint32_t rng;
+  unsigned long seq;
+  long next_publish;  // all times in ms on CLOCK_MONOTONIC
+  long next_churn;
+  long next_reconnect;
+  long connect_started;
+  char topic[64];
+} swarm_device_t;
+
+typedef struct swarm_counters_s {
+  unsigned long published;
+  unsigned long acked;
+  unsigned long received;
+  unsigned long bytes;
+  unsigned long connects;
+  unsigned long reconnects;
+  unsigned long errors;
+} swarm_counters_t;
+
+typedef struct swarm_s {
+  const swarm_profile_t *profile;
+  mosq_config_t *cfg;
+  const char *host;  // the broker, or the MQTT_PROXY override
+  int port;
+  char proxy[256];
+  swarm_device_t *devices;  // device_count devices followed by the sink
+  int device_count;
+  int *heap;  // device indexes ordered by their next due time
+  int heap_len;
+  int epfd;
+  swarm_counters_t total;
+  swarm_counters_t last;
+  swarm_hist_t latency;
+  swarm_hist_t connect;
+} swarm_t;
+
+static volatile sig_atomic_t run = 1;
+
+static void stop_func(int signum) { run = 0; }
+
+static long now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static long now_us(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t next_rand(swarm_device_t *dev) {
+  dev->rng ^= dev->rng << 13;
+  dev->rng ^= dev->rng >> 17;
+  dev->rng ^= dev->rng << 5;
+  return dev->rng;
+}
+
+static long jittered(swarm_device_t *dev, long base_ms, long jitter_ms) {
+  if (jitter_ms <= 0) {
+    return base_ms;
+  }
+  return base_ms - jitter_ms + (long)(next_rand(dev) % (uint32_t)(2 * jitter_ms + 1));
+}
+
+static void hist_add(swarm_hist_t *hist, long us) {
+  int bucket = 0;
+
+  while (bucket < SWARM_HIST_BUCKETS - 1 && (1L << (bucket + 1)) <= us) bucket++;
+  hist->buckets[bucket]++;
+  hist->count++;
+  if (us > hist->max_us) hist->max_us = us;
+}
+
+static long hist_percentile(const swarm_hist_t *hist, double pct) {
+  unsigned long seen = 0, target = (unsigned long)(hist->count * pct);
+
+  for (int i = 0; i < SWARM_HIST_BUCKETS; i++) {
+    seen += hist->buckets[i];
+    if (seen > target) return 1L << (i + 1);
+  }
+  return hist->max_us;
+}
+
+static long device_due(const swarm_device_t *dev) {
+  long due = dev->next_reconnect ? dev->next_reconnect : dev->next_publish;
+
+  if (!dev->next_reconnect && dev->next_churn && dev->next_churn < due) due = dev->next_churn;
+  return due;
+}
+
+static void heap_swap(swarm_t *swarm, int a, int b) {
+  int tmp = swarm->heap[a];
+
+  swarm->heap[a] = swarm->heap[b];
+  swarm->heap[b] = tmp;
+}
+
+static void heap_down(swarm_t *swarm, int pos) {
+  int child;
+
+  while ((child = 2 * pos + 1) < swarm->heap_len) {
+    if (child + 1 < swarm->heap_len &&
+        device_due(&swarm->devices[swarm->heap[child + 1]]) < device_due(&swarm->devices[swarm->heap[child]])) {
+      child++;
+    }
+    if (device_due(&swarm->devices[swarm->heap[pos]]) <= device_due(&swarm->devices[swarm->heap[child]])) break;
+    heap_swap(swarm, pos, child);
+    pos = child;
+  }
+}
+
+static void heap_push(swarm_t *swarm, int index) {
+  int pos = swarm->heap_len++, parent;
+
+  swarm->heap[pos] = index;
+  while (pos > 0) {
+    parent = (pos - 1) / 2;
+    if (device_due(&swarm->devices[swarm->heap[parent]]) <= device_due(&swarm->devices[swarm->heap[pos]])) break;
+    heap_swap(swarm, pos, parent);
+    pos = parent;
+  }
+}
+
+/* libmosquitto replaces the socket on every reconnect, so the registration follows mosquitto_socket(). The set is
+ * level-triggered, EPOLLOUT is only registered while libmosquitto has something to write or every wait returns at
+ * once for a writable socket. */
+static void sync_fd(swarm_device_t *dev) {
+  int fd = mosquitto_socket(dev->mosq);
+  struct epoll_event ev = {.events = EPOLLIN, .data.u32 = dev->index};
+
+  if (fd >= 0 && mosquitto_want_write(dev->mosq)) ev.events |= EPOLLOUT;
+  if (fd != dev->fd) {
+    if (dev->fd >= 0) epoll_ctl(dev->swarm->epfd, EPOLL_CTL_DEL, dev->fd, NULL);
+    if (fd >= 0 && epoll_ctl(dev->swarm->epfd, EPOLL_CTL_ADD, fd, &ev)) fd = -1;
+    dev->fd = fd;
+  } else if (fd >= 0 && ev.events != dev->events) {
+    epoll_ctl(dev->swarm->epfd, EPOLL_CTL_MOD, fd, &ev);
+  }
+  dev->events = ev.events;
+}
+
+static void connect_device(swarm_device_t *dev, bool reconnect) {
+  mosq_general_config_t *general = dev->swarm->cfg->general_config;
+  int ret;
+
+  if (dev->fd >= 0) {
+    epoll_ctl(dev->swarm->epfd, EPOLL_CTL_DEL, dev->fd, NULL);
+    dev->fd = -1;
+  }
+  dev->connected = false;
+  dev->connect_started = now_us();
+  if (reconnect) {
+    dev->swarm->total.reconnects++;
+    ret = mosquitto_reconnect(dev->mosq);
+  } else {
+    ret = mosquitto_connect_bind_v5(dev->mosq, dev->swarm->host, dev->swarm->port, general->keepalive,
+                                    general->bind_address, NULL);
+  }
+  if (ret != MOSQ_ERR_SUCCESS) {
+    dev->swarm->total.errors++;
+    dev->next_reconnect = now_ms() + SWARM_RECONNECT_DELAY_MS;
+    return;
+  }
+  dev->next_reconnect = 0;
+  sync_fd(dev);
+}
+
+static int build_payload(swarm_device_t *dev, char *buf) {
+  const swarm_profile_t *profile = dev->swarm->profile;
+  int len = snprintf(buf, SWARM_MAX_PAYLOAD, "%ld ", now_us());
+
+  switch (profile->payload) {
+    case PAYLOAD_JSON:
+      len += snprintf(buf + len, SWARM_MAX_PAYLOAD - len, "{\"dev\":%d,\"seq\":%lu,\"temp\":%.2f,\"rssi\":%d}",
+                      dev->index, dev->seq, 15.0 + next_rand(dev) % 2000 / 100.0, -(int)(next_rand(dev) % 60) - 60);
+      break;
+    case PAYLOAD_RANDOM:
+      while (len < profile->payload_len) buf[len++] = 'a' + next_rand(dev) % 26;
+      break;
+    case PAYLOAD_FIXED:
+      break;
+  }
+  while (len < profile->payload_len && len < SWARM_MAX_PAYLOAD) buf[len++] = ' ';
+  return len;
+}
+
+static void publish_device(swarm_device_t *dev) {
+  const swarm_profile_t *profile = dev->swarm->profile;
+  char payload[SWARM_MAX_PAYLOAD];
+  int len = build_payload(dev, payload);
+
+  if (mosquitto_publish(dev->mosq, NULL, dev->topic, len, payload, profile->qos, false) == MOSQ_ERR_SUCCESS) {
+    dev->seq++;
+    dev->swarm->total.published++;
+    dev->swarm->total.bytes += len;
+  } else {
+    dev->swarm->total.errors++;
+  }
+  sync_fd(dev);
+}
+
+/* Handles whatever the device at the top of the heap is due for and puts it back with its next due time. */
+static void run_timers(swarm_t *swarm, long now) {
+  const swarm_profile_t *profile = swarm->profile;
+  swarm_device_t *dev;
+
+  while (swarm->heap_len > 0 && device_due(&swarm->devices[swarm->heap[0]]) <= now) {
+    dev = &swarm->devices[swarm->heap[0]];
+    if (dev->next_reconnect) {
+      connect_device(dev, true);
+    } else if (dev->next_churn && dev->next_churn <= now) {
+      dev->next_churn = now + jittered(dev, profile->churn_sec * 1000L, profile->churn_sec * 500L);
+      connect_device(dev, true);
+    } else {
+      if (dev->connected) publish_device(dev);
+      dev->next_publish = now + jittered(dev, profile->period_ms, profile->jitter_ms);
+    }
+    heap_down(swarm, 0);
+  }
+}
+
+static void connect_callback_swarm_func(struct mosquitto *mosq, void *obj, int result, int flags,
+                                        const mosquitto_property *properties) {
+  swarm_device_t *dev = (swarm_device_t *)obj;
+
+  if (result) {
+    dev->swarm->total.errors++;
+    return;
+  }
+  dev->connected = true;
+  dev->swarm->total.connects++;
+  hist_add(&dev->swarm->connect, now_us() - dev->connect_started);
+  if (dev->sink) {
+    mosquitto_subscribe(mosq, NULL, SWARM_TOPIC "/#", dev->swarm->profile->qos);
+  }
+}
+
+static void disconnect_callback_swarm_func(struct mosquitto *mosq, void *obj, int rc,
+                                           const mosquitto_property *properties) {
+  swarm_device_t *dev = (swarm_device_t *)obj;
+
+  dev->connected = false;
+}
+
+static void publish_callback_swarm_func(struct mosquitto *mosq, void *obj, int mid, int reason_code,
+                                        const mosquitto_property *properties) {
+  swarm_device_t *dev = (swarm_device_t *)obj;
+
+  if (dev->swarm->profile->qos > 0) dev->swarm->total.acked++;
+}
+
+static void message_callback_swarm_func(struct mosquitto *mosq, void *obj, const struct mosquitto_message *message,
+                                        const mosquitto_property *properties) {
+  swarm_device_t *dev = (swarm_device_t *)obj;
+  long sent = strtol(message->payload, NULL, 10);
+
+  dev->swarm->total.received++;
+  if (sent > 0) hist_add(&dev->swarm->latency, now_us() - sent);
+}
+
+static void handle_event(swarm_t *swarm, const struct epoll_event *ev) {
+  swarm_device_t *dev = &swarm->devices[ev->data.u32];
+  int ret = MOSQ_ERR_SUCCESS;
+
+  if (ev->events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+    ret = mosquitto_loop_read(dev->mosq, 1);
+  }
+  if (ret == MOSQ_ERR_SUCCESS && ev->events & EPOLLOUT) {
+    ret = mosquitto_loop_write(dev->mosq, 1);
+  }
+  if (ret != MOSQ_ERR_SUCCESS) {
+    dev->connected = false;
+    swarm->total.errors++;
+    if (dev->fd >= 0) epoll_ctl(swarm->epfd, EPOLL_CTL_DEL, dev->fd, NULL);
+    dev->fd = -1;
+    if (!dev->next_reconnect) {
+      // The device is already somewhere in the heap, an earlier due time has to bubble it up
+      dev->next_reconnect = now_ms() + SWARM_RECONNECT_DELAY_MS;
+      for (int i = 0; i < swarm->heap_len; i++) {
+        if (swarm->heap[i] == dev->index) {
+          for (int pos = i; pos > 0 && device_due(&swarm->devices[swarm->heap[(pos - 1) / 2]]) > device_due(dev);
+               pos = (pos - 1) / 2) {
+            heap_swap(swarm, pos, (pos - 1) / 2);
+          }
+          break;
+        }
+      }
+    }
+    return;
+  }
+  sync_fd(dev);
+}
+
+static void report(swarm_t *swarm, double interval) {
+  swarm_counters_t *t = &swarm->total, *l = &swarm->last;
+  int connected = 0;
+
+  for (int i = 0; i < swarm->device_count; i++) {
+    if (swarm->devices[i].connected) connected++;
+  }
+  printf("devices %d/%d connected | pub %.1f msg/s %.1f kB/s | ack %.1f/s | recv %.1f msg/s | reconnects %lu errors %lu\n",
+         connected, swarm->device_count, (t->published - l->published) / interval,
+         (t->bytes - l->bytes) / interval / 1024, (t->acked - l->acked) / interval,
+         (t->received - l->received) / interval, t->reconnects, t->errors);
+  printf("latency us p50 %ld p99 %ld max %ld | connect us p50 %ld p99 %ld max %ld\n",
+         hist_percentile(&swarm->latency, 0.5), hist_percentile(&swarm->latency, 0.99), swarm->latency.max_us,
+         hist_percentile(&swarm->connect, 0.5), hist_percentile(&swarm->connect, 0.99), swarm->connect.max_us);
+  fflush(stdout);
+  *l = *t;
+}
+
+static void raise_fd_limit(int needed) {
+  struct rlimit limit;
+
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t)needed) {
+    limit.rlim_cur = limit.rlim_max < (rlim_t)needed ? limit.rlim_max : (rlim_t)needed;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < (rlim_t)needed) {
+      fprintf(stderr, "Warning: Open file limit is %lu, not every device will connect.\n",
+              (unsigned long)limit.rlim_cur);
+    }
+  }
+}
+
+static const swarm_profile_t *find_profile(const char *name) {
+  for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++) {
+    if (!strcmp(profiles[i].name, name)) return &profiles[i];
+  }
+  return NULL;
+}
+
+/* One override, `key` without the leading dashes of the command line. Returns -1 for an unknown key or a value out of
+ * range. */
+static int set_profile_field(swarm_profile_t *profile, const char *key, const char *value) {
+  char *end;
+  long n;
+
+  if (!strcmp(key, "payload")) {
+    for (size_t i = 0; i < sizeof(payload_names) / sizeof(payload_names[0]); i++) {
+      if (!strcmp(value, payload_names[i])) {
+        profile->payload = (payload_kind_t)i;
+        return 0;
+      }
+    }
+    return -1;
+  }
+  errno = 0;
+  n = strtol(value, &end, 10);
+  if (errno || end == value || *end || n < 0 || n > INT_MAX) {
+    return -1;
+  }
+  if (!strcmp(key, "period") && n > 0) {
+    profile->period_ms = n;
+  } else if (!strcmp(key, "jitter")) {
+    profile->jitter_ms = n;
+  } else if (!strcmp(key, "len") && n <= SWARM_MAX_PAYLOAD) {
+    profile->payload_len = n;
+  } else if (!strcmp(key, "qos") && n <= 2) {
+    profile->qos = n;
+  } else if (!strcmp(key, "churn")) {
+    profile->churn_sec = n;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+static char *trim(char *s) {
+  char *end;
+
+  while (*s == ' ' || *s == '\t') s++;
+  end = s + strcspn(s, "\r\n");
+  while (end > s && (end[-1] == ' ' || end[-1] == '\t')) end--;
+  *end = '\0';
+  return s;
+}
+
+/* `key=value` lines with the keys of the command line options, blank lines and lines starting with # are skipped. */
+static int load_profile_file(swarm_profile_t *profile, const char *path) {
+  char line[256], *key, *value;
+  FILE *f = fopen(path, "r");
+  int line_no = 0;
+
+  if (!f) {
+    fprintf(stderr, "Error: Unable to open profile file %s.\n", path);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), f)) {
+    line_no++;
+    key = trim(line);
+    if (!*key || *key == '#') continue;
+    value = strchr(key, '=');
+    if (value) {
+      *value = '\0';
+      key = trim(key);
+      value = trim(value + 1);
+    }
+    if (!value || set_profile_field(profile, key, value)) {
+      fprintf(stderr, "Error: Invalid setting on line %d of %s.\n", line_no, path);
+      fclose(f);
+      return -1;
+    }
+  }
+  fclose(f);
+  return 0;
+}
+
+/* Usage: swarm [devices] [seconds] [nbiot|burst|churn] [host] [--profile-file <file>] [--period <ms>]
+ *              [--jitter <ms>] [--payload fixed|random|json] [--len <bytes>] [--qos <0-2>] [--churn <seconds>]
+ * Runs until the time is up or SIGINT, then prints the totals. Defaults to 1000 devices for 60 seconds of the nbiot
+ * profile against localhost. The options override fields of the named profile in the order given, a profile file
+ * holds the same settings as `key=value` lines, e.g. `period=30000`. */
+int main(int argc, char *argv[]) {
+  const char *positional[4] = {NULL, NULL, "nbiot", "localhost"};
+  struct epoll_event events[SWARM_MAX_EVENTS];
+  rc_mosq_retcode_t ret = RC_MOS_OK;
+  long started, now, next_report, next_misc, timeout;
+  int device_count, duration, positional_count = 0;
+  const swarm_profile_t *base;
+  swarm_profile_t profile;
+  swarm_device_t *dev;
+  mosq_config_t cfg;
+  swarm_t swarm;
+  char id[64];
+  int n;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strncmp(argv[i], "--", 2)) {
+      i++;  // every option takes a value, applied once the profile is known
+    } else if (positional_count < 4) {
+      positional[positional_count++] = argv[i];
+    }
+  }
+  device_count = positional[0] ? atoi(positional[0]) : 1000;
+  duration = positional[1] ? atoi(positional[1]) : 60;
+  base = find_profile(positional[2]);
+  if (!base || device_count < 1 || device_count > SWARM_MAX_DEVICES) {
+    fprintf(stderr, "Error: Usage: swarm [1-%d devices] [seconds] [nbiot|burst|churn] [host] [options]\n",
+            SWARM_MAX_DEVICES);
+    return EXIT_FAILURE;
+  }
+  profile = *base;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--", 2)) continue;
+    if (i + 1 >= argc) {
+      fprintf(stderr, "Error: %s needs a value.\n", argv[i]);
+      return EXIT_FAILURE;
+    }
+    if (!strcmp(argv[i], "--profile-file")) {
+      if (load_profile_file(&profile, argv[++i])) return EXIT_FAILURE;
+    } else if (set_profile_field(&profile, argv[i] + 2, argv[i + 1])) {
+      fprintf(stderr, "Error: Invalid option %s %s.\n", argv[i], argv[i + 1]);
+      return EXIT_FAILURE;
+    } else {
+      i++;
+    }
+  }
+  if (profile.jitter_ms > profile.period_ms) {
+    fprintf(stderr, "Error: The jitter of %d ms is longer than the period of %d ms.\n", profile.jitter_ms,
+            profile.period_ms);
+    return EXIT_FAILURE;
+  }
+  printf("profile %s: every %d ms +-%d, %s payload of %d bytes at QoS %d, churn %d s\n", profile.name,
+         profile.period_ms, profile.jitter_ms, payload_names[profile.payload], profile.payload_len, profile.qos,
+         profile.churn_sec);
+
+  memset(&swarm, 0, sizeof(swarm));
+  swarm.profile = &profile;
+  signal(SIGINT, stop_func);
+  signal(SIGTERM, stop_func);
+  signal(SIGPIPE, SIG_IGN);
+  raise_fd_limit(device_count + 64);
+
+  init_mosq_config(&cfg, client_pub);
+  mosquitto_lib_init();
+  cfg.general_config->host = strdup(positional[3]);
+  cfg.general_config->protocol_version = MQTT_PROTOCOL_V311;
+  swarm.cfg = &cfg;
+  swarm.device_count = device_count;
+  swarm.devices = calloc(device_count + 1, sizeof(swarm_device_t));
+  swarm.heap = calloc(device_count, sizeof(int));
+  swarm.epfd = epoll_create1(0);
+  if (!swarm.devices || !swarm.heap || swarm.epfd < 0) {
+    ret = RC_MOS_INIT_ERROR;
+    goto cleanup;
+  }
+  if (mosq_connect_target(&cfg, swarm.proxy, sizeof(swarm.proxy), &swarm.host, &swarm.port)) {
+    ret = RC_CLIENT_CONNTECT;
+    goto cleanup;
+  }
+  if (swarm.host == swarm.proxy) fprintf(stderr, "Warning: Connecting through %s:%d.\n", swarm.host, swarm.port);
+
+  started = now_ms();
+  for (int i = 0; i <= device_count; i++) {
+    dev = &swarm.devices[i];
+    dev->swarm = &swarm;
+    dev->index = i;
+    dev->fd = -1;
+    dev->sink = i == device_count;
+    dev->rng = 2463534242u + i * 2654435761u;
+    snprintf(id, sizeof(id), dev->sink ? "swarm_sink_%d" : "swarm_%d_%d", getpid(), i);
+    snprintf(dev->topic, sizeof(dev->topic), "%s/%d", SWARM_TOPIC, i);
+    dev->mosq = mosquitto_new(id, true, dev);
+    if (!dev->mosq) {
+      ret = RC_MOS_INIT_ERROR;
+      goto cleanup;
+    }
+    mosquitto_int_option(dev->mosq, MOSQ_OPT_PROTOCOL_VERSION, cfg.general_config->protocol_version);
+    mosquitto_connect_v5_callback_set(dev->mosq, connect_callback_swarm_func);
+    mosquitto_disconnect_v5_callback_set(dev->mosq, disconnect_callback_swarm_func);
+    mosquitto_publish_v5_callback_set(dev->mosq, publish_callback_swarm_func);
+    mosquitto_message_v5_callback_set(dev->mosq, message_callback_swarm_func);
+    connect_device(dev, false);
+    if (dev->sink) break;
+    // Spread the first reports over one period instead of firing them all at once
+    dev->next_publish = started + next_rand(dev) % (uint32_t)swarm.profile->period_ms;
+    if (swarm.profile->churn_sec) {
+      dev->next_churn = started + jittered(dev, swarm.profile->churn_sec * 1000L, swarm.profile->churn_sec * 1000L);
+    }
+    heap_push(&swarm, i);
+  }
+
+  next_report = started + SWARM_REPORT_INTERVAL * 1000;
+  next_misc = started + 1000;
+  while (run && (duration <= 0 || now_ms() - started < duration * 1000L)) {
+    now = now_ms();
+    timeout = swarm.heap_len ? device_due(&swarm.devices[swarm.heap[0]]) - now : 100;
+    if (timeout > 100) timeout = 100;
+    if (timeout < 0) timeout = 0;
+    n = epoll_wait(swarm.epfd, events, SWARM_MAX_EVENTS, timeout);
+    for (int i = 0; i < n; i++) {
+      handle_event(&swarm, &events[i]);
+    }
+
+    now = now_ms();
+    run_timers(&swarm, now);
+    if (swarm.devices[device_count].next_reconnect && swarm.devices[device_count].next_reconnect <= now) {
+      connect_device(&swarm.devices[device_count], true);
+    }
+    if (now >= next_misc) {
+      // Keepalive pings, one pass per second is plenty for keepalives measured in tens of seconds
+      for (int i = 0; i <= device_count; i++) {
+        if (swarm.devices[i].fd >= 0) {
+          mosquitto_loop_misc(swarm.devices[i].mosq);
+          sync_fd(&swarm.devices[i]);
+        }
+      }
+      next_misc += 1000;
+    }
+    if (now >= next_report) {
+      report(&swarm, SWARM_REPORT_INTERVAL);
+      next_report += SWARM_REPORT_INTERVAL * 1000;
+    }
+  }
+
+  printf("total: %lu published, %lu acked, %lu received, %lu connects, %lu reconnects, %lu errors in %.1f s\n",
+         swarm.total.published, swarm.total.acked, swarm.total.received, swarm.total.connects, swarm.total.reconnects,
+         swarm.total.errors, (now_ms() - started) / 1000.0);
+  memset(&swarm.last, 0, sizeof(swarm.last));
+  report(&swarm, (now_ms() - started) / 1000.0);
+
+cleanup:
+  if (swarm.devices) {
+    for (int i = 0; i <= device_count; i++) {
+      if (swarm.devices[i].mosq) {
+        mosquitto_disconnect(swarm.devices[i].mosq);
+        mosquitto_destroy(swarm.devices[i].mosq);
+      }
+    }
+  }
+  if (swarm.epfd >= 0) close(swarm.epfd);
+  free(swarm.devices);
+  free(swarm.heap);
+  mosquitto_lib_cleanup();
+  mosq_config_cleanup(&cfg);
+  return ret;
+}
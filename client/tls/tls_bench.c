@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "client_common.h"
+#include "tls_session.h"
+
+#define BENCH_ROUNDS 20
+#define BENCH_TLS_PORT 8883
+#define BENCH_PSK_PORT 8884
+#define BENCH_TIMEOUT_MS 10000
+
+typedef struct bench_s {
+  bool connected;
+  bool disconnected;
+  int result;
+} bench_t;
+
+static double now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void connect_callback_bench_func(struct mosquitto *mosq, void *obj, int result, int flags,
+                                        const mosquitto_property *properties) {
+  bench_t *bench = (bench_t *)obj;
+
+  bench->connected = true;
+  bench->result = result;
+}
+
+static void disconnect_callback_bench_func(struct mosquitto *mosq, void *obj, int rc,
+                                           const mosquitto_property *properties) {
+  ((bench_t *)obj)->disconnected = true;
+}
+
+static bool wait_for(struct mosquitto *mosq, bool *flag) {
+  double deadline = now_ms() + BENCH_TIMEOUT_MS;
+
+  while (!*flag && now_ms() < deadline) {
+    if (mosquitto_loop(mosq, 100, 1) != MOSQ_ERR_SUCCESS && !*flag) return false;
+  }
+  return *flag;
+}
+
+/* `rounds` connections up to the CONNACK and back. The first one goes through mosquitto_connect, the rest through
+ * mosquitto_reconnect as after a dropped link. `full` forgets the session before each of them. */
+static int run(const char *name, mosq_config_t *cfg, int rounds, bool full) {
+  struct mosquitto *mosq;
+  bench_t bench = {0};
+  double connack_ms = 0, start;
+  int ret = 0, done = 0;
+
+  mosq = mosquitto_new(NULL, true, &bench);
+  if (!mosq || mosq_opts_set(mosq, cfg)) {
+    mosquitto_destroy(mosq);
+    return -1;
+  }
+  mosquitto_connect_v5_callback_set(mosq, connect_callback_bench_func);
+  mosquitto_disconnect_v5_callback_set(mosq, disconnect_callback_bench_func);
+
+  for (int i = 0; i < rounds && !ret; i++) {
+    if (full) tls_session_forget(cfg->tls_config->session);
+    bench.connected = bench.disconnected = false;
+    start = now_ms();
+    ret = i == 0 ? mosq_client_connect(mosq, cfg) : mosquitto_reconnect(mosq);
+    if (ret || !wait_for(mosq, &bench.connected) || bench.result) {
+      fprintf(stderr, "Error: %s connection %d failed.\n", name, i + 1);
+      ret = -1;
+      break;
+    }
+    connack_ms += now_ms() - start;
+    done++;
+    mosquitto_disconnect_v5(mosq, 0, NULL);
+    wait_for(mosq, &bench.disconnected);
+  }
+  printf("%s: %d connections, %.2f ms to CONNACK on average\n", name, done, done ? connack_ms / done : 0);
+  tls_session_stats(cfg->tls_config->session, stdout);
+  mosquitto_destroy(mosq);
+  return ret;
+}
+
+/* Fresh configuration per run so every run starts with its own session cache and statistics. */
+static void bench_config(mosq_config_t *cfg, const char *host, int port) {
+  init_mosq_config(cfg, client_pub);
+  cfg->general_config->host = cfg_strdup(cfg, host);
+  cfg->general_config->port = port;
+}
+
+/* Usage: tls_bench <host> <CA file> [PSK hex] [PSK identity] [rounds]
+ * Connects to a local broker `rounds` times with full certificate handshakes, then with the session resumed on every
+ * reconnect, then, when a PSK is given, with TLS-PSK, and reports handshake bytes and time for each. Needs the WITH_TLS
+ * build and a broker with a certificate listener on BENCH_TLS_PORT and a PSK listener on BENCH_PSK_PORT, e.g.
+ *   listener 8883
+ *   cafile ca.crt
+ *   certfile server.crt
+ *   keyfile server.key
+ *   listener 8884
+ *   psk_hint bench
+ *   psk_file psk.txt */
+int main(int argc, char *argv[]) {
+  int rounds = argc > 5 ? atoi(argv[5]) : BENCH_ROUNDS;
+  mosq_config_t cfg;
+  int ret = 0;
+
+  if (argc < 3) {
+    fprintf(stderr, "Usage: tls_bench <host> <CA file> [PSK hex] [PSK identity] [rounds]\n");
+    return EXIT_FAILURE;
+  }
+  if (rounds < 1) rounds = 1;
+  mosquitto_lib_init();
+
+  bench_config(&cfg, argv[1], BENCH_TLS_PORT);
+  cfg.tls_config->cafile = cfg_strdup(&cfg, argv[2]);
+  ret |= run("full", &cfg, rounds, true);
+  mosq_config_cleanup(&cfg);
+
+  bench_config(&cfg, argv[1], BENCH_TLS_PORT);
+  cfg.tls_config->cafile = cfg_strdup(&cfg, argv[2]);
+  ret |= run("resumed", &cfg, rounds, false);
+  mosq_config_cleanup(&cfg);
+
+  if (argc > 4) {
+    bench_config(&cfg, argv[1], BENCH_PSK_PORT);
+    cfg.tls_config->psk = cfg_strdup(&cfg, argv[3]);
+    cfg.tls_config->psk_identity = cfg_strdup(&cfg, argv[4]);
+    ret |= run("psk", &cfg, rounds, false);
+    mosq_config_cleanup(&cfg);
+  }
+
+  mosquitto_lib_cleanup();
+  return ret ? EXIT_FAILURE : 0;
+}
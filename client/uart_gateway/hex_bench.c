@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hex.h"
+
+#define BENCH_MIN_MS 200
+#define BENCH_MAX_LEN 65536
+
+static const int sizes[] = {16, 64, 512, 4096, BENCH_MAX_LEN};
+
+static double now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* The loop write_payload() used, formatting into a memory stream so no I/O is measured */
+static void encode_fprintf(FILE *out, const unsigned char *in, int len) {
+  rewind(out);
+  for (int i = 0; i < len; i++) {
+    fprintf(out, "%02x", in[i]);
+  }
+  fflush(out);
+}
+
+// What modem drivers usually do with URC hex data
+static int decode_strtol(unsigned char *out, const char *in, int len) {
+  char pair[3] = {0};
+  char *end;
+
+  for (int i = 0; i < len / 2; i++) {
+    pair[0] = in[2 * i];
+    pair[1] = in[2 * i + 1];
+    out[i] = strtol(pair, &end, 16);
+    if (end != pair + 2) return -1;
+  }
+  return len / 2;
+}
+
+static void report(const char *name, int len, double ms, long calls) {
+  printf("  %-10s %9.3f GB/s %10.1f ns/call\n", name, (double)len * calls / ms / 1e6, ms * 1e6 / calls);
+}
+
+/* Times `expr` on `len` payload bytes for at least BENCH_MIN_MS */
+#define BENCH(name, len, expr)                    \
+  do {                                            \
+    double start = now_ms(), ms;                  \
+    long calls = 0;                               \
+    do {                                          \
+      for (int rep = 0; rep < 64; rep++) {        \
+        expr;                                     \
+      }                                           \
+      calls += 64;                                \
+      ms = now_ms() - start;                      \
+    } while (ms < BENCH_MIN_MS);                  \
+    report(name, len, ms, calls);                 \
+  } while (0)
+
+/* Usage: hex_bench
+ * Encodes and decodes payloads of URC to bulk transfer size with the old per-byte loops and every hex kernel the CPU
+ * has. Throughput is in payload bytes, the hex text is twice that. */
+int main(void) {
+  unsigned char *data = malloc(BENCH_MAX_LEN), *decoded = malloc(BENCH_MAX_LEN);
+  char *text = malloc(HEX_ENCODED_LEN(BENCH_MAX_LEN) + 1);
+  FILE *stream;
+  int len;
+
+  if (!data || !decoded || !text) {
+    fprintf(stderr, "Error: Out of memory.\n");
+    return EXIT_FAILURE;
+  }
+  stream = fmemopen(text, HEX_ENCODED_LEN(BENCH_MAX_LEN) + 1, "w");
+  if (!stream) {
+    perror("fmemopen");
+    return EXIT_FAILURE;
+  }
+  srand(1);
+  for (int i = 0; i < BENCH_MAX_LEN; i++) {
+    data[i] = rand();
+  }
+
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    len = sizes[s];
+    printf("encode %d bytes:\n", len);
+    BENCH("fprintf", len, encode_fprintf(stream, data, len));
+    for (int isa = SIMD_SCALAR; isa <= (int)simd_best_isa(); isa++) {
+      hex_set_isa(isa);
+      BENCH(simd_isa_name(isa), len, hex_encode(text, data, len, false));
+    }
+
+    printf("decode %d bytes:\n", len);
+    BENCH("strtol", len, decode_strtol(decoded, text, HEX_ENCODED_LEN(len)));
+    for (int isa = SIMD_SCALAR; isa <= (int)simd_best_isa(); isa++) {
+      hex_set_isa(isa);
+      BENCH(simd_isa_name(isa), len, hex_decode(decoded, text, HEX_ENCODED_LEN(len)));
+      if (memcmp(decoded, data, len)) {
+        fprintf(stderr, "Error: %s decode does not round trip.\n", simd_isa_name(isa));
+        return EXIT_FAILURE;
+      }
+    }
+  }
+  fclose(stream);
+  free(data);
+  free(decoded);
+  free(text);
+  return 0;
+}
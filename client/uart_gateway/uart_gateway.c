@@ -0,0 +1,320 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "bqueue.h"
+#include "client_common.h"
+#include "hex.h"
+#include "pub_queue.h"
+#include "pub_utils.h"
+#include "uart_utils.h"
+
+/* read -> frame -> translate -> publish, every arrow is a bounded queue. When the broker is slow the publish queues
+ * fill up, the translator blocks, then the framer, then the readers stop reading and RTS/CTS stops the modems. */
+#define GW_MAX_PORTS 4
+#define GW_RAW_QUEUE_LEN 64
+#define GW_FRAME_QUEUE_LEN 128
+#define GW_CHUNK_LEN 256
+#define GW_MAX_FRAME 1024
+#define GW_REPORT_INTERVAL 10
+
+typedef struct raw_chunk_s {
+  int port;
+  int len;
+  unsigned char data[GW_CHUNK_LEN];
+} raw_chunk_t;
+
+typedef struct frame_s {
+  int port;
+  int len;
+  char data[];
+} frame_t;
+
+typedef struct uart_port_s {
+  const char *name;
+  int index;
+  int fd;
+  pthread_t thread;
+  struct uart_gateway_s *gw;
+  bool hex;  // the modem firmware hex encodes payloads, as most NB-IoT modems do for socket data
+  char line[GW_MAX_FRAME];
+  int line_len;
+  unsigned long bytes;
+  unsigned long overflows;
+} uart_port_t;
+
+typedef struct uart_gateway_s {
+  uart_port_t ports[GW_MAX_PORTS];
+  int port_count;
+  bqueue_t raw;
+  bqueue_t frames;
+  pub_queue_t pub;
+  pthread_t framer;
+  pthread_t translator;
+  mosq_config_t *cfg;
+  unsigned long malformed;
+} uart_gateway_t;
+
+static volatile sig_atomic_t run = 1;
+
+static void stop_func(int signum) { run = 0; }
+
+static void *reader_func(void *arg) {
+  uart_port_t *port = (uart_port_t *)arg;
+  struct pollfd pfd = {.fd = port->fd, .events = POLLIN};
+  raw_chunk_t *chunk;
+  int len;
+
+  while (run) {
+    // Wake up regularly so the thread notices shutdown, it is never cancelled while holding a queue lock
+    if (poll(&pfd, 1, 500) <= 0) continue;
+    chunk = malloc(sizeof(raw_chunk_t));
+    if (!chunk) break;
+    len = read(port->fd, chunk->data, GW_CHUNK_LEN);
+    if (len <= 0) {
+      free(chunk);
+      if (len < 0 && errno != EINTR && errno != EAGAIN) {
+        printf("Error from read on %s: %s\n", port->name, strerror(errno));
+        break;
+      }
+      continue;
+    }
+    chunk->port = port->index;
+    chunk->len = len;
+    port->bytes += chunk->len;
+    if (!bqueue_push(&port->gw->raw, chunk)) {
+      free(chunk);
+      break;
+    }
+  }
+  return NULL;
+}
+
+/* Modems terminate every message with CR LF, empty lines and AT echo noise are dropped here. */
+static void *framer_func(void *arg) {
+  uart_gateway_t *gw = (uart_gateway_t *)arg;
+  raw_chunk_t *chunk;
+  uart_port_t *port;
+  frame_t *frame;
+
+  while ((chunk = bqueue_pop(&gw->raw))) {
+    port = &gw->ports[chunk->port];
+    for (int i = 0; i < chunk->len; i++) {
+      char c = chunk->data[i];
+      if (c != '\n') {
+        if (c == '\r') continue;
+        if (port->line_len < GW_MAX_FRAME) {
+          port->line[port->line_len] = c;
+        }
+        port->line_len++;
+        continue;
+      }
+      if (port->line_len > GW_MAX_FRAME) {
+        port->overflows++;
+      } else if (port->line_len > 0) {
+        frame = malloc(sizeof(frame_t) + port->line_len + 1);
+        if (frame) {
+          frame->port = chunk->port;
+          frame->len = port->line_len;
+          memcpy(frame->data, port->line, port->line_len);
+          frame->data[port->line_len] = '\0';
+          if (!bqueue_push(&gw->frames, frame)) free(frame);
+        }
+      }
+      port->line_len = 0;
+    }
+    free(chunk);
+  }
+  bqueue_close(&gw->frames);
+  return NULL;
+}
+
+/* Frames look like `[ALARM|CTRL] <resource> <payload>` and are published to `TOPIC/<resource>`. Frames without a class
+ * are routine telemetry. On hex ports the payload is decoded in place first. */
+static pub_item_t *translate_frame(frame_t *frame, bool hex) {
+  pub_class_t cls = PUB_CLASS_TELEMETRY;
+  char topic[GW_MAX_FRAME + sizeof(TOPIC) + 1];
+  char *resource = frame->data, *payload;
+  long payload_len;
+  int resource_len;
+
+  if (!strncmp(resource, "ALARM ", 6)) {
+    cls = PUB_CLASS_ALARM;
+    resource += 6;
+  } else if (!strncmp(resource, "CTRL ", 5)) {
+    cls = PUB_CLASS_CONTROL;
+    resource += 5;
+  }
+  payload = strchr(resource, ' ');
+  if (!payload || payload == resource) {
+    return NULL;
+  }
+  resource_len = payload - resource;
+  payload++;
+  snprintf(topic, sizeof(topic), "%s/%.*s", TOPIC, resource_len, resource);
+  if (mosquitto_pub_topic_check(topic) != MOSQ_ERR_SUCCESS) {
+    return NULL;
+  }
+  payload_len = strlen(payload);
+  if (hex) {
+    payload_len = hex_decode((unsigned char *)payload, payload, payload_len);
+    if (payload_len < 0) return NULL;
+  }
+  return pub_item_new(cls, topic, payload, payload_len);
+}
+
+static void *translator_func(void *arg) {
+  uart_gateway_t *gw = (uart_gateway_t *)arg;
+  pub_item_t *item;
+  frame_t *frame;
+
+  while ((frame = bqueue_pop(&gw->frames))) {
+    item = translate_frame(frame, gw->ports[frame->port].hex);
+    if (!item) {
+      gw->malformed++;
+    } else if (!pub_queue_push(&gw->pub, item)) {
+      pub_item_free(item);
+    }
+    free(frame);
+  }
+  return NULL;
+}
+
+static void publish_callback_gw_func(struct mosquitto *mosq, void *obj, int mid, int reason_code,
+                                     const mosquitto_property *properties) {
+  uart_gateway_t *gw = (uart_gateway_t *)obj;
+
+  if (reason_code > 127) {
+    fprintf(stderr, "Warning: Publish %d failed: %s.\n", mid, mosquitto_reason_string(reason_code));
+  }
+  pub_queue_on_publish(&gw->pub, mid);
+}
+
+static void disconnect_callback_gw_func(struct mosquitto *mosq, void *obj, int rc, const mosquitto_property *props) {
+  pub_queue_on_disconnect(&((uart_gateway_t *)obj)->pub);
+}
+
+static void report(uart_gateway_t *gw) {
+  printf("raw     depth %3d/%-3d high %3d blocked %lu\n", bqueue_depth(&gw->raw), GW_RAW_QUEUE_LEN,
+         gw->raw.high_watermark, gw->raw.blocked);
+  printf("frames  depth %3d/%-3d high %3d blocked %lu malformed %lu\n", bqueue_depth(&gw->frames), GW_FRAME_QUEUE_LEN,
+         gw->frames.high_watermark, gw->frames.blocked, gw->malformed);
+  for (int i = 0; i < gw->port_count; i++) {
+    printf("%s: %lu bytes, %lu oversized frames\n", gw->ports[i].name, gw->ports[i].bytes, gw->ports[i].overflows);
+  }
+  pub_queue_report(&gw->pub, stdout);
+  fflush(stdout);
+}
+
+/* Usage: uart_gateway [serial port[:hex]]...
+ * A port given as e.g. /dev/ttyUSB0:hex carries hex encoded payloads, they are published as binary. */
+int main(int argc, char *argv[]) {
+  rc_mosq_retcode_t ret = RC_MOS_OK;
+  struct mosquitto *mosq = NULL;
+  mosq_config_t cfg;
+  uart_gateway_t gw;
+  raw_chunk_t *chunk;
+  frame_t *frame;
+  time_t next_report;
+
+  memset(&gw, 0, sizeof(gw));
+  signal(SIGINT, stop_func);
+  signal(SIGTERM, stop_func);
+
+  gw.port_count = argc > 1 ? argc - 1 : 1;
+  if (gw.port_count > GW_MAX_PORTS) gw.port_count = GW_MAX_PORTS;
+  if (bqueue_init(&gw.raw, GW_RAW_QUEUE_LEN) || bqueue_init(&gw.frames, GW_FRAME_QUEUE_LEN)) {
+    return EXIT_FAILURE;
+  }
+
+  init_mosq_config(&cfg, client_pub);
+  mosquitto_lib_init();
+  cfg.general_config->host = strdup(HOST);
+  cfg.general_config->id_prefix = strdup("uart_gw_");
+  // The publish queue adapts its own window to the PUBACK RTT, libmosquitto must not cap it lower
+  cfg.general_config->max_inflight = PUB_QUEUE_MAX_INFLIGHT;
+  if (generate_client_id(&cfg) || init_check_error(&cfg, client_pub) ||
+      pub_queue_init(&gw.pub, cfg.general_config->max_inflight)) {
+    ret = RC_MOS_INIT_ERROR;
+    goto cleanup;
+  }
+  gw.cfg = &cfg;
+
+  mosq = mosquitto_new(cfg.general_config->id, true, &gw);
+  if (!mosq || mosq_opts_set(mosq, &cfg)) {
+    ret = RC_MOS_INIT_ERROR;
+    goto cleanup;
+  }
+  mosquitto_publish_v5_callback_set(mosq, publish_callback_gw_func);
+  mosquitto_disconnect_v5_callback_set(mosq, disconnect_callback_gw_func);
+  ret = mosq_client_connect(mosq, &cfg);
+  if (ret) {
+    goto cleanup;
+  }
+
+  for (int i = 0; i < gw.port_count; i++) {
+    uart_port_t *port = &gw.ports[i];
+    port->name = argc > 1 ? argv[i + 1] : "/dev/ttyUSB0";
+    if (strlen(port->name) > 4 && !strcmp(port->name + strlen(port->name) - 4, ":hex")) {
+      argv[i + 1][strlen(port->name) - 4] = '\0';
+      port->hex = true;
+    }
+    port->index = i;
+    port->gw = &gw;
+    port->fd = uart_open(port->name, B115200);
+    if (port->fd < 0) {
+      ret = RC_MOS_INIT_ERROR;
+      goto stop;
+    }
+    set_flow_control(port->fd, 1);
+    pthread_create(&port->thread, NULL, reader_func, port);
+  }
+  pthread_create(&gw.framer, NULL, framer_func, &gw);
+  pthread_create(&gw.translator, NULL, translator_func, &gw);
+
+  next_report = time(NULL) + GW_REPORT_INTERVAL;
+  while (run) {
+    if (mosquitto_loop(mosq, 10, 1) != MOSQ_ERR_SUCCESS) {
+      sleep(1);
+      mosquitto_reconnect(mosq);
+      continue;
+    }
+    pub_queue_dispatch(&gw.pub, mosq, gw.cfg);
+    if (time(NULL) >= next_report) {
+      report(&gw);
+      next_report += GW_REPORT_INTERVAL;
+    }
+  }
+
+stop:
+  // Closing the queues unblocks every stage, the stages drain what is left and exit
+  run = 0;
+  bqueue_close(&gw.raw);
+  pub_queue_close(&gw.pub);
+  for (int i = 0; i < gw.port_count; i++) {
+    if (gw.ports[i].thread) {
+      pthread_join(gw.ports[i].thread, NULL);
+    }
+    if (gw.ports[i].fd > 0) {
+      close(gw.ports[i].fd);
+    }
+  }
+  if (gw.framer) pthread_join(gw.framer, NULL);
+  if (gw.translator) pthread_join(gw.translator, NULL);
+  report(&gw);
+
+cleanup:
+  while ((chunk = bqueue_try_pop(&gw.raw))) free(chunk);
+  while ((frame = bqueue_try_pop(&gw.frames))) free(frame);
+  pub_queue_destroy(&gw.pub);
+  bqueue_destroy(&gw.raw);
+  bqueue_destroy(&gw.frames);
+  mosquitto_destroy(mosq);
+  mosquitto_lib_cleanup();
+  mosq_config_cleanup(&cfg);
+  return ret;
+}
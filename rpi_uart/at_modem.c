@@ -0,0 +1,167 @@
+#include "at_modem.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "hex.h"
+
+#define AT_MAX_FIELDS 12
+
+static long now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Sends `cmd` and collects the information lines of the answer (the ones starting with '+') into `response`, one per
+ * line. Returns 0 on OK, -1 on ERROR, +CME ERROR or when no final result code arrives in time. Echo and unsolicited
+ * lines before the answer are skipped. */
+int at_command(int fd, const char *cmd, char *response, int size, int timeout_ms) {
+  char line[AT_MAX_RESPONSE], c;
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+  long deadline = now_ms() + timeout_ms;
+  int line_len = 0, resp_len = 0, len;
+
+  if (response && size > 0) response[0] = '\0';
+  // The late answer to a command that timed out would otherwise be taken for the answer to this one
+  tcflush(fd, TCIFLUSH);
+  len = strlen(cmd);
+  if (write(fd, cmd, len) != len || write(fd, "\r\n", 2) != 2) {
+    printf("Error from write: %s\n", strerror(errno));
+    return -1;
+  }
+
+  while (now_ms() < deadline) {
+    if (poll(&pfd, 1, (int)(deadline - now_ms())) <= 0) continue;
+    if (read(fd, &c, 1) != 1) return -1;
+    if (c != '\n') {
+      if (c != '\r' && line_len < (int)sizeof(line) - 1) line[line_len++] = c;
+      continue;
+    }
+    line[line_len] = '\0';
+    line_len = 0;
+    if (!strcmp(line, "OK")) return 0;
+    if (!strcmp(line, "ERROR") || !strncmp(line, "+CME ERROR", 10)) return -1;
+    if (line[0] == '+' && response && resp_len + (int)strlen(line) + 2 <= size) {
+      resp_len += snprintf(response + resp_len, size - resp_len, "%s\n", line);
+    }
+  }
+  return -1;
+}
+
+/* GPRS timer 3 (3GPP 24.008 10.5.7.4a): three unit bits followed by a five bit value, -1 when deactivated. */
+int at_decode_t3412(const char *bits) {
+  static const int units[] = {600, 3600, 36000, 2, 30, 60, 1152000, -1};
+  long raw = strtol(bits, NULL, 2);
+
+  if (strlen(bits) != 8 || units[raw >> 5] < 0) return -1;
+  return units[raw >> 5] * (int)(raw & 0x1f);
+}
+
+/* GPRS timer 2 (3GPP 24.008 10.5.7.4), the units differ from timer 3. */
+int at_decode_t3324(const char *bits) {
+  static const int units[] = {2, 60, 360, -1, -1, -1, -1, -1};
+  long raw = strtol(bits, NULL, 2);
+
+  if (strlen(bits) != 8 || units[raw >> 5] < 0) return -1;
+  return units[raw >> 5] * (int)(raw & 0x1f);
+}
+
+// eDRX cycle length for E-UTRAN and NB-S1 (3GPP 24.008 10.5.5.32)
+double at_decode_edrx(const char *bits) {
+  static const double cycles[] = {5.12,   10.24,  20.48,  40.96,   61.44,   81.92,   102.4,   122.88,
+                                  143.36, 163.84, 327.68, 655.36, 1310.72, 2621.44, 5242.88, 10485.76};
+  if (strlen(bits) != 4) return 0;
+  return cycles[strtol(bits, NULL, 2) & 0xf];
+}
+
+// NB-S1 paging time window, 2.56 s steps
+double at_decode_ptw(const char *bits) {
+  if (strlen(bits) != 4) return 0;
+  return 2.56 * (strtol(bits, NULL, 2) + 1);
+}
+
+/* Splits the first line of "+CMD: a,\"b\",,c" into fields without quotes, empty fields stay empty. Modifies `line`. */
+static int split_fields(char *line, char **fields, int max) {
+  char *p = strchr(line, ':'), *end;
+  int count = 0;
+
+  if (!p) return 0;
+  end = strchr(p, '\n');
+  if (end) *end = '\0';
+  p++;
+  while (*p == ' ') p++;
+  while (count < max) {
+    end = strchr(p, ',');
+    if (end) *end = '\0';
+    if (*p == '"') p++;
+    if (*p && p[strlen(p) - 1] == '"') p[strlen(p) - 1] = '\0';
+    fields[count++] = p;
+    if (!end) break;
+    p = end + 1;
+  }
+  return count;
+}
+
+/* The network may grant other timers than the ones requested with AT+CPSMS, so they are read from the extended
+ * registration status first and only fall back to the requested values when the modem does not report them. */
+int at_query_timers(int fd, modem_timers_t *timers) {
+  char resp[AT_MAX_RESPONSE], *fields[AT_MAX_FIELDS];
+  int count;
+
+  memset(timers, 0, sizeof(modem_timers_t));
+  if (at_command(fd, "AT", NULL, 0, AT_TIMEOUT_MS)) {
+    printf("Error: The modem does not answer AT commands.\n");
+    return -1;
+  }
+
+  if (!at_command(fd, "AT+CEREG=4", NULL, 0, AT_TIMEOUT_MS) &&
+      !at_command(fd, "AT+CEREG?", resp, sizeof(resp), AT_TIMEOUT_MS)) {
+    count = split_fields(resp, fields, AT_MAX_FIELDS);
+    if (count >= 9 && strlen(fields[7]) == 8 && strlen(fields[8]) == 8) {
+      timers->active_sec = at_decode_t3324(fields[7]);
+      timers->tau_sec = at_decode_t3412(fields[8]);
+    }
+  }
+  if (!timers->tau_sec && !at_command(fd, "AT+CPSMS?", resp, sizeof(resp), AT_TIMEOUT_MS)) {
+    count = split_fields(resp, fields, AT_MAX_FIELDS);
+    if (count >= 5 && atoi(fields[0]) == 1) {
+      timers->tau_sec = at_decode_t3412(fields[3]);
+      timers->active_sec = at_decode_t3324(fields[4]);
+    }
+  }
+  timers->psm = timers->tau_sec > 0 && timers->active_sec >= 0;
+
+  if (!at_command(fd, "AT+CEDRXRDP", resp, sizeof(resp), AT_TIMEOUT_MS)) {
+    count = split_fields(resp, fields, AT_MAX_FIELDS);
+    if (count >= 4 && atoi(fields[0]) != 0) {
+      timers->edrx = true;
+      timers->edrx_sec = at_decode_edrx(fields[2]);
+      timers->ptw_sec = at_decode_ptw(fields[3]);
+    }
+  }
+  return 0;
+}
+
+/* Publishes through the modem's own MQTT client with the SIM7020 style AT+CMQPUB on connection 0, which has to be
+ * opened beforehand with AT+CMQNEW and AT+CMQCON. The payload is hex encoded so binary data gets past the AT parser.
+ * Returns 0 once the modem answered OK. */
+int at_mqtt_publish(int fd, const char *topic, const void *payload, int len, int qos, int timeout_ms) {
+  char cmd[AT_MAX_COMMAND];
+  int n;
+
+  if (len < 0 || len > AT_MQTT_MAX_PAYLOAD || strlen(topic) > AT_MQTT_MAX_TOPIC || strchr(topic, '"')) {
+    return -1;
+  }
+  n = snprintf(cmd, sizeof(cmd), "AT+CMQPUB=0,\"%s\",%d,0,0,%d,\"", topic, qos, HEX_ENCODED_LEN(len));
+  hex_encode(cmd + n, payload, len, true);
+  n += HEX_ENCODED_LEN(len);
+  cmd[n++] = '"';
+  cmd[n] = '\0';
+  return at_command(fd, cmd, NULL, 0, timeout_ms);
+}
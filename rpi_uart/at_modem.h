@@ -0,0 +1,30 @@
+#ifndef AT_MODEM_H
+#define AT_MODEM_H
+
+#include <stdbool.h>
+
+#define AT_TIMEOUT_MS 2000
+#define AT_MAX_RESPONSE 512
+#define AT_MQTT_MAX_TOPIC 128
+#define AT_MQTT_MAX_PAYLOAD 512  // bytes, the command carries them hex encoded
+#define AT_MAX_COMMAND (AT_MQTT_MAX_TOPIC + 2 * AT_MQTT_MAX_PAYLOAD + 64)
+
+/* Power saving timers as granted by the network, in seconds. A timer the network did not grant is 0. */
+typedef struct modem_timers_s {
+  bool psm;
+  int tau_sec;     // T3412 extended, periodic tracking area update
+  int active_sec;  // T3324, how long the modem stays reachable after an uplink
+  bool edrx;
+  double edrx_sec;  // eDRX cycle
+  double ptw_sec;   // paging time window within each cycle
+} modem_timers_t;
+
+int at_command(int fd, const char *cmd, char *response, int size, int timeout_ms);
+int at_query_timers(int fd, modem_timers_t *timers);
+int at_mqtt_publish(int fd, const char *topic, const void *payload, int len, int qos, int timeout_ms);
+int at_decode_t3412(const char *bits);
+int at_decode_t3324(const char *bits);
+double at_decode_edrx(const char *bits);
+double at_decode_ptw(const char *bits);
+
+#endif
@@ -0,0 +1,118 @@
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "modem_bond.h"
+
+#define BOND_REPORT_INTERVAL 10
+#define BOND_FLUSH_MS 30000
+#define BOND_MAX_LINE AT_MQTT_MAX_PAYLOAD
+
+static volatile sig_atomic_t run = 1;
+
+static void stop_func(int signum) { run = 0; }
+
+static double now_sec(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void publish_line(modem_bond_t *bond, const char *topic, char *line, int len) {
+  bond_msg_t *msg;
+
+  if (len > 0 && line[len - 1] == '\r') len--;
+  if (len == 0) return;
+  msg = bond_msg_new(topic, line, len, 1);
+  if (!msg) {
+    fprintf(stderr, "Error: Out of memory.\n");
+    return;
+  }
+  if (!modem_bond_publish(bond, msg)) {
+    fprintf(stderr, "Error: Line dropped, no modem is answering.\n");
+  }
+}
+
+/* One message per line, a line longer than BOND_MAX_LINE is split. */
+static void read_lines(modem_bond_t *bond, const char *topic, bool *eof) {
+  static char buf[BOND_MAX_LINE];
+  static int used;
+  char *start, *nl;
+  int len;
+
+  len = read(STDIN_FILENO, buf + used, sizeof(buf) - used);
+  if (len <= 0) {
+    if (len < 0 && errno == EINTR) return;
+    publish_line(bond, topic, buf, used);
+    used = 0;
+    *eof = true;
+    return;
+  }
+  used += len;
+  start = buf;
+  while ((nl = memchr(start, '\n', used - (start - buf)))) {
+    publish_line(bond, topic, start, nl - start);
+    start = nl + 1;
+  }
+  used -= start - buf;
+  memmove(buf, start, used);
+  if (used == sizeof(buf)) {
+    publish_line(bond, topic, buf, used);
+    used = 0;
+  }
+}
+
+/* Usage: bond_pub <topic> <serial port>...
+ * Publishes the lines read from stdin to `topic` over up to BOND_MAX_MODEMS modems at once, each line through the
+ * modem expected to get it out first, and moves the traffic of a modem that stops answering to the others. The MQTT
+ * connection of every modem has to be open already. Prints per-modem throughput every BOND_REPORT_INTERVAL seconds.
+ * Try it without modems by running one modem_sim per port and passing the ptys they print. */
+int main(int argc, char *argv[]) {
+  struct pollfd pfd = {.fd = STDIN_FILENO, .events = POLLIN};
+  modem_bond_t bond;
+  double now, last_report;
+  bool eof = false;
+
+  if (argc < 3) {
+    fprintf(stderr, "Usage: bond_pub <topic> <serial port>...\n");
+    return EXIT_FAILURE;
+  }
+  if (argc - 2 > BOND_MAX_MODEMS) {
+    fprintf(stderr, "Warning: Only the first %d modems are used.\n", BOND_MAX_MODEMS);
+  }
+  if (modem_bond_init(&bond, (const char **)&argv[2], argc - 2)) {
+    fprintf(stderr, "Error: Failed to set up the modems.\n");
+    modem_bond_destroy(&bond);
+    return EXIT_FAILURE;
+  }
+
+  signal(SIGINT, stop_func);
+  signal(SIGTERM, stop_func);
+  now = last_report = now_sec();
+  while (run && !eof) {
+    if (poll(&pfd, 1, 1000) < 0 && errno != EINTR) {
+      break;
+    }
+    if (pfd.revents & (POLLIN | POLLHUP)) {
+      read_lines(&bond, argv[1], &eof);
+    }
+    modem_bond_pump(&bond);
+
+    now = now_sec();
+    if (now - last_report >= BOND_REPORT_INTERVAL) {
+      modem_bond_report(&bond, stdout);
+      last_report = now;
+    }
+  }
+  if (run && !modem_bond_flush(&bond, BOND_FLUSH_MS)) {
+    fprintf(stderr, "Warning: Not every message was sent in time.\n");
+  }
+  modem_bond_report(&bond, stdout);
+  modem_bond_destroy(&bond);
+  return 0;
+}
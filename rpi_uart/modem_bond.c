@@ -0,0 +1,340 @@
+#include "modem_bond.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "uart_utils.h"
+
+#define BOND_POLL_MS 50
+
+static double now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+bond_msg_t *bond_msg_new(const char *topic, const void *payload, int len, int qos) {
+  bond_msg_t *msg = calloc(1, sizeof(bond_msg_t));
+
+  if (!msg) return NULL;
+  msg->topic = strdup(topic);
+  msg->payload = malloc(len > 0 ? len : 1);
+  if (!msg->topic || !msg->payload) {
+    bond_msg_free(msg);
+    return NULL;
+  }
+  memcpy(msg->payload, payload, len);
+  msg->len = len;
+  msg->qos = qos;
+  return msg;
+}
+
+void bond_msg_free(bond_msg_t *msg) {
+  if (!msg) return;
+  free(msg->topic);
+  free(msg->payload);
+  free(msg);
+}
+
+static bool is_closing(modem_bond_t *bond) {
+  bool closing;
+
+  pthread_mutex_lock(&bond->lock);
+  closing = bond->closing;
+  pthread_mutex_unlock(&bond->lock);
+  return closing;
+}
+
+static void drop(modem_bond_t *bond, bond_msg_t *msg) {
+  pthread_mutex_lock(&bond->lock);
+  bond->dropped++;
+  bond->pending--;
+  pthread_mutex_unlock(&bond->lock);
+  bond_msg_free(msg);
+}
+
+/* The cheapest modem that is up, NULL when none is. A publish in progress counts with the time it already took, so a
+ * modem that hangs gets more expensive by the second well before it is declared down. Called with the lock held. */
+static bond_modem_t *pick_modem(modem_bond_t *bond) {
+  bond_modem_t *modem, *best = NULL;
+  double now = now_ms(), latency, cost, best_cost = 0;
+
+  for (int i = 0; i < bond->count; i++) {
+    modem = &bond->modems[i];
+    if (modem->state != MODEM_UP) continue;
+    latency = modem->latency_ms;
+    if (modem->busy_since && now - modem->busy_since > latency) latency = now - modem->busy_since;
+    cost = (bqueue_depth(&modem->queue) + (modem->busy_since ? 1 : 0) + 1) * latency;
+    if (!best || cost < best_cost) {
+      best = modem;
+      best_cost = cost;
+    }
+  }
+  return best;
+}
+
+/* Queues `msg` on the cheapest modem, blocking while its queue is full. Returns false when no modem is up. */
+static bool dispatch(modem_bond_t *bond, bond_msg_t *msg) {
+  bond_modem_t *modem;
+
+  pthread_mutex_lock(&bond->lock);
+  modem = pick_modem(bond);
+  pthread_mutex_unlock(&bond->lock);
+  // Never pushed with the lock held, the sender that has to make room needs it
+  return modem && bqueue_push(&modem->queue, msg);
+}
+
+static void hand_back(bond_modem_t *modem, bond_msg_t *msg) {
+  modem_bond_t *bond = modem->bond;
+
+  pthread_mutex_lock(&bond->lock);
+  modem->handed_back++;
+  pthread_mutex_unlock(&bond->lock);
+  if (msg->attempts >= BOND_MAX_ATTEMPTS || !bqueue_try_push(&bond->retry, msg)) {
+    drop(bond, msg);
+  }
+}
+
+static void send_msg(bond_modem_t *modem, bond_msg_t *msg) {
+  modem_bond_t *bond = modem->bond;
+  bool went_down = false;
+  double start = now_ms(), took;
+  int ret;
+
+  pthread_mutex_lock(&bond->lock);
+  modem->busy_since = start;
+  pthread_mutex_unlock(&bond->lock);
+
+  msg->attempts++;
+  ret = at_mqtt_publish(modem->fd, msg->topic, msg->payload, msg->len, msg->qos, BOND_AT_TIMEOUT_MS);
+  took = now_ms() - start;
+
+  pthread_mutex_lock(&bond->lock);
+  modem->busy_since = 0;
+  modem->busy_ms += took;
+  if (!ret) {
+    // The first sample replaces the initial guess outright, a modem whose guess was too high would never be tried
+    if (modem->sent == 0) {
+      modem->latency_ms = took;
+    } else {
+      modem->latency_ms += BOND_LATENCY_GAIN * (took - modem->latency_ms);
+    }
+    modem->failures = 0;
+    modem->sent++;
+    modem->bytes += msg->len;
+    bond->delivered++;
+    bond->pending--;
+  } else {
+    modem->timeouts++;
+    if (++modem->failures >= BOND_MAX_FAILURES && modem->state == MODEM_UP) {
+      modem->state = MODEM_DOWN;
+      modem->outages++;
+      went_down = true;
+    }
+  }
+  pthread_mutex_unlock(&bond->lock);
+
+  if (went_down) {
+    fprintf(stderr, "Warning: %s stopped answering, its messages go to the other modems.\n", modem->name);
+  }
+  if (ret) {
+    hand_back(modem, msg);
+  } else {
+    bond_msg_free(msg);
+  }
+}
+
+/* Waits BOND_PROBE_INTERVAL_MS, handing back whatever was queued on the modem in the meantime, then checks whether it
+ * answers AT again. A port that could not be opened at startup is opened again first. Returns false once the bond is
+ * closing. */
+static bool probe(bond_modem_t *modem) {
+  modem_bond_t *bond = modem->bond;
+  bond_msg_t *msg;
+
+  for (int waited = 0; waited < BOND_PROBE_INTERVAL_MS; waited += BOND_POLL_MS) {
+    if (is_closing(bond)) return false;
+    while ((msg = bqueue_try_pop(&modem->queue))) {
+      hand_back(modem, msg);
+    }
+    usleep(BOND_POLL_MS * 1000);
+  }
+  if (modem->fd < 0) {
+    modem->fd = uart_open(modem->name, B115200);
+  }
+  if (modem->fd >= 0 && !at_command(modem->fd, "AT", NULL, 0, AT_TIMEOUT_MS)) {
+    pthread_mutex_lock(&bond->lock);
+    modem->state = MODEM_UP;
+    modem->failures = 0;
+    pthread_mutex_unlock(&bond->lock);
+    printf("%s is answering again.\n", modem->name);
+    fflush(stdout);
+  }
+  return true;
+}
+
+static void *sender_func(void *arg) {
+  bond_modem_t *modem = (bond_modem_t *)arg;
+  modem_bond_t *bond = modem->bond;
+  modem_state_t state;
+  bond_msg_t *msg;
+
+  for (;;) {
+    pthread_mutex_lock(&bond->lock);
+    state = modem->state;
+    pthread_mutex_unlock(&bond->lock);
+    if (state == MODEM_DOWN) {
+      if (!probe(modem)) break;
+      continue;
+    }
+    msg = bqueue_pop(&modem->queue);
+    if (!msg) break;
+    // What is still queued at shutdown is not sent, modem_bond_flush() is the way to wait for it
+    if (is_closing(bond)) {
+      drop(bond, msg);
+      continue;
+    }
+    send_msg(modem, msg);
+  }
+  return NULL;
+}
+
+/* Opens every port and starts its sender. A port that cannot be opened starts out down and is retried like a modem
+ * that stopped answering, so one missing modem does not keep the node offline. */
+int modem_bond_init(modem_bond_t *bond, const char **ports, int count) {
+  bond_modem_t *modem;
+
+  memset(bond, 0, sizeof(modem_bond_t));
+  bond->count = count < BOND_MAX_MODEMS ? count : BOND_MAX_MODEMS;
+  bond->started = now_ms();
+  if (pthread_mutex_init(&bond->lock, NULL) || bqueue_init(&bond->retry, BOND_RETRY_LEN)) {
+    return -1;
+  }
+  for (int i = 0; i < bond->count; i++) {
+    modem = &bond->modems[i];
+    modem->name = ports[i];
+    modem->bond = bond;
+    modem->latency_ms = BOND_INITIAL_LATENCY_MS;
+    modem->fd = uart_open(modem->name, B115200);
+    if (modem->fd < 0) {
+      modem->state = MODEM_DOWN;
+      modem->outages++;
+    }
+    if (bqueue_init(&modem->queue, BOND_QUEUE_LEN)) {
+      if (modem->fd >= 0) close(modem->fd);
+      return -1;
+    }
+    bond->ready++;
+  }
+  // Senders hand messages over to each other, none starts before every modem is set up
+  for (int i = 0; i < bond->count; i++) {
+    modem = &bond->modems[i];
+    if (pthread_create(&modem->thread, NULL, sender_func, modem)) {
+      return -1;
+    }
+    modem->running = true;
+  }
+  return 0;
+}
+
+/* Moves messages handed back by failing modems to the ones that are up. */
+void modem_bond_pump(modem_bond_t *bond) {
+  bond_msg_t *msg;
+
+  while ((msg = bqueue_try_pop(&bond->retry))) {
+    if (!dispatch(bond, msg)) {
+      // Still no modem up, the message keeps its place
+      if (!bqueue_try_push(&bond->retry, msg)) drop(bond, msg);
+      return;
+    }
+    pthread_mutex_lock(&bond->lock);
+    bond->rescheduled++;
+    pthread_mutex_unlock(&bond->lock);
+  }
+}
+
+/* Takes ownership of `msg`. Blocks while every modem that is up has a full queue, and up to BOND_WAIT_MS while no
+ * modem is up at all. Returns false when the message could not be accepted, it is freed then. */
+bool modem_bond_publish(modem_bond_t *bond, bond_msg_t *msg) {
+  double deadline = now_ms() + BOND_WAIT_MS;
+
+  if (msg->len > AT_MQTT_MAX_PAYLOAD || strlen(msg->topic) > AT_MQTT_MAX_TOPIC) {
+    fprintf(stderr, "Error: Message on %s is too large for the modems.\n", msg->topic);
+    bond_msg_free(msg);
+    return false;
+  }
+  pthread_mutex_lock(&bond->lock);
+  bond->accepted++;
+  bond->pending++;
+  pthread_mutex_unlock(&bond->lock);
+
+  modem_bond_pump(bond);
+  while (!dispatch(bond, msg)) {
+    if (is_closing(bond) || now_ms() >= deadline) {
+      drop(bond, msg);
+      return false;
+    }
+    usleep(BOND_POLL_MS * 1000);
+    modem_bond_pump(bond);
+  }
+  return true;
+}
+
+/* Waits until every accepted message was sent or dropped. Returns false on timeout. */
+bool modem_bond_flush(modem_bond_t *bond, int timeout_ms) {
+  double deadline = now_ms() + timeout_ms;
+  int pending;
+
+  for (;;) {
+    modem_bond_pump(bond);
+    pthread_mutex_lock(&bond->lock);
+    pending = bond->pending;
+    pthread_mutex_unlock(&bond->lock);
+    if (pending == 0) return true;
+    if (now_ms() >= deadline) return false;
+    usleep(BOND_POLL_MS * 1000);
+  }
+}
+
+void modem_bond_destroy(modem_bond_t *bond) {
+  bond_modem_t *modem;
+  bond_msg_t *msg;
+
+  pthread_mutex_lock(&bond->lock);
+  bond->closing = true;
+  pthread_mutex_unlock(&bond->lock);
+  for (int i = 0; i < bond->ready; i++) {
+    bqueue_close(&bond->modems[i].queue);
+  }
+  for (int i = 0; i < bond->ready; i++) {
+    modem = &bond->modems[i];
+    if (modem->running) pthread_join(modem->thread, NULL);
+    while ((msg = bqueue_try_pop(&modem->queue))) bond_msg_free(msg);
+    bqueue_destroy(&modem->queue);
+    if (modem->fd >= 0) close(modem->fd);
+  }
+  while ((msg = bqueue_try_pop(&bond->retry))) bond_msg_free(msg);
+  bqueue_destroy(&bond->retry);
+  pthread_mutex_destroy(&bond->lock);
+}
+
+void modem_bond_report(modem_bond_t *bond, FILE *out) {
+  double elapsed = (now_ms() - bond->started) / 1e3;
+  bond_modem_t *modem;
+
+  if (elapsed <= 0) elapsed = 1e-3;
+  pthread_mutex_lock(&bond->lock);
+  fprintf(out, "bond: %lu accepted, %lu delivered, %lu rescheduled, %lu dropped, %d pending\n", bond->accepted,
+          bond->delivered, bond->rescheduled, bond->dropped, bond->pending);
+  for (int i = 0; i < bond->count; i++) {
+    modem = &bond->modems[i];
+    fprintf(out,
+            "%s: %s, %lu messages %lu bytes (%.1f msg/s, %.0f B/s), latency %.0f ms, busy %.0f%%, queue %d/%d, "
+            "%lu timeouts, %lu outages, %lu handed back\n",
+            modem->name, modem->state == MODEM_UP ? "up" : "down", modem->sent, modem->bytes, modem->sent / elapsed,
+            modem->bytes / elapsed, modem->latency_ms, modem->busy_ms / (elapsed * 10), bqueue_depth(&modem->queue),
+            BOND_QUEUE_LEN, modem->timeouts, modem->outages, modem->handed_back);
+  }
+  pthread_mutex_unlock(&bond->lock);
+  fflush(out);
+}
@@ -0,0 +1,81 @@
+#ifndef MODEM_BOND_H
+#define MODEM_BOND_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "at_modem.h"
+#include "bqueue.h"
+
+/* Several NB-IoT modems used as one uplink. Every modem has a sender thread and a short queue, a publish goes to the
+ * modem that is expected to finish it first: (queued + in progress + 1) * smoothed publish latency. A modem that times
+ * out BOND_MAX_FAILURES times in a row is taken out, everything queued on it moves to the others, and it is probed
+ * with AT until it answers again. Messages are not kept in order across modems. */
+#define BOND_MAX_MODEMS 4
+#define BOND_QUEUE_LEN 8
+#define BOND_RETRY_LEN (BOND_MAX_MODEMS * (BOND_QUEUE_LEN + 1))  // every queued and in-progress message fits
+#define BOND_MAX_FAILURES 2
+#define BOND_MAX_ATTEMPTS 3  // modems a message is tried on before it is dropped
+#define BOND_PROBE_INTERVAL_MS 2000
+#define BOND_AT_TIMEOUT_MS 5000  // AT+CMQPUB waits for the network, so longer than AT_TIMEOUT_MS
+#define BOND_WAIT_MS 10000       // how long a publish waits for any modem to come back
+#define BOND_INITIAL_LATENCY_MS 200.0
+#define BOND_LATENCY_GAIN 0.125  // as TCP's smoothed RTT
+
+typedef struct bond_msg_s {
+  char *topic;
+  void *payload;
+  int len;
+  int qos;
+  int attempts;
+} bond_msg_t;
+
+typedef enum modem_state_s {
+  MODEM_UP,
+  MODEM_DOWN,  // stopped answering, probed until it does again
+} modem_state_t;
+
+typedef struct bond_modem_s {
+  const char *name;
+  int fd;
+  struct modem_bond_s *bond;
+  pthread_t thread;
+  bool running;  // the sender thread was started
+  bqueue_t queue;
+  modem_state_t state;
+  double busy_since;  // 0 while no publish is in progress
+  int failures;       // consecutive
+  double latency_ms;
+  double busy_ms;
+  unsigned long sent;
+  unsigned long bytes;
+  unsigned long timeouts;
+  unsigned long outages;
+  unsigned long handed_back;  // messages moved to other modems
+} bond_modem_t;
+
+typedef struct modem_bond_s {
+  bond_modem_t modems[BOND_MAX_MODEMS];
+  int count;
+  int ready;             // modems set up so far, the only ones modem_bond_destroy() touches
+  bqueue_t retry;        // handed back by a failing modem, scheduled again before anything new
+  pthread_mutex_t lock;  // modem state, counters and latencies
+  bool closing;
+  int pending;  // accepted and neither sent nor dropped
+  double started;
+  unsigned long accepted;
+  unsigned long delivered;
+  unsigned long rescheduled;
+  unsigned long dropped;
+} modem_bond_t;
+
+bond_msg_t *bond_msg_new(const char *topic, const void *payload, int len, int qos);
+void bond_msg_free(bond_msg_t *msg);
+int modem_bond_init(modem_bond_t *bond, const char **ports, int count);
+bool modem_bond_publish(modem_bond_t *bond, bond_msg_t *msg);
+void modem_bond_pump(modem_bond_t *bond);
+bool modem_bond_flush(modem_bond_t *bond, int timeout_ms);
+void modem_bond_destroy(modem_bond_t *bond);
+void modem_bond_report(modem_bond_t *bond, FILE *out);
+
+#endif
@@ -0,0 +1,129 @@
+#define _XOPEN_SOURCE 600
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "at_modem.h"
+#include "hex.h"
+#include "uart_utils.h"
+
+/* Timer defaults: TAU 1 h (001 00001), active time 10 s (000 00101), eDRX 81.92 s, paging window 10.24 s */
+#define SIM_T3412 "00100001"
+#define SIM_T3324 "00000101"
+#define SIM_EDRX "0101"
+#define SIM_PTW "0011"
+#define SIM_MAX_LINE 256
+
+static volatile sig_atomic_t run = 1;
+static volatile sig_atomic_t hung;
+static int publish_ms, hang_after, published;
+
+static void stop_func(int signum) { run = 0; }
+
+static void hang_func(int signum) { hung = !hung; }
+
+static void reply(int fd, const char *text) {
+  char buf[SIM_MAX_LINE * 2];
+  int len = snprintf(buf, sizeof(buf), "\r\n%s\r\n", text);
+
+  if (write(fd, buf, len) != len) printf("Error from write: %s\n", strerror(errno));
+}
+
+/* AT+CMQPUB=<id>,"<topic>",<qos>,<retained>,<dup>,<hex length>,"<hex>", answered after `publish_ms` as if the
+ * network took that long. */
+static void publish(int fd, const char *cmd) {
+  unsigned char payload[AT_MQTT_MAX_PAYLOAD];
+  int id, qos, retained, dup, len, start = 0;
+
+  printf("<- AT+CMQPUB, %zu bytes\n", strlen(cmd));
+  if (sscanf(cmd, "AT+CMQPUB=%d,\"%*[^\"]\",%d,%d,%d,%d,\"%n", &id, &qos, &retained, &dup, &len, &start) != 5 ||
+      !start || len > HEX_ENCODED_LEN(AT_MQTT_MAX_PAYLOAD) || (int)strlen(cmd + start) != len + 1 ||
+      cmd[start + len] != '"' || hex_decode(payload, cmd + start, len) < 0) {
+    reply(fd, "ERROR");
+    return;
+  }
+  usleep(publish_ms * 1000);
+  if (++published == hang_after) {
+    printf("hanging after %d publishes\n", published);
+    hung = 1;
+  }
+  reply(fd, "OK");
+}
+
+static void answer(int fd, const char *cmd, char **timers) {
+  char info[SIM_MAX_LINE];
+
+  if (!strncmp(cmd, "AT+CMQPUB=", 10)) {
+    publish(fd, cmd);
+    return;
+  }
+  printf("<- %s\n", cmd);
+  info[0] = '\0';
+  if (!strcmp(cmd, "AT+CEREG?")) {
+    snprintf(info, sizeof(info), "+CEREG: 4,1,\"1A2B\",\"01A2D301\",9,,,\"%s\",\"%s\"", timers[1], timers[0]);
+  } else if (!strcmp(cmd, "AT+CPSMS?")) {
+    snprintf(info, sizeof(info), "+CPSMS: 1,,,\"%s\",\"%s\"", timers[0], timers[1]);
+  } else if (!strcmp(cmd, "AT+CEDRXRDP")) {
+    snprintf(info, sizeof(info), "+CEDRXRDP: 5,\"%s\",\"%s\",\"%s\"", timers[2], timers[2], timers[3]);
+  } else if (strcmp(cmd, "AT") && strncmp(cmd, "AT+CEREG=", 9)) {
+    reply(fd, "ERROR");
+    return;
+  }
+  if (info[0]) reply(fd, info);
+  reply(fd, "OK");
+}
+
+/* Usage: modem_sim [T3412 bits] [T3324 bits] [eDRX bits] [PTW bits] [publish ms] [hang after publishes]
+ * Pretends to be an NB-IoT modem on a pseudo terminal and answers the power saving queries of at_query_timers with
+ * the given timers, coded as in AT+CPSMS and AT+CEDRXS. Pass the printed device to psm_pub. AT+CMQPUB takes `publish
+ * ms` to answer, for bond_pub. After `hang after publishes` publishes, or on SIGUSR1, the modem stops answering until
+ * the next SIGUSR1. */
+int main(int argc, char *argv[]) {
+  char *timers[] = {argc > 1 ? argv[1] : SIM_T3412, argc > 2 ? argv[2] : SIM_T3324, argc > 3 ? argv[3] : SIM_EDRX,
+                    argc > 4 ? argv[4] : SIM_PTW};
+  struct sigaction hang = {.sa_handler = hang_func};
+  struct pollfd pfd;
+  char line[AT_MAX_COMMAND], c;
+  int master, slave, len = 0;
+
+  master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) || unlockpt(master)) {
+    printf("Error opening pty: %s\n", strerror(errno));
+    return -1;
+  }
+  // Holding the slave open keeps reads on the master from failing with EIO between two clients
+  slave = uart_open(ptsname(master), B115200);
+  if (slave < 0) {
+    close(master);
+    return -1;
+  }
+  publish_ms = argc > 5 ? atoi(argv[5]) : 0;
+  hang_after = argc > 6 ? atoi(argv[6]) : 0;
+  printf("modem on %s\n", ptsname(master));
+  fflush(stdout);
+
+  signal(SIGINT, stop_func);
+  signal(SIGTERM, stop_func);
+  // signal() would reset the handler after the first delivery with _XOPEN_SOURCE, and SIGUSR1 comes more than once
+  sigaction(SIGUSR1, &hang, NULL);
+  pfd.fd = master;
+  pfd.events = POLLIN;
+  while (run) {
+    if (poll(&pfd, 1, 500) <= 0) continue;
+    if (read(master, &c, 1) != 1) break;
+    if (c == '\r' || c == '\n') {
+      line[len] = '\0';
+      if (len > 0 && !hung) answer(master, line, timers);
+      len = 0;
+    } else if (len < (int)sizeof(line) - 1) {
+      line[len++] = c;
+    }
+  }
+  close(slave);
+  close(master);
+  return 0;
+}
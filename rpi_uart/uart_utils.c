@@ -0,0 +1,90 @@
+#include "uart_utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+int set_interface_attribs(int fd, int speed) {
+  struct termios tty;
+
+  if (tcgetattr(fd, &tty) < 0) {
+    printf("Error from tcgetattr: %s\n", strerror(errno));
+    return -1;
+  }
+
+  cfsetospeed(&tty, (speed_t)speed);
+  cfsetispeed(&tty, (speed_t)speed);
+
+  tty.c_cflag |= (CLOCAL | CREAD); /* ignore modem controls */
+  tty.c_cflag &= ~CSIZE;
+  tty.c_cflag |= CS8;      /* 8-bit characters */
+  tty.c_cflag &= ~PARENB;  /* no parity bit */
+  tty.c_cflag &= ~CSTOPB;  /* only need 1 stop bit */
+  tty.c_cflag &= ~CRTSCTS; /* no hardware flowcontrol */
+
+  /* setup for non-canonical mode */
+  tty.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+  tty.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+  tty.c_oflag &= ~OPOST;
+
+  /* fetch bytes as they become available */
+  tty.c_cc[VMIN] = 1;
+  tty.c_cc[VTIME] = 1;
+
+  if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+    printf("Error from tcsetattr: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+void set_mincount(int fd, int mcount) {
+  struct termios tty;
+
+  if (tcgetattr(fd, &tty) < 0) {
+    printf("Error tcgetattr: %s\n", strerror(errno));
+    return;
+  }
+
+  tty.c_cc[VMIN] = mcount ? 1 : 0;
+  tty.c_cc[VTIME] = 5; /* half second timer */
+
+  if (tcsetattr(fd, TCSANOW, &tty) < 0) printf("Error tcsetattr: %s\n", strerror(errno));
+}
+
+/* With RTS/CTS enabled the driver stops the modem once its receive buffer is full, so a reader that stops reading
+ * pushes back on the modem instead of losing bytes. */
+int set_flow_control(int fd, int enable) {
+  struct termios tty;
+
+  if (tcgetattr(fd, &tty) < 0) {
+    printf("Error from tcgetattr: %s\n", strerror(errno));
+    return -1;
+  }
+  if (enable) {
+    tty.c_cflag |= CRTSCTS;
+  } else {
+    tty.c_cflag &= ~CRTSCTS;
+  }
+  if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+    printf("Error from tcsetattr: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+/* Opens `portname` as a raw 8N1 line at `speed`, returns the fd or -1. */
+int uart_open(const char *portname, int speed) {
+  int fd = open(portname, O_RDWR | O_NOCTTY | O_SYNC);
+
+  if (fd < 0) {
+    printf("Error opening %s: %s\n", portname, strerror(errno));
+    return -1;
+  }
+  if (set_interface_attribs(fd, speed)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
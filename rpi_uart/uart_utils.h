@@ -0,0 +1,11 @@
+#ifndef UART_UTILS_H
+#define UART_UTILS_H
+
+#include <termios.h>
+
+int set_interface_attribs(int fd, int speed);
+void set_mincount(int fd, int mcount);
+int set_flow_control(int fd, int enable);
+int uart_open(const char *portname, int speed);
+
+#endif